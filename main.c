@@ -1,11 +1,17 @@
 /* Include some files */
+#define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
 #include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include "map_mtm.h"
+#include "map_loader.h"
 #include "test_utilities.h"
 
 
@@ -25,6 +31,19 @@ static int compareInt(MapKeyElement a, MapKeyElement b) {
     return *(int *) a - *(int *) b;
 }
 
+static int serializeInt(void *e, void *buffer, int size) {
+    if (size >= (int) sizeof(int)) memcpy(buffer, e, sizeof(int));
+    return sizeof(int);
+}
+
+static void *deserializeInt(const void *buffer, int size) {
+    if (size != sizeof(int)) return NULL;
+    int *newInt = malloc(sizeof(int));
+    if (newInt == NULL) return NULL;
+    memcpy(newInt, buffer, sizeof(int));
+    return newInt;
+}
+
 
 //The tests block
 static int createDestroyTest(int *tests_passed) {
@@ -241,6 +260,1123 @@ static int mapGetTest(int *tests_passed) {
     return test_number;
 }
 
+static MapDataElement countInt(MapKeyElement key, MapDataElement data, void *context) {
+    (void) key;
+    if (data == NULL) return context;
+    *(int *) data += 1;
+    return data;
+}
+
+static MapDataElement removeInt(MapKeyElement key, MapDataElement data, void *context) {
+    (void) key;
+    (void) data;
+    (void) context;
+    return NULL;
+}
+
+static MapDataElement sumInt(MapDataElement a, MapDataElement b) {
+    *(int *) a += *(int *) b;
+    return a;
+}
+
+static MapDataElement sumIntNew(MapDataElement a, MapDataElement b) {
+    int sum = *(int *) a + *(int *) b;
+    return copyInt(&sum);
+}
+
+static int mapComputeTest(int *tests_passed) {
+    _print_mode_name("Testing mapCompute/mapMergeValue function:");
+    int test_number = 1;
+    _print_test_number(test_number, __LINE__);
+    int a[6] = {0, 1, 2, 3, 4, 5};
+    Map map = mapCreate(copyInt, copyInt, freeInt, freeInt, compareInt);
+    test( mapCompute(NULL, &a[0], countInt, &a[1]) != MAP_NULL_ARGUMENT, __LINE__, &test_number, "mapCompute doesn't return MAP_NULL_ARGUMENT on NULL map input", tests_passed);
+    test( mapCompute(map, &a[0], NULL, &a[1]) != MAP_NULL_ARGUMENT, __LINE__, &test_number, "mapCompute doesn't return MAP_NULL_ARGUMENT on NULL function input", tests_passed);
+    mapCompute(map, &a[2], countInt, &a[1]);
+    test( mapGetSize(map) != 1 || *(int *) mapGet(map, &a[2]) != 1, __LINE__, &test_number, "mapCompute doesn't insert a key which is not in map", tests_passed);
+    mapCompute(map, &a[2], countInt, &a[1]);
+    mapCompute(map, &a[2], countInt, &a[1]);
+    test( *(int *) mapGet(map, &a[2]) != 3, __LINE__, &test_number, "mapCompute doesn't update the data in place", tests_passed);
+    test( mapCompute(map, &a[2], removeInt, NULL) != MAP_SUCCESS || mapContains(map, &a[2]), __LINE__, &test_number, "mapCompute doesn't remove a key when NULL is computed", tests_passed);
+    test( mapMergeValue(map, &a[4], &a[5], NULL) != MAP_NULL_ARGUMENT, __LINE__, &test_number, "mapMergeValue doesn't return MAP_NULL_ARGUMENT on NULL function input", tests_passed);
+    mapMergeValue(map, &a[4], &a[5], sumInt);
+    mapMergeValue(map, &a[4], &a[3], sumInt);
+    test( *(int *) mapGet(map, &a[4]) != 8, __LINE__, &test_number, "mapMergeValue doesn't combine the values correctly", tests_passed);
+    test( a[5] != 5 || a[3] != 3, __LINE__, &test_number, "mapMergeValue changes the value sent to it", tests_passed);
+    mapMergeValue(map, &a[4], &a[2], sumIntNew);
+    test( *(int *) mapGet(map, &a[4]) != 10, __LINE__, &test_number, "mapMergeValue doesn't take a newly allocated combination", tests_passed);
+    _print_test_success(test_number);
+    *tests_passed += 1;
+    mapDestroy(map);
+    return test_number;
+}
+
+static int mapTxnTest(int *tests_passed) {
+    _print_mode_name("Testing mapTxn functions:");
+    int test_number = 1;
+    _print_test_number(test_number, __LINE__);
+    int a[10] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9};
+    Map map = mapCreate(copyInt, copyInt, freeInt, freeInt, compareInt);
+    test( mapTxnBegin(NULL) != NULL, __LINE__, &test_number, "mapTxnBegin doesn't return NULL on NULL map input", tests_passed);
+    mapPut(map, &a[2], &a[2]);
+    mapPut(map, &a[6], &a[6]);
+    MapTxn txn = mapTxnBegin(map);
+    test( mapTxnPut(txn, NULL, &a[1]) != MAP_NULL_ARGUMENT, __LINE__, &test_number, "mapTxnPut doesn't return MAP_NULL_ARGUMENT on NULL key input", tests_passed);
+    mapTxnPut(txn, &a[8], &a[8]);
+    mapTxnPut(txn, &a[4], &a[4]);
+    mapTxnRemove(txn, &a[6]);
+    mapTxnPut(txn, &a[2], &a[9]);
+    mapTxnPut(txn, &a[0], &a[0]);
+    mapTxnRemove(txn, &a[0]);
+    mapTxnRemove(txn, &a[5]);
+    test( mapGetSize(map) != 2 || *(int *) mapGet(map, &a[2]) != 2, __LINE__, &test_number, "mapTxnPut changes the map before commit", tests_passed);
+    test( mapTxnCommit(txn) != MAP_SUCCESS, __LINE__, &test_number, "mapTxnCommit doesn't return MAP_SUCCESS", tests_passed);
+    int expected[3] = {2, 4, 8};
+    int k = 0;
+    bool ordered = mapGetSize(map) == 3;
+    MAP_FOREACH(int*, i, map) {
+        if (k >= 3 || expected[k++] != *i) {
+            ordered = false;
+            break;
+        }
+    }
+    test( !ordered, __LINE__, &test_number, "mapTxnCommit doesn't apply the operations in order", tests_passed);
+    test( *(int *) mapGet(map, &a[2]) != 9, __LINE__, &test_number, "mapTxnCommit doesn't rewrite the data on existing key", tests_passed);
+    txn = mapTxnBegin(map);
+    mapTxnRemove(txn, &a[2]);
+    mapTxnAbort(txn);
+    test( !mapContains(map, &a[2]), __LINE__, &test_number, "mapTxnAbort changes the map", tests_passed);
+    _print_test_success(test_number);
+    *tests_passed += 1;
+    mapDestroy(map);
+    return test_number;
+}
+
+static int mapSavepointTest(int *tests_passed) {
+    _print_mode_name("Testing mapSavepoint/mapRollback function:");
+    int test_number = 1;
+    _print_test_number(test_number, __LINE__);
+    int a[6] = {0, 1, 2, 3, 4, 5};
+    MapSavepoint first, second;
+    Map map = mapCreate(copyInt, copyInt, freeInt, freeInt, compareInt);
+    test( mapSavepoint(map, NULL) != MAP_NULL_ARGUMENT, __LINE__, &test_number, "mapSavepoint doesn't return MAP_NULL_ARGUMENT on NULL savepoint input", tests_passed);
+    test( mapRollback(map, 0) != MAP_ITEM_DOES_NOT_EXIST, __LINE__, &test_number, "mapRollback doesn't return MAP_ITEM_DOES_NOT_EXIST on inactive savepoint", tests_passed);
+    mapPut(map, &a[0], &a[0]);
+    mapPut(map, &a[2], &a[2]);
+    mapSavepoint(map, &first);
+    mapPut(map, &a[1], &a[1]);
+    mapPut(map, &a[2], &a[5]);
+    mapRemove(map, &a[0]);
+    mapSavepoint(map, &second);
+    mapClear(map);
+    mapPut(map, &a[4], &a[4]);
+    test( mapRollback(map, second) != MAP_SUCCESS || mapGetSize(map) != 2 || mapContains(map, &a[4]), __LINE__, &test_number, "mapRollback doesn't revert mapClear", tests_passed);
+    mapRollback(map, first);
+    int expected[2] = {0, 2};
+    int k = 0;
+    bool restored = mapGetSize(map) == 2;
+    MAP_FOREACH(int*, i, map) {
+        if (k >= 2 || expected[k] != *i || *(int *) mapGet(map, i) != expected[k]) {
+            restored = false;
+            break;
+        }
+        k++;
+    }
+    test( !restored, __LINE__, &test_number, "mapRollback doesn't restore the map to the savepoint", tests_passed);
+    test( mapRollback(map, second) != MAP_ITEM_DOES_NOT_EXIST, __LINE__, &test_number, "mapRollback doesn't release later savepoints", tests_passed);
+    mapPut(map, &a[3], &a[3]);
+    test( mapReleaseSavepoint(map, first) != MAP_SUCCESS || !mapContains(map, &a[3]), __LINE__, &test_number, "mapReleaseSavepoint doesn't keep the changes", tests_passed);
+    _print_test_success(test_number);
+    *tests_passed += 1;
+    mapDestroy(map);
+    return test_number;
+}
+
+static int mapSaveLoadTest(int *tests_passed) {
+    _print_mode_name("Testing mapSave/mapLoad function:");
+    int test_number = 1;
+    _print_test_number(test_number, __LINE__);
+    int a[6] = {0, 1, 2, 3, 4, 5};
+    Map map = mapCreate(copyInt, copyInt, freeInt, freeInt, compareInt);
+    Map loaded = mapCreate(copyInt, copyInt, freeInt, freeInt, compareInt);
+    FILE *stream = tmpfile();
+    test( mapSave(map, NULL, serializeInt, serializeInt) != MAP_NULL_ARGUMENT, __LINE__, &test_number, "mapSave doesn't return MAP_NULL_ARGUMENT on NULL stream input", tests_passed);
+    for (int i = 5; i >= 0; i--) {
+        mapPut(map, &a[i], &a[5 - i]);
+    }
+    mapGetFirst(map);
+    test( mapSave(map, stream, serializeInt, serializeInt) != MAP_SUCCESS, __LINE__, &test_number, "mapSave doesn't return MAP_SUCCESS", tests_passed);
+    test( *(int *) mapGetNext(map) != 1, __LINE__, &test_number, "mapSave changes the iterator", tests_passed);
+    rewind(stream);
+    mapPut(loaded, &a[3], &a[0]);
+    test( mapLoad(loaded, stream, deserializeInt, deserializeInt) != MAP_SUCCESS, __LINE__, &test_number, "mapLoad doesn't return MAP_SUCCESS", tests_passed);
+    bool equal = mapGetSize(loaded) == 6;
+    int k = 0;
+    MAP_FOREACH(int*, i, loaded) {
+        if (*i != a[k] || *(int *) mapGet(loaded, i) != a[5 - k]) {
+            equal = false;
+            break;
+        }
+        k++;
+    }
+    test( !equal, __LINE__, &test_number, "mapLoad doesn't load the saved elements in order", tests_passed);
+    test( mapLoad(loaded, stream, deserializeInt, deserializeInt) != MAP_IO_ERROR || mapGetSize(loaded) != 6, __LINE__, &test_number, "mapLoad doesn't return MAP_IO_ERROR at the end of the stream", tests_passed);
+    fclose(stream);
+    _print_test_success(test_number);
+    *tests_passed += 1;
+    mapDestroy(map);
+    mapDestroy(loaded);
+    return test_number;
+}
+
+static int mapSaveCompressedTest(int *tests_passed) {
+    _print_mode_name("Testing mapSaveCompressed function:");
+    int test_number = 1;
+    _print_test_number(test_number, __LINE__);
+    Map map = mapCreate(copyInt, copyInt, freeInt, freeInt, compareInt);
+    for (int i = -300; i < 300; i++) {
+        int data = i % 4;
+        mapPut(map, &i, &data);
+    }
+    FILE *plain = tmpfile();
+    mapSave(map, plain, serializeInt, serializeInt);
+    MapKeyEncoding encodings[3] = {MAP_KEY_ENCODING_PLAIN, MAP_KEY_ENCODING_INTEGER, MAP_KEY_ENCODING_PREFIX};
+    for (int e = 0; e < 3; e++) {
+        FILE *stream = tmpfile();
+        test( mapSaveCompressed(map, stream, serializeInt, serializeInt, encodings[e]) != MAP_SUCCESS, __LINE__, &test_number, "mapSaveCompressed doesn't return MAP_SUCCESS", tests_passed);
+        test( ftell(stream) >= ftell(plain), __LINE__, &test_number, "mapSaveCompressed doesn't write less than mapSave", tests_passed);
+        rewind(stream);
+        Map loaded = mapCreate(copyInt, copyInt, freeInt, freeInt, compareInt);
+        test( mapLoad(loaded, stream, deserializeInt, deserializeInt) != MAP_SUCCESS, __LINE__, &test_number, "mapLoad doesn't return MAP_SUCCESS on a compressed map", tests_passed);
+        bool equal = mapGetSize(loaded) == 600;
+        int k = -300;
+        MAP_FOREACH(int*, i, loaded) {
+            if (*i != k || *(int *) mapGet(loaded, i) != k % 4) {
+                equal = false;
+                break;
+            }
+            k++;
+        }
+        test( !equal, __LINE__, &test_number, "mapLoad doesn't load the compressed elements in order", tests_passed);
+        mapDestroy(loaded);
+        fclose(stream);
+    }
+    fclose(plain);
+    _print_test_success(test_number);
+    *tests_passed += 1;
+    mapDestroy(map);
+    return test_number;
+}
+
+static int mapMappedTest(int *tests_passed) {
+    _print_mode_name("Testing mapSaveMapped/mapOpenMapped function:");
+    int test_number = 1;
+    _print_test_number(test_number, __LINE__);
+    int a[6] = {0, 1, 2, 3, 4, 5};
+    char path[] = "map_mtm_test_image.tmp";
+    Map map = mapCreate(copyInt, copyInt, freeInt, freeInt, compareInt);
+    for (int i = 0; i < 6; i += 2) {
+        mapPut(map, &a[i], &a[i + 1]);
+    }
+    test( mapSaveMapped(map, path, serializeInt, serializeInt) != MAP_SUCCESS, __LINE__, &test_number, "mapSaveMapped doesn't return MAP_SUCCESS", tests_passed);
+    test( mapOpenMapped(path, NULL) != NULL, __LINE__, &test_number, "mapOpenMapped doesn't return NULL on NULL compare function input", tests_passed);
+    MappedMap mapped = mapOpenMapped(path, compareInt);
+    test( mappedMapGetSize(mapped) != 3, __LINE__, &test_number, "mappedMapGetSize doesn't return the size of the saved map", tests_passed);
+    MapDataElement data = mappedMapGet(mapped, &a[2]);
+    test( data == NULL || *(int *) data != a[3], __LINE__, &test_number, "mappedMapGet doesn't return the saved data", tests_passed);
+    test( mappedMapGet(mapped, &a[1]) != NULL, __LINE__, &test_number, "mappedMapGet doesn't return NULL on key which is not in map", tests_passed);
+    int k = 0;
+    bool ordered = true;
+    for (int *i = mappedMapGetFirst(mapped); i; i = mappedMapGetNext(mapped)) {
+        if (*i != a[k]) {
+            ordered = false;
+            break;
+        }
+        k += 2;
+    }
+    test( !ordered || k != 6, __LINE__, &test_number, "mappedMapGetFirst/mappedMapGetNext don't iterate in order", tests_passed);
+    mappedMapClose(mapped);
+    MapOpenMode modes[2] = {MAP_OPEN_LAZY, MAP_OPEN_EAGER};
+    for (int m = 0; m < 2; m++) {
+        mapped = mapOpenMappedWithMode(path, compareInt, modes[m]);
+        k = 0;
+        for (int *i = mappedMapGetFirst(mapped); i; i = mappedMapGetNext(mapped)) {
+            k += 2;
+        }
+        data = mappedMapGet(mapped, &a[4]);
+        test( k != 6 || data == NULL || *(int *) data != a[5], __LINE__, &test_number, "mapOpenMappedWithMode doesn't open the image", tests_passed);
+        mappedMapClose(mapped);
+    }
+    remove(path);
+    _print_test_success(test_number);
+    *tests_passed += 1;
+    mapDestroy(map);
+    return test_number;
+}
+
+static int mapSharedTest(int *tests_passed) {
+    _print_mode_name("Testing mapSaveShared/mapOpenShared function:");
+    int test_number = 1;
+    _print_test_number(test_number, __LINE__);
+    int a[6] = {0, 1, 2, 3, 4, 5};
+    char name[] = "/map_mtm_test_shared";
+    Map map = mapCreate(copyInt, copyInt, freeInt, freeInt, compareInt);
+    for (int i = 0; i < 6; i += 2) {
+        mapPut(map, &a[i], &a[i + 1]);
+    }
+    test( mapSaveShared(map, NULL, serializeInt, serializeInt) != MAP_NULL_ARGUMENT, __LINE__, &test_number, "mapSaveShared doesn't return MAP_NULL_ARGUMENT on NULL name input", tests_passed);
+    test( mapSaveShared(map, name, serializeInt, serializeInt) != MAP_SUCCESS, __LINE__, &test_number, "mapSaveShared doesn't return MAP_SUCCESS", tests_passed);
+    MappedMap shared = mapOpenShared(name, compareInt);
+    test( mappedMapGetSize(shared) != 3, __LINE__, &test_number, "mapOpenShared doesn't attach to the saved map", tests_passed);
+    MapDataElement data = mappedMapGet(shared, &a[4]);
+    test( data == NULL || *(int *) data != a[5], __LINE__, &test_number, "mappedMapGet doesn't return the shared data", tests_passed);
+    test( mapRemoveShared(name) != MAP_SUCCESS, __LINE__, &test_number, "mapRemoveShared doesn't return MAP_SUCCESS", tests_passed);
+    test( mappedMapGet(shared, &a[2]) == NULL, __LINE__, &test_number, "mapRemoveShared unmaps attached maps", tests_passed);
+    test( mapOpenShared(name, compareInt) != NULL, __LINE__, &test_number, "mapOpenShared doesn't return NULL on a removed object", tests_passed);
+    mappedMapClose(shared);
+    _print_test_success(test_number);
+    *tests_passed += 1;
+    mapDestroy(map);
+    return test_number;
+}
+
+static long fileSize(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (!file) return -1;
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fclose(file);
+    return size;
+}
+
+static void sleepMilliseconds(long milliseconds) {
+    struct timespec duration = {milliseconds / 1000, (milliseconds % 1000) * 1000000};
+    nanosleep(&duration, NULL);
+}
+
+static int mapDurableTest(int *tests_passed) {
+    _print_mode_name("Testing mapOpenDurable/mapCheckpoint function:");
+    int test_number = 1;
+    _print_test_number(test_number, __LINE__);
+    int a[6] = {0, 1, 2, 3, 4, 5};
+    char path[] = "map_mtm_test_durable.tmp";
+    char log_path[] = "map_mtm_test_durable.tmp.wal";
+    remove(path);
+    remove(log_path);
+    Map map = mapCreate(copyInt, copyInt, freeInt, freeInt, compareInt);
+    test( mapOpenDurable(map, NULL, serializeInt, serializeInt, deserializeInt, deserializeInt, MAP_SYNC_GROUP) != MAP_NULL_ARGUMENT, __LINE__, &test_number, "mapOpenDurable doesn't return MAP_NULL_ARGUMENT on NULL path input", tests_passed);
+    test( mapOpenDurable(map, path, serializeInt, serializeInt, deserializeInt, deserializeInt, MAP_SYNC_GROUP) != MAP_SUCCESS, __LINE__, &test_number, "mapOpenDurable doesn't return MAP_SUCCESS on a new path", tests_passed);
+    for (int i = 0; i < 6; i++) {
+        mapPut(map, &a[i], &a[i]);
+    }
+    mapRemove(map, &a[1]);
+    test( mapCheckpoint(map) != MAP_SUCCESS, __LINE__, &test_number, "mapCheckpoint doesn't return MAP_SUCCESS", tests_passed);
+    mapPut(map, &a[2], &a[5]);
+    mapRemove(map, &a[3]);
+    mapDestroy(map);
+    FILE *log = fopen(log_path, "ab");
+    fputs("torn", log);
+    fclose(log);
+    map = mapCreate(copyInt, copyInt, freeInt, freeInt, compareInt);
+    test( mapOpenDurable(map, path, serializeInt, serializeInt, deserializeInt, deserializeInt, MAP_SYNC_ALWAYS) != MAP_SUCCESS, __LINE__, &test_number, "mapOpenDurable doesn't ignore a torn record at the end of the log", tests_passed);
+    test( mapGetSize(map) != 4 || mapContains(map, &a[3]) || *(int *) mapGet(map, &a[2]) != 5, __LINE__, &test_number, "mapOpenDurable doesn't restore the snapshot and the logged changes", tests_passed);
+    mapClear(map);
+    mapPut(map, &a[4], &a[0]);
+    mapDestroy(map);
+    map = mapCreate(copyInt, copyInt, freeInt, freeInt, compareInt);
+    mapOpenDurable(map, path, serializeInt, serializeInt, deserializeInt, deserializeInt, MAP_SYNC_NONE);
+    test( mapGetSize(map) != 1 || *(int *) mapGet(map, &a[4]) != 0, __LINE__, &test_number, "mapOpenDurable doesn't restore a cleared map", tests_passed);
+    long log_size = fileSize(log_path);
+    mapPut(map, &a[1], &a[1]);
+    test( fileSize(log_path) != log_size, __LINE__, &test_number, "a durable map doesn't group its changes", tests_passed);
+    sleepMilliseconds(20);
+    mapPut(map, &a[2], &a[2]);
+    test( fileSize(log_path) <= log_size, __LINE__, &test_number, "a durable map doesn't write a group after its delay", tests_passed);
+    mapDestroy(map);
+    remove(path);
+    remove(log_path);
+    _print_test_success(test_number);
+    *tests_passed += 1;
+    return test_number;
+}
+
+static int mapCheckpointIncrementalTest(int *tests_passed) {
+    _print_mode_name("Testing mapCheckpointIncremental/mapRestoreCheckpoint function:");
+    int test_number = 1;
+    _print_test_number(test_number, __LINE__);
+    char path[] = "map_mtm_test_checkpoint.tmp";
+    char delta_path[] = "map_mtm_test_checkpoint.tmp.delta";
+    remove(path);
+    remove(delta_path);
+    Map map = mapCreate(copyInt, copyInt, freeInt, freeInt, compareInt);
+    for (int i = 0; i < 100; i++) {
+        mapPut(map, &i, &i);
+    }
+    test( mapCheckpointIncremental(map, NULL, serializeInt, serializeInt) != MAP_NULL_ARGUMENT, __LINE__, &test_number, "mapCheckpointIncremental doesn't return MAP_NULL_ARGUMENT on NULL path input", tests_passed);
+    test( mapCheckpointIncremental(map, path, serializeInt, serializeInt) != MAP_SUCCESS, __LINE__, &test_number, "mapCheckpointIncremental doesn't return MAP_SUCCESS", tests_passed);
+    long snapshot_size = fileSize(path);
+    int key = 7, data = -7;
+    mapPut(map, &key, &data);
+    key = 8;
+    mapRemove(map, &key);
+    mapRemove(map, &key);
+    test( mapCheckpointIncremental(map, path, serializeInt, serializeInt) != MAP_SUCCESS, __LINE__, &test_number, "mapCheckpointIncremental doesn't return MAP_SUCCESS", tests_passed);
+    test( fileSize(path) != snapshot_size || fileSize(delta_path) <= 0 || fileSize(delta_path) >= snapshot_size / 10, __LINE__, &test_number, "mapCheckpointIncremental doesn't write only the changed entries", tests_passed);
+    Map restored = mapCreate(copyInt, copyInt, freeInt, freeInt, compareInt);
+    test( mapRestoreCheckpoint(restored, path, deserializeInt, deserializeInt) != MAP_SUCCESS, __LINE__, &test_number, "mapRestoreCheckpoint doesn't return MAP_SUCCESS", tests_passed);
+    key = 7;
+    test( mapGetSize(restored) != 99 || *(int *) mapGet(restored, &key) != -7, __LINE__, &test_number, "mapRestoreCheckpoint doesn't apply the deltas", tests_passed);
+    mapDestroy(restored);
+    int stale_key = 10;
+    mapPut(map, &stale_key, &data);
+    mapCheckpointIncremental(map, path, serializeInt, serializeInt);
+    char stale[256];
+    FILE *file = fopen(delta_path, "rb");
+    size_t stale_size = fread(stale, 1, sizeof(stale), file);
+    fclose(file);
+    for (int i = 0; i < 100; i += 2) {
+        mapRemove(map, &i);
+    }
+    test( mapCheckpointIncremental(map, path, serializeInt, serializeInt) != MAP_SUCCESS || fileSize(delta_path) != 8, __LINE__, &test_number, "mapCheckpointIncremental doesn't compact the deltas into a snapshot", tests_passed);
+    file = fopen(delta_path, "wb");
+    fwrite(stale, 1, stale_size, file);
+    fclose(file);
+    restored = mapCreate(copyInt, copyInt, freeInt, freeInt, compareInt);
+    mapRestoreCheckpoint(restored, path, deserializeInt, deserializeInt);
+    test( mapGetSize(restored) != 50 || mapContains(restored, &stale_key), __LINE__, &test_number, "mapRestoreCheckpoint applies deltas of an older snapshot", tests_passed);
+    mapDestroy(restored);
+    mapClear(map);
+    mapPut(map, &key, &key);
+    mapCheckpointIncremental(map, path, serializeInt, serializeInt);
+    restored = mapCreate(copyInt, copyInt, freeInt, freeInt, compareInt);
+    mapRestoreCheckpoint(restored, path, deserializeInt, deserializeInt);
+    test( mapGetSize(restored) != 1 || *(int *) mapGet(restored, &key) != 7, __LINE__, &test_number, "mapRestoreCheckpoint doesn't restore a cleared map", tests_passed);
+    mapDestroy(restored);
+    mapDestroy(map);
+    remove(path);
+    remove(delta_path);
+    _print_test_success(test_number);
+    *tests_passed += 1;
+    return test_number;
+}
+
+static int mapSnapshotBackgroundTest(int *tests_passed) {
+    _print_mode_name("Testing mapSnapshotBackground/mapSnapshotWait function:");
+    int test_number = 1;
+    _print_test_number(test_number, __LINE__);
+    char path[] = "map_mtm_test_snapshot.tmp";
+    Map map = mapCreate(copyInt, copyInt, freeInt, freeInt, compareInt);
+    for (int i = 0; i < 1000; i++) {
+        mapPut(map, &i, &i);
+    }
+    MapSnapshot snapshot = NULL;
+    test( mapSnapshotBackground(map, path, serializeInt, serializeInt, NULL) != MAP_NULL_ARGUMENT, __LINE__, &test_number, "mapSnapshotBackground doesn't return MAP_NULL_ARGUMENT on NULL snapshot input", tests_passed);
+    test( mapSnapshotBackground(map, path, serializeInt, serializeInt, &snapshot) != MAP_SUCCESS, __LINE__, &test_number, "mapSnapshotBackground doesn't return MAP_SUCCESS", tests_passed);
+    for (int i = 0; i < 1000; i += 2) {
+        mapRemove(map, &i);
+    }
+    test( mapSnapshotWait(snapshot) != MAP_SUCCESS, __LINE__, &test_number, "mapSnapshotWait doesn't return MAP_SUCCESS", tests_passed);
+    Map loaded = mapCreate(copyInt, copyInt, freeInt, freeInt, compareInt);
+    FILE *stream = fopen(path, "rb");
+    test( !stream || mapLoad(loaded, stream, deserializeInt, deserializeInt) != MAP_SUCCESS || mapGetSize(loaded) != 1000, __LINE__, &test_number, "mapSnapshotBackground doesn't save the map as it was when started", tests_passed);
+    if (stream) fclose(stream);
+    MapSnapshot other = NULL;
+    mapSnapshotBackground(map, path, serializeInt, serializeInt, &snapshot);
+    mapSnapshotBackground(map, path, serializeInt, serializeInt, &other);
+    test( mapSnapshotWait(snapshot) != MAP_SUCCESS || mapSnapshotWait(other) != MAP_SUCCESS, __LINE__, &test_number, "mapSnapshotWait fails for two snapshots of the same path", tests_passed);
+    mapClear(loaded);
+    stream = fopen(path, "rb");
+    test( !stream || mapLoad(loaded, stream, deserializeInt, deserializeInt) != MAP_SUCCESS || mapGetSize(loaded) != 500, __LINE__, &test_number, "mapSnapshotBackground doesn't write snapshots of the same path apart", tests_passed);
+    if (stream) fclose(stream);
+    test( mapSnapshotWait(NULL) != MAP_NULL_ARGUMENT, __LINE__, &test_number, "mapSnapshotWait doesn't return MAP_NULL_ARGUMENT on NULL input", tests_passed);
+    mapDestroy(loaded);
+    mapDestroy(map);
+    remove(path);
+    _print_test_success(test_number);
+    *tests_passed += 1;
+    return test_number;
+}
+
+static int measureInt(void *e) {
+    (void) e;
+    return sizeof(int);
+}
+
+static int serialize_calls = 0;
+
+static int serializeIntCounted(void *e, void *buffer, int size) {
+    serialize_calls += 1;
+    return serializeInt(e, buffer, size);
+}
+
+static int mapSetMemoryBudgetTest(int *tests_passed) {
+    _print_mode_name("Testing mapSetMemoryBudget function:");
+    int test_number = 1;
+    _print_test_number(test_number, __LINE__);
+    char path[] = "map_mtm_test_spill.tmp";
+    Map map = mapCreate(copyInt, copyInt, freeInt, freeInt, compareInt);
+    for (int i = 0; i < 50; i++) {
+        int data = 2 * i;
+        mapPut(map, &i, &data);
+    }
+    FILE *existing = fopen(path, "wb");
+    fputs("keep", existing);
+    fclose(existing);
+    test( mapSetMemoryBudget(map, NULL, 40, serializeInt, deserializeInt, NULL) != MAP_NULL_ARGUMENT, __LINE__, &test_number, "mapSetMemoryBudget doesn't return MAP_NULL_ARGUMENT on NULL path input", tests_passed);
+    test( mapSetMemoryBudget(map, path, 40, serializeInt, deserializeInt, NULL) != MAP_SUCCESS, __LINE__, &test_number, "mapSetMemoryBudget doesn't return MAP_SUCCESS", tests_passed);
+    test( fileSize(path) != 4, __LINE__, &test_number, "mapSetMemoryBudget overwrites an existing file", tests_passed);
+    remove(path);
+    for (int i = 50; i < 100; i++) {
+        int data = 2 * i;
+        mapPut(map, &i, &data);
+    }
+    MapSavepoint savepoint;
+    mapSavepoint(map, &savepoint);
+    for (int i = 0; i < 100; i += 3) {
+        mapRemove(map, &i);
+    }
+    int key = 1, data = -1;
+    mapPut(map, &key, &data);
+    mapRollback(map, savepoint);
+    mapReleaseSavepoint(map, savepoint);
+    bool correct = mapGetSize(map) == 100;
+    for (int i = 0; i < 100 && correct; i++) {
+        int *value = mapGet(map, &i);
+        correct = value && *value == 2 * i;
+    }
+    test( !correct, __LINE__, &test_number, "mapGet doesn't return spilled data", tests_passed);
+    Map copy = mapCopy(map);
+    FILE *stream = tmpfile();
+    mapSave(map, stream, serializeInt, serializeInt);
+    rewind(stream);
+    Map loaded = mapCreate(copyInt, copyInt, freeInt, freeInt, compareInt);
+    mapLoad(loaded, stream, deserializeInt, deserializeInt);
+    fclose(stream);
+    correct = mapGetSize(copy) == 100 && mapGetSize(loaded) == 100;
+    for (int i = 0; i < 100 && correct; i++) {
+        correct = *(int *) mapGet(copy, &i) == 2 * i && *(int *) mapGet(loaded, &i) == 2 * i;
+    }
+    test( !correct, __LINE__, &test_number, "mapCopy/mapSave don't read spilled data", tests_passed);
+    int *values[16];
+    for (int i = 0; i < 16; i++) {
+        values[i] = mapGet(map, &i);
+    }
+    for (int i = 0; i < 16 && correct; i++) {
+        correct = *values[i] == 2 * i;
+    }
+    test( !correct, __LINE__, &test_number, "mapGet returns data which is spilled by the next calls", tests_passed);
+    mapDestroy(loaded);
+    mapDestroy(copy);
+    copy = mapCreate(copyInt, copyInt, freeInt, freeInt, compareInt);
+    mapSetMemoryBudget(copy, path, 400, serializeIntCounted, deserializeInt, measureInt);
+    for (int i = 0; i < 100; i++) {
+        mapPut(copy, &i, &i);
+    }
+    test( serialize_calls != 0, __LINE__, &test_number, "mapSetMemoryBudget serializes the data it can measure", tests_passed);
+    for (int i = 100; i < 200; i++) {
+        mapPut(copy, &i, &i);
+    }
+    correct = serialize_calls > 0;
+    for (int i = 0; i < 200 && correct; i++) {
+        correct = *(int *) mapGet(copy, &i) == i;
+    }
+    test( !correct, __LINE__, &test_number, "mapSetMemoryBudget doesn't spill data it measures", tests_passed);
+    mapDestroy(copy);
+    mapDestroy(map);
+    _print_test_success(test_number);
+    *tests_passed += 1;
+    return test_number;
+}
+
+static bool sameMaps(Map map1, Map map2) {
+    if (mapGetSize(map1) != mapGetSize(map2)) return false;
+    MAP_FOREACH(int*, i, map1) {
+        int *data = mapGet(map2, i);
+        if (!data || *data != *(int *) mapGet(map1, i)) return false;
+    }
+    return true;
+}
+
+static int mapReplicateTest(int *tests_passed) {
+    _print_mode_name("Testing mapReplicate/mapFollowerApply function:");
+    int test_number = 1;
+    _print_test_number(test_number, __LINE__);
+    int a[6] = {0, 1, 2, 3, 4, 5};
+    int fds[2];
+    pipe(fds);
+    Map primary = mapCreate(copyInt, copyInt, freeInt, freeInt, compareInt);
+    Map replica = mapCreate(copyInt, copyInt, freeInt, freeInt, compareInt);
+    MapFollower follower = mapFollowerCreate(replica, deserializeInt, deserializeInt);
+    test( mapReplicate(primary, fds[1], NULL, serializeInt, 0) != MAP_NULL_ARGUMENT, __LINE__, &test_number, "mapReplicate doesn't return MAP_NULL_ARGUMENT on NULL serialize function input", tests_passed);
+    test( mapReplicate(primary, fds[1], serializeInt, serializeInt, 0) != MAP_SUCCESS, __LINE__, &test_number, "mapReplicate doesn't return MAP_SUCCESS", tests_passed);
+    for (int i = 0; i < 4; i++) {
+        mapPut(primary, &a[i], &a[5 - i]);
+    }
+    mapRemove(primary, &a[1]);
+    test( mapFollowerApply(follower, fds[0]) != MAP_SUCCESS, __LINE__, &test_number, "mapFollowerApply doesn't return MAP_SUCCESS", tests_passed);
+    test( !sameMaps(primary, replica) || mapFollowerGetSequence(follower) != 5 || mapGetSequence(primary) != 5, __LINE__, &test_number, "mapFollowerApply doesn't mirror the primary", tests_passed);
+    mapReplicate(primary, -1, serializeInt, serializeInt, 0);
+    test( mapFollowerApply(follower, fds[0]) != MAP_IO_ERROR, __LINE__, &test_number, "mapFollowerApply doesn't return MAP_IO_ERROR when the primary disconnects", tests_passed);
+    close(fds[0]);
+    mapPut(primary, &a[4], &a[4]);
+    mapClear(primary);
+    mapPut(primary, &a[5], &a[0]);
+    pipe(fds);
+    mapReplicate(primary, fds[1], serializeInt, serializeInt, mapFollowerGetSequence(follower));
+    mapFollowerApply(follower, fds[0]);
+    test( !sameMaps(primary, replica) || mapFollowerGetSequence(follower) != 8, __LINE__, &test_number, "mapReplicate doesn't send the changes a follower missed", tests_passed);
+    Map new_replica = mapCreate(copyInt, copyInt, freeInt, freeInt, compareInt);
+    MapFollower new_follower = mapFollowerCreate(new_replica, deserializeInt, deserializeInt);
+    mapPut(new_replica, &a[1], &a[1]);
+    mapReplicate(primary, fds[1], serializeInt, serializeInt, 100);
+    mapFollowerApply(new_follower, fds[0]);
+    test( !sameMaps(primary, new_replica) || mapFollowerGetSequence(new_follower) != 8, __LINE__, &test_number, "mapReplicate doesn't resynchronize a follower which missed too much", tests_passed);
+    char missed[256];
+    mapPut(primary, &a[2], &a[2]);
+    read(fds[0], missed, sizeof(missed));
+    mapPut(primary, &a[3], &a[3]);
+    test( mapFollowerApply(new_follower, fds[0]) != MAP_IO_ERROR || mapFollowerGetSequence(new_follower) != 8, __LINE__, &test_number, "mapFollowerApply applies a record after missed changes", tests_passed);
+    mapReplicate(primary, fds[1], serializeInt, serializeInt, mapFollowerGetSequence(new_follower));
+    test( mapFollowerApply(new_follower, fds[0]) != MAP_SUCCESS || !sameMaps(primary, new_replica), __LINE__, &test_number, "mapFollowerApply doesn't recover after reconnecting", tests_passed);
+    signal(SIGPIPE, SIG_IGN);
+    close(fds[0]);
+    test( mapPut(primary, &a[4], &a[4]) != MAP_IO_ERROR || mapPut(primary, &a[5], &a[5]) != MAP_SUCCESS, __LINE__, &test_number, "mapPut doesn't report a disconnected follower", tests_passed);
+    mapFollowerDestroy(new_follower);
+    mapFollowerDestroy(follower);
+    mapDestroy(primary);
+    mapDestroy(new_replica);
+    mapDestroy(replica);
+    _print_test_success(test_number);
+    *tests_passed += 1;
+    return test_number;
+}
+
+static void countEviction(MapKeyElement key, MapDataElement data, void *context) {
+    int *evicted = context;
+    evicted[0] += 1;
+    evicted[1] = *(int *) key;
+    evicted[2] = *(int *) data;
+}
+
+static int mapSetCapacityTest(int *tests_passed) {
+    _print_mode_name("Testing mapSetCapacity function:");
+    int test_number = 1;
+    _print_test_number(test_number, __LINE__);
+    int a[7] = {0, 1, 2, 3, 4, 5, 6};
+    int evicted[3] = {0, 0, 0};
+    Map map = mapCreate(copyInt, copyInt, freeInt, freeInt, compareInt);
+    test( mapSetCapacity(NULL, 3, countEviction, evicted) != MAP_NULL_ARGUMENT, __LINE__, &test_number, "mapSetCapacity doesn't return MAP_NULL_ARGUMENT on NULL map input", tests_passed);
+    test( mapSetCapacity(map, 3, countEviction, evicted) != MAP_SUCCESS, __LINE__, &test_number, "mapSetCapacity doesn't return MAP_SUCCESS", tests_passed);
+    for (int i = 1; i <= 3; i++) {
+        mapPut(map, &a[i], &a[i]);
+    }
+    mapGet(map, &a[1]);
+    mapPut(map, &a[4], &a[4]);
+    test( mapGetSize(map) != 3 || mapContains(map, &a[2]) || evicted[0] != 1 || evicted[1] != 2 || evicted[2] != 2, __LINE__, &test_number, "mapPut doesn't evict the least recently used key", tests_passed);
+    mapPut(map, &a[3], &a[0]);
+    mapPut(map, &a[5], &a[5]);
+    test( mapContains(map, &a[1]) || !mapContains(map, &a[3]) || evicted[1] != 1, __LINE__, &test_number, "mapPut doesn't make a key the most recently used one", tests_passed);
+    MapSavepoint savepoint;
+    mapSavepoint(map, &savepoint);
+    mapPut(map, &a[6], &a[6]);
+    test( mapContains(map, &a[4]) || evicted[0] != 3, __LINE__, &test_number, "mapPut doesn't evict inside a savepoint", tests_passed);
+    mapRollback(map, savepoint);
+    mapReleaseSavepoint(map, savepoint);
+    test( mapGetSize(map) != 3 || !mapContains(map, &a[4]) || mapContains(map, &a[6]), __LINE__, &test_number, "mapRollback doesn't bring an evicted key back", tests_passed);
+    mapSetCapacity(map, 1, NULL, NULL);
+    test( mapGetSize(map) != 1 || evicted[0] != 3, __LINE__, &test_number, "mapSetCapacity doesn't evict down to a smaller capacity", tests_passed);
+    mapSetCapacity(map, 0, NULL, NULL);
+    for (int i = 0; i < 7; i++) {
+        mapPut(map, &a[i], &a[i]);
+    }
+    test( mapGetSize(map) != 7, __LINE__, &test_number, "mapSetCapacity doesn't end the cache mode", tests_passed);
+    mapDestroy(map);
+    map = mapCreate(copyInt, copyInt, freeInt, freeInt, compareInt);
+    for (int i = 0; i < 7; i++) {
+        mapPut(map, &a[i], &a[i]);
+    }
+    mapSavepoint(map, &savepoint);
+    mapRemove(map, &a[2]);
+    mapClear(map);
+    mapSetCapacity(map, 3, NULL, NULL);
+    mapRollback(map, savepoint);
+    mapReleaseSavepoint(map, savepoint);
+    mapPut(map, &a[0], &a[1]);
+    test( mapGetSize(map) != 3 || !mapContains(map, &a[0]) || !mapContains(map, &a[6]), __LINE__, &test_number, "mapSetCapacity doesn't evict the keys a rollback brings back", tests_passed);
+    mapDestroy(map);
+    _print_test_success(test_number);
+    *tests_passed += 1;
+    return test_number;
+}
+
+static int mapPutWithTTLTest(int *tests_passed) {
+    _print_mode_name("Testing mapPutWithTTL/mapExpireTick function:");
+    int test_number = 1;
+    _print_test_number(test_number, __LINE__);
+    Map map = mapCreate(copyInt, copyInt, freeInt, freeInt, compareInt);
+    test( mapPutWithTTL(map, NULL, &test_number, 10) != MAP_NULL_ARGUMENT, __LINE__, &test_number, "mapPutWithTTL doesn't return MAP_NULL_ARGUMENT on NULL key input", tests_passed);
+    MapStats stats;
+    test( mapGetStats(map, &stats) == MAP_SUCCESS && stats.calls[MAP_OPERATION_PUT] != 1, __LINE__, &test_number, "mapPutWithTTL doesn't count a call with a NULL key", tests_passed);
+    test( mapExpireTick(NULL, 0) != -1, __LINE__, &test_number, "mapExpireTick doesn't return -1 on NULL map input", tests_passed);
+    for (int i = 0; i < 10; i++) {
+        test( mapPutWithTTL(map, &i, &i, i % 2 == 0 ? 20 : 100000) != MAP_SUCCESS, __LINE__, &test_number, "mapPutWithTTL doesn't return MAP_SUCCESS", tests_passed);
+    }
+    int key = 10, data = 10;
+    mapPut(map, &key, &data);
+    test( !mapContains(map, &key) || mapGet(map, &key) == NULL || mapExpireTick(map, 0) != 0, __LINE__, &test_number, "mapPutWithTTL expires keys early", tests_passed);
+    key = 1;
+    mapPutWithTTL(map, &key, &data, 20);
+    mapPut(map, &key, &data);
+    key = 3;
+    mapPutWithTTL(map, &key, &data, 90);
+    sleepMilliseconds(40);
+    key = 0;
+    test( mapGet(map, &key) != NULL || mapGetSize(map) != 10, __LINE__, &test_number, "mapGet doesn't remove an expired key", tests_passed);
+    key = 2;
+    test( mapContains(map, &key) || mapGetSize(map) != 9, __LINE__, &test_number, "mapContains doesn't remove an expired key", tests_passed);
+    test( mapExpireTick(map, 2) != 2 || mapExpireTick(map, 0) != 1 || mapGetSize(map) != 6, __LINE__, &test_number, "mapExpireTick doesn't remove the expired keys in slices", tests_passed);
+    key = 1;
+    test( !mapContains(map, &key) || *(int *) mapGet(map, &key) != 10, __LINE__, &test_number, "mapPut doesn't make a key never expire", tests_passed);
+    sleepMilliseconds(80);
+    key = 3;
+    test( mapExpireTick(map, 0) != 1 || mapContains(map, &key) || mapGetSize(map) != 5, __LINE__, &test_number, "mapExpireTick doesn't remove keys of longer TTLs", tests_passed);
+    Map copy = mapCopy(map);
+    key = 5;
+    mapPutWithTTL(map, &key, &data, 1);
+    mapPutWithTTL(copy, &key, &data, 1);
+    sleepMilliseconds(5);
+    mapPutWithTTL(map, &key, &data, 100000);
+    test( mapRemove(copy, &key) != MAP_ITEM_DOES_NOT_EXIST || !mapContains(map, &key) || mapExpireTick(copy, 0) != 0, __LINE__, &test_number, "mapPutWithTTL doesn't renew the TTL of a key", tests_passed);
+    int keys[2] = {7, 9};
+    MapKeyElement batch_key = &keys[0];
+    MapDataElement batch_data = &data;
+    mapPutWithTTL(map, &keys[0], &data, 1);
+    mapPutWithTTL(map, &keys[1], &data, 1);
+    mapPutBatch(map, &batch_key, &batch_data, 1);
+    MapTxn txn = mapTxnBegin(map);
+    mapTxnPut(txn, &keys[1], &data);
+    mapTxnCommit(txn);
+    sleepMilliseconds(5);
+    test( !mapContains(map, &keys[0]) || !mapContains(map, &keys[1]), __LINE__, &test_number, "mapPutBatch/mapTxnPut don't make a key never expire", tests_passed);
+    key = 11;
+    mapPutWithTTL(map, &key, &data, 5);
+    MapSavepoint savepoint;
+    mapSavepoint(map, &savepoint);
+    mapPutWithTTL(map, &keys[0], &data, 5);
+    mapPut(map, &key, &keys[1]);
+    mapRollback(map, savepoint);
+    mapReleaseSavepoint(map, savepoint);
+    sleepMilliseconds(20);
+    test( !mapContains(map, &keys[0]), __LINE__, &test_number, "mapRollback doesn't restore a key that never expired", tests_passed);
+    test( mapContains(map, &key), __LINE__, &test_number, "mapRollback doesn't restore the TTL of a key", tests_passed);
+    mapDestroy(copy);
+    mapDestroy(map);
+    _print_test_success(test_number);
+    *tests_passed += 1;
+    return test_number;
+}
+
+static unsigned int hashInt(MapKeyElement e) {
+    return (unsigned int) *(int *) e;
+}
+
+static long long runScanWorkload(Map map) {
+    mapResetCacheStats(map);
+    for (int round = 0; round < 20; round++) {
+        for (int i = 0; i < 50; i++) {
+            if (!mapGet(map, &i)) mapPut(map, &i, &i);
+        }
+        // a one-off scan of keys never used again
+        for (int i = 0; i < 100; i++) {
+            int key = 1000 + round * 100 + i;
+            if (!mapGet(map, &key)) mapPut(map, &key, &key);
+        }
+    }
+    MapCacheStats stats;
+    mapGetCacheStats(map, &stats);
+    return stats.hits;
+}
+
+static int mapSetEvictionPolicyTest(int *tests_passed) {
+    _print_mode_name("Testing mapSetEvictionPolicy/mapGetCacheStats function:");
+    int test_number = 1;
+    _print_test_number(test_number, __LINE__);
+    MapCacheStats stats;
+    Map lru = mapCreate(copyInt, copyInt, freeInt, freeInt, compareInt);
+    Map tinylfu = mapCreate(copyInt, copyInt, freeInt, freeInt, compareInt);
+    test( mapSetEvictionPolicy(lru, MAP_EVICTION_LRU, NULL) != MAP_ITEM_DOES_NOT_EXIST, __LINE__, &test_number, "mapSetEvictionPolicy doesn't return MAP_ITEM_DOES_NOT_EXIST on a map not in cache mode", tests_passed);
+    test( mapGetCacheStats(lru, &stats) != MAP_ITEM_DOES_NOT_EXIST, __LINE__, &test_number, "mapGetCacheStats doesn't return MAP_ITEM_DOES_NOT_EXIST on a map not in cache mode", tests_passed);
+    mapSetCapacity(lru, 100, NULL, NULL);
+    mapSetCapacity(tinylfu, 100, NULL, NULL);
+    test( mapSetEvictionPolicy(tinylfu, MAP_EVICTION_TINYLFU, NULL) != MAP_NULL_ARGUMENT, __LINE__, &test_number, "mapSetEvictionPolicy doesn't return MAP_NULL_ARGUMENT on NULL hash function input", tests_passed);
+    test( mapSetEvictionPolicy(tinylfu, MAP_EVICTION_TINYLFU, hashInt) != MAP_SUCCESS, __LINE__, &test_number, "mapSetEvictionPolicy doesn't return MAP_SUCCESS", tests_passed);
+    long long lru_hits = runScanWorkload(lru);
+    long long tinylfu_hits = runScanWorkload(tinylfu);
+    test( mapGetCacheStats(tinylfu, &stats) != MAP_SUCCESS || stats.hits + stats.misses != 20 * 150 || stats.rejections == 0 || mapGetSize(tinylfu) != 100, __LINE__, &test_number, "mapGetCacheStats doesn't count the accesses", tests_passed);
+    test( tinylfu_hits <= lru_hits + 500, __LINE__, &test_number, "MAP_EVICTION_TINYLFU doesn't resist scans", tests_passed);
+    mapSetEvictionPolicy(tinylfu, MAP_EVICTION_LRU, NULL);
+    int key = 5000;
+    mapPut(tinylfu, &key, &key);
+    test( mapGetSize(tinylfu) != 100 || !mapContains(tinylfu, &key), __LINE__, &test_number, "mapSetEvictionPolicy doesn't switch back to MAP_EVICTION_LRU", tests_passed);
+    mapDestroy(tinylfu);
+    mapDestroy(lru);
+    _print_test_success(test_number);
+    *tests_passed += 1;
+    return test_number;
+}
+
+// the data of the byte budget test stand for elements of the size they hold
+static int measureIntSize(void *e) {
+    return *(int *) e;
+}
+
+static long long cacheBytes(Map map) {
+    MapCacheStats stats;
+    mapGetCacheStats(map, &stats);
+    return stats.bytes;
+}
+
+static int mapSetByteBudgetTest(int *tests_passed) {
+    _print_mode_name("Testing mapSetByteBudget function:");
+    int test_number = 1;
+    _print_test_number(test_number, __LINE__);
+    Map map = mapCreate(copyInt, copyInt, freeInt, freeInt, compareInt);
+    test( mapSetByteBudget(map, 1000, measureInt, measureIntSize) != MAP_ITEM_DOES_NOT_EXIST, __LINE__, &test_number, "mapSetByteBudget doesn't return MAP_ITEM_DOES_NOT_EXIST on a map not in cache mode", tests_passed);
+    mapSetCapacity(map, 1000, NULL, NULL);
+    test( mapSetByteBudget(map, 1000, measureInt, NULL) != MAP_NULL_ARGUMENT, __LINE__, &test_number, "mapSetByteBudget doesn't return MAP_NULL_ARGUMENT on NULL function input", tests_passed);
+    test( mapSetByteBudget(map, 1000, measureInt, measureIntSize) != MAP_SUCCESS, __LINE__, &test_number, "mapSetByteBudget doesn't return MAP_SUCCESS", tests_passed);
+    int size = 100;
+    for (int i = 0; i < 10; i++) {
+        mapPut(map, &i, &size);
+    }
+    int key = 0;
+    test( mapGetSize(map) != 9 || mapContains(map, &key) || cacheBytes(map) != 9 * 104, __LINE__, &test_number, "mapPut doesn't evict down to the byte budget", tests_passed);
+    key = 20, size = 900;
+    mapPut(map, &key, &size);
+    test( mapGetSize(map) != 1 || cacheBytes(map) != 904, __LINE__, &test_number, "mapPut doesn't evict down to the byte budget for a large entry", tests_passed);
+    key = 21, size = 2000;
+    mapPut(map, &key, &size);
+    test( mapGetSize(map) != 0 || cacheBytes(map) != 0, __LINE__, &test_number, "mapPut doesn't evict an entry larger than the byte budget", tests_passed);
+    key = 1, size = 10;
+    mapPut(map, &key, &size);
+    size = 500;
+    mapPut(map, &key, &size);
+    test( cacheBytes(map) != 504, __LINE__, &test_number, "mapPut doesn't keep the byte total up to date", tests_passed);
+    MapSavepoint savepoint;
+    mapSavepoint(map, &savepoint);
+    size = 300;
+    mapPut(map, &key, &size);
+    key = 2;
+    mapPut(map, &key, &size);
+    mapRollback(map, savepoint);
+    mapReleaseSavepoint(map, savepoint);
+    test( cacheBytes(map) != 504, __LINE__, &test_number, "mapRollback doesn't restore the byte total", tests_passed);
+    key = 1;
+    mapRemove(map, &key);
+    test( cacheBytes(map) != 0, __LINE__, &test_number, "mapRemove doesn't keep the byte total up to date", tests_passed);
+    size = 200;
+    mapPut(map, &key, &size);
+    mapSavepoint(map, &savepoint);
+    size = 300;
+    mapPut(map, &key, &size);
+    mapSetByteBudget(map, 0, NULL, NULL);
+    test( cacheBytes(map) != 0, __LINE__, &test_number, "mapSetByteBudget doesn't reset the byte total when disabled", tests_passed);
+    mapRollback(map, savepoint);
+    mapReleaseSavepoint(map, savepoint);
+    mapRemove(map, &key);
+    test( cacheBytes(map) != 0, __LINE__, &test_number, "mapRollback/mapRemove count bytes without a byte budget", tests_passed);
+    mapDestroy(map);
+    _print_test_success(test_number);
+    *tests_passed += 1;
+    return test_number;
+}
+
+static void writeBackInts(MapKeyElement *keys, MapDataElement *data, int count, void *context) {
+    int *written = context;
+    written[0] += 1;
+    for (int i = 0; i < count; i++) {
+        written[1] += 1;
+        written[2] += *(int *) keys[i];
+        freeInt(keys[i]);
+        freeInt(data[i]);
+    }
+}
+
+static int mapSetWriteBackTest(int *tests_passed) {
+    _print_mode_name("Testing mapSetWriteBack/mapMarkDirty function:");
+    int test_number = 1;
+    _print_test_number(test_number, __LINE__);
+    int a[8] = {0, 1, 2, 3, 4, 5, 6, 7};
+    int written[3] = {0, 0, 0};
+    Map map = mapCreate(copyInt, copyInt, freeInt, freeInt, compareInt);
+    test( mapSetWriteBack(map, writeBackInts, 2, written) != MAP_ITEM_DOES_NOT_EXIST, __LINE__, &test_number, "mapSetWriteBack doesn't return MAP_ITEM_DOES_NOT_EXIST on a map not in cache mode", tests_passed);
+    mapSetCapacity(map, 2, NULL, NULL);
+    test( mapSetWriteBack(map, writeBackInts, 2, written) != MAP_SUCCESS, __LINE__, &test_number, "mapSetWriteBack doesn't return MAP_SUCCESS", tests_passed);
+    test( mapMarkDirty(map, &a[1], true) != MAP_ITEM_DOES_NOT_EXIST, __LINE__, &test_number, "mapMarkDirty doesn't return MAP_ITEM_DOES_NOT_EXIST on a missing key", tests_passed);
+    for (int i = 1; i <= 3; i++) {
+        mapPut(map, &a[i], &a[i]);
+        mapMarkDirty(map, &a[i], true);
+    }
+    test( written[0] != 0 || !mapIsDirty(map, &a[2]), __LINE__, &test_number, "mapSetWriteBack doesn't wait for a full batch", tests_passed);
+    mapPut(map, &a[4], &a[4]);
+    test( written[0] != 1 || written[1] != 2 || written[2] != 3, __LINE__, &test_number, "mapSetWriteBack doesn't give a batch of evicted dirty keys", tests_passed);
+    mapMarkDirty(map, &a[4], true);
+    mapMarkDirty(map, &a[3], false);
+    mapPut(map, &a[5], &a[5]);
+    mapMarkDirty(map, &a[5], true);
+    mapPut(map, &a[6], &a[6]);
+    test( mapFlushWriteBack(map) != MAP_SUCCESS || written[0] != 2 || written[1] != 3 || written[2] != 7, __LINE__, &test_number, "mapFlushWriteBack doesn't give a partial batch", tests_passed);
+    MapSavepoint savepoint;
+    mapSavepoint(map, &savepoint);
+    mapPut(map, &a[7], &a[7]);
+    mapRollback(map, savepoint);
+    mapReleaseSavepoint(map, savepoint);
+    test( mapFlushWriteBack(map) != MAP_SUCCESS || written[1] != 4 || written[2] != 12 || !mapIsDirty(map, &a[5]), __LINE__, &test_number, "mapSetWriteBack doesn't give copies of keys evicted in a savepoint", tests_passed);
+    mapGet(map, &a[6]);
+    mapPut(map, &a[7], &a[7]);
+    mapDestroy(map);
+    test( written[1] != 5, __LINE__, &test_number, "mapDestroy doesn't give the last batch to the hook", tests_passed);
+    map = mapCreate(copyInt, copyInt, freeInt, freeInt, compareInt);
+    mapPut(map, &a[1], &a[1]);
+    mapPut(map, &a[2], &a[2]);
+    test( mapMarkDirty(map, &a[2], false) != MAP_SUCCESS || mapMarkDirty(map, &a[1], true) != MAP_SUCCESS || !mapIsDirty(map, &a[1]) || mapIsDirty(map, &a[2]), __LINE__, &test_number, "mapMarkDirty doesn't mark a key of a map not in cache mode", tests_passed);
+    mapDestroy(map);
+    _print_test_success(test_number);
+    *tests_passed += 1;
+    return test_number;
+}
+
+static void *putThousand(void *map) {
+    for (int i = 0; i < 1000; i++) {
+        mapPut(map, &i, &i);
+    }
+    return NULL;
+}
+
+static int mapGetStatsTest(int *tests_passed) {
+    _print_mode_name("Testing mapGetStats/mapResetStats function:");
+    int test_number = 1;
+    _print_test_number(test_number, __LINE__);
+    int a[10] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9};
+    MapStats stats;
+    Map map = mapCreate(copyInt, copyInt, freeInt, freeInt, compareInt);
+    test( mapGetStats(NULL, &stats) != MAP_NULL_ARGUMENT, __LINE__, &test_number, "mapGetStats doesn't return MAP_NULL_ARGUMENT", tests_passed);
+    if (mapGetStats(map, &stats) == MAP_ITEM_DOES_NOT_EXIST) {
+        // built with MAP_NO_STATS, nothing is counted
+        mapDestroy(map);
+        _print_test_success(test_number);
+        *tests_passed += 1;
+        return test_number;
+    }
+    test( stats.searches != 0 || stats.compares != 0, __LINE__, &test_number, "mapGetStats doesn't return zero counts for a new map", tests_passed);
+    for (int i = 0; i < 10; i++) {
+        mapPut(map, &a[i], &a[i]);
+    }
+    mapGet(map, &a[4]);
+    mapGet(map, &a[4]);
+    mapGetStats(map, &stats);
+    test( stats.calls[MAP_OPERATION_PUT] != 10 || stats.calls[MAP_OPERATION_GET] != 2 || stats.calls[MAP_OPERATION_REMOVE] != 0, __LINE__, &test_number, "mapGetStats doesn't count the calls of each operation", tests_passed);
+    test( stats.searches != 12 || stats.nodes_traversed != 53 || stats.max_traversed != 9 || stats.compares != 55, __LINE__, &test_number, "mapGetStats doesn't count the nodes searches step over", tests_passed);
+    test( stats.key_copies != 10 || stats.data_copies != 10 || stats.allocations > 10, __LINE__, &test_number, "mapGetStats doesn't count the copies and allocations", tests_passed);
+    mapRemove(map, &a[9]);
+    mapPut(map, &a[0], &a[1]);
+    mapGetStats(map, &stats);
+    test( stats.key_frees != 1 || stats.data_frees != 2 || stats.data_copies != 11, __LINE__, &test_number, "mapGetStats doesn't count the frees", tests_passed);
+    Map copy = mapCopy(map);
+    MapStats copy_stats;
+    mapGetStats(map, &stats);
+    mapGetStats(copy, &copy_stats);
+    test( stats.calls[MAP_OPERATION_COPY] != 1 || stats.key_copies != 19 || copy_stats.key_copies != 0, __LINE__, &test_number, "mapCopy isn't counted by the map copied", tests_passed);
+    mapResetStats(map);
+    mapGetStats(map, &stats);
+    test( stats.calls[MAP_OPERATION_PUT] != 0 || stats.max_traversed != 0 || stats.key_copies != 0, __LINE__, &test_number, "mapResetStats doesn't zero the counts", tests_passed);
+    FILE *stream = tmpfile();
+    mapSave(map, stream, serializeInt, serializeInt);
+    rewind(stream);
+    mapLoad(map, stream, deserializeInt, deserializeInt);
+    fclose(stream);
+    mapCheckpoint(map);
+    mapSetCapacity(map, 100, NULL, NULL);
+    mapSetCapacity(map, 0, NULL, NULL);
+    mapReplicate(NULL, -1, serializeInt, serializeInt, 0);
+    mapGetStats(map, &stats);
+    test( stats.calls[MAP_OPERATION_SAVE] != 1 || stats.calls[MAP_OPERATION_LOAD] != 1 || stats.calls[MAP_OPERATION_CHECKPOINT] != 1 || stats.calls[MAP_OPERATION_CONFIGURE] != 2 || stats.calls[MAP_OPERATION_PUT] != 0, __LINE__, &test_number, "mapGetStats doesn't count saving, loading and configuring", tests_passed);
+    mapResetStats(map);
+    pthread_t thread;
+    pthread_create(&thread, NULL, putThousand, copy);
+    pthread_join(thread, NULL);
+    mapClear(copy);
+    mapResetStats(copy);
+    pthread_create(&thread, NULL, putThousand, copy);
+    pthread_join(thread, NULL);
+    mapGetStats(copy, &copy_stats);
+    test( mapGetSize(copy) != 1000 || copy_stats.allocations > 100, __LINE__, &test_number, "nodes freed by a thread aren't reused by other threads", tests_passed);
+    mapDestroy(copy);
+    mapDestroy(map);
+    _print_test_success(test_number);
+    *tests_passed += 1;
+    return test_number;
+}
+
+static int mapSetLatencyTrackingTest(int *tests_passed) {
+    _print_mode_name("Testing mapSetLatencyTracking/mapGetLatency function:");
+    int test_number = 1;
+    _print_test_number(test_number, __LINE__);
+    int a[100];
+    MapLatencyHistogram histogram, other;
+    Map map = mapCreate(copyInt, copyInt, freeInt, freeInt, compareInt);
+    Map second = mapCreate(copyInt, copyInt, freeInt, freeInt, compareInt);
+    test( mapGetLatency(map, MAP_OPERATION_PUT, &histogram) != MAP_ITEM_DOES_NOT_EXIST, __LINE__, &test_number, "mapGetLatency doesn't return MAP_ITEM_DOES_NOT_EXIST on an untracked map", tests_passed);
+    test( mapSetLatencyTracking(NULL, true) != MAP_NULL_ARGUMENT, __LINE__, &test_number, "mapSetLatencyTracking doesn't return MAP_NULL_ARGUMENT", tests_passed);
+    test( mapSetLatencyTracking(map, true) != MAP_SUCCESS, __LINE__, &test_number, "mapSetLatencyTracking doesn't return MAP_SUCCESS", tests_passed);
+    mapSetLatencyTracking(second, true);
+    for (int i = 0; i < 100; i++) {
+        a[i] = i;
+        mapPut(map, &a[i], &a[i]);
+        mapGet(second, &a[i]);
+    }
+    MAP_FOREACH(int *, key, map) {
+        mapGet(map, key);
+    }
+    mapGetLatency(map, MAP_OPERATION_PUT, &histogram);
+    test( histogram.count != 100 || histogram.max <= 0 || histogram.total < histogram.max, __LINE__, &test_number, "mapGetLatency doesn't record every call", tests_passed);
+    long long median = mapLatencyPercentile(&histogram, 50);
+    test( median <= 0 || median > mapLatencyPercentile(&histogram, 99.9) || mapLatencyPercentile(&histogram, 100) != histogram.max, __LINE__, &test_number, "mapLatencyPercentile doesn't return ordered percentiles", tests_passed);
+    mapGetLatency(map, MAP_OPERATION_GET_NEXT, &histogram);
+    test( histogram.count != 100, __LINE__, &test_number, "mapGetLatency doesn't record the iteration", tests_passed);
+    mapGetLatency(map, MAP_OPERATION_GET, &histogram);
+    mapGetLatency(second, MAP_OPERATION_GET, &other);
+    test( mapMergeLatency(&histogram, &other) != MAP_SUCCESS || histogram.count != 200 || mapLatencyPercentile(&histogram, 50) <= 0, __LINE__, &test_number, "mapMergeLatency doesn't add the latencies of two maps", tests_passed);
+    mapResetLatency(map);
+    mapGetLatency(map, MAP_OPERATION_PUT, &histogram);
+    test( histogram.count != 0 || mapLatencyPercentile(&histogram, 99) != 0, __LINE__, &test_number, "mapResetLatency doesn't empty the histograms", tests_passed);
+    mapSetLatencyTracking(map, false);
+    test( mapGetLatency(map, MAP_OPERATION_PUT, &histogram) != MAP_ITEM_DOES_NOT_EXIST, __LINE__, &test_number, "mapSetLatencyTracking doesn't stop tracking", tests_passed);
+    mapDestroy(second);
+    mapDestroy(map);
+    _print_test_success(test_number);
+    *tests_passed += 1;
+    return test_number;
+}
+
+typedef struct {
+    int begins;
+    int ends;
+    MapOperation operation;
+    int key;
+    MapResult result;
+    long long elapsed;
+} TraceLog;
+
+static void traceBegin(Map map, MapOperation operation, MapKeyElement key, void *context) {
+    (void) map;
+    TraceLog *log = context;
+    log->begins++;
+    log->operation = operation;
+    log->key = key ? *(int *) key : -1;
+}
+
+static void traceEnd(Map map, MapOperation operation, MapKeyElement key, MapResult result, long long elapsed, void *context) {
+    (void) map;
+    (void) key;
+    TraceLog *log = context;
+    log->ends += log->operation == operation;
+    log->result = result;
+    log->elapsed = elapsed;
+}
+
+static int mapSetTraceHooksTest(int *tests_passed) {
+    _print_mode_name("Testing mapSetTraceHooks function:");
+    int test_number = 1;
+    _print_test_number(test_number, __LINE__);
+    int a[3] = {0, 1, 2};
+    TraceLog log = {0, 0, MAP_OPERATION_PUT, 0, MAP_SUCCESS, 0};
+    MapTraceHooks hooks = {traceBegin, traceEnd, &log};
+    if (mapSetTraceHooks(&hooks) == MAP_ITEM_DOES_NOT_EXIST) {
+        // built without MAP_TRACING, nothing is traced
+        _print_test_success(test_number);
+        *tests_passed += 1;
+        return test_number;
+    }
+    Map map = mapCreate(copyInt, copyInt, freeInt, freeInt, compareInt);
+    mapPut(map, &a[1], &a[2]);
+    test( log.begins != 1 || log.ends != 1 || log.operation != MAP_OPERATION_PUT || log.key != 1 || log.result != MAP_SUCCESS || log.elapsed <= 0, __LINE__, &test_number, "mapSetTraceHooks doesn't trace mapPut", tests_passed);
+    mapGet(map, &a[2]);
+    test( log.operation != MAP_OPERATION_GET || log.key != 2 || log.result != MAP_ITEM_DOES_NOT_EXIST, __LINE__, &test_number, "mapSetTraceHooks doesn't report a missing key", tests_passed);
+    mapRemove(map, NULL);
+    test( log.operation != MAP_OPERATION_REMOVE || log.key != -1 || log.result != MAP_NULL_ARGUMENT, __LINE__, &test_number, "mapSetTraceHooks doesn't report a NULL argument", tests_passed);
+    MAP_FOREACH(int *, key, map) {
+    }
+    test( log.begins != 5 || log.ends != 5 || log.operation != MAP_OPERATION_GET_NEXT, __LINE__, &test_number, "mapSetTraceHooks doesn't trace the iteration", tests_passed);
+    mapSetWriteBack(map, NULL, 1, NULL);
+    test( log.begins != 6 || log.operation != MAP_OPERATION_CONFIGURE || log.result != MAP_ITEM_DOES_NOT_EXIST, __LINE__, &test_number, "mapSetTraceHooks doesn't trace the configuration", tests_passed);
+    mapSetTraceHooks(NULL);
+    mapClear(map);
+    test( log.begins != 6 || log.ends != 6, __LINE__, &test_number, "mapSetTraceHooks doesn't stop tracing", tests_passed);
+    mapDestroy(map);
+    _print_test_success(test_number);
+    *tests_passed += 1;
+    return test_number;
+}
+
+static bool parseIntPair(char *line, int length, MapKeyElement *key, MapDataElement *data, void *context) {
+    (void) length;
+    (void) context;
+    int k, d;
+    if (sscanf(line, "%d,%d", &k, &d) != 2) return false;
+    *key = copyInt(&k);
+    *data = copyInt(&d);
+    return true;
+}
+
+static int mapPutBatchTest(int *tests_passed) {
+    _print_mode_name("Testing mapPutBatch/mapLoadLines function:");
+    int test_number = 1;
+    _print_test_number(test_number, __LINE__);
+    int a[6] = {4, 1, 2, 0, 4, 5};
+    MapKeyElement keys[6];
+    MapDataElement datas[6];
+    for (int i = 0; i < 6; i++) {
+        keys[i] = &a[i];
+        datas[i] = &a[5 - i];
+    }
+    Map map = mapCreate(copyInt, copyInt, freeInt, freeInt, compareInt);
+    test( mapPutBatch(map, NULL, datas, 6) != MAP_NULL_ARGUMENT, __LINE__, &test_number, "mapPutBatch doesn't return MAP_NULL_ARGUMENT on NULL keys input", tests_passed);
+    mapPut(map, &a[2], &a[2]);
+    test( mapPutBatch(map, keys, datas, 6) != MAP_SUCCESS, __LINE__, &test_number, "mapPutBatch doesn't return MAP_SUCCESS", tests_passed);
+    int expected_keys[5] = {0, 1, 2, 4, 5};
+    int expected_datas[5] = {2, 4, 0, 1, 4};
+    int k = 0;
+    bool equal = mapGetSize(map) == 5;
+    MAP_FOREACH(int*, i, map) {
+        if (k >= 5 || *i != expected_keys[k] || *(int *) mapGet(map, i) != expected_datas[k]) {
+            equal = false;
+            break;
+        }
+        k++;
+    }
+    test( !equal, __LINE__, &test_number, "mapPutBatch doesn't insert the pairs in order, last pair winning", tests_passed);
+    mapDestroy(map);
+    char path[] = "map_mtm_test_lines.tmp";
+    FILE *file = fopen(path, "w");
+    fprintf(file, "key,data\n");
+    for (int i = 2000; i > 0; i--) {
+        fprintf(file, "%d,%d\r\n", i % 1000, i);
+    }
+    fprintf(file, "\n7,77");
+    fclose(file);
+    map = mapCreate(copyInt, copyInt, freeInt, freeInt, compareInt);
+    MapLoaderStats stats;
+    test( mapLoadLines(map, path, parseIntPair, NULL, freeInt, freeInt, 3, &stats) != MAP_SUCCESS, __LINE__, &test_number, "mapLoadLines doesn't return MAP_SUCCESS", tests_passed);
+    test( mapGetSize(map) != 1000 || *(int *) mapGet(map, &a[2]) != 2 || *(int *) mapGet(map, &(int){7}) != 77, __LINE__, &test_number, "mapLoadLines doesn't load the lines in file order", tests_passed);
+    test( stats.lines != 2001 || stats.skipped_lines != 1, __LINE__, &test_number, "mapLoadLines doesn't count the lines correctly", tests_passed);
+    remove(path);
+    _print_test_success(test_number);
+    *tests_passed += 1;
+    mapDestroy(map);
+    return test_number;
+}
+
 int main() {
     printf("\nWelcome to the homework 3 map_module tests, written by Vova Parakhin.\n\n---Passing those tests won't "
            "guarantee you a good grade---\nBut they might get you close to one "
@@ -259,6 +1395,27 @@ int main() {
     tests_number += mapRemoveTest(&tests_passed);
     tests_number += mapClearTest(&tests_passed);
     tests_number += mapGetTest(&tests_passed);
+    tests_number += mapComputeTest(&tests_passed);
+    tests_number += mapTxnTest(&tests_passed);
+    tests_number += mapSavepointTest(&tests_passed);
+    tests_number += mapSaveLoadTest(&tests_passed);
+    tests_number += mapSaveCompressedTest(&tests_passed);
+    tests_number += mapMappedTest(&tests_passed);
+    tests_number += mapSharedTest(&tests_passed);
+    tests_number += mapDurableTest(&tests_passed);
+    tests_number += mapCheckpointIncrementalTest(&tests_passed);
+    tests_number += mapSnapshotBackgroundTest(&tests_passed);
+    tests_number += mapSetMemoryBudgetTest(&tests_passed);
+    tests_number += mapReplicateTest(&tests_passed);
+    tests_number += mapSetCapacityTest(&tests_passed);
+    tests_number += mapPutWithTTLTest(&tests_passed);
+    tests_number += mapSetEvictionPolicyTest(&tests_passed);
+    tests_number += mapSetByteBudgetTest(&tests_passed);
+    tests_number += mapSetWriteBackTest(&tests_passed);
+    tests_number += mapGetStatsTest(&tests_passed);
+    tests_number += mapSetLatencyTrackingTest(&tests_passed);
+    tests_number += mapSetTraceHooksTest(&tests_passed);
+    tests_number += mapPutBatchTest(&tests_passed);
     print_grade(tests_number, tests_passed);
     return 0;
 }
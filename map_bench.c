@@ -0,0 +1,610 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include "map_mtm.h"
+
+/**
+* YCSB-style benchmark of the map.
+*
+* Loads a map with a number of records, then runs a workload of operations on
+* it and prints, for every kind of operation in the workload and for all of
+* them together, one JSON object per line: the number of operations, their
+* throughput and their latency percentiles. The workloads are those of YCSB:
+*   A - 50% reads, 50% updates (zipfian)
+*   B - 95% reads, 5% updates (zipfian)
+*   C - 100% reads (zipfian)
+*   D - 95% reads, 5% inserts (latest)
+*   E - 95% short scans, 5% inserts (zipfian)
+*   F - 50% reads, 50% read-modify-writes with mapCompute (zipfian)
+* Keys are 64 bit integers scrambled from the record numbers, so records are
+* spread over the list in no relation to when they were inserted, and data
+* are BENCH_RECORD_SIZE-byte records.
+*
+* Usage: map_bench [-w workloads] [-n records,...] [-o operations]
+*                  [-d uniform|zipfian|latest] [-s seed]
+* Building: gcc -std=c99 -O2 map_bench.c map_mtm.c -pthread -lm -o map_bench
+*/
+
+// constants
+
+/** number of bytes of a record */
+#define BENCH_RECORD_SIZE 100
+
+/** the most records a scan reads */
+#define BENCH_MAX_SCAN_LENGTH 100
+
+/** the skew of the zipfian distributions, as in YCSB */
+#define BENCH_ZIPFIAN_THETA 0.99
+
+/** default workloads, numbers of records and number of operations */
+#define BENCH_DEFAULT_WORKLOADS "ABCDEF"
+#define BENCH_DEFAULT_RECORDS "1000,10000,100000"
+#define BENCH_DEFAULT_OPERATIONS 10000
+
+// structs
+
+typedef enum{
+    BENCH_UNIFORM,
+    BENCH_ZIPFIAN,
+    BENCH_LATEST,
+    BENCH_DISTRIBUTIONS_COUNT
+}Distribution;
+
+typedef enum{
+    BENCH_READ,
+    BENCH_UPDATE,
+    BENCH_INSERT,
+    BENCH_SCAN,
+    BENCH_READ_MODIFY_WRITE,
+    BENCH_OPERATIONS_COUNT
+}Operation;
+
+static const char *distribution_names[BENCH_DISTRIBUTIONS_COUNT] = {
+    "uniform","zipfian","latest"
+};
+
+static const char *operation_names[BENCH_OPERATIONS_COUNT] = {
+    "read","update","insert","scan","read_modify_write"
+};
+
+// the share of every operation in a workload, and the distribution of the
+// records it chooses
+typedef struct workload_t{
+    char name;
+    double shares[BENCH_OPERATIONS_COUNT];
+    Distribution distribution;
+}Workload;
+
+static const Workload workloads[] = {
+    {'A',{0.5,0.5,0,0,0},BENCH_ZIPFIAN},
+    {'B',{0.95,0.05,0,0,0},BENCH_ZIPFIAN},
+    {'C',{1,0,0,0,0},BENCH_ZIPFIAN},
+    {'D',{0.95,0,0.05,0,0},BENCH_LATEST},
+    {'E',{0,0,0.05,0.95,0},BENCH_ZIPFIAN},
+    {'F',{0.5,0,0,0,0.5},BENCH_ZIPFIAN}
+};
+
+typedef struct record_t{
+    unsigned char bytes[BENCH_RECORD_SIZE];
+}Record;
+
+// the zipfian generator of Gray et al., as used by YCSB: chooses 0 most
+// often, then 1, and so on. The number of items may grow
+typedef struct zipfian_t{
+    long long items;
+    double zeta_items;
+    double zeta_two;
+    double alpha;
+    double eta;
+}Zipfian;
+
+// the state of a run of a workload
+typedef struct run_t{
+    Map map;
+    uint64_t random;
+    Distribution distribution;
+    Zipfian zipfian;
+    // number of records in the map, the next one inserted is numbered so
+    long long records;
+    Record record;
+    // the latency of every operation of each kind, in nanoseconds
+    long long *latencies[BENCH_OPERATIONS_COUNT];
+    long long counts[BENCH_OPERATIONS_COUNT];
+}*Run;
+
+// additional functions declarations
+
+/**
+* nanosecondsNow: reading a monotonic clock
+* @return
+*    the current time in nanoseconds
+*/
+static long long nanosecondsNow(void);
+
+/**
+* mixBits: scrambling a 64 bit number (the finalizer of splitmix64, which is a
+*          bijection, so distinct numbers stay distinct)
+* @param value - the number to scramble
+* @return
+*    the scrambled number
+*/
+static uint64_t mixBits(uint64_t value);
+
+/**
+* nextRandom: drawing a uniformly distributed random number
+* @param state - the state of the generator, updated
+* @return
+*    the random number
+*/
+static uint64_t nextRandom(uint64_t *state);
+
+/**
+* nextUniform: drawing a random number uniformly distributed in [0,1)
+* @param state - the state of the generator, updated
+* @return
+*    the random number
+*/
+static double nextUniform(uint64_t *state);
+
+/**
+* growZipfian: initializing a zipfian generator, or letting it choose from
+*              more items
+* @param zipfian - the generator, zeroed before it is first grown
+* @param items - the new number of items
+*/
+static void growZipfian(Zipfian *zipfian,long long items);
+
+/**
+* nextZipfian: drawing an item from a zipfian generator
+* @param zipfian - the generator
+* @param state - the state of the random number generator, updated
+* @return
+*    the item, from 0 to the number of items - 1
+*/
+static long long nextZipfian(Zipfian *zipfian,uint64_t *state);
+
+/**
+* chooseRecord: choosing an existing record by the distribution of a run
+* @param run - the run
+* @return
+*    the number of the record
+*/
+static long long chooseRecord(Run run);
+
+/**
+* copyKey, freeKey, compareKeys, copyRecord, freeRecord: the functions of the
+*           map of keys (uint64_t) and records
+*/
+static MapKeyElement copyKey(MapKeyElement key);
+static void freeKey(MapKeyElement key);
+static int compareKeys(MapKeyElement first,MapKeyElement second);
+static MapDataElement copyRecord(MapDataElement record);
+static void freeRecord(MapDataElement record);
+
+/**
+* modifyRecord: the read-modify-write of a record, changing it in place
+* @param key - the key of the record
+* @param record - the record, NULL if it is not in the map
+* @param context - the record to use if it is not in the map
+* @return
+*    the record
+*/
+static MapDataElement modifyRecord(MapKeyElement key,MapDataElement record,
+                                   void *context);
+
+/**
+* loadRecords: putting the first "records" records into the map of a run
+* @param run - the run, whose map is empty
+* @param records - the number of records to put
+* @return
+*    MAP_OUT_OF_MEMORY if an allocation failed
+*    MAP_SUCCESS otherwise
+*/
+static MapResult loadRecords(Run run,long long records);
+
+/**
+* runOperation: running an operation of a run and recording its latency
+* @param run - the run
+* @param operation - the kind of the operation
+* @return
+*    MAP_OUT_OF_MEMORY if an allocation failed
+*    MAP_SUCCESS otherwise
+*/
+static MapResult runOperation(Run run,Operation operation);
+
+/**
+* compareLatencies: comparing two latencies, for qsort
+*/
+static int compareLatencies(const void *first,const void *second);
+
+/**
+* printResult: printing the JSON line of a kind of operation, sorting its
+*              latencies
+* @param workload - the workload run
+* @param distribution - the distribution of the records
+* @param records - the number of records loaded
+* @param operation - the name of the kind of operation
+* @param latencies - the latency of every operation
+* @param count - the number of operations
+* @param seconds - the time the operations took, for their throughput
+*/
+static void printResult(const Workload *workload,Distribution distribution,
+                        long long records,const char *operation,
+                        long long *latencies,long long count,double seconds);
+
+/**
+* runWorkload: loading a map and running a workload on it
+* @param workload - the workload
+* @param distribution - the distribution of the records
+* @param records - the number of records to load
+* @param operations - the number of operations to run
+* @param seed - the seed of the random number generator
+* @return
+*    MAP_OUT_OF_MEMORY if an allocation failed
+*    MAP_SUCCESS otherwise
+*/
+static MapResult runWorkload(const Workload *workload,
+                             Distribution distribution,long long records,
+                             long long operations,uint64_t seed);
+
+// functions implementations
+
+static long long nanosecondsNow(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC,&now);
+    return (long long)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static uint64_t mixBits(uint64_t value)
+{
+    value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    value = (value ^ (value >> 27)) * 0x94d049bb133111ebULL;
+    return value ^ (value >> 31);
+}
+
+static uint64_t nextRandom(uint64_t *state)
+{
+    *state += 0x9e3779b97f4a7c15ULL;
+    return mixBits(*state);
+}
+
+static double nextUniform(uint64_t *state)
+{
+    return (nextRandom(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static void growZipfian(Zipfian *zipfian,long long items)
+{
+    for(long long i = zipfian->items + 1; i <= items; i++){
+        zipfian->zeta_items += 1 / pow((double)i,BENCH_ZIPFIAN_THETA);
+    }
+    zipfian->items = items;
+    zipfian->zeta_two = 1 + 1 / pow(2,BENCH_ZIPFIAN_THETA);
+    zipfian->alpha = 1 / (1 - BENCH_ZIPFIAN_THETA);
+    zipfian->eta = (1 - pow(2.0 / items,1 - BENCH_ZIPFIAN_THETA)) /
+                   (1 - zipfian->zeta_two / zipfian->zeta_items);
+}
+
+static long long nextZipfian(Zipfian *zipfian,uint64_t *state)
+{
+    double uniform = nextUniform(state);
+    double scaled = uniform * zipfian->zeta_items;
+    if(scaled < 1){
+        return 0;
+    }
+    if(scaled < 1 + pow(0.5,BENCH_ZIPFIAN_THETA)){
+        return 1;
+    }
+    long long item = (long long)(zipfian->items *
+                     pow(zipfian->eta * uniform - zipfian->eta + 1,
+                         zipfian->alpha));
+    return item < zipfian->items ? item : zipfian->items - 1;
+}
+
+static long long chooseRecord(Run run)
+{
+    switch(run->distribution){
+    case BENCH_ZIPFIAN:
+        // scrambled, so the popular records are spread over the list
+        return (long long)(mixBits(nextZipfian(&run->zipfian,&run->random)) %
+                           (uint64_t)run->records);
+    case BENCH_LATEST:
+        return run->records - 1 - nextZipfian(&run->zipfian,&run->random);
+    default:
+        return (long long)(nextRandom(&run->random) % (uint64_t)run->records);
+    }
+}
+
+static MapKeyElement copyKey(MapKeyElement key)
+{
+    uint64_t *copy = malloc(sizeof(*copy));
+    if(copy){
+        *copy = *(uint64_t*)key;
+    }
+    return copy;
+}
+
+static void freeKey(MapKeyElement key)
+{
+    free(key);
+}
+
+static int compareKeys(MapKeyElement first,MapKeyElement second)
+{
+    uint64_t a = *(uint64_t*)first,b = *(uint64_t*)second;
+    return (a > b) - (a < b);
+}
+
+static MapDataElement copyRecord(MapDataElement record)
+{
+    Record *copy = malloc(sizeof(*copy));
+    if(copy){
+        *copy = *(Record*)record;
+    }
+    return copy;
+}
+
+static void freeRecord(MapDataElement record)
+{
+    free(record);
+}
+
+static MapDataElement modifyRecord(MapKeyElement key,MapDataElement record,
+                                   void *context)
+{
+    (void)key;
+    if(!record){
+        return context;
+    }
+    ((Record*)record)->bytes[0] += 1;
+    return record;
+}
+
+static MapResult loadRecords(Run run,long long records)
+{
+    uint64_t *keys = malloc(records * sizeof(*keys));
+    MapKeyElement *key_elements = malloc(records * sizeof(*key_elements));
+    MapDataElement *data_elements = malloc(records * sizeof(*data_elements));
+    MapResult result = MAP_OUT_OF_MEMORY;
+    if(keys && key_elements && data_elements){
+        for(long long i = 0; i < records; i++){
+            keys[i] = mixBits(i);
+            key_elements[i] = &keys[i];
+            data_elements[i] = &run->record;
+        }
+        result = mapPutBatch(run->map,key_elements,data_elements,
+                             (int)records);
+    }
+    free(keys);
+    free(key_elements);
+    free(data_elements);
+    run->records = records;
+
+    return result;
+}
+
+static MapResult runOperation(Run run,Operation operation)
+{
+    MapResult result = MAP_SUCCESS;
+    uint64_t key = mixBits(operation == BENCH_INSERT ? run->records :
+                           chooseRecord(run));
+    int length = operation != BENCH_SCAN ? 0 :
+                 1 + (int)(nextRandom(&run->random) % BENCH_MAX_SCAN_LENGTH);
+    run->record.bytes[0] += 1;
+
+    long long start = nanosecondsNow();
+    switch(operation){
+    case BENCH_READ:
+        mapGet(run->map,&key);
+        break;
+    case BENCH_UPDATE:
+    case BENCH_INSERT:
+        result = mapPut(run->map,&key,&run->record);
+        break;
+    case BENCH_SCAN:
+        // the map can only be iterated from its first key
+        for(MapKeyElement cur = mapGetFirst(run->map); cur && length > 0;
+            cur = mapGetNext(run->map)){
+            if(*(uint64_t*)cur >= key){
+                length--;
+            }
+        }
+        break;
+    default:
+        result = mapCompute(run->map,&key,modifyRecord,&run->record);
+        break;
+    }
+    long long latency = nanosecondsNow() - start;
+
+    if(operation == BENCH_INSERT && result == MAP_SUCCESS){
+        run->records += 1;
+        if(run->distribution == BENCH_LATEST){
+            growZipfian(&run->zipfian,run->records);
+        }
+    }
+    run->latencies[operation][run->counts[operation]++] = latency;
+    return result == MAP_OUT_OF_MEMORY ? result : MAP_SUCCESS;
+}
+
+static int compareLatencies(const void *first,const void *second)
+{
+    long long a = *(const long long*)first,b = *(const long long*)second;
+    return (a > b) - (a < b);
+}
+
+static void printResult(const Workload *workload,Distribution distribution,
+                        long long records,const char *operation,
+                        long long *latencies,long long count,double seconds)
+{
+    qsort(latencies,count,sizeof(*latencies),compareLatencies);
+    static const double percentiles[] = {50,95,99,99.9};
+    static const char *names[] = {"p50","p95","p99","p999"};
+    long long total = 0;
+    for(long long i = 0; i < count; i++){
+        total += latencies[i];
+    }
+
+    printf("{\"workload\":\"%c\",\"distribution\":\"%s\",\"records\":%lld,"
+           "\"operation\":\"%s\",\"count\":%lld,\"ops_per_sec\":%.1f,"
+           "\"mean_ns\":%.1f",workload->name,distribution_names[distribution],
+           records,operation,count,seconds > 0 ? count / seconds : 0,
+           (double)total / count);
+    for(int i = 0; i < 4; i++){
+        long long rank = (long long)ceil(percentiles[i] / 100 * count);
+        printf(",\"%s_ns\":%lld",names[i],latencies[rank > 0 ? rank - 1 : 0]);
+    }
+    printf(",\"max_ns\":%lld}\n",latencies[count - 1]);
+}
+
+static MapResult runWorkload(const Workload *workload,
+                             Distribution distribution,long long records,
+                             long long operations,uint64_t seed)
+{
+    struct run_t run;
+    memset(&run,0,sizeof(run));
+    run.random = seed;
+    run.distribution = distribution;
+    run.map = mapCreate(copyRecord,copyKey,freeRecord,freeKey,compareKeys);
+    // every operation's latency, and then all of them together
+    long long *all = malloc(operations * sizeof(*all));
+    bool allocated = run.map && all;
+    for(int i = 0; i < BENCH_OPERATIONS_COUNT; i++){
+        run.latencies[i] = malloc(operations * sizeof(*run.latencies[i]));
+        allocated = allocated && run.latencies[i];
+    }
+    MapResult result = allocated ? loadRecords(&run,records) :
+                       MAP_OUT_OF_MEMORY;
+    if(result == MAP_SUCCESS){
+        growZipfian(&run.zipfian,records);
+    }
+
+    long long start = nanosecondsNow();
+    for(long long i = 0; i < operations && result == MAP_SUCCESS; i++){
+        double choice = nextUniform(&run.random);
+        Operation operation = BENCH_READ;
+        for(int j = 0; j < BENCH_OPERATIONS_COUNT; j++){
+            if(workload->shares[j] > 0){
+                operation = j;
+                if(choice < workload->shares[j]){
+                    break;
+                }
+                choice -= workload->shares[j];
+            }
+        }
+        result = runOperation(&run,operation);
+    }
+    double seconds = (nanosecondsNow() - start) / 1e9;
+
+    if(result == MAP_SUCCESS){
+        long long count = 0;
+        for(int i = 0; i < BENCH_OPERATIONS_COUNT; i++){
+            if(run.counts[i] == 0){
+                continue;
+            }
+            memcpy(all + count,run.latencies[i],
+                   run.counts[i] * sizeof(*all));
+            count += run.counts[i];
+            long long total = 0;
+            for(long long j = 0; j < run.counts[i]; j++){
+                total += run.latencies[i][j];
+            }
+            printResult(workload,distribution,records,operation_names[i],
+                        run.latencies[i],run.counts[i],total / 1e9);
+        }
+        printResult(workload,distribution,records,"all",all,count,seconds);
+        fflush(stdout);
+    }
+
+    for(int i = 0; i < BENCH_OPERATIONS_COUNT; i++){
+        free(run.latencies[i]);
+    }
+    free(all);
+    mapDestroy(run.map);
+    return result;
+}
+
+int main(int argc,char *argv[])
+{
+    const char *workload_names = BENCH_DEFAULT_WORKLOADS;
+    const char *record_counts = BENCH_DEFAULT_RECORDS;
+    long long operations = BENCH_DEFAULT_OPERATIONS;
+    int distribution = -1;
+    uint64_t seed = 1;
+
+    int option;
+    while((option = getopt(argc,argv,"w:n:o:d:s:")) != -1){
+        switch(option){
+        case 'w':
+            workload_names = optarg;
+            break;
+        case 'n':
+            record_counts = optarg;
+            break;
+        case 'o':
+            operations = atoll(optarg);
+            break;
+        case 'd':
+            for(int i = 0; i < BENCH_DISTRIBUTIONS_COUNT; i++){
+                if(strcmp(optarg,distribution_names[i]) == 0){
+                    distribution = i;
+                }
+            }
+            if(distribution < 0){
+                fprintf(stderr,"unknown distribution: %s\n",optarg);
+                return 1;
+            }
+            break;
+        case 's':
+            seed = strtoull(optarg,NULL,10);
+            break;
+        default:
+            fprintf(stderr,"usage: %s [-w workloads] [-n records,...] "
+                    "[-o operations] [-d uniform|zipfian|latest] "
+                    "[-s seed]\n",argv[0]);
+            return 1;
+        }
+    }
+    if(operations <= 0){
+        fprintf(stderr,"the number of operations must be positive\n");
+        return 1;
+    }
+
+    for(const char *count = record_counts; *count;){
+        char *end;
+        long long records = strtoll(count,&end,10);
+        if(end == count || records <= 0 || records > INT32_MAX){
+            fprintf(stderr,"invalid number of records: %s\n",count);
+            return 1;
+        }
+        count = *end == ',' ? end + 1 : end;
+        for(const char *name = workload_names; *name; name++){
+            const Workload *workload = NULL;
+            for(size_t i = 0; i < sizeof(workloads) / sizeof(*workloads); i++){
+                if(workloads[i].name == *name){
+                    workload = &workloads[i];
+                }
+            }
+            if(!workload){
+                fprintf(stderr,"unknown workload: %c\n",*name);
+                return 1;
+            }
+            if(runWorkload(workload,distribution >= 0 ?
+                           (Distribution)distribution :
+                           workload->distribution,records,operations,
+                           seed) != MAP_SUCCESS){
+                fprintf(stderr,"out of memory\n");
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
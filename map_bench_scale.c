@@ -0,0 +1,549 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "map_mtm.h"
+
+/**
+* Scaling benchmark of the bulk operations of the map.
+*
+* For every key type (int, string and struct) and number of elements, loads a
+* map and measures the bulk operations on it, printing one JSON object per
+* line with the time per element and the peak resident set size of the
+* process so far (by getrusage), so the growth of both can be plotted against
+* the number of elements:
+*   list backend   - load (mapPutBatch), foreach (MAP_FOREACH), copy
+*                    (mapCopy), clear (mapClear of the copy), destroy
+*                    (mapDestroy of the original)
+*   mapped backend - save (mapSaveMapped), foreach (mappedMapGetFirst and
+*                    mappedMapGetNext over the image), close (mappedMapClose)
+* Every key type and number of elements is measured in a process of its own,
+* so the peak resident set sizes of one do not hide those of another. The
+* label given with -l is printed in every line, to tell apart the output of
+* builds compared side by side (such as one with MAP_NO_STATS defined).
+*
+* Usage: map_bench_scale [-n elements,...] [-k int,string,struct]
+*                        [-b list,mapped] [-d directory] [-l label]
+* Building: gcc -std=c99 -O2 map_bench_scale.c map_mtm.c -pthread -o map_bench_scale
+*/
+
+// constants
+
+/** default numbers of elements, key types and backends. Up to 100M elements
+ *  can be measured given enough memory: about 200 bytes per element, twice
+ *  that while copying */
+#define SCALE_DEFAULT_ELEMENTS "1000,10000,100000,1000000"
+#define SCALE_DEFAULT_KEY_TYPES "int,string,struct"
+#define SCALE_DEFAULT_BACKENDS "list,mapped"
+
+/** directory the images of the mapped backend are written to by default */
+#define SCALE_DEFAULT_DIRECTORY "/tmp"
+
+/** number of elements put into the map at a time while loading it */
+#define SCALE_LOAD_BATCH 65536
+
+/** number of bytes of a string key, including the terminating '\0' */
+#define SCALE_STRING_KEY_SIZE 24
+
+// structs
+
+typedef struct struct_key_t{
+    int32_t group;
+    int64_t id;
+    char name[12];
+}StructKey;
+
+// the functions of the map of one type of keys, and how to make the key of
+// the n-th element, in order
+typedef struct key_type_t{
+    const char *name;
+    size_t size;
+    void (*make)(void *key,long long number);
+    copyMapKeyElements copy;
+    freeMapKeyElements free;
+    compareMapKeyElements compare;
+    serializeMapElement serialize;
+}KeyType;
+
+// the options of the benchmark
+typedef struct options_t{
+    const char *label;
+    const char *directory;
+    bool list;
+    bool mapped;
+}Options;
+
+// additional functions declarations
+
+/**
+* nanosecondsNow: reading a monotonic clock
+* @return
+*    the current time in nanoseconds
+*/
+static long long nanosecondsNow(void);
+
+/**
+* peakResidentSize: reading the peak resident set size of the process
+* @return
+*    the size in kilobytes
+*/
+static long peakResidentSize(void);
+
+/**
+* makeInt, makeString, makeStruct: writing the key of an element
+* @param key - where to write the key
+* @param number - the number of the element; keys are ordered as numbers
+*/
+static void makeInt(void *key,long long number);
+static void makeString(void *key,long long number);
+static void makeStruct(void *key,long long number);
+
+/**
+* copyInt, copyString, copyStruct, freeElement, compareInts, compareStrings,
+* compareStructs, serializeInt, serializeString, serializeStruct: the
+*           functions of the maps of every key type, and of their int data
+*/
+static void *copyInt(void *element);
+static void *copyString(void *element);
+static void *copyStruct(void *element);
+static void freeElement(void *element);
+static int compareInts(void *first,void *second);
+static int compareStrings(void *first,void *second);
+static int compareStructs(void *first,void *second);
+static int serializeInt(void *element,void *buffer,int size);
+static int serializeString(void *element,void *buffer,int size);
+static int serializeStruct(void *element,void *buffer,int size);
+
+/**
+* printResult: printing the JSON line of a measurement
+* @param options - the options, holding the label
+* @param backend - the name of the backend
+* @param key_type - the type of the keys
+* @param elements - the number of elements
+* @param operation - the name of the operation
+* @param nanoseconds - the time the operation took
+*/
+static void printResult(const Options *options,const char *backend,
+                        const KeyType *key_type,long long elements,
+                        const char *operation,long long nanoseconds);
+
+/**
+* loadMap: putting elements into an empty map, in batches of descending keys
+*          so every batch goes in front of the ones before it and loading
+*          takes linear time
+* @param map - the map
+* @param key_type - the type of the keys
+* @param elements - the number of elements
+* @return
+*    MAP_OUT_OF_MEMORY if an allocation failed
+*    MAP_SUCCESS otherwise
+*/
+static MapResult loadMap(Map map,const KeyType *key_type,long long elements);
+
+/**
+* measureMapped: measuring the mapped backend on an image of a map
+* @param options - the options
+* @param map - the map to write the image of
+* @param key_type - the type of the keys
+* @param elements - the number of elements
+* @return
+*    MAP_IO_ERROR if writing or mapping the image failed
+*    MAP_SUCCESS otherwise
+*/
+static MapResult measureMapped(const Options *options,Map map,
+                               const KeyType *key_type,long long elements);
+
+/**
+* measure: measuring every backend with a key type and number of elements
+* @param options - the options
+* @param key_type - the type of the keys
+* @param elements - the number of elements
+* @return
+*    MAP_OUT_OF_MEMORY if an allocation failed
+*    MAP_IO_ERROR if the mapped backend failed
+*    MAP_SUCCESS otherwise
+*/
+static MapResult measure(const Options *options,const KeyType *key_type,
+                         long long elements);
+
+/**
+* hasItem: checking whether a comma-separated list has an item
+* @param list - the list
+* @param item - the item
+* @return
+*    true if the list has the item
+*/
+static bool hasItem(const char *list,const char *item);
+
+static const KeyType key_types[] = {
+    {"int",sizeof(int),makeInt,copyInt,freeElement,compareInts,serializeInt},
+    {"string",SCALE_STRING_KEY_SIZE,makeString,copyString,freeElement,
+     compareStrings,serializeString},
+    {"struct",sizeof(StructKey),makeStruct,copyStruct,freeElement,
+     compareStructs,serializeStruct}
+};
+
+// the data of every element
+static int data_element = 1;
+
+// functions implementations
+
+static long long nanosecondsNow(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC,&now);
+    return (long long)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static long peakResidentSize(void)
+{
+    struct rusage usage;
+    getrusage(RUSAGE_SELF,&usage);
+    return usage.ru_maxrss;
+}
+
+static void makeInt(void *key,long long number)
+{
+    *(int*)key = (int)number;
+}
+
+static void makeString(void *key,long long number)
+{
+    snprintf(key,SCALE_STRING_KEY_SIZE,"key-%019lld",number);
+}
+
+static void makeStruct(void *key,long long number)
+{
+    StructKey *struct_key = key;
+    memset(struct_key,0,sizeof(*struct_key));
+    struct_key->group = (int32_t)(number >> 16);
+    struct_key->id = number;
+    snprintf(struct_key->name,sizeof(struct_key->name),"n%lld",
+             number % 100000000);
+}
+
+static void *copyInt(void *element)
+{
+    int *copy = malloc(sizeof(*copy));
+    if(copy){
+        *copy = *(int*)element;
+    }
+    return copy;
+}
+
+static void *copyString(void *element)
+{
+    char *copy = malloc(strlen(element) + 1);
+    if(copy){
+        strcpy(copy,element);
+    }
+    return copy;
+}
+
+static void *copyStruct(void *element)
+{
+    StructKey *copy = malloc(sizeof(*copy));
+    if(copy){
+        *copy = *(StructKey*)element;
+    }
+    return copy;
+}
+
+static void freeElement(void *element)
+{
+    free(element);
+}
+
+static int compareInts(void *first,void *second)
+{
+    int a = *(int*)first,b = *(int*)second;
+    return (a > b) - (a < b);
+}
+
+static int compareStrings(void *first,void *second)
+{
+    return strcmp(first,second);
+}
+
+static int compareStructs(void *first,void *second)
+{
+    const StructKey *a = first,*b = second;
+    if(a->group != b->group){
+        return a->group > b->group ? 1 : -1;
+    }
+    return (a->id > b->id) - (a->id < b->id);
+}
+
+static int serializeInt(void *element,void *buffer,int size)
+{
+    if(size >= (int)sizeof(int)){
+        memcpy(buffer,element,sizeof(int));
+    }
+    return sizeof(int);
+}
+
+static int serializeString(void *element,void *buffer,int size)
+{
+    // with the '\0', so keys in the image are strings too
+    int length = (int)strlen(element) + 1;
+    if(size >= length){
+        memcpy(buffer,element,length);
+    }
+    return length;
+}
+
+static int serializeStruct(void *element,void *buffer,int size)
+{
+    if(size >= (int)sizeof(StructKey)){
+        memcpy(buffer,element,sizeof(StructKey));
+    }
+    return sizeof(StructKey);
+}
+
+static void printResult(const Options *options,const char *backend,
+                        const KeyType *key_type,long long elements,
+                        const char *operation,long long nanoseconds)
+{
+    printf("{\"label\":\"%s\",\"backend\":\"%s\",\"key\":\"%s\","
+           "\"elements\":%lld,\"operation\":\"%s\",\"seconds\":%.6f,"
+           "\"ns_per_element\":%.2f,\"peak_rss_kb\":%ld}\n",options->label,
+           backend,key_type->name,elements,operation,nanoseconds / 1e9,
+           (double)nanoseconds / elements,peakResidentSize());
+    fflush(stdout);
+}
+
+static MapResult loadMap(Map map,const KeyType *key_type,long long elements)
+{
+    long long batch = elements < SCALE_LOAD_BATCH ? elements :
+                      SCALE_LOAD_BATCH;
+    unsigned char *keys = malloc(batch * key_type->size);
+    MapKeyElement *key_elements = malloc(batch * sizeof(*key_elements));
+    MapDataElement *data_elements = malloc(batch * sizeof(*data_elements));
+    MapResult result = keys && key_elements && data_elements ?
+                       MAP_SUCCESS : MAP_OUT_OF_MEMORY;
+
+    for(long long end = elements; end > 0 && result == MAP_SUCCESS;
+        end -= batch){
+        long long start = end > batch ? end - batch : 0;
+        for(long long i = start; i < end; i++){
+            void *key = keys + (i - start) * key_type->size;
+            key_type->make(key,i);
+            key_elements[i - start] = key;
+            data_elements[i - start] = &data_element;
+        }
+        result = mapPutBatch(map,key_elements,data_elements,
+                             (int)(end - start));
+    }
+    free(keys);
+    free(key_elements);
+    free(data_elements);
+
+    return result;
+}
+
+static MapResult measureMapped(const Options *options,Map map,
+                               const KeyType *key_type,long long elements)
+{
+    size_t path_size = strlen(options->directory) +
+                       sizeof("/map_bench_scale_XXXXXX");
+    char *path = malloc(path_size);
+    if(!path){
+        return MAP_OUT_OF_MEMORY;
+    }
+    snprintf(path,path_size,"%s/map_bench_scale_XXXXXX",options->directory);
+    int fd = mkstemp(path);
+    if(fd < 0){
+        free(path);
+        return MAP_IO_ERROR;
+    }
+    close(fd);
+
+    long long start = nanosecondsNow();
+    MapResult result = mapSaveMapped(map,path,key_type->serialize,
+                                     serializeInt);
+    MappedMap mapped = NULL;
+    if(result == MAP_SUCCESS){
+        printResult(options,"mapped",key_type,elements,"save",
+                    nanosecondsNow() - start);
+        mapped = mapOpenMapped(path,key_type->compare);
+        result = mapped ? MAP_SUCCESS : MAP_IO_ERROR;
+    }
+    if(result == MAP_SUCCESS){
+        long long count = 0;
+        start = nanosecondsNow();
+        for(MapKeyElement key = mappedMapGetFirst(mapped); key;
+            key = mappedMapGetNext(mapped)){
+            count++;
+        }
+        printResult(options,"mapped",key_type,elements,"foreach",
+                    nanosecondsNow() - start);
+        if(count != elements){
+            result = MAP_IO_ERROR;
+        }
+        start = nanosecondsNow();
+        mappedMapClose(mapped);
+        printResult(options,"mapped",key_type,elements,"close",
+                    nanosecondsNow() - start);
+    }
+    unlink(path);
+    free(path);
+
+    return result;
+}
+
+static MapResult measure(const Options *options,const KeyType *key_type,
+                         long long elements)
+{
+    Map map = mapCreate(copyInt,key_type->copy,freeElement,key_type->free,
+                        key_type->compare);
+    if(!map){
+        return MAP_OUT_OF_MEMORY;
+    }
+    long long start = nanosecondsNow();
+    MapResult result = loadMap(map,key_type,elements);
+    if(result != MAP_SUCCESS){
+        mapDestroy(map);
+        return result;
+    }
+    long long loaded = nanosecondsNow() - start;
+
+    if(options->list){
+        printResult(options,"list",key_type,elements,"load",loaded);
+
+        long long count = 0;
+        start = nanosecondsNow();
+        MAP_FOREACH(MapKeyElement,key,map){
+            count += key != NULL;
+        }
+        printResult(options,"list",key_type,elements,"foreach",
+                    nanosecondsNow() - start);
+
+        start = nanosecondsNow();
+        Map copy = mapCopy(map);
+        if(!copy || count != elements){
+            mapDestroy(copy);
+            mapDestroy(map);
+            return MAP_OUT_OF_MEMORY;
+        }
+        printResult(options,"list",key_type,elements,"copy",
+                    nanosecondsNow() - start);
+
+        start = nanosecondsNow();
+        mapClear(copy);
+        printResult(options,"list",key_type,elements,"clear",
+                    nanosecondsNow() - start);
+        mapDestroy(copy);
+    }
+
+    if(options->mapped){
+        result = measureMapped(options,map,key_type,elements);
+    }
+
+    start = nanosecondsNow();
+    mapDestroy(map);
+    if(options->list){
+        printResult(options,"list",key_type,elements,"destroy",
+                    nanosecondsNow() - start);
+    }
+
+    return result;
+}
+
+static bool hasItem(const char *list,const char *item)
+{
+    size_t length = strlen(item);
+    while(*list){
+        if(strncmp(list,item,length) == 0 &&
+           (list[length] == ',' || list[length] == '\0')){
+            return true;
+        }
+        list += strcspn(list,",");
+        list += *list == ',';
+    }
+    return false;
+}
+
+int main(int argc,char *argv[])
+{
+    const char *element_counts = SCALE_DEFAULT_ELEMENTS;
+    const char *key_type_names = SCALE_DEFAULT_KEY_TYPES;
+    const char *backends = SCALE_DEFAULT_BACKENDS;
+    Options options = {"",SCALE_DEFAULT_DIRECTORY,false,false};
+
+    int option;
+    while((option = getopt(argc,argv,"n:k:b:d:l:")) != -1){
+        switch(option){
+        case 'n':
+            element_counts = optarg;
+            break;
+        case 'k':
+            key_type_names = optarg;
+            break;
+        case 'b':
+            backends = optarg;
+            break;
+        case 'd':
+            options.directory = optarg;
+            break;
+        case 'l':
+            options.label = optarg;
+            break;
+        default:
+            fprintf(stderr,"usage: %s [-n elements,...] "
+                    "[-k int,string,struct] [-b list,mapped] "
+                    "[-d directory] [-l label]\n",argv[0]);
+            return 1;
+        }
+    }
+    options.list = hasItem(backends,"list");
+    options.mapped = hasItem(backends,"mapped");
+    if(!options.list && !options.mapped){
+        fprintf(stderr,"unknown backends: %s\n",backends);
+        return 1;
+    }
+
+    for(const char *count = element_counts; *count;){
+        char *end;
+        long long elements = strtoll(count,&end,10);
+        if(end == count || elements <= 0 || elements > INT32_MAX){
+            fprintf(stderr,"invalid number of elements: %s\n",count);
+            return 1;
+        }
+        count = *end == ',' ? end + 1 : end;
+        for(size_t i = 0; i < sizeof(key_types) / sizeof(*key_types); i++){
+            if(!hasItem(key_type_names,key_types[i].name)){
+                continue;
+            }
+            // a process of its own, for its own peak resident set size
+            pid_t pid = fork();
+            if(pid < 0){
+                perror("fork");
+                return 1;
+            }
+            if(pid == 0){
+                MapResult result = measure(&options,&key_types[i],elements);
+                if(result != MAP_SUCCESS){
+                    fprintf(stderr,"%s with %lld %s keys\n",
+                            result == MAP_OUT_OF_MEMORY ? "out of memory" :
+                            "mapped backend failed",elements,
+                            key_types[i].name);
+                }
+                _exit(result == MAP_SUCCESS ? 0 : 1);
+            }
+            int status;
+            if(waitpid(pid,&status,0) < 0 || !WIFEXITED(status) ||
+               WEXITSTATUS(status) != 0){
+                return 1;
+            }
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,528 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "map_loader.h"
+
+// constants
+
+/** number of bytes the reader reads at a time */
+#define LOADER_CHUNK_SIZE (4 * 1024 * 1024)
+
+/** number of chunks that may be read but not yet inserted, per worker */
+#define LOADER_CHUNKS_PER_WORKER 2
+
+/** initial number of elements a batch has room for */
+#define LOADER_BATCH_INITIAL_CAPACITY 1024
+
+// structs
+
+// a chunk of whole lines of the file, and the batch of elements parsed from it
+typedef struct loader_chunk_t{
+    // position of the chunk in the file, counting chunks
+    long sequence;
+    char *text;
+    size_t length;
+    MapKeyElement *keys;
+    MapDataElement *datas;
+    int count;
+    int capacity;
+    long long skipped_lines;
+    struct loader_chunk_t *next;
+}*LoaderChunk;
+
+// the state shared by the threads of a load, guarded by lock
+typedef struct loader_t{
+    pthread_mutex_t lock;
+    // signaled whenever the state changes
+    pthread_cond_t changed;
+    FILE *stream;
+    parseMapLine parse;
+    void *context;
+    freeMapKeyElements free_key;
+    freeMapDataElements free_data;
+    // chunks waiting to be parsed, in file order
+    LoaderChunk to_parse;
+    LoaderChunk to_parse_tail;
+    // parsed chunks waiting to be inserted, in any order
+    LoaderChunk parsed;
+    // chunks read and not yet inserted, bounded by max_in_flight
+    int in_flight;
+    int max_in_flight;
+    long chunks_read;
+    bool reading_done;
+    // set when the load fails, to stop all the threads
+    bool stop;
+    MapResult result;
+    MapLoaderStats stats;
+}*Loader;
+
+// additional functions declarations
+
+/**
+* secondsNow: reading a monotonic clock
+* @return
+*    the current time in seconds
+*/
+static double secondsNow(void);
+
+/**
+* failLoad: recording that the load failed and waking all the threads so
+*           they stop. The lock must be held
+* @param loader - the state of the load
+* @param result - the error to report
+*/
+static void failLoad(Loader loader,MapResult result);
+
+/**
+* readChunk: reading the next chunk of whole lines from the file. The part of
+*            the last line read which is not complete is kept in carry and
+*            put at the start of the next chunk
+* @param stream - the file to read from
+* @param carry - the incomplete line left by the previous chunk, updated
+* @param carry_length - the length of the incomplete line, updated
+* @param chunk - a variable to store the chunk, NULL at the end of the file
+* @return
+*    MAP_OUT_OF_MEMORY if an allocation failed
+*    MAP_IO_ERROR if reading failed
+*    MAP_SUCCESS otherwise
+*/
+static MapResult readChunk(FILE *stream,char **carry,size_t *carry_length,
+                           LoaderChunk *chunk);
+
+/**
+* parseChunk: parsing every line of a chunk into its batch of elements
+* @param loader - the state of the load, holding the parse function
+* @param chunk - the chunk to parse
+* @return
+*    MAP_OUT_OF_MEMORY if growing the batch failed
+*    MAP_SUCCESS otherwise
+*/
+static MapResult parseChunk(Loader loader,LoaderChunk chunk);
+
+/**
+* destroyChunk: deallocating a chunk and the elements parsed from it
+* @param loader - the state of the load, holding the free functions
+* @param chunk - the chunk to destroy
+*/
+static void destroyChunk(Loader loader,LoaderChunk chunk);
+
+/**
+* readerThread: the thread reading the file into chunks for the workers
+* @param argument - the state of the load
+* @return
+*    NULL
+*/
+static void *readerThread(void *argument);
+
+/**
+* workerThread: a thread parsing chunks into batches of elements
+* @param argument - the state of the load
+* @return
+*    NULL
+*/
+static void *workerThread(void *argument);
+
+/**
+* takeParsedChunk: waiting for the chunk following the last inserted one to
+*                  be parsed and taking it
+* @param loader - the state of the load
+* @param sequence - the position of the chunk to take
+* @return
+*    the chunk
+*    NULL if every chunk was inserted or the load failed
+*/
+static LoaderChunk takeParsedChunk(Loader loader,long sequence);
+
+/**
+* insertChunks: inserting the batches of the parsed chunks into map in file
+*               order, until the end of the file or a failure
+* @param loader - the state of the load
+* @param map - the map to insert into
+*/
+static void insertChunks(Loader loader,Map map);
+
+// functions implementations
+
+static double secondsNow(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC,&now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+static void failLoad(Loader loader,MapResult result)
+{
+    if(!(loader->stop)){
+        loader->result = result;
+        loader->stop = true;
+    }
+    pthread_cond_broadcast(&loader->changed);
+}
+
+static MapResult readChunk(FILE *stream,char **carry,size_t *carry_length,
+                           LoaderChunk *chunk)
+{
+    *chunk = NULL;
+    char *text = malloc(*carry_length + LOADER_CHUNK_SIZE + 1);
+    if(!text){
+        return MAP_OUT_OF_MEMORY;
+    }
+    if(*carry_length > 0){
+        memcpy(text,*carry,*carry_length);
+    }
+    size_t read = fread(text + *carry_length,1,LOADER_CHUNK_SIZE,stream);
+    if(read < LOADER_CHUNK_SIZE && ferror(stream)){
+        free(text);
+        return MAP_IO_ERROR;
+    }
+    size_t length = *carry_length + read;
+    if(length == 0){
+        free(text);
+        return MAP_SUCCESS;
+    }
+
+    // at the end of the file the last line is complete even without a break
+    size_t end = length;
+    if(read == LOADER_CHUNK_SIZE){
+        while(end > 0 && text[end - 1] != '\n'){
+            end--;
+        }
+        if(end == 0){
+            // a single line longer than a chunk: keep reading it
+            free(*carry);
+            *carry = text;
+            *carry_length = length;
+            return readChunk(stream,carry,carry_length,chunk);
+        }
+    }
+    size_t rest = length - end;
+    char *new_carry = malloc(rest + 1);
+    LoaderChunk new_chunk = malloc(sizeof(*new_chunk));
+    if(!new_carry || !new_chunk){
+        free(new_carry);
+        free(new_chunk);
+        free(text);
+        return MAP_OUT_OF_MEMORY;
+    }
+    memcpy(new_carry,text + end,rest);
+    free(*carry);
+    *carry = new_carry;
+    *carry_length = rest;
+
+    text[end] = '\0';
+    new_chunk->text = text;
+    new_chunk->length = end;
+    new_chunk->keys = NULL;
+    new_chunk->datas = NULL;
+    new_chunk->count = 0;
+    new_chunk->capacity = 0;
+    new_chunk->skipped_lines = 0;
+    new_chunk->next = NULL;
+    *chunk = new_chunk;
+
+    return MAP_SUCCESS;
+}
+
+static MapResult parseChunk(Loader loader,LoaderChunk chunk)
+{
+    char *line = chunk->text;
+    char *text_end = chunk->text + chunk->length;
+
+    while(line < text_end){
+        char *line_end = memchr(line,'\n',text_end - line);
+        if(!line_end){
+            line_end = text_end;
+        }
+        char *next_line = line_end + 1;
+        if(line_end > line && line_end[-1] == '\r'){
+            line_end--;
+        }
+        *line_end = '\0';
+        int length = (int)(line_end - line);
+        if(length == 0){
+            line = next_line;
+            continue;
+        }
+
+        if(chunk->count == chunk->capacity){
+            int new_capacity = chunk->capacity ? 2 * chunk->capacity :
+                                                 LOADER_BATCH_INITIAL_CAPACITY;
+            MapKeyElement *new_keys = realloc(chunk->keys,
+                                              new_capacity * sizeof(*new_keys));
+            if(new_keys){
+                chunk->keys = new_keys;
+            }
+            MapDataElement *new_datas = realloc(chunk->datas,
+                                            new_capacity * sizeof(*new_datas));
+            if(new_datas){
+                chunk->datas = new_datas;
+            }
+            if(!new_keys || !new_datas){
+                return MAP_OUT_OF_MEMORY;
+            }
+            chunk->capacity = new_capacity;
+        }
+        MapKeyElement key = NULL;
+        MapDataElement data = NULL;
+        if(loader->parse(line,length,&key,&data,loader->context) && key &&
+           data){
+            chunk->keys[chunk->count] = key;
+            chunk->datas[chunk->count] = data;
+            chunk->count += 1;
+        }else{
+            if(key){
+                loader->free_key(key);
+            }
+            if(data){
+                loader->free_data(data);
+            }
+            chunk->skipped_lines += 1;
+        }
+        line = next_line;
+    }
+
+    return MAP_SUCCESS;
+}
+
+static void destroyChunk(Loader loader,LoaderChunk chunk)
+{
+    for(int i = 0; i < chunk->count; i++){
+        loader->free_key(chunk->keys[i]);
+        loader->free_data(chunk->datas[i]);
+    }
+    free(chunk->keys);
+    free(chunk->datas);
+    free(chunk->text);
+    free(chunk);
+}
+
+static void *readerThread(void *argument)
+{
+    Loader loader = argument;
+    char *carry = NULL;
+    size_t carry_length = 0;
+
+    pthread_mutex_lock(&loader->lock);
+    while(!(loader->stop)){
+        while(loader->in_flight >= loader->max_in_flight && !(loader->stop)){
+            pthread_cond_wait(&loader->changed,&loader->lock);
+        }
+        if(loader->stop){
+            break;
+        }
+        pthread_mutex_unlock(&loader->lock);
+
+        double start = secondsNow();
+        LoaderChunk chunk = NULL;
+        MapResult result = readChunk(loader->stream,&carry,&carry_length,
+                                     &chunk);
+        double elapsed = secondsNow() - start;
+
+        pthread_mutex_lock(&loader->lock);
+        loader->stats.read_seconds += elapsed;
+        if(result != MAP_SUCCESS){
+            failLoad(loader,result);
+            break;
+        }
+        if(!chunk){
+            break;
+        }
+        loader->stats.bytes += chunk->length;
+        chunk->sequence = loader->chunks_read++;
+        if(loader->to_parse_tail){
+            loader->to_parse_tail->next = chunk;
+        }else{
+            loader->to_parse = chunk;
+        }
+        loader->to_parse_tail = chunk;
+        loader->in_flight += 1;
+        pthread_cond_broadcast(&loader->changed);
+    }
+    loader->reading_done = true;
+    pthread_cond_broadcast(&loader->changed);
+    pthread_mutex_unlock(&loader->lock);
+
+    free(carry);
+    return NULL;
+}
+
+static void *workerThread(void *argument)
+{
+    Loader loader = argument;
+
+    pthread_mutex_lock(&loader->lock);
+    while(true){
+        while(!(loader->to_parse) && !(loader->reading_done) &&
+              !(loader->stop)){
+            pthread_cond_wait(&loader->changed,&loader->lock);
+        }
+        if(!(loader->to_parse) || loader->stop){
+            break;
+        }
+        LoaderChunk chunk = loader->to_parse;
+        loader->to_parse = chunk->next;
+        if(!(loader->to_parse)){
+            loader->to_parse_tail = NULL;
+        }
+        pthread_mutex_unlock(&loader->lock);
+
+        double start = secondsNow();
+        MapResult result = parseChunk(loader,chunk);
+        double elapsed = secondsNow() - start;
+
+        pthread_mutex_lock(&loader->lock);
+        loader->stats.parse_seconds += elapsed;
+        chunk->next = loader->parsed;
+        loader->parsed = chunk;
+        if(result != MAP_SUCCESS){
+            failLoad(loader,result);
+        }
+        pthread_cond_broadcast(&loader->changed);
+    }
+    pthread_mutex_unlock(&loader->lock);
+
+    return NULL;
+}
+
+static LoaderChunk takeParsedChunk(Loader loader,long sequence)
+{
+    LoaderChunk chunk = NULL;
+
+    pthread_mutex_lock(&loader->lock);
+    while(!(loader->stop)){
+        LoaderChunk *link = &loader->parsed;
+        while(*link && (*link)->sequence != sequence){
+            link = &(*link)->next;
+        }
+        if(*link){
+            chunk = *link;
+            *link = chunk->next;
+            break;
+        }
+        if(loader->reading_done && sequence == loader->chunks_read){
+            break;
+        }
+        pthread_cond_wait(&loader->changed,&loader->lock);
+    }
+    pthread_mutex_unlock(&loader->lock);
+
+    return chunk;
+}
+
+static void insertChunks(Loader loader,Map map)
+{
+    for(long sequence = 0; ; sequence++){
+        LoaderChunk chunk = takeParsedChunk(loader,sequence);
+        if(!chunk){
+            return;
+        }
+
+        double start = secondsNow();
+        MapResult result = mapPutBatch(map,chunk->keys,chunk->datas,
+                                       chunk->count);
+        double elapsed = secondsNow() - start;
+
+        pthread_mutex_lock(&loader->lock);
+        loader->stats.insert_seconds += elapsed;
+        loader->stats.lines += chunk->count;
+        loader->stats.skipped_lines += chunk->skipped_lines;
+        loader->stats.batches += 1;
+        loader->in_flight -= 1;
+        if(result != MAP_SUCCESS){
+            failLoad(loader,result);
+        }
+        pthread_cond_broadcast(&loader->changed);
+        pthread_mutex_unlock(&loader->lock);
+
+        destroyChunk(loader,chunk);
+    }
+}
+
+MapResult mapLoadLines(Map map,const char* path,parseMapLine parse,
+                       void* context,freeMapKeyElements freeKeyElement,
+                       freeMapDataElements freeDataElement,int workers,
+                       MapLoaderStats* stats)
+{
+    if(!map || !path || !parse || !freeKeyElement || !freeDataElement){
+        return MAP_NULL_ARGUMENT;
+    }
+    if(workers <= 0){
+        long processors = sysconf(_SC_NPROCESSORS_ONLN);
+        workers = processors > 0 ? (int)processors : 1;
+    }
+
+    struct loader_t loader;
+    memset(&loader,0,sizeof(loader));
+    loader.stream = fopen(path,"rb");
+    if(!(loader.stream)){
+        return MAP_IO_ERROR;
+    }
+    pthread_t *threads = malloc((workers + 1) * sizeof(*threads));
+    if(!threads){
+        fclose(loader.stream);
+        return MAP_OUT_OF_MEMORY;
+    }
+    pthread_mutex_init(&loader.lock,NULL);
+    pthread_cond_init(&loader.changed,NULL);
+    loader.parse = parse;
+    loader.context = context;
+    loader.free_key = freeKeyElement;
+    loader.free_data = freeDataElement;
+    loader.max_in_flight = LOADER_CHUNKS_PER_WORKER * workers;
+    loader.result = MAP_SUCCESS;
+    double start = secondsNow();
+
+    int started = 0;
+    if(pthread_create(&threads[started],NULL,readerThread,&loader) == 0){
+        started++;
+        while(started <= workers &&
+              pthread_create(&threads[started],NULL,workerThread,
+                             &loader) == 0){
+            started++;
+        }
+    }
+    if(started < 2){
+        pthread_mutex_lock(&loader.lock);
+        failLoad(&loader,MAP_IO_ERROR);
+        pthread_mutex_unlock(&loader.lock);
+    }else{
+        insertChunks(&loader,map);
+    }
+
+    // stop the other threads if inserting ended early, and wait for them
+    pthread_mutex_lock(&loader.lock);
+    if(loader.result == MAP_SUCCESS && !(loader.reading_done)){
+        failLoad(&loader,MAP_SUCCESS);
+    }
+    pthread_mutex_unlock(&loader.lock);
+    for(int i = 0; i < started; i++){
+        pthread_join(threads[i],NULL);
+    }
+    while(loader.to_parse){
+        LoaderChunk chunk = loader.to_parse;
+        loader.to_parse = chunk->next;
+        destroyChunk(&loader,chunk);
+    }
+    while(loader.parsed){
+        LoaderChunk chunk = loader.parsed;
+        loader.parsed = chunk->next;
+        destroyChunk(&loader,chunk);
+    }
+
+    loader.stats.total_seconds = secondsNow() - start;
+    if(stats){
+        *stats = loader.stats;
+    }
+    pthread_cond_destroy(&loader.changed);
+    pthread_mutex_destroy(&loader.lock);
+    free(threads);
+    fclose(loader.stream);
+
+    return loader.result;
+}
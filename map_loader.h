@@ -0,0 +1,79 @@
+#ifndef MAP_LOADER_H_
+#define MAP_LOADER_H_
+
+#include <stdbool.h>
+#include "map_mtm.h"
+
+/**
+* Map Loader
+*
+* Bulk-loads a map from a text file with one element per line, such as a CSV
+* file. Reading, parsing and inserting are pipelined: a reader thread reads
+* the file in large chunks, worker threads parse chunks into batches of
+* elements, and the calling thread inserts the batches with mapPutBatch in
+* file order - so the three overlap instead of running one after the other.
+* Uses POSIX threads (compile with -pthread).
+*
+* The following functions are available:
+*   mapLoadLines	- Loads the elements parsed from the lines of a file into a
+*   				  map, and reports throughput statistics.
+*/
+
+/**
+* Type of function for parsing a line of a file into a key and a data element.
+* Receives the line (without its line break, terminated by '\0' and which may
+* be changed), its length, where to store the elements and the context
+* pointer given to mapLoadLines. Called from several threads at once.
+* This function should return:
+* 		true, having stored newly allocated key and data elements, which are
+* 		deallocated (using the free functions given to mapLoadLines) once
+* 		copies of them are in the map;
+* 		false if the line should be skipped (such as a header or malformed line).
+*/
+typedef bool(*parseMapLine)(char*, int, MapKeyElement*, MapDataElement*,
+                            void*);
+
+/** Throughput statistics of a mapLoadLines call */
+typedef struct MapLoaderStats_t {
+	/** number of bytes read from the file */
+	long long bytes;
+	/** number of lines parsed into elements */
+	long long lines;
+	/** number of non-empty lines the parse function skipped */
+	long long skipped_lines;
+	/** number of batches inserted into the map */
+	long long batches;
+	/** seconds spent reading, parsing (summed over the workers) and inserting */
+	double read_seconds;
+	double parse_seconds;
+	double insert_seconds;
+	/** seconds from start to end of the load */
+	double total_seconds;
+} MapLoaderStats;
+
+/**
+* mapLoadLines: Loads the elements parsed from every line of a file into a
+* map. Lines later in the file override the data of equal keys earlier in it.
+* If loading fails part of the file may already be in the map.
+* Iterator's value is undefined after this operation.
+*
+* @param map - The map to load the elements into
+* @param path - The path of the file
+* @param parse - Function for parsing a line into a key and a data element
+* @param context - Passed as is to parse. May be NULL.
+* @param freeKeyElement - Function for deallocating the parsed key elements
+* @param freeDataElement - Function for deallocating the parsed data elements
+* @param workers - Number of parsing threads. 0 to use one per processor.
+* @param stats - Where to store the throughput statistics. May be NULL.
+* @return
+* 	MAP_NULL_ARGUMENT if a NULL was sent as one of the required arguments
+* 	MAP_OUT_OF_MEMORY if an allocation failed
+* 	MAP_IO_ERROR if the file cannot be read or the threads cannot be started
+* 	MAP_SUCCESS the file had been loaded successfully
+*/
+MapResult mapLoadLines(Map map, const char* path, parseMapLine parse,
+                       void* context, freeMapKeyElements freeKeyElement,
+                       freeMapDataElements freeDataElement, int workers,
+                       MapLoaderStats* stats);
+
+#endif /* MAP_LOADER_H_ */
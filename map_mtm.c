@@ -1,16 +1,456 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <pthread.h>
 #include "map_mtm.h"
 
+// constants
+
+/** maximal number of free nodes a thread keeps in its magazine for reuse */
+#define MAP_NODE_MAGAZINE_SIZE 64
+
+/** number of nodes a thread takes from and puts in its magazine between two
+ *  rebalancings of the magazine against the shared node pool */
+#define MAP_NODE_REBALANCE_INTERVAL 1024
+
+/** maximal number of free nodes kept in the pool shared by all maps */
+#define MAP_NODE_POOL_SIZE 4096
+
+/** initial number of operations a transaction has room for */
+#define MAP_TXN_INITIAL_CAPACITY 8
+
+/** initial number of entries the undo log has room for */
+#define MAP_UNDO_INITIAL_CAPACITY 16
+
+/** identifies a stream written by mapSave */
+#define MAP_SAVE_MAGIC "MTMM"
+#define MAP_SAVE_MAGIC_LENGTH 4
+
+/** version of the format written by mapSave */
+#define MAP_SAVE_VERSION 1
+
+/** version of the block-compressed format written by mapSaveCompressed */
+#define MAP_SAVE_COMPRESSED_VERSION 2
+
+/** size of the header written by mapSave: magic, version and count */
+#define MAP_SAVE_HEADER_SIZE (MAP_SAVE_MAGIC_LENGTH + 12)
+
+/** maximal number of elements in a block of the compressed format */
+#define MAP_BLOCK_SIZE 256
+
+/** size of the header of a block: count, key encoding, key width, whether the
+ * data is compressed, and the lengths of the keys and (raw and stored) data */
+#define MAP_BLOCK_HEADER_SIZE 20
+
+/** shortest match the LZ codec encodes, and the farthest back it looks */
+#define MAP_LZ_MIN_MATCH 4
+#define MAP_LZ_MAX_OFFSET 65535
+
+/** number of entries in the hash table of the LZ codec, a power of 2 */
+#define MAP_LZ_HASH_SIZE 4096
+
+/** initial size of the buffer elements are serialized into */
+#define MAP_SERIALIZE_INITIAL_CAPACITY 256
+
+/** identifies an image written by mapSaveMapped */
+#define MAP_IMAGE_MAGIC "MTMI"
+
+/** version of the image format written by mapSaveMapped */
+#define MAP_IMAGE_VERSION 1
+
+/** size of the header of an image: magic, version, count and index offset */
+#define MAP_IMAGE_HEADER_SIZE 24
+
+/** size of the header of a record in an image: key and data lengths */
+#define MAP_IMAGE_RECORD_HEADER_SIZE 8
+
+/** alignment of the records, and the elements in them, in an image */
+#define MAP_IMAGE_ALIGNMENT 8
+
+/** number of bytes of records read ahead of a scan of a lazily opened image */
+#define MAP_IMAGE_READAHEAD (256 * 1024)
+
+/** size of the header of a change record: body length and checksum */
+#define MAP_RECORD_HEADER_SIZE 8
+
+/** number of change records a durable map writes to its log together */
+#define MAP_WAL_GROUP_SIZE 64
+
+/** number of milliseconds after which the first change made writes a group
+ *  of change records to the log, however few records it holds */
+#define MAP_WAL_GROUP_DELAY 10
+
+/** number of change records after which a durable map writes a snapshot */
+#define MAP_WAL_SNAPSHOT_INTERVAL 65536
+
+/** suffixes of the files of a durable map, appended to its path. The end of
+ *  the temporary suffix is replaced by a unique name, see mkstemp */
+#define MAP_WAL_LOG_SUFFIX ".wal"
+#define MAP_WAL_TEMPORARY_SUFFIX ".tmp.XXXXXX"
+
+/** suffix of the file incremental checkpoints append their deltas to */
+#define MAP_DELTA_SUFFIX ".delta"
+
+/** identifies a delta file, followed by the checksum of the snapshot its
+ *  deltas were written after */
+#define MAP_DELTA_MAGIC "MTMD"
+#define MAP_DELTA_HEADER_SIZE (MAP_SAVE_MAGIC_LENGTH + 4)
+
+/** flags of a node: its data was spilled to disk and replaced by a stub, and
+ *  its data was used since the clock hand of the spill mode last passed it */
+#define NODE_SPILLED 1u
+#define NODE_REFERENCED 2u
+
+/** least number of unused bytes in a spill file before it is compacted */
+#define MAP_SPILL_COMPACT_MIN (1 << 20)
+
+/** number of nodes whose data, returned by the last calls to mapGet, is kept
+ *  in memory in spill mode */
+#define MAP_SPILL_PINNED_COUNT 16
+
+/** suffix replaced by a unique name to create spill files, see mkstemp */
+#define MAP_SPILL_TEMPLATE_SUFFIX ".XXXXXX"
+
+/** number of bytes of the latest change records a primary keeps for
+ *  followers catching up */
+#define MAP_REPLICATION_BACKLOG_SIZE (1 << 20)
+
+/** number of bytes a full resynchronization or a follower handles at once */
+#define MAP_REPLICATION_CHUNK_SIZE (64 * 1024)
+
+/** number of levels of the timer wheel of expiring keys, and the number of
+ *  slots in each level (as a power of 2). A slot of level 0 spans a
+ *  millisecond, and a slot of every level spans a whole level below it */
+#define MAP_WHEEL_LEVELS 4
+#define MAP_WHEEL_BITS 6
+#define MAP_WHEEL_SLOTS (1 << MAP_WHEEL_BITS)
+
+/** number of rows of the frequency sketch of a TinyLFU cache, the least
+ *  number of counters in a row, and the value counters saturate at */
+#define MAP_SKETCH_DEPTH 4
+#define MAP_SKETCH_MIN_WIDTH 64
+#define MAP_SKETCH_MAX_WIDTH (1 << 20)
+#define MAP_SKETCH_MAX_COUNT 15
+
+/** number of accesses a TinyLFU cache counts, per counter in a row of its
+ *  sketch, before halving all the counters to age them */
+#define MAP_SKETCH_SAMPLE_FACTOR 10
+
+/** number of bits of a latency below its highest set bit which choose its
+ *  bucket in a latency histogram, and the highest latency histograms tell
+ *  apart (see MAP_LATENCY_BUCKETS) */
+#define MAP_LATENCY_SUB_BITS 3
+#define MAP_LATENCY_MAX ((1LL << 40) - 1)
+
+/** counts an event in the statistics of a map (see mapGetStats). Counts
+ *  nothing when the library is built with MAP_NO_STATS defined */
+#ifndef MAP_NO_STATS
+#define COUNT_STAT(map,counter) ((map)->stats.counter += 1)
+#else
+#define COUNT_STAT(map,counter) ((void)(map))
+#endif
+
 // structs
 
 typedef struct node_t{
     MapDataElement data;
     MapKeyElement key;
     struct node_t *next;
+    // what the cache, spill and expiry modes keep of the node, NULL until one
+    // of them is first enabled on its map (see createNodeStates), so the nodes
+    // of a map in none of them stay three pointers long
+    struct node_state_t *state;
 }*Node;
 
+typedef struct node_state_t{
+    // the node before it in the list (the dummy first node for the first
+    // one), so evicted and expired nodes are unlinked without a search
+    struct node_t *prev;
+    // NODE_ flags, used by the spill mode
+    unsigned int flags;
+    // size of the data as counted against the memory budget of the spill mode
+    // while it is in memory (kept while it is spilled)
+    int data_size;
+    // the neighbours of the node in its recency list of the cache mode, the
+    // CacheList it is in, and the size of its key and data as counted against
+    // the byte budget of the cache mode
+    struct node_t *newer;
+    struct node_t *older;
+    int cache_list;
+    int cache_size;
+    // whether the node was marked by mapMarkDirty (and not cleared since), so
+    // the write-back hook gets it when it is evicted
+    bool dirty;
+    // the time (in milliseconds) the key expires at, 0 if it never does
+    long long expires_at;
+    // the neighbours of the node in its slot of the timer wheel, and the
+    // index of the slot (level * MAP_WHEEL_SLOTS + slot), -1 if it has none
+    struct node_t *timer_prev;
+    struct node_t *timer_next;
+    int timer_slot;
+}*NodeState;
+
+typedef enum ChangeType_t{
+    CHANGE_PUT = 1,
+    CHANGE_REMOVE,
+    CHANGE_CLEAR
+}ChangeType;
+
+// a growable array of bytes
+typedef struct byte_buffer_t{
+    unsigned char *bytes;
+    size_t size;
+    size_t capacity;
+}ByteBuffer;
+
+// serializes changes of a map into change records. A record is its body
+// length and a checksum of the body, followed by the body: the change type,
+// its sequence number, and the key and data (where relevant) each prefixed
+// by its length
+typedef struct record_encoder_t{
+    serializeMapElement serialize_key;
+    serializeMapElement serialize_data;
+    unsigned char *key_buffer;
+    int key_capacity;
+    unsigned char *data_buffer;
+    int data_capacity;
+}RecordEncoder;
+
+// a change record decoded from a body. The key and data point into the body
+typedef struct change_record_t{
+    ChangeType type;
+    uint64_t sequence;
+    const unsigned char *key;
+    uint32_t key_length;
+    const unsigned char *data;
+    uint32_t data_length;
+}ChangeRecord;
+
+// the write-ahead log of a durable map
+typedef struct journal_t{
+    // the snapshot is kept at path, the log next to it
+    char *snapshot_path;
+    char *log_path;
+    int log_fd;
+    MapSyncPolicy sync_policy;
+    RecordEncoder encoder;
+    // records of changes not written to the log yet, and the time the first
+    // of them was added at
+    ByteBuffer pending;
+    int pending_count;
+    long long pending_since;
+    // number of records written since the last snapshot
+    int records_since_snapshot;
+    uint64_t sequence;
+    // set when a change could not be logged, until a snapshot is written
+    bool failed;
+}*Journal;
+
+// the entries of a map changed since its last incremental checkpoint
+typedef struct change_tracker_t{
+    // the full snapshot is kept at path, the deltas written after it are
+    // appended to the delta file next to it, after a header holding the
+    // checksum of the snapshot
+    char *snapshot_path;
+    char *delta_path;
+    RecordEncoder encoder;
+    // the keys put or removed since the last checkpoint, each mapped to
+    // dirty_mark
+    Map dirty;
+    // whether the map was cleared since the last checkpoint
+    bool cleared;
+    // number of records in the delta file
+    int delta_records;
+    uint64_t sequence;
+    // set when a change could not be tracked (and for a new tracker), until
+    // a full snapshot is written
+    bool failed;
+}*ChangeTracker;
+
+// the stub replacing the data of a node whose data was spilled to disk: where
+// the serialized data is in the spill file
+typedef struct spill_slot_t{
+    off_t offset;
+    int length;
+}*SpillSlot;
+
+// the spill mode of a map. The data of nodes are spilled to the spill file in
+// the order of a clock: a hand goes round the list, spilling the data of
+// nodes not used since it last passed them, until the data left in memory fit
+// in the budget
+typedef struct spill_t{
+    // the spill file, created with a unique name starting with path and
+    // unlinked right away
+    char *path;
+    int fd;
+    // size of the spill file, new slots being appended at its end, and the
+    // size of the slots still in use
+    off_t file_size;
+    off_t used_size;
+    long long budget;
+    // sum of the data sizes of the nodes in the list whose data is in memory
+    long long resident_size;
+    serializeMapElement serialize_data;
+    deserializeMapElement deserialize_data;
+    // the function measuring the data, NULL to measure the serialized data
+    measureMapElement measure_data;
+    unsigned char *buffer;
+    int capacity;
+    // the next node the clock hand looks at, NULL to start over
+    Node hand;
+    // the nodes whose data was returned by the last calls to mapGet, which
+    // are not spilled so the data stays valid, replaced in a round
+    Node pinned[MAP_SPILL_PINNED_COUNT];
+    int next_pinned;
+}*Spill;
+
+// the change stream of a primary map. Changes are encoded into change records
+// (see RecordEncoder) numbered by sequence, shipped to the follower's file
+// descriptor when the function making them finishes, and kept in the backlog
+// for a while
+typedef struct replication_t{
+    // the file descriptor of the follower, -1 if it is disconnected
+    int fd;
+    RecordEncoder encoder;
+    // records of changes not shipped yet
+    ByteBuffer pending;
+    // the latest records shipped, starting at backlog_start
+    ByteBuffer backlog;
+    size_t backlog_start;
+    // sequence number of the latest change
+    uint64_t sequence;
+    // set when the follower is disconnected by a failure, until the function
+    // making the change reports it
+    bool failed;
+}*Replication;
+
+// the recency lists of a cache. An LRU cache keeps all its nodes in the window.
+// A TinyLFU cache keeps new nodes in a small window, and admits the ones
+// leaving it into the probation part of the main area only if they are used
+// more often than the node they would take the place of. Nodes used while on
+// probation are protected
+typedef enum CacheList_t{
+    CACHE_WINDOW,
+    CACHE_PROBATION,
+    CACHE_PROTECTED,
+    CACHE_LISTS_COUNT
+}CacheList;
+
+// the cache mode of a map. Its nodes are also linked, through their newer and
+// older fields, into recency lists from the most recently used node to the
+// least recently used one
+typedef struct cache_t{
+    // maximal number of keys in the map
+    int capacity;
+    MapEvictionPolicy policy;
+    Node newest[CACHE_LISTS_COUNT];
+    Node oldest[CACHE_LISTS_COUNT];
+    int sizes[CACHE_LISTS_COUNT];
+    evictMapElements evict;
+    void *context;
+    // the byte budget, 0 if there is none, the functions measuring the keys
+    // and data against it, and the sum of the sizes of the nodes in the list
+    long long byte_budget;
+    measureMapElement measure_key;
+    measureMapElement measure_data;
+    long long bytes;
+    // the write-back hook, NULL if there is none, and the batch of the keys
+    // and data of evicted dirty nodes it gets next, owned by the map until
+    // the batch is full
+    writeBackMapElements write_back;
+    void *write_back_context;
+    MapKeyElement *batch_keys;
+    MapDataElement *batch_data;
+    int batch_size;
+    int batch_count;
+    // TinyLFU: the count-min sketch of how often keys were accessed lately,
+    // MAP_SKETCH_DEPTH rows of width counters, and the number of accesses
+    // counted since it was last aged
+    hashMapKeyElements hash_key;
+    unsigned char *sketch;
+    int width;
+    long long additions;
+    MapCacheStats stats;
+}*Cache;
+
+// the timer wheel of the expiring keys of a map. A node expiring within
+// MAP_WHEEL_SLOTS milliseconds is in the level 0 slot of its expiry time, and
+// is removed when the wheel reaches that slot. A node expiring later is in a
+// slot of a higher level, and is moved to a lower level (cascaded) when the
+// wheel reaches the time its slot starts at
+typedef struct expiry_t{
+    Node slots[MAP_WHEEL_LEVELS][MAP_WHEEL_SLOTS];
+    // number of nodes in the slots of each level
+    int counts[MAP_WHEEL_LEVELS];
+    // the time of the next level 0 slot to expire. Every key expiring before
+    // it was removed
+    long long time;
+}*Expiry;
+
+// the applier of a follower map, reading change records from a primary
+struct MapFollower_t{
+    Map map;
+    deserializeMapElement deserialize_key;
+    deserializeMapElement deserialize_data;
+    // the file descriptor last read from, and the bytes read from it not
+    // applied yet, starting at start
+    int fd;
+    ByteBuffer buffer;
+    size_t start;
+    // sequence number of the latest change applied
+    uint64_t sequence;
+    // set after a clear, while the puts sent with the same sequence number by
+    // a resynchronization (see mapReplicate) are applied
+    bool resynchronizing;
+};
+
+typedef enum UndoType_t{
+    UNDO_INSERT,
+    UNDO_REMOVE,
+    UNDO_DATA,
+    UNDO_CLEAR
+}UndoType;
+
+// an entry of the undo log, recording a single change made to the list.
+// Changes are undone in reverse order, so when an entry is undone the list is
+// exactly as it was right after the change, and prev is still the node
+// previous to node
+typedef struct undo_entry_t{
+    UndoType type;
+    // UNDO_INSERT, UNDO_REMOVE: the node previous to the inserted or removed
+    // node
+    Node prev;
+    // UNDO_INSERT, UNDO_REMOVE: the inserted or removed node
+    // UNDO_DATA: the node whose data was overwritten
+    // UNDO_CLEAR: the list that was cleared
+    Node node;
+    // UNDO_DATA: the overwritten data
+    MapDataElement data;
+    // UNDO_DATA: the flags and the data size of the node before its data was
+    // overwritten
+    // UNDO_CLEAR: the size of the map before it was cleared
+    unsigned int flags;
+    int size;
+    // UNDO_DATA: the size of the node before its data was overwritten, as
+    // counted against the byte budget of the cache mode
+    int cache_size;
+    // UNDO_DATA: the expiry time of the node before its data was overwritten,
+    // since putting a key also sets or clears its TTL
+    long long expires_at;
+}UndoEntry;
+
 struct Map_t{
     Node iterator;
     // number of keys in the map
@@ -23,10 +463,237 @@ struct Map_t{
     freeMapDataElements free_data;
     freeMapKeyElements free_key;
     compareMapKeyElements compare_keys;
+    // changes made since the first active savepoint. Overwritten data and
+    // removed nodes are kept by the log until it is discarded
+    UndoEntry *undo_log;
+    int undo_size;
+    int undo_capacity;
+    // position in the undo log of every active savepoint, oldest first
+    int *savepoints;
+    int savepoints_count;
+    int savepoints_capacity;
+    // the write-ahead log of a durable map, NULL otherwise
+    Journal journal;
+    // the changes since the last incremental checkpoint, NULL if the map was
+    // never checkpointed incrementally
+    ChangeTracker tracker;
+    // the spill mode of the map, NULL if its data are all kept in memory
+    Spill spill;
+    // the change stream of a primary map, NULL otherwise
+    Replication replication;
+    // the cache mode of the map, NULL if it has no capacity
+    Cache cache;
+    // the timer wheel of the expiring keys, NULL if no key was given a TTL
+    Expiry expiry;
+    // whether every node of the map has a state (see createNodeStates), which
+    // stays so once a mode or mapMarkDirty needed them
+    bool node_states;
+    // the operation counts of the map, see mapGetStats
+    MapStats stats;
+    // a latency histogram for every MapOperation, NULL if the latencies of
+    // the map are not tracked
+    MapLatencyHistogram *latency;
+};
+
+// the free nodes kept by a thread for reuse by new nodes of any map
+typedef struct magazine_t{
+    Node nodes;
+    int size;
+    // number of nodes taken from and put in the magazine since it was last
+    // rebalanced
+    int operations;
+}*Magazine;
+
+// the pool of free nodes shared by all threads. Every thread keeps its own
+// magazine (under magazine_key), so most node allocations and deallocations
+// take no lock. A thread moves nodes between its magazine and the pool when
+// the magazine runs empty or full, and every MAP_NODE_REBALANCE_INTERVAL
+// nodes, bringing the magazine back to half full - so the nodes freed by one
+// thread are reused by the others. The pool is only accessed holding
+// node_pool_lock, and it is deallocated when the last map is destroyed
+static pthread_mutex_t node_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static Node node_pool = NULL;
+static int node_pool_size = 0;
+static int maps_count = 0;
+static pthread_key_t magazine_key;
+static pthread_once_t magazine_key_once = PTHREAD_ONCE_INIT;
+static bool magazine_key_created = false;
+
+// the data of every key in the dirty set of a change tracker
+static char dirty_mark;
+
+#ifdef MAP_TRACING
+// the hooks called around the operations of every map, see mapSetTraceHooks
+static MapTraceHooks trace_hooks;
+#endif
+
+typedef struct staged_operation_t{
+    MapKeyElement key;
+    // node holding the copies of the key and data of a put, NULL for a remove
+    Node node;
+}StagedOperation;
+
+// a read-only map memory-mapped from an image. The image is a header, then a
+// record for every element: its key and data lengths followed by the key and
+// the data, each padded to MAP_IMAGE_ALIGNMENT, then an index of the offsets
+// of the records in key order. Records are reached through offsets only, so
+// the image is valid wherever it is mapped
+struct MappedMap_t{
+    const unsigned char *image;
+    size_t image_size;
+    int size;
+    // offset of the index of records in the image
+    uint64_t index_offset;
+    compareMapKeyElements compare_keys;
+    // position in the index of the current key, -1 if there is none
+    int iterator;
+    MapOpenMode mode;
+    // offset in the image up to which records were read ahead of a scan
+    uint64_t readahead_end;
+};
+
+// a snapshot being written by a child process. The child has a copy-on-write
+// view of the map as it was when it was forked, so the parent can go on
+// changing the map while the child writes
+struct MapSnapshot_t{
+    pid_t pid;
+};
+
+struct MapTxn_t{
+    Map map;
+    // the staged operations, in the order they were staged. The array has
+    // room for twice the capacity, the second half being the buffer used for
+    // sorting, so committing never allocates
+    StagedOperation *operations;
+    int size;
+    int capacity;
 };
 
 // additional functions declarations
 
+/**
+* allocateNode: taking a free node from the magazine of the calling thread,
+*               rebalancing the magazine against the shared node pool if it is
+*               empty or due to, and allocating a new node if both are empty
+* @param map - the map for which the node is allocated
+* @return
+*    pointer to the node (only its state is initialized, to a new state if
+*    the nodes of map have states and to NULL otherwise)
+*    NULL if memory allocation failed
+*/
+static Node allocateNode(Map map);
+
+/**
+* createNodeState: giving a node a new state, unless it already has one, and
+*                  setting the node before it
+* @param map - the map for which the state is allocated
+* @param node - the node
+* @param prev - the node before it in the list
+* @return
+*    MAP_OUT_OF_MEMORY if memory allocation failed
+*    MAP_SUCCESS otherwise
+*/
+static MapResult createNodeState(Map map,Node node,Node prev);
+
+/**
+* createNodeStates: giving a state to every node of map which has none, both
+*                   in the list and kept by the undo log, before a mode first
+*                   needs them. Afterwards every new node of the map gets one
+* @param map - the map
+* @return
+*    MAP_OUT_OF_MEMORY if memory allocation failed (the nodes given a state
+*    keep it)
+*    MAP_SUCCESS otherwise
+*/
+static MapResult createNodeStates(Map map);
+
+/**
+* setPrevNode: setting the node before a node in the list, if it has a state
+* @param node - the node
+* @param prev - the node before it
+*/
+static void setPrevNode(Node node,Node prev);
+
+/**
+* nodeFlags: getting the NODE_ flags of a node
+* @param node - the node
+* @return
+*    its flags, 0 if it has no state
+*/
+static unsigned int nodeFlags(Node node);
+
+/**
+* nodeExpiry: getting the expiry time of a node
+* @param node - the node
+* @return
+*    the time (in milliseconds) it expires at, 0 if it never does
+*/
+static long long nodeExpiry(Node node);
+
+/**
+* releaseNode: putting a node whose fields were already deallocated back into
+*              the magazine of the calling thread, rebalancing the magazine
+*              against the shared node pool if it is full or due to
+* @param node - the node to release
+*/
+static void releaseNode(Node node);
+
+/**
+* getMagazine: getting the magazine of the calling thread, creating it on its
+*              first use
+* @return
+*    the magazine of the thread
+*    NULL if it could not be created, in which case nodes are allocated and
+*    deallocated directly
+*/
+static Magazine getMagazine(void);
+
+/**
+* createMagazineKey: creating the key of the magazines of the threads, once
+*/
+static void createMagazineKey(void);
+
+/**
+* rebalanceMagazine: bringing a magazine back to half full, by moving its
+*                    excess nodes to the shared node pool or taking the nodes
+*                    it lacks from it
+* @param magazine - the magazine to rebalance
+*/
+static void rebalanceMagazine(Magazine magazine);
+
+/**
+* destroyMagazine: giving all the free nodes in a magazine back to the shared
+*                  node pool (called when its thread exits), deallocating the
+*                  nodes that exceed the capacity of the pool - or the whole
+*                  pool if no map is alive - and then the magazine itself
+* @param magazine - the magazine to destroy
+*/
+static void destroyMagazine(void *magazine);
+
+/**
+* moveFreeNodes: moving up to "count" free nodes from one free list to another
+* @param from - the free list to take the nodes from
+* @param from_size - the number of nodes in the "from" list
+* @param to - the free list to put the nodes in
+* @param to_size - the number of nodes in the "to" list
+* @param count - the number of nodes to move
+*/
+static void moveFreeNodes(Node *from,int *from_size,Node *to,int *to_size,
+                          int count);
+
+/**
+* leaveNodePool: counting a map out of the maps using the shared node pool
+*                when it is destroyed, deallocating the pool and the magazine
+*                of the calling thread if no other map is alive
+*/
+static void leaveNodePool(void);
+
+/**
+* freeNodePool: deallocating all the nodes in the shared node pool. Called
+*               holding node_pool_lock
+*/
+static void freeNodePool(void);
+
 /**
 * freeNode: deallocating all the fields of node (key and data) using supplied
  *          free_data, free_key functions
@@ -44,12 +711,19 @@ static void freeList(Map map,Node list);
 
 /**
 * createNewList: creating a list with "length" number of nodes
+* @param map - the map for which the nodes are allocated
 * @param length - number of nodes to create for the new list
 * @return
 *    pointer to the first node of the list if creating the list was successful
 *    NULL if memory allocation of a node failed
 */
-static Node createNewList(int length);
+static Node createNewList(Map map,int length);
+
+/**
+* releaseList: releasing every node of a list whose fields are not initialized
+* @param list - the list of nodes to release
+*/
+static void releaseList(Node list);
 
 /**
 * copyList: create a copy of the list from src_map and put it as the list
@@ -76,6 +750,45 @@ static MapResult copyList(Map src_map,Map new_map);
 */
 static bool findPrevNode(Map map,Node *prev_node,MapKeyElement element);
 
+/**
+* countSearch: counting a search for the position of a key in the statistics
+*              of map
+* @param map - the map which was searched
+* @param traversed - the number of nodes the search stepped over
+*/
+static void countSearch(Map map,int traversed);
+
+/**
+* compareKeys: comparing two keys using the compare_keys function of map,
+*              counting the call
+* @param map - the map whose keys are compared
+* @param first - the first key
+* @param second - the second key
+* @return
+*    the result of compare_keys
+*/
+static int compareKeys(Map map,MapKeyElement first,MapKeyElement second);
+
+/**
+* copyKey, copyData: copying a key or data element using the copy function of
+*                    map, counting the call
+* @param map - the map whose element is copied
+* @param key, data - the element to copy
+* @return
+*    the copy, NULL if the copy function failed
+*/
+static MapKeyElement copyKey(Map map,MapKeyElement key);
+static MapDataElement copyData(Map map,MapDataElement data);
+
+/**
+* freeKey, freeData: deallocating a key or data element using the free function
+*                    of map, counting the call
+* @param map - the map whose element is deallocated
+* @param key, data - the element to deallocate
+*/
+static void freeKey(Map map,MapKeyElement key);
+static void freeData(Map map,MapDataElement data);
+
 /**
 * createNewNode: allocating dynamic memory for a new node and it's fields
  *               and copying the key-data elements into the node's fields
@@ -100,341 +813,6664 @@ static Node createNewNode(Map map,MapKeyElement keyElement,
 static void insertNewNode(Node prev_node,Node new_node);
 
 /**
-* initializeMap: initialize the fields of the map with given parameters
-* @param map - target map to initialize it's fields
-* @param copyDataElement - pointer to the data element copying function
-* @param copyKeyElement - pointer to the key element copying function
-* @param freeDataElement - pointer to the data element deallocating function
-* @param freeKeyElement - pointer to the key element deallocating function
-* @param compareKeyElements - pointer to the key comparing function
-* @param dummy_first - pointer to the previously allocated dummy first node
+* replaceNodeData: pairing node with a copy of new_data and deallocating the
+*                  data it held. If new_data is the data node already holds
+*                  (it was updated in place), nothing is done
+* @param map - the map that holds the copy and free functions
+* @param node - the node whose data is replaced
+* @param new_data - the data element to copy into the node
+* @return
+*    MAP_OUT_OF_MEMORY if copying new_data failed (the node keeps its data)
+*    MAP_SUCCESS if the data was replaced
 */
-static void initializeMap(Map map,copyMapDataElements copyDataElement,
-                          copyMapKeyElements copyKeyElement,
-                          freeMapDataElements freeDataElement,
-                          freeMapKeyElements freeKeyElement,
-                          compareMapKeyElements compareKeyElements,
-                          Node dummy_first);
+static MapResult replaceNodeData(Map map,Node node,MapDataElement new_data);
 
-// functions implementations
+/**
+* removeNextNode: unlinking the node after prev_node from the list and
+*                 deallocating it
+* @param map - the map that holds the list of key-data elements
+* @param prev_node - the node previous to the node to be removed
+*/
+static void removeNextNode(Map map,Node prev_node);
 
-static void freeNode(Map map,Node node)
-{
-    map->free_data(node->data);
-    map->free_key(node->key);
-    free(node);
-}
+/**
+* unlinkNextNode: unlinking the node after prev_node from the list, leaving
+*                 it to the caller to deallocate or keep
+* @param map - the map that holds the list of key-data elements
+* @param prev_node - the node previous to the node to be unlinked
+* @return
+*    the unlinked node
+*/
+static Node unlinkNextNode(Map map,Node prev_node);
 
-static void freeList(Map map,Node list)
-{
-    Node cur_node = list,temp;
+/**
+* storeComputedData: storing the result of a compute or merge function for
+*                    the key searched by findPrevNode - updating, inserting
+*                    or removing the node after prev_node as needed
+* @param map - the map to update
+* @param prev_node - the node returned by findPrevNode for keyElement
+* @param was_found - whether findPrevNode found keyElement
+* @param keyElement - the key element the data was computed for
+* @param new_data - the computed data element, NULL to remove the key
+* @return
+*    MAP_OUT_OF_MEMORY if an allocation failed
+*    MAP_SUCCESS otherwise
+*/
+static MapResult storeComputedData(Map map,Node prev_node,bool was_found,
+                                   MapKeyElement keyElement,
+                                   MapDataElement new_data);
 
-    while(cur_node != NULL){
-        temp = cur_node;
-        cur_node = cur_node->next;
-        freeNode(map,temp);
-    }
-}
+/**
+* setNodeData: pairing node with new_data (which the map now owns) and
+*              deallocating the data it held
+* @param map - the map that holds the free functions
+* @param node - the node whose data is replaced
+* @param new_data - the data element to put in the node
+*/
+static void setNodeData(Map map,Node node,MapDataElement new_data);
 
-static Node createNewList(int length)
-{
-    Node new_list_head = NULL;
+/**
+* stageOperation: appending an operation to a transaction, growing its array
+*                 of operations if needed
+* @param txn - the transaction to append the operation to
+* @param key - the copy of the key element of the operation
+* @param node - the node of a put, NULL for a remove
+* @return
+*    MAP_OUT_OF_MEMORY if growing the array failed
+*    MAP_SUCCESS if the operation was appended
+*/
+static MapResult stageOperation(MapTxn txn,MapKeyElement key,Node node);
 
-    while(length--){
-        Node new_node = malloc(sizeof(*new_node));
-        if(!new_node){
-            free(new_list_head);
-            return NULL;
-        }
-        new_node->next = new_list_head;
-        new_list_head = new_node;
-    }
+/**
+* sortOperations: stable merge sort of operations by their keys, so operations
+*                 on equal keys keep the order they were staged in
+* @param map - the map that holds the key comparing function
+* @param operations - the array of operations to sort
+* @param buffer - an array of at least "size" operations for merging
+* @param size - number of operations in the array
+*/
+static void sortOperations(Map map,StagedOperation *operations,
+                           StagedOperation *buffer,int size);
 
-    return new_list_head;
-}
+/**
+* discardOperation: deallocating the copies held by a staged operation
+* @param map - the map that holds the free functions
+* @param operation - the operation to discard
+*/
+static void discardOperation(Map map,StagedOperation *operation);
 
-static MapResult copyList(Map src_map,Map new_map)
-{
-    if(!src_map || !new_map){
-        return MAP_NULL_ARGUMENT;
-    }
+/**
+* seekPrevNode: like findPrevNode, but starting the search from a given node
+*               rather than from the first node, for passes over the map with
+*               sorted keys
+* @param map - the map that holds the list of key-data elements
+* @param prev_node - the node to start from, whose key is smaller than element
+* @param element - the key element to search for
+* @param was_found - a variable to store whether the element exists in the map
+* @return
+*    the node that should be previous to element
+*/
+static Node seekPrevNode(Map map,Node prev_node,MapKeyElement element,
+                         bool *was_found);
 
-    Node new_list_head = createNewList(src_map->size);
-    if(!new_list_head){
-        return MAP_OUT_OF_MEMORY;
-    }
+/**
+* mergeNode: storing a node whose key and data the map already owns after
+*            prev_node - moving its data into the next node if it holds an
+*            equal key, or linking the node itself otherwise
+* @param map - the map to store the node in
+* @param prev_node - the node returned by seekPrevNode for the node's key
+* @param was_found - whether seekPrevNode found the node's key
+* @param node - the node to store
+* @return
+*    the node holding the key now, from which later keys can be sought
+*/
+static Node mergeNode(Map map,Node prev_node,bool was_found,Node node);
 
-    Node new_list_cur = new_list_head;
-    Node src_list_cur = src_map->first->next;
+/**
+* applyOperations: merging sorted operations into the list of map in a single
+*                  pass. Of several operations on equal keys only the last one
+*                  is applied
+* @param map - the map to apply the operations to
+* @param operations - the operations, sorted by sortOperations
+* @param size - number of operations
+*/
+static void applyOperations(Map map,StagedOperation *operations,int size);
 
-    while(src_list_cur != NULL){
-        new_list_cur->data = src_map->copy_data(src_list_cur->data);
-        new_list_cur->key = src_map->copy_key(src_list_cur->key);
-        if(!(new_list_cur->data) || !(new_list_cur->key)){
-            freeList(src_map,new_list_head);
-            return MAP_OUT_OF_MEMORY;
-        }
-        src_list_cur = src_list_cur->next;
-        new_list_cur = new_list_cur->next;
-    }
+/**
+* linkNewNode: inserting new_node after prev_node and counting it in the size
+*              of the map
+* @param map - the map that holds the list of key-data elements
+* @param prev_node - the node previous to the inserted node
+* @param new_node - the node to insert
+*/
+static void linkNewNode(Map map,Node prev_node,Node new_node);
 
-    new_map->first->next = new_list_head;
-    return MAP_SUCCESS;
-}
+/**
+* reserveUndoEntries: making sure the undo log has room for "count" more
+*                     entries, so the changes about to be made can be logged
+*                     without failing. Does nothing if there are no active
+*                     savepoints
+* @param map - the map whose undo log is grown
+* @param count - the number of entries to make room for
+* @return
+*    MAP_OUT_OF_MEMORY if growing the log failed
+*    MAP_SUCCESS otherwise
+*/
+static MapResult reserveUndoEntries(Map map,int count);
 
-static bool findPrevNode(Map map,Node *prev_node,MapKeyElement element)
-{
-    Node cur_node = map->first,next;
-    bool was_found = false;
+/**
+* logUndoEntry: appending an entry to the undo log, whose room was reserved
+*               by reserveUndoEntries
+* @param map - the map whose undo log is appended to
+* @param type - the type of change
+* @param prev - the node previous to the changed node, if relevant
+* @param node - the changed node or list
+* @param data - the overwritten data, if relevant
+* @param flags - the flags of the node before its data was overwritten, if
+*        relevant
+* @param size - the data size of the node before its data was overwritten,
+*        or the size of the map before it was cleared, if relevant
+*/
+static void logUndoEntry(Map map,UndoType type,Node prev,Node node,
+                         MapDataElement data,unsigned int flags,int size);
 
-    while(cur_node != NULL){
-        next = cur_node->next;
-        if(!next){
-            was_found = false;
-            break;
-        }
-        int result = map->compare_keys(element,next->key);
-        if(result == 0){
-            was_found = true;
-            break;
-        }
-        if(result < 0){
-            was_found = false;
-            break;
-        }
-        cur_node = next;
-    }
+/**
+* undoEntry: reverting the change recorded by an undo log entry
+* @param map - the map to revert the change in
+* @param entry - the entry to undo
+*/
+static void undoEntry(Map map,UndoEntry *entry);
+
+/**
+* discardEntry: deallocating whatever an undo log entry kept for undoing it
+* @param map - the map that holds the free functions
+* @param entry - the entry to discard
+*/
+static void discardEntry(Map map,UndoEntry *entry);
+
+/**
+* truncateUndoLog: undoing or discarding the undo log entries from position
+*                  "size" onwards, latest first
+* @param map - the map whose undo log is truncated
+* @param size - the number of entries to keep
+* @param undo - true to undo the entries, false to discard them
+*/
+static void truncateUndoLog(Map map,int size,bool undo);
+
+/**
+* storeUint32: storing an unsigned integer as 4 little-endian bytes
+* @param bytes - where to store the integer
+* @param value - the integer to store
+*/
+static void storeUint32(unsigned char *bytes,uint32_t value);
+
+/**
+* loadUint32: loading an unsigned integer stored by storeUint32
+* @param bytes - where the integer is stored
+* @return
+*    the integer
+*/
+static uint32_t loadUint32(const unsigned char *bytes);
+
+/**
+* storeUint64: storing an unsigned integer as 8 little-endian bytes
+* @param bytes - where to store the integer
+* @param value - the integer to store
+*/
+static void storeUint64(unsigned char *bytes,uint64_t value);
+
+/**
+* loadUint64: loading an unsigned integer stored by storeUint64
+* @param bytes - where the integer is stored
+* @return
+*    the integer
+*/
+static uint64_t loadUint64(const unsigned char *bytes);
+
+/**
+* serializeElement: serializing an element into a buffer, growing the buffer
+*                   if the element does not fit in it
+* @param serialize - the function serializing the element
+* @param element - the element to serialize
+* @param buffer - the buffer, which may be reallocated
+* @param capacity - the size of the buffer, updated if it is reallocated
+* @param length - a variable to store the number of bytes of the element
+* @return
+*    MAP_OUT_OF_MEMORY if growing the buffer failed
+*    MAP_IO_ERROR if the element cannot be serialized
+*    MAP_SUCCESS if the element was serialized
+*/
+static MapResult serializeElement(serializeMapElement serialize,void *element,
+                                  unsigned char **buffer,int *capacity,
+                                  int *length);
+
+/**
+* writeElement: serializing an element and writing it to a stream, prefixed by
+*               its length
+* @param stream - the stream to write to
+* @param serialize - the function serializing the element
+* @param element - the element to write
+* @param buffer - the buffer to serialize into, which may be reallocated
+* @param capacity - the size of the buffer, updated if it is reallocated
+* @return
+*    MAP_OUT_OF_MEMORY if growing the buffer failed
+*    MAP_IO_ERROR if serializing or writing failed
+*    MAP_SUCCESS if the element was written
+*/
+static MapResult writeElement(FILE *stream,serializeMapElement serialize,
+                              void *element,unsigned char **buffer,
+                              int *capacity);
+
+/**
+* readElement: reading an element written by writeElement and deserializing it
+* @param stream - the stream to read from
+* @param deserialize - the function deserializing the element
+* @param buffer - the buffer to read into, which may be reallocated
+* @param capacity - the size of the buffer, updated if it is reallocated
+* @param element - a variable to store the deserialized element
+* @return
+*    MAP_OUT_OF_MEMORY if growing the buffer failed
+*    MAP_IO_ERROR if reading or deserializing failed
+*    MAP_SUCCESS if the element was read
+*/
+static MapResult readElement(FILE *stream,deserializeMapElement deserialize,
+                             unsigned char **buffer,int *capacity,
+                             void **element);
+
+/**
+* readSortedList: reading the elements written by mapSave into a new list,
+*                 checking that their keys are in increasing order
+* @param map - the map the list is read for
+* @param stream - the stream to read from, positioned after the header
+* @param count - the number of elements to read
+* @param deserializeKey - the function deserializing the key elements
+* @param deserializeData - the function deserializing the data elements
+* @param list - a variable to store the first node of the list
+* @return
+*    MAP_OUT_OF_MEMORY if an allocation failed
+*    MAP_IO_ERROR if reading failed or the keys are not in increasing order
+*    MAP_SUCCESS if the list was read
+*/
+static MapResult readSortedList(Map map,FILE *stream,int count,
+                                deserializeMapElement deserializeKey,
+                                deserializeMapElement deserializeData,
+                                Node *list);
+
+/**
+* alignImageOffset: rounding an offset in an image up to MAP_IMAGE_ALIGNMENT
+* @param offset - the offset to round
+* @return
+*    the rounded offset
+*/
+static uint64_t alignImageOffset(uint64_t offset);
+
+/**
+* writeImageElement: writing a serialized element into an image, padded to
+*                    MAP_IMAGE_ALIGNMENT
+* @param stream - the stream the image is written to
+* @param length - the number of bytes of the element
+* @param buffer - the serialized element
+* @return
+*    MAP_IO_ERROR if writing failed
+*    MAP_SUCCESS if the element was written
+*/
+static MapResult writeImageElement(FILE *stream,int length,
+                                   const unsigned char *buffer);
+
+/**
+* writeMappedImage: writing all the elements of map to a stream as an image
+* @param map - the map to write
+* @param stream - the stream to write to, which must be seekable
+* @param serializeKey - the function serializing the key elements
+* @param serializeData - the function serializing the data elements
+* @return
+*    MAP_OUT_OF_MEMORY if an allocation failed
+*    MAP_IO_ERROR if serializing or writing failed
+*    MAP_SUCCESS if the image was written
+*/
+static MapResult writeMappedImage(Map map,FILE *stream,
+                                  serializeMapElement serializeKey,
+                                  serializeMapElement serializeData);
+
+/**
+* mapImage: memory-mapping an image from an open file as a read-only map,
+*           checking only its header and the bounds of its index
+* @param fd - the file descriptor of the image, which may be closed afterwards
+* @param compareKeyElements - the key comparing function
+* @return
+*    the read-only map
+*    NULL if mapping failed, the file is not an image or allocation failed
+*/
+static MappedMap mapImage(int fd,compareMapKeyElements compareKeyElements);
+
+/**
+* adviseImage: telling the kernel how the pages of a read-only map will be
+*              accessed, according to its open mode
+* @param map - the read-only map
+*/
+static void adviseImage(MappedMap map);
+
+/**
+* readAhead: asking the kernel to read the records following a record of a
+*            lazily opened read-only map, when a scan gets close to the end
+*            of the records read ahead so far
+* @param map - the read-only map
+* @param key - the key of the record the scan reached
+*/
+static void readAhead(MappedMap map,const unsigned char *key);
+
+/**
+* imageRecord: finding the record of the element at a position of the index
+*              of a read-only map, checking that it lies within the image
+* @param map - the read-only map
+* @param position - the position in the index, in the range [0, size)
+* @param key_length - a variable to store the length of the key
+* @param data_length - a variable to store the length of the data
+* @return
+*    pointer to the key of the record, followed (after padding) by its data
+*    NULL if the record does not lie within the image
+*/
+static const unsigned char *imageRecord(MappedMap map,int position,
+                                        uint32_t *key_length,
+                                        uint32_t *data_length);
+
+/**
+* appendBytes: appending bytes to a byte buffer, growing it if needed
+* @param buffer - the buffer to append to
+* @param bytes - the bytes to append, or NULL to leave them uninitialized
+* @param count - the number of bytes to append
+* @return
+*    false if growing the buffer failed
+*    true if the bytes were appended
+*/
+static bool appendBytes(ByteBuffer *buffer,const void *bytes,size_t count);
+
+/**
+* checksumBytes: computing the FNV-1a checksum of bytes
+* @param bytes - the bytes to checksum
+* @param count - the number of bytes
+* @return
+*    the checksum
+*/
+static uint32_t checksumBytes(const unsigned char *bytes,size_t count);
+
+/**
+* updateChecksum: continuing an FNV-1a checksum with more bytes
+* @param checksum - the checksum of the bytes before
+* @param bytes - the bytes to checksum
+* @param count - the number of bytes
+* @return
+*    the checksum of the bytes before followed by bytes
+*/
+static uint32_t updateChecksum(uint32_t checksum,const unsigned char *bytes,
+                               size_t count);
+
+/**
+* checksumFile: computing the FNV-1a checksum of the contents of a file
+* @param path - the path of the file
+* @param checksum - a variable to store the checksum in
+* @return
+*    false if reading the file failed
+*    true otherwise
+*/
+static bool checksumFile(const char *path,uint32_t *checksum);
+
+/**
+* encodeRecord: appending the change record of a change to a byte buffer
+* @param encoder - the encoder serializing the elements
+* @param out - the buffer to append the record to
+* @param type - the type of the change
+* @param sequence - the sequence number of the change
+* @param key - the key element changed, NULL for a clear
+* @param data - the data element put, NULL for a remove or clear
+* @return
+*    MAP_OUT_OF_MEMORY if an allocation failed
+*    MAP_IO_ERROR if serializing an element failed
+*    MAP_SUCCESS if the record was appended
+*/
+static MapResult encodeRecord(RecordEncoder *encoder,ByteBuffer *out,
+                              ChangeType type,uint64_t sequence,
+                              MapKeyElement key,MapDataElement data);
+
+/**
+* decodeRecord: decoding the body of a change record
+* @param body - the body of the record
+* @param length - the number of bytes in the body
+* @param record - a variable to store the decoded record
+* @return
+*    false if the body is not a valid change record
+*    true if the record was decoded
+*/
+static bool decodeRecord(const unsigned char *body,size_t length,
+                         ChangeRecord *record);
+
+/**
+* readRecord: reading a change record from a stream and checking its checksum
+* @param stream - the stream to read from
+* @param body - the buffer to read the body of the record into
+* @return
+*    MAP_OUT_OF_MEMORY if growing the buffer failed
+*    MAP_IO_ERROR if the stream ended or the record is damaged
+*    MAP_SUCCESS if the body was read
+*/
+static MapResult readRecord(FILE *stream,ByteBuffer *body);
+
+/**
+* applyRecord: applying a decoded change record to map, taking the
+*              deserialized elements as they are
+* @param map - the map to apply the change to
+* @param record - the change record
+* @param deserializeKey - the function deserializing the key element
+* @param deserializeData - the function deserializing the data element
+* @return
+*    MAP_OUT_OF_MEMORY if an allocation failed
+*    MAP_IO_ERROR if deserializing an element failed
+*    MAP_SUCCESS if the change was applied
+*/
+static MapResult applyRecord(Map map,ChangeRecord *record,
+                             deserializeMapElement deserializeKey,
+                             deserializeMapElement deserializeData);
+
+/**
+* recordChange: passing a change that was just made to map to whatever
+*               follows its changes (the write-ahead log of a durable map and
+*               the dirty set of incremental checkpoints)
+* @param map - the changed map
+* @param type - the type of change
+* @param node - the node put or removed, NULL for a clear
+*/
+static void recordChange(Map map,ChangeType type,Node node);
+
+/**
+* finishChanges: completing a function which changed map - shipping the
+*                changes to its follower, writing the group of logged
+*                changes if it is full (or at every change, depending on the
+*                sync policy) and a snapshot if enough changes were logged
+*                since the last one
+* @param map - the changed map
+* @return
+*    MAP_IO_ERROR if a change could not be logged, or the follower of map
+*    was disconnected
+*    MAP_SUCCESS otherwise
+*/
+static MapResult finishChanges(Map map);
+
+/**
+* flushJournal: writing the pending records of a journal to its log
+* @param journal - the journal to flush
+* @param sync - whether to force the log to disk after writing
+* @return
+*    MAP_IO_ERROR if writing failed
+*    MAP_SUCCESS otherwise
+*/
+static MapResult flushJournal(Journal journal,bool sync);
+
+/**
+* writeBytes: writing bytes to a file descriptor
+* @param fd - the file descriptor to write to
+* @param bytes - the bytes to write
+* @param count - the number of bytes
+* @return
+*    false if writing failed
+*    true otherwise
+*/
+static bool writeBytes(int fd,const unsigned char *bytes,size_t count);
+
+/**
+* syncDirectory: forcing the directory holding a file to disk, so that a file
+*                renamed into it is still there after a crash
+* @param path - the path of the file
+* @return
+*    false if opening or forcing the directory failed
+*    true otherwise
+*/
+static bool syncDirectory(const char *path);
+
+/**
+* saveToFile: saving map to a temporary file with mapSave, forcing it to
+*             disk and renaming it over path (forcing the directory to disk
+*             too), so that the file at path is either the old or the new
+*             snapshot. The temporary file gets a unique name starting with
+*             path, so snapshots written to the same path at once do not
+*             write the same file
+* @param map - the map to save
+* @param path - the path of the snapshot
+* @param encoder - the encoder whose serialize functions are used
+* @return
+*    MAP_OUT_OF_MEMORY if an allocation failed
+*    MAP_IO_ERROR if writing the snapshot failed
+*    MAP_SUCCESS otherwise
+*/
+static MapResult saveToFile(Map map,const char *path,
+                            const RecordEncoder *encoder);
+
+/**
+* replayRecords: applying the change records read from a stream to map,
+*                until the end of the stream or the first damaged record
+* @param map - the map to apply the records to
+* @param stream - the stream to read from
+* @param deserializeKey - the function deserializing the key elements
+* @param deserializeData - the function deserializing the data elements
+* @param sequence - a variable to store the sequence number of the last
+*        record applied, left as is if none was
+* @param count - a variable to add the number of records applied to
+* @param valid_length - a variable to store the position in the stream after
+*        the last record applied
+* @return
+*    MAP_OUT_OF_MEMORY if an allocation failed
+*    MAP_IO_ERROR if deserializing an element failed
+*    MAP_SUCCESS otherwise
+*/
+static MapResult replayRecords(Map map,FILE *stream,
+                               deserializeMapElement deserializeKey,
+                               deserializeMapElement deserializeData,
+                               uint64_t *sequence,int *count,
+                               long *valid_length);
+
+/**
+* writeSnapshot: saving map to a temporary file, replacing its snapshot with
+*                it and emptying its log
+* @param map - the durable map
+* @return
+*    MAP_OUT_OF_MEMORY if an allocation failed
+*    MAP_IO_ERROR if writing the snapshot or emptying the log failed
+*    MAP_SUCCESS otherwise
+*/
+static MapResult writeSnapshot(Map map);
+
+/**
+* replayLog: applying the change records of a log to map, and cutting off
+*            the log after the last complete record (a record being written
+*            when the process stopped)
+* @param map - the map to apply the log to
+* @param journal - the journal whose log is replayed
+* @param deserializeKey - the function deserializing the key elements
+* @param deserializeData - the function deserializing the data elements
+* @return
+*    MAP_OUT_OF_MEMORY if an allocation failed
+*    MAP_IO_ERROR if reading the log or deserializing an element failed
+*    MAP_SUCCESS otherwise
+*/
+static MapResult replayLog(Map map,Journal journal,
+                           deserializeMapElement deserializeKey,
+                           deserializeMapElement deserializeData);
+
+/**
+* createJournal: allocating a journal for the files at path
+* @param path - the path of the snapshot
+* @param serializeKey - the function serializing the key elements
+* @param serializeData - the function serializing the data elements
+* @param policy - the sync policy
+* @return
+*    the journal, whose log is not open yet
+*    NULL if an allocation failed
+*/
+static Journal createJournal(const char *path,serializeMapElement serializeKey,
+                             serializeMapElement serializeData,
+                             MapSyncPolicy policy);
+
+/**
+* destroyJournal: closing the log of a journal and deallocating it
+* @param journal - the journal to destroy
+*/
+static void destroyJournal(Journal journal);
+
+/**
+* writeSaveHeader: writing the header of a saved map
+* @param stream - the stream to write to
+* @param version - the version of the format
+* @param count - the number of elements
+* @return
+*    MAP_IO_ERROR if writing failed
+*    MAP_SUCCESS otherwise
+*/
+static MapResult writeSaveHeader(FILE *stream,uint32_t version,int count);
+
+/**
+* appendVarint: appending an unsigned integer to a byte buffer using 7 bits
+*               per byte, the high bit marking that more bytes follow
+* @param buffer - the buffer to append to
+* @param value - the integer to append
+* @return
+*    false if growing the buffer failed
+*    true otherwise
+*/
+static bool appendVarint(ByteBuffer *buffer,uint64_t value);
+
+/**
+* readVarint: reading an integer appended by appendVarint
+* @param position - the position to read from, advanced past the integer
+* @param end - the end of the bytes that may be read
+* @param value - a variable to store the integer
+* @return
+*    false if the integer does not end before "end"
+*    true otherwise
+*/
+static bool readVarint(const unsigned char **position,const unsigned char *end,
+                       uint64_t *value);
+
+/**
+* readBytes: reading a length-prefixed string of bytes appended by
+*            appendVarint and appendBytes
+* @param position - the position to read from, advanced past the bytes
+* @param end - the end of the bytes that may be read
+* @param bytes - a variable to store the position of the bytes
+* @param length - a variable to store the number of bytes
+* @return
+*    false if the bytes do not end before "end"
+*    true otherwise
+*/
+static bool readBytes(const unsigned char **position,const unsigned char *end,
+                      const unsigned char **bytes,uint64_t *length);
+
+/**
+* compressBytes: compressing bytes with the LZ codec - a sequence of literal
+*                runs, each followed by a match copying earlier output
+* @param bytes - the bytes to compress
+* @param length - the number of bytes
+* @param out - the buffer to append the compressed bytes to
+* @return
+*    false if growing the buffer failed
+*    true otherwise
+*/
+static bool compressBytes(const unsigned char *bytes,size_t length,
+                          ByteBuffer *out);
+
+/**
+* decompressBytes: decompressing bytes compressed by compressBytes
+* @param bytes - the compressed bytes
+* @param length - the number of compressed bytes
+* @param out - where to store the decompressed bytes
+* @param out_length - the number of bytes they decompress to
+* @return
+*    false if the compressed bytes are damaged
+*    true otherwise
+*/
+static bool decompressBytes(const unsigned char *bytes,size_t length,
+                            unsigned char *out,size_t out_length);
+
+/**
+* encodeKeys: encoding the keys of a block
+* @param encoding - the requested key encoding
+* @param keys - the serialized keys, each prefixed by its length
+* @param count - the number of keys
+* @param out - the buffer to append the encoded keys to
+* @param width - a variable to store the width of integer keys
+* @return
+*    the encoding used, which is MAP_KEY_ENCODING_PLAIN if the keys cannot be
+*    encoded as requested
+*    -1 if growing the buffer failed
+*/
+static int encodeKeys(MapKeyEncoding encoding,const ByteBuffer *keys,
+                      int count,ByteBuffer *out,int *width);
+
+/**
+* decodeKeys: decoding the keys of a block encoded by encodeKeys into
+*             serialized keys, each prefixed by its length
+* @param encoding - the encoding of the keys
+* @param width - the width of integer keys
+* @param bytes - the encoded keys
+* @param length - the number of encoded bytes
+* @param count - the number of keys
+* @param out - the buffer to append the decoded keys to
+* @return
+*    MAP_OUT_OF_MEMORY if growing the buffer failed
+*    MAP_IO_ERROR if the encoded keys are damaged
+*    MAP_SUCCESS otherwise
+*/
+static MapResult decodeKeys(int encoding,int width,const unsigned char *bytes,
+                            size_t length,int count,ByteBuffer *out);
+
+/**
+* writeBlock: encoding and writing a block of the compressed format
+* @param stream - the stream to write to
+* @param encoding - the requested key encoding
+* @param keys - the serialized keys of the block, each prefixed by its length
+* @param data - the serialized data of the block, each prefixed by its length
+* @param count - the number of elements in the block
+* @param scratch - buffers to encode into
+* @return
+*    MAP_OUT_OF_MEMORY if an allocation failed
+*    MAP_IO_ERROR if writing failed
+*    MAP_SUCCESS otherwise
+*/
+static MapResult writeBlock(FILE *stream,MapKeyEncoding encoding,
+                            const ByteBuffer *keys,const ByteBuffer *data,
+                            int count,ByteBuffer scratch[2]);
+
+/**
+* readCompressedList: reading the elements written by mapSaveCompressed into
+*                     a new list, checking that their keys are in increasing
+*                     order
+* @param map - the map the list is read for
+* @param stream - the stream to read from, positioned after the header
+* @param count - the number of elements to read
+* @param deserializeKey - the function deserializing the key elements
+* @param deserializeData - the function deserializing the data elements
+* @param list - a variable to store the first node of the list
+* @return
+*    MAP_OUT_OF_MEMORY if an allocation failed
+*    MAP_IO_ERROR if reading failed, a block is damaged or the keys are not
+*    in increasing order
+*    MAP_SUCCESS if the list was read
+*/
+static MapResult readCompressedList(Map map,FILE *stream,int count,
+                                    deserializeMapElement deserializeKey,
+                                    deserializeMapElement deserializeData,
+                                    Node *list);
+
+/**
+* copyDirtyMark: the copy function of the data elements of a dirty set,
+*                which are all dirty_mark
+* @param mark - the data element to copy
+* @return
+*    the data element itself
+*/
+static MapDataElement copyDirtyMark(MapDataElement mark);
+
+/**
+* freeDirtyMark: the free function of the data elements of a dirty set,
+*                which does nothing
+* @param mark - the data element to free
+*/
+static void freeDirtyMark(MapDataElement mark);
+
+/**
+* createTracker: allocating a change tracker for incremental checkpoints of
+*                map at path. It starts as failed, so the first checkpoint
+*                is a full snapshot
+* @param map - the tracked map
+* @param path - the path of the snapshot
+* @param serializeKey - the function serializing the key elements
+* @param serializeData - the function serializing the data elements
+* @return
+*    the change tracker
+*    NULL if an allocation failed
+*/
+static ChangeTracker createTracker(Map map,const char *path,
+                                   serializeMapElement serializeKey,
+                                   serializeMapElement serializeData);
+
+/**
+* destroyTracker: deallocating a change tracker
+* @param tracker - the change tracker to destroy
+*/
+static void destroyTracker(ChangeTracker tracker);
+
+/**
+* writeDelta: appending a record of the current state of every entry of map
+*             changed since the last checkpoint to the delta file, and
+*             emptying the dirty set
+* @param map - the tracked map
+* @return
+*    MAP_OUT_OF_MEMORY if an allocation failed
+*    MAP_IO_ERROR if serializing an element or writing failed
+*    MAP_SUCCESS otherwise
+*/
+static MapResult writeDelta(Map map);
+
+/**
+* writeFullCheckpoint: replacing the snapshot of a tracked map with a new
+*                      one, then starting a delta file tagged with its
+*                      checksum. Deltas tagged with another checksum are
+*                      ignored by mapRestoreCheckpoint, so a crash between
+*                      the two steps does not apply the old deltas to the new
+*                      snapshot
+* @param map - the tracked map
+* @return
+*    MAP_OUT_OF_MEMORY if an allocation failed
+*    MAP_IO_ERROR if writing the snapshot or starting the delta file failed
+*    MAP_SUCCESS otherwise
+*/
+static MapResult writeFullCheckpoint(Map map);
+
+/**
+* releaseData: deallocating the data of a node, or its stub if the data was
+*              spilled
+* @param map - the map of the node
+* @param data - the data or stub to deallocate
+* @param flags - the flags of the node the data belongs to
+*/
+static void releaseData(Map map,MapDataElement data,unsigned int flags);
+
+/**
+* measureNodeData: setting the data size of a node in the list to the size of
+*                  its data, as measured by the measure function of the spill
+*                  mode or else as the length of its serialized data, if map
+*                  is in spill mode, and marking the node as referenced. Also
+*                  measuring the node against the byte budget of the cache
+*                  mode, if it has one
+* @param map - the map of the node
+* @param node - the node whose data is in memory
+*/
+static void measureNodeData(Map map,Node node);
+
+/**
+* countNode: adding the data size of a node which enters the list to the
+*            memory used by map, if it is in spill mode and the data is in
+*            memory, and its size to the bytes of the cache mode
+* @param map - the map of the node
+* @param node - the node entering the list
+*/
+static void countNode(Map map,Node node);
+
+/**
+* uncountNode: the opposite of countNode, for a node which leaves the list or
+*              whose data is replaced
+* @param map - the map of the node
+* @param node - the node
+*/
+static void uncountNode(Map map,Node node);
+
+/**
+* passNode: moving the clock hand of the spill mode past a node which leaves
+*           the list, unpinning it, and removing its data from the memory used
+* @param map - the map of the node
+* @param node - the node leaving the list
+*/
+static void passNode(Map map,Node node);
+
+/**
+* loadSpilledData: reading the spilled data of a node from the spill file
+* @param map - the map of the node
+* @param node - the node whose data was spilled
+* @return
+*    a new data element deserialized from the spill file
+*    NULL if reading or deserializing failed
+*/
+static MapDataElement loadSpilledData(Map map,Node node);
+
+/**
+* faultInData: bringing the data of a node back into memory if it was spilled,
+*              and marking the node as referenced
+* @param map - the map of the node
+* @param node - the node in the list
+* @return
+*    MAP_IO_ERROR if reading or deserializing the data failed
+*    MAP_SUCCESS otherwise
+*/
+static MapResult faultInData(Map map,Node node);
+
+/**
+* borrowNodeData: getting the data of a node for reading it once, without
+*                 bringing it back into memory if it was spilled
+* @param map - the map of the node
+* @param node - the node
+* @return
+*    the data of the node, or a temporary copy of its spilled data, to be
+*    given back with returnNodeData
+*    NULL if reading or deserializing spilled data failed
+*/
+static MapDataElement borrowNodeData(Map map,Node node);
+
+/**
+* returnNodeData: giving back data got from borrowNodeData
+* @param map - the map of the node
+* @param node - the node
+* @param data - the data borrowed
+*/
+static void returnNodeData(Map map,Node node,MapDataElement data);
+
+/**
+* serializeNodeData: serializing the data of a node with serializeElement,
+*                    reading it from the spill file if it was spilled
+* @param map - the map of the node
+* @param node - the node
+* @param serialize - the serialize function
+* @param buffer - pointer to the buffer to serialize into, which may be
+*        replaced by a bigger one
+* @param capacity - pointer to the capacity of the buffer
+* @param length - a variable to store the length of the serialized data
+* @return
+*    MAP_OUT_OF_MEMORY if growing the buffer failed
+*    MAP_IO_ERROR if reading or serializing the data failed
+*    MAP_SUCCESS otherwise
+*/
+static MapResult serializeNodeData(Map map,Node node,
+                                   serializeMapElement serialize,
+                                   unsigned char **buffer,int *capacity,
+                                   int *length);
+
+/**
+* spillNodeData: writing the data of a node to the end of the spill file and
+*                replacing it by a stub
+* @param map - the map in spill mode
+* @param node - the node in the list, whose data is in memory
+* @return
+*    MAP_OUT_OF_MEMORY if an allocation failed
+*    MAP_IO_ERROR if serializing or writing failed
+*    MAP_SUCCESS otherwise
+*/
+static MapResult spillNodeData(Map map,Node node);
+
+/**
+* pinNode: keeping the data of a node returned by mapGet in memory, in place
+*          of the node pinned the longest
+* @param spill - the spill mode of the map of the node
+* @param node - the node to pin
+*/
+static void pinNode(Spill spill,Node node);
+
+/**
+* isPinned: checking whether the data of a node must stay in memory
+* @param spill - the spill mode of the map of the node
+* @param node - the node
+* @return
+*    true if the node is pinned
+*    false otherwise
+*/
+static bool isPinned(Spill spill,Node node);
+
+/**
+* enforceBudget: spilling the data of unpinned nodes in the order of the clock
+*                until the data in memory fit in the budget of map, and
+*                compacting the spill file if most of it is unused
+* @param map - the map in spill mode
+*/
+static void enforceBudget(Map map);
+
+/**
+* openSpillFile: creating a new spill file with a unique name starting with
+*                path, so no existing file is overwritten, and unlinking it
+* @param path - the path the name of the file starts with
+* @return
+*    the file descriptor of the file
+*    -1 if it cannot be created
+*/
+static int openSpillFile(const char *path);
+
+/**
+* compactSpillFile: moving the spilled data of map to a new spill file with
+*                   no unused space
+* @param map - the map in spill mode, with no active savepoint
+* @return
+*    MAP_OUT_OF_MEMORY if an allocation failed
+*    MAP_IO_ERROR if reading or writing failed, leaving the old spill file
+*    MAP_SUCCESS otherwise
+*/
+static MapResult compactSpillFile(Map map);
+
+/**
+* destroySpill: closing the spill file of a spill mode and deallocating it
+* @param spill - the spill mode to destroy
+*/
+static void destroySpill(Spill spill);
+
+/**
+* shipChanges: shipping the pending records of a primary map with
+*              appendToBacklog, and reporting a disconnection of the follower
+*              since the last call
+* @param replication - the change stream of the primary map
+* @return
+*    MAP_IO_ERROR if the follower was disconnected by a failure
+*    MAP_SUCCESS otherwise
+*/
+static MapResult shipChanges(Replication replication);
+
+/**
+* appendToBacklog: writing the pending records of a primary map to the
+*                  follower, appending them to the backlog and trimming the
+*                  oldest records off it. The follower is disconnected if
+*                  writing fails
+* @param replication - the change stream of the primary map, with pending
+*        records
+*/
+static void appendToBacklog(Replication replication);
+
+/**
+* shipRecords: writing change records to the follower of a primary map,
+*              disconnecting it if writing fails
+* @param replication - the change stream of the primary map
+* @param bytes - the records
+* @param count - the number of bytes of the records
+* @return
+*    MAP_IO_ERROR if writing failed
+*    MAP_SUCCESS otherwise
+*/
+static MapResult shipRecords(Replication replication,
+                             const unsigned char *bytes,size_t count);
+
+/**
+* findBacklogRecord: finding the record following a sequence number in the
+*                    backlog of a primary map
+* @param replication - the change stream of the primary map
+* @param sequence - the sequence number of the latest change the follower
+*        has
+* @param offset - a variable to store the offset of the record in the backlog
+* @return
+*    false if the backlog does not reach back to the record
+*    true otherwise
+*/
+static bool findBacklogRecord(Replication replication,uint64_t sequence,
+                              size_t *offset);
+
+/**
+* resynchronize: shipping the whole map to its follower, as a clear followed
+*                by a put of every element, all numbered with the sequence
+*                number of the latest change
+* @param map - the primary map
+* @return
+*    MAP_OUT_OF_MEMORY if an allocation failed
+*    MAP_IO_ERROR if serializing an element or writing failed
+*    MAP_SUCCESS otherwise
+*/
+static MapResult resynchronize(Map map);
+
+/**
+* destroyReplication: closing the file descriptor of the follower of a
+*                     primary map and deallocating its change stream
+* @param replication - the change stream to destroy
+*/
+static void destroyReplication(Replication replication);
+
+/**
+* pushRecentNode: putting a node that is in no recency list of a cache at the
+*                 most recently used end of one
+* @param cache - the cache
+* @param node - the node to link
+* @param list - the CacheList to put the node in
+*/
+static void pushRecentNode(Cache cache,Node node,int list);
+
+/**
+* linkRecentNode: putting a node that is in no recency list of a cache at the
+*                 most recently used end of its window
+* @param map - the map the node is in
+* @param node - the node to link
+*/
+static void linkRecentNode(Map map,Node node);
+
+/**
+* unlinkRecentNode: taking a node out of its recency list of a cache
+* @param map - the map the node is in
+* @param node - the node to unlink
+*/
+static void unlinkRecentNode(Map map,Node node);
+
+/**
+* touchNode: counting an access to a node of a cache, and moving it to the
+*            most recently used end of its recency list (a node on probation
+*            becoming protected)
+* @param map - the map the node is in
+* @param node - the node used
+*/
+static void touchNode(Map map,Node node);
+
+/**
+* countAccess: counting an access to a key in the frequency sketch of a
+*              TinyLFU cache, aging the sketch once enough were counted
+* @param cache - the cache
+* @param key - the key accessed, which may not be in the map
+*/
+static void countAccess(Cache cache,MapKeyElement key);
+
+/**
+* estimateFrequency: estimating how often a key was accessed lately
+* @param cache - the TinyLFU cache
+* @param key - the key
+* @return
+*    the least of the counters of the key in the rows of the sketch
+*/
+static int estimateFrequency(Cache cache,MapKeyElement key);
+
+/**
+* sketchIndex: computing the position of the counter of a key in a row of the
+*              frequency sketch
+* @param cache - the TinyLFU cache
+* @param hash - the hash of the key, mixed further for every row
+* @param row - the row
+* @return
+*    the index of the counter in the sketch
+*/
+static size_t sketchIndex(Cache cache,uint64_t *hash,int row);
+
+/**
+* resizeSketch: giving the frequency sketch of a TinyLFU cache a width fit for
+*               its capacity, forgetting the counts if it changes
+* @param cache - the TinyLFU cache
+* @return
+*    MAP_OUT_OF_MEMORY if an allocation failed
+*    MAP_SUCCESS otherwise
+*/
+static MapResult resizeSketch(Cache cache);
+
+/**
+* windowCapacity: computing the number of nodes the window of a TinyLFU cache
+*                 holds, 1% of its capacity, and the number the main area
+*                 holds. With a byte budget the map may fit fewer keys than
+*                 its capacity, so the keys it holds are divided instead
+* @param map - the map in cache mode
+* @param main_capacity - a variable to store the capacity of the main area
+* @return
+*    the capacity of the window, at least 1
+*/
+static int windowCapacity(Map map,int *main_capacity);
+
+/**
+* moveAllRecentNodes: moving every node of a cache into one recency list,
+*                     keeping them in order of recency as far as it is known
+* @param cache - the cache
+* @param list - the CacheList to move the nodes to
+*/
+static void moveAllRecentNodes(Cache cache,int list);
+
+/**
+* selectVictim: choosing the node a cache over its capacity evicts next. A
+*               TinyLFU cache first moves the nodes leaving its window into its
+*               main area, or, when the main area is full, chooses between the
+*               node leaving the window and the least recently used one of the
+*               main area by how often they were accessed
+* @param map - the map in cache mode
+* @return
+*    the node to evict
+*/
+static Node selectVictim(Map map);
+
+/**
+* isOverCapacity: checking whether a cache holds more keys than its capacity,
+*                 or more bytes than its byte budget
+* @param map - the map in cache mode
+* @return
+*    true if the map has to evict nodes
+*    false otherwise
+*/
+static bool isOverCapacity(Map map);
+
+/**
+* enforceCapacity: evicting nodes of a cache, as chosen by its policy, until
+*                  it is within its capacity and byte budget. If the undo log
+*                  cannot make room for the evictions the map is left over
+*                  its capacity, until the next change
+* @param map - the map in cache mode
+*/
+static void enforceCapacity(Map map);
+
+/**
+* writeBackNode: evicting a dirty node of a cache with a write-back hook,
+*                adding its key and data to the batch of the hook and giving
+*                the batch to the hook once it is full. While a savepoint is
+*                active the eviction may be rolled back, so copies of the key
+*                and data are added, and the node is kept by the undo log
+* @param map - the map in cache mode
+* @param prev_node - the node previous to the evicted node
+* @return
+*    MAP_OUT_OF_MEMORY if copying failed
+*    MAP_IO_ERROR if reading spilled data failed
+*    MAP_SUCCESS otherwise (only then the node was evicted)
+*/
+static MapResult writeBackNode(Map map,Node prev_node);
+
+/**
+* flushWriteBack: giving the batch of evicted dirty nodes of a cache to its
+*                 write-back hook, if it is not empty
+* @param cache - the cache
+*/
+static void flushWriteBack(Cache cache);
+
+/**
+* destroyCache: deallocating the cache mode of a map, giving what is left in
+*               its write-back batch to the hook first
+* @param cache - the cache mode to destroy
+*/
+static void destroyCache(Cache cache);
+
+/**
+* currentTime: reading the monotonic clock
+* @return
+*    the current time in milliseconds
+*/
+static long long currentTime(void);
+
+/**
+* currentNanoseconds: reading the monotonic clock precisely
+* @return
+*    the current time in nanoseconds
+*/
+static long long currentNanoseconds(void);
+
+/**
+* beginOperation: counting a call of an operation of map, starting to time it
+*                 if its latencies are tracked or it is traced, and calling
+*                 the begin trace hook
+* @param map - the map, may be NULL
+* @param operation - the operation
+* @param key - the key the operation was given, NULL if none
+* @return
+*    the current time in nanoseconds, 0 if the operation is not timed
+*/
+static long long beginOperation(Map map,MapOperation operation,
+                                MapKeyElement key);
+
+/**
+* endOperation: recording the latency of an operation of map timed by
+*               beginOperation, and calling the end trace hook
+* @param map - the map, may be NULL
+* @param operation - the operation
+* @param key - the key the operation was given, NULL if none
+* @param result - the result of the operation
+* @param start - the time the operation started at, as read by beginOperation
+*/
+static void endOperation(Map map,MapOperation operation,MapKeyElement key,
+                         MapResult result,long long start);
+
+/**
+* lookupResult: the result code reported for an operation which does not
+*               return one
+* @param valid - whether the operation was given valid arguments
+* @param found - whether the operation found what it looked for
+* @return
+*    MAP_NULL_ARGUMENT if not valid
+*    MAP_SUCCESS if found
+*    MAP_ITEM_DOES_NOT_EXIST otherwise
+*/
+static MapResult lookupResult(bool valid,bool found);
+
+/**
+* latencyBucket: finding the bucket of a latency histogram a latency is in
+* @param latency - the latency in nanoseconds
+* @return
+*    the index of the bucket
+*/
+static int latencyBucket(long long latency);
+
+/**
+* latencyBucketEnd: finding the highest latency in a bucket of a latency
+*                   histogram
+* @param bucket - the index of the bucket
+* @return
+*    the latency in nanoseconds
+*/
+static long long latencyBucketEnd(int bucket);
+
+/**
+* createExpiry: giving map an empty timer wheel, if it has none
+* @param map - the map to give the timer wheel
+* @return
+*    MAP_OUT_OF_MEMORY if an allocation failed
+*    MAP_SUCCESS otherwise
+*/
+static MapResult createExpiry(Map map);
+
+/**
+* linkTimer: putting a node with an expiry time in the slot of the timer wheel
+*            its expiry time falls in
+* @param expiry - the timer wheel
+* @param node - the node, which is in no slot
+*/
+static void linkTimer(Expiry expiry,Node node);
+
+/**
+* unlinkTimer: taking a node out of its slot of the timer wheel of map, if it
+*              is in one. Its expiry time is kept
+* @param map - the map the node is in
+* @param node - the node to unlink
+*/
+static void unlinkTimer(Map map,Node node);
+
+/**
+* relinkTimer: putting a node back into the timer wheel of map after it was
+*              put back in the list, if it has an expiry time
+* @param map - the map the node is in
+* @param node - the node to link
+*/
+static void relinkTimer(Map map,Node node);
+
+/**
+* setNodeExpiry: changing the expiry time of a node
+* @param map - the map the node is in, which has a timer wheel if expires_at
+*        is not 0
+* @param node - the node
+* @param expires_at - the new expiry time, 0 if the key should never expire
+*/
+static void setNodeExpiry(Map map,Node node,long long expires_at);
+
+/**
+* hasExpired: checking whether the key of a node expired
+* @param node - the node to check
+* @return
+*    true if the node has an expiry time which passed
+*    false otherwise
+*/
+static bool hasExpired(Node node);
+
+/**
+* removeExpiredNode: removing the node following prev_node, which expired,
+*                    from a function that does not change the iterator. The
+*                    node is left to mapExpireTick if it is the current node of
+*                    the iterator or the undo log cannot make room for it
+* @param map - the map the node is in
+* @param prev_node - the node previous to the expired node
+*/
+static void removeExpiredNode(Map map,Node prev_node);
+
+/**
+* cascadeSlot: moving the nodes of a slot of a level above 0 of the timer
+*              wheel to the slots they belong in now
+* @param expiry - the timer wheel
+* @param level - the level of the slot
+* @param slot - the index of the slot in its level
+*/
+static void cascadeSlot(Expiry expiry,int level,int slot);
+
+/**
+* advanceWheel: removing the nodes of map which expired by now, advancing its
+*               timer wheel
+* @param map - the map with a timer wheel
+* @param now - the current time
+* @param limit - the maximal number of nodes to remove
+* @return
+*    the number of nodes removed
+*/
+static int advanceWheel(Map map,long long now,int limit);
+
+/**
+* putElement: the implementation of mapPut and mapPutWithTTL
+* @param map - the map
+* @param keyElement - the key to put
+* @param dataElement - the data to put
+* @param expires_at - the expiry time of the key, 0 if it should never expire
+* @return
+*    as mapPut
+*/
+static MapResult putElement(Map map,MapKeyElement keyElement,
+                            MapDataElement dataElement,long long expires_at);
+
+/**
+* containsElement, getElement, removeElement, getFirstKey, getNextKey, copyMap,
+* clearMap, computeElement, mergeElement, putElements, commitTxn: the
+*     implementations of mapContains, mapGet, mapRemove, mapGetFirst,
+*     mapGetNext, mapCopy, mapClear, mapCompute, mapMergeValue, mapPutBatch
+*     and mapTxnCommit, which time and trace them (see mapSetLatencyTracking
+*     and mapSetTraceHooks)
+* @param, @return - as the functions they implement
+*/
+static bool containsElement(Map map,MapKeyElement element);
+static MapDataElement getElement(Map map,MapKeyElement keyElement);
+static MapResult removeElement(Map map,MapKeyElement keyElement);
+static MapKeyElement getFirstKey(Map map);
+static MapKeyElement getNextKey(Map map);
+static Map copyMap(Map map);
+static MapResult clearMap(Map map);
+static MapResult computeElement(Map map,MapKeyElement keyElement,
+                                computeMapDataElement compute,void* context);
+static MapResult mergeElement(Map map,MapKeyElement keyElement,
+                              MapDataElement dataElement,
+                              mergeMapDataElements combine);
+static MapResult putElements(Map map,MapKeyElement* keyElements,
+                             MapDataElement* dataElements,int count);
+static MapResult commitTxn(MapTxn txn);
+
+/**
+* saveMap, loadMap, checkpointMap, saveCompressed, checkpointIncremental,
+* restoreCheckpoint, setMemoryBudget, replicateMap, applyReplication,
+* setCapacity, setEvictionPolicy, setByteBudget, setWriteBack: the
+*     implementations of mapSave, mapLoad, mapCheckpoint, mapSaveCompressed,
+*     mapCheckpointIncremental, mapRestoreCheckpoint, mapSetMemoryBudget,
+*     mapReplicate, mapFollowerApply, mapSetCapacity, mapSetEvictionPolicy,
+*     mapSetByteBudget and mapSetWriteBack, which count, time and trace them
+*     (the map's own uses of mapSave and mapLoad are not counted)
+* @param, @return - as the functions they implement
+*/
+static MapResult saveMap(Map map,FILE* stream,serializeMapElement serializeKey,
+                         serializeMapElement serializeData);
+static MapResult loadMap(Map map,FILE* stream,
+                         deserializeMapElement deserializeKey,
+                         deserializeMapElement deserializeData);
+static MapResult checkpointMap(Map map);
+static MapResult saveCompressed(Map map,FILE* stream,
+                                serializeMapElement serializeKey,
+                                serializeMapElement serializeData,
+                                MapKeyEncoding keyEncoding);
+static MapResult checkpointIncremental(Map map,const char* path,
+                                       serializeMapElement serializeKey,
+                                       serializeMapElement serializeData);
+static MapResult restoreCheckpoint(Map map,const char* path,
+                                   deserializeMapElement deserializeKey,
+                                   deserializeMapElement deserializeData);
+static MapResult setMemoryBudget(Map map,const char* path,long long budget,
+                                 serializeMapElement serializeData,
+                                 deserializeMapElement deserializeData,
+                                 measureMapElement measureData);
+static MapResult replicateMap(Map map,int fd,serializeMapElement serializeKey,
+                              serializeMapElement serializeData,
+                              uint64_t fromSequence);
+static MapResult applyReplication(MapFollower follower,int fd);
+static MapResult setCapacity(Map map,int capacity,evictMapElements evict,
+                             void* context);
+static MapResult setEvictionPolicy(Map map,MapEvictionPolicy policy,
+                                   hashMapKeyElements hashKey);
+static MapResult setByteBudget(Map map,long long budget,
+                               measureMapElement measureKey,
+                               measureMapElement measureData);
+static MapResult setWriteBack(Map map,writeBackMapElements writeBack,
+                              int batchSize,void* context);
+
+/**
+* initializeMap: initialize the fields of the map with given parameters
+* @param map - target map to initialize it's fields
+* @param copyDataElement - pointer to the data element copying function
+* @param copyKeyElement - pointer to the key element copying function
+* @param freeDataElement - pointer to the data element deallocating function
+* @param freeKeyElement - pointer to the key element deallocating function
+* @param compareKeyElements - pointer to the key comparing function
+* @param dummy_first - pointer to the previously allocated dummy first node
+*/
+static void initializeMap(Map map,copyMapDataElements copyDataElement,
+                          copyMapKeyElements copyKeyElement,
+                          freeMapDataElements freeDataElement,
+                          freeMapKeyElements freeKeyElement,
+                          compareMapKeyElements compareKeyElements,
+                          Node dummy_first);
+
+// functions implementations
+
+static Node allocateNode(Map map)
+{
+    Magazine magazine = getMagazine();
+    Node node = NULL;
+    if(magazine){
+        magazine->operations += 1;
+        if(!(magazine->nodes) ||
+           magazine->operations >= MAP_NODE_REBALANCE_INTERVAL){
+            rebalanceMagazine(magazine);
+        }
+        node = magazine->nodes;
+        if(node){
+            magazine->nodes = node->next;
+            magazine->size -= 1;
+        }
+    }
+    if(!node){
+        node = malloc(sizeof(*node));
+        if(!node){
+            return NULL;
+        }
+        COUNT_STAT(map,allocations);
+    }
+    node->state = NULL;
+    if(map->node_states && createNodeState(map,node,NULL) != MAP_SUCCESS){
+        releaseNode(node);
+        return NULL;
+    }
+
+    return node;
+}
+
+static MapResult createNodeState(Map map,Node node,Node prev)
+{
+    if(!(node->state)){
+        NodeState state = malloc(sizeof(*state));
+        if(!state){
+            return MAP_OUT_OF_MEMORY;
+        }
+        COUNT_STAT(map,allocations);
+        state->flags = 0;
+        state->data_size = 0;
+        state->cache_size = 0;
+        state->dirty = false;
+        state->expires_at = 0;
+        state->timer_slot = -1;
+        node->state = state;
+    }
+    node->state->prev = prev;
+
+    return MAP_SUCCESS;
+}
+
+static MapResult createNodeStates(Map map)
+{
+    if(map->node_states){
+        return MAP_SUCCESS;
+    }
+    MapResult result = MAP_SUCCESS;
+    for(Node prev = map->first; prev->next && result == MAP_SUCCESS;
+        prev = prev->next){
+        result = createNodeState(map,prev->next,prev);
+    }
+    // the nodes the undo log may put back into the list
+    for(int i = 0; i < map->undo_size && result == MAP_SUCCESS; i++){
+        UndoEntry *entry = &map->undo_log[i];
+        if(entry->type == UNDO_REMOVE){
+            result = createNodeState(map,entry->node,entry->prev);
+        }else if(entry->type == UNDO_CLEAR){
+            Node prev = map->first;
+            for(Node node = entry->node; node && result == MAP_SUCCESS;
+                node = node->next){
+                result = createNodeState(map,node,prev);
+                prev = node;
+            }
+        }
+    }
+    if(result == MAP_SUCCESS){
+        map->node_states = true;
+    }
+
+    return result;
+}
+
+static void setPrevNode(Node node,Node prev)
+{
+    if(node->state){
+        node->state->prev = prev;
+    }
+}
+
+static unsigned int nodeFlags(Node node)
+{
+    return node->state ? node->state->flags : 0;
+}
+
+static long long nodeExpiry(Node node)
+{
+    return node->state ? node->state->expires_at : 0;
+}
+
+static void releaseNode(Node node)
+{
+    free(node->state);
+    Magazine magazine = getMagazine();
+    if(!magazine){
+        free(node);
+        return;
+    }
+    magazine->operations += 1;
+    if(magazine->size == MAP_NODE_MAGAZINE_SIZE ||
+       magazine->operations >= MAP_NODE_REBALANCE_INTERVAL){
+        rebalanceMagazine(magazine);
+    }
+    node->next = magazine->nodes;
+    magazine->nodes = node;
+    magazine->size += 1;
+}
+
+static Magazine getMagazine(void)
+{
+    pthread_once(&magazine_key_once,createMagazineKey);
+    if(!magazine_key_created){
+        return NULL;
+    }
+    Magazine magazine = pthread_getspecific(magazine_key);
+    if(magazine){
+        return magazine;
+    }
+    magazine = malloc(sizeof(*magazine));
+    if(!magazine){
+        return NULL;
+    }
+    magazine->nodes = NULL;
+    magazine->size = 0;
+    magazine->operations = 0;
+    if(pthread_setspecific(magazine_key,magazine) != 0){
+        free(magazine);
+        return NULL;
+    }
+
+    return magazine;
+}
+
+static void createMagazineKey(void)
+{
+    magazine_key_created = pthread_key_create(&magazine_key,
+                                              destroyMagazine) == 0;
+}
+
+static void rebalanceMagazine(Magazine magazine)
+{
+    int half = MAP_NODE_MAGAZINE_SIZE / 2;
+    magazine->operations = 0;
+    pthread_mutex_lock(&node_pool_lock);
+    if(magazine->size > half){
+        moveFreeNodes(&magazine->nodes,&magazine->size,&node_pool,
+                      &node_pool_size,magazine->size - half);
+    }else{
+        moveFreeNodes(&node_pool,&node_pool_size,&magazine->nodes,
+                      &magazine->size,half - magazine->size);
+    }
+    pthread_mutex_unlock(&node_pool_lock);
+}
+
+static void destroyMagazine(void *magazine)
+{
+    Magazine thread_magazine = magazine;
+    pthread_mutex_lock(&node_pool_lock);
+    moveFreeNodes(&thread_magazine->nodes,&thread_magazine->size,&node_pool,
+                  &node_pool_size,thread_magazine->size);
+    if(maps_count == 0){
+        freeNodePool();
+    }
+    pthread_mutex_unlock(&node_pool_lock);
+    free(thread_magazine);
+}
+
+static void moveFreeNodes(Node *from,int *from_size,Node *to,int *to_size,
+                          int count)
+{
+    while(count-- && *from){
+        Node node = *from;
+        *from = node->next;
+        *from_size -= 1;
+        if(to == &node_pool && *to_size >= MAP_NODE_POOL_SIZE){
+            free(node);
+            continue;
+        }
+        node->next = *to;
+        *to = node;
+        *to_size += 1;
+    }
+}
+
+static void leaveNodePool(void)
+{
+    pthread_mutex_lock(&node_pool_lock);
+    maps_count -= 1;
+    bool last_map = maps_count == 0;
+    if(last_map){
+        freeNodePool();
+    }
+    pthread_mutex_unlock(&node_pool_lock);
+    Magazine magazine = last_map ? getMagazine() : NULL;
+    if(magazine){
+        pthread_setspecific(magazine_key,NULL);
+        destroyMagazine(magazine);
+    }
+}
+
+static void freeNodePool(void)
+{
+    while(node_pool){
+        Node node = node_pool;
+        node_pool = node->next;
+        free(node);
+    }
+    node_pool_size = 0;
+}
+
+static void freeNode(Map map,Node node)
+{
+    releaseData(map,node->data,nodeFlags(node));
+    freeKey(map,node->key);
+    releaseNode(node);
+}
+
+static void freeList(Map map,Node list)
+{
+    Node cur_node = list,temp;
+
+    while(cur_node != NULL){
+        temp = cur_node;
+        cur_node = cur_node->next;
+        freeNode(map,temp);
+    }
+}
+
+static Node createNewList(Map map,int length)
+{
+    Node new_list_head = NULL;
+
+    while(length--){
+        Node new_node = allocateNode(map);
+        if(!new_node){
+            releaseList(new_list_head);
+            return NULL;
+        }
+        new_node->next = new_list_head;
+        new_list_head = new_node;
+    }
+
+    return new_list_head;
+}
+
+static void releaseList(Node list)
+{
+    while(list != NULL){
+        Node temp = list;
+        list = list->next;
+        releaseNode(temp);
+    }
+}
+
+static MapResult copyList(Map src_map,Map new_map)
+{
+    if(!src_map || !new_map){
+        return MAP_NULL_ARGUMENT;
+    }
+
+    Node new_list_head = createNewList(new_map,src_map->size);
+    if(!new_list_head){
+        return MAP_OUT_OF_MEMORY;
+    }
+
+    Node new_list_cur = new_list_head;
+    Node new_list_prev = new_map->first;
+    Node src_list_cur = src_map->first->next;
+
+    while(src_list_cur != NULL){
+        // spilled data is read back as a new element, which is the copy
+        MapDataElement data = borrowNodeData(src_map,src_list_cur);
+        new_list_cur->data = data == src_list_cur->data ?
+                             copyData(src_map,data) : data;
+        new_list_cur->key = copyKey(src_map,src_list_cur->key);
+        if(!(new_list_cur->data) || !(new_list_cur->key)){
+            // the nodes before new_list_cur hold copies, the rest hold nothing
+            Node rest = new_list_cur->next;
+            new_list_cur->next = NULL;
+            freeList(new_map,new_list_head);
+            releaseList(rest);
+            return MAP_OUT_OF_MEMORY;
+        }
+        setPrevNode(new_list_cur,new_list_prev);
+        new_list_prev = new_list_cur;
+        src_list_cur = src_list_cur->next;
+        new_list_cur = new_list_cur->next;
+    }
+
+    new_map->first->next = new_list_head;
+    return MAP_SUCCESS;
+}
+
+static bool findPrevNode(Map map,Node *prev_node,MapKeyElement element)
+{
+    Node cur_node = map->first,next;
+    bool was_found = false;
+    int traversed = 0;
+
+    while(cur_node != NULL){
+        next = cur_node->next;
+        if(!next){
+            was_found = false;
+            break;
+        }
+        int result = compareKeys(map,element,next->key);
+        if(result == 0){
+            was_found = true;
+            break;
+        }
+        if(result < 0){
+            was_found = false;
+            break;
+        }
+        cur_node = next;
+        traversed++;
+    }
+
+    countSearch(map,traversed);
+    *prev_node = cur_node;
+    return was_found;
+}
+
+static void countSearch(Map map,int traversed)
+{
+#ifndef MAP_NO_STATS
+    map->stats.searches += 1;
+    map->stats.nodes_traversed += traversed;
+    if(traversed > map->stats.max_traversed){
+        map->stats.max_traversed = traversed;
+    }
+#else
+    (void)map;
+    (void)traversed;
+#endif
+}
+
+static int compareKeys(Map map,MapKeyElement first,MapKeyElement second)
+{
+    COUNT_STAT(map,compares);
+    return map->compare_keys(first,second);
+}
+
+static MapKeyElement copyKey(Map map,MapKeyElement key)
+{
+    COUNT_STAT(map,key_copies);
+    return map->copy_key(key);
+}
+
+static MapDataElement copyData(Map map,MapDataElement data)
+{
+    COUNT_STAT(map,data_copies);
+    return map->copy_data(data);
+}
+
+static void freeKey(Map map,MapKeyElement key)
+{
+    COUNT_STAT(map,key_frees);
+    map->free_key(key);
+}
+
+static void freeData(Map map,MapDataElement data)
+{
+    COUNT_STAT(map,data_frees);
+    map->free_data(data);
+}
+
+static Node createNewNode(Map map,MapKeyElement keyElement,
+                          MapDataElement dataElement)
+{
+    Node new_node = allocateNode(map);
+    if(!new_node){
+        return NULL;
+    }
+    new_node->key = copyKey(map,keyElement);
+    new_node->data = copyData(map,dataElement);
+    if(!(new_node->key) || !(new_node->data)){
+        freeNode(map,new_node);
+        return NULL;
+    }
+
+    return new_node;
+}
+
+static void insertNewNode(Node prev_node,Node new_node)
+{
+    new_node->next = prev_node->next;
+    setPrevNode(new_node,prev_node);
+    if(new_node->next){
+        setPrevNode(new_node->next,new_node);
+    }
+    prev_node->next = new_node;
+}
+
+static MapResult replaceNodeData(Map map,Node node,MapDataElement new_data)
+{
+    if(new_data == node->data){
+        // the data was changed in place, so its size may have changed
+        measureNodeData(map,node);
+        touchNode(map,node);
+        recordChange(map,CHANGE_PUT,node);
+        return MAP_SUCCESS;
+    }
+    MapDataElement data_copy = copyData(map,new_data);
+    if(!data_copy){
+        return MAP_OUT_OF_MEMORY;
+    }
+    setNodeData(map,node,data_copy);
+
+    return MAP_SUCCESS;
+}
+
+static void setNodeData(Map map,Node node,MapDataElement new_data)
+{
+    uncountNode(map,node);
+    NodeState state = node->state;
+    if(map->savepoints_count > 0){
+        logUndoEntry(map,UNDO_DATA,NULL,node,node->data,nodeFlags(node),
+                     state ? state->data_size : 0);
+    }else{
+        releaseData(map,node->data,nodeFlags(node));
+    }
+    node->data = new_data;
+    if(state){
+        state->flags = 0;
+        state->data_size = 0;
+        state->cache_size = 0;
+    }
+    measureNodeData(map,node);
+    touchNode(map,node);
+    recordChange(map,CHANGE_PUT,node);
+}
+
+static void removeNextNode(Map map,Node prev_node)
+{
+    Node node_to_remove = unlinkNextNode(map,prev_node);
+    if(map->savepoints_count > 0){
+        logUndoEntry(map,UNDO_REMOVE,prev_node,node_to_remove,NULL,0,0);
+    }else{
+        freeNode(map,node_to_remove);
+    }
+}
+
+static Node unlinkNextNode(Map map,Node prev_node)
+{
+    Node node = prev_node->next;
+    passNode(map,node);
+    unlinkRecentNode(map,node);
+    unlinkTimer(map,node);
+    prev_node->next = node->next;
+    if(node->next){
+        setPrevNode(node->next,prev_node);
+    }
+    recordChange(map,CHANGE_REMOVE,node);
+    map->size -= 1;
+
+    return node;
+}
+
+static void linkNewNode(Map map,Node prev_node,Node new_node)
+{
+    insertNewNode(prev_node,new_node);
+    if(map->savepoints_count > 0){
+        logUndoEntry(map,UNDO_INSERT,prev_node,new_node,NULL,0,0);
+    }
+    map->size += 1;
+    measureNodeData(map,new_node);
+    linkRecentNode(map,new_node);
+    recordChange(map,CHANGE_PUT,new_node);
+}
+
+static MapResult reserveUndoEntries(Map map,int count)
+{
+    if(map->savepoints_count == 0 ||
+       map->undo_size + count <= map->undo_capacity){
+        return MAP_SUCCESS;
+    }
+    int new_capacity = map->undo_capacity ? map->undo_capacity :
+                                            MAP_UNDO_INITIAL_CAPACITY;
+    while(new_capacity < map->undo_size + count){
+        new_capacity *= 2;
+    }
+    UndoEntry *new_log = realloc(map->undo_log,
+                                 new_capacity * sizeof(*new_log));
+    if(!new_log){
+        return MAP_OUT_OF_MEMORY;
+    }
+    map->undo_log = new_log;
+    map->undo_capacity = new_capacity;
+
+    return MAP_SUCCESS;
+}
+
+static void logUndoEntry(Map map,UndoType type,Node prev,Node node,
+                         MapDataElement data,unsigned int flags,int size)
+{
+    UndoEntry *entry = &map->undo_log[map->undo_size++];
+    entry->type = type;
+    entry->prev = prev;
+    entry->node = node;
+    entry->data = data;
+    entry->flags = flags;
+    entry->size = size;
+    entry->cache_size = node && node->state ? node->state->cache_size : 0;
+    entry->expires_at = node ? nodeExpiry(node) : 0;
+}
+
+static void undoEntry(Map map,UndoEntry *entry)
+{
+    switch(entry->type){
+        case UNDO_INSERT:
+            passNode(map,entry->node);
+            unlinkRecentNode(map,entry->node);
+            unlinkTimer(map,entry->node);
+            entry->prev->next = entry->node->next;
+            if(entry->node->next){
+                setPrevNode(entry->node->next,entry->prev);
+            }
+            recordChange(map,CHANGE_REMOVE,entry->node);
+            freeNode(map,entry->node);
+            map->size -= 1;
+            break;
+        case UNDO_REMOVE:
+            insertNewNode(entry->prev,entry->node);
+            map->size += 1;
+            countNode(map,entry->node);
+            // its place in the recency list is lost, so it counts as used
+            linkRecentNode(map,entry->node);
+            relinkTimer(map,entry->node);
+            recordChange(map,CHANGE_PUT,entry->node);
+            break;
+        case UNDO_DATA:
+            uncountNode(map,entry->node);
+            releaseData(map,entry->node->data,nodeFlags(entry->node));
+            entry->node->data = entry->data;
+            if(entry->node->state){
+                NodeState state = entry->node->state;
+                state->flags = entry->flags;
+                state->data_size = entry->size;
+                state->cache_size = map->cache && map->cache->byte_budget ?
+                                    entry->cache_size : 0;
+            }
+            countNode(map,entry->node);
+            if(nodeExpiry(entry->node) != entry->expires_at){
+                setNodeExpiry(map,entry->node,entry->expires_at);
+            }
+            recordChange(map,CHANGE_PUT,entry->node);
+            break;
+        case UNDO_CLEAR:
+            // every change made after the clear was already undone, so the
+            // list is empty again
+            map->first->next = entry->node;
+            if(entry->node){
+                setPrevNode(entry->node,map->first);
+            }
+            map->size = entry->size;
+            for(Node node = entry->node; node; node = node->next){
+                countNode(map,node);
+                linkRecentNode(map,node);
+                relinkTimer(map,node);
+                recordChange(map,CHANGE_PUT,node);
+            }
+            break;
+    }
+}
+
+static void discardEntry(Map map,UndoEntry *entry)
+{
+    switch(entry->type){
+        case UNDO_INSERT:
+            break;
+        case UNDO_REMOVE:
+            freeNode(map,entry->node);
+            break;
+        case UNDO_DATA:
+            releaseData(map,entry->data,entry->flags);
+            break;
+        case UNDO_CLEAR:
+            freeList(map,entry->node);
+            break;
+    }
+}
+
+static void truncateUndoLog(Map map,int size,bool undo)
+{
+    while(map->undo_size > size){
+        UndoEntry *entry = &map->undo_log[--map->undo_size];
+        if(undo){
+            undoEntry(map,entry);
+        }else{
+            discardEntry(map,entry);
+        }
+    }
+}
+
+static MapResult storeComputedData(Map map,Node prev_node,bool was_found,
+                                   MapKeyElement keyElement,
+                                   MapDataElement new_data)
+{
+    if(was_found){
+        if(!new_data){
+            removeNextNode(map,prev_node);
+            return MAP_SUCCESS;
+        }
+        return replaceNodeData(map,prev_node->next,new_data);
+    }
+    if(!new_data){
+        return MAP_SUCCESS;
+    }
+    Node new_node = createNewNode(map,keyElement,new_data);
+    if(!new_node){
+        return MAP_OUT_OF_MEMORY;
+    }
+    linkNewNode(map,prev_node,new_node);
+
+    return MAP_SUCCESS;
+}
+
+static MapResult stageOperation(MapTxn txn,MapKeyElement key,Node node)
+{
+    if(txn->size == txn->capacity){
+        int new_capacity = txn->capacity * 2;
+        StagedOperation *new_operations =
+                realloc(txn->operations,
+                        2 * new_capacity * sizeof(*new_operations));
+        if(!new_operations){
+            return MAP_OUT_OF_MEMORY;
+        }
+        txn->operations = new_operations;
+        txn->capacity = new_capacity;
+    }
+    txn->operations[txn->size].key = key;
+    txn->operations[txn->size].node = node;
+    txn->size += 1;
+
+    return MAP_SUCCESS;
+}
+
+static void sortOperations(Map map,StagedOperation *operations,
+                           StagedOperation *buffer,int size)
+{
+    for(int width = 1; width < size; width *= 2){
+        for(int low = 0; low < size; low += 2 * width){
+            int mid = low + width < size ? low + width : size;
+            int high = low + 2 * width < size ? low + 2 * width : size;
+            int left = low,right = mid,out = low;
+            while(left < mid && right < high){
+                if(compareKeys(map,operations[right].key,
+                                     operations[left].key) < 0){
+                    buffer[out++] = operations[right++];
+                }else{
+                    buffer[out++] = operations[left++];
+                }
+            }
+            while(left < mid){
+                buffer[out++] = operations[left++];
+            }
+            while(right < high){
+                buffer[out++] = operations[right++];
+            }
+        }
+        for(int i = 0; i < size; i++){
+            operations[i] = buffer[i];
+        }
+    }
+}
+
+static void discardOperation(Map map,StagedOperation *operation)
+{
+    if(operation->node){
+        freeNode(map,operation->node);
+    }else{
+        freeKey(map,operation->key);
+    }
+}
+
+static void applyOperations(Map map,StagedOperation *operations,int size)
+{
+    Node prev_node = map->first;
+
+    for(int i = 0; i < size; i++){
+        StagedOperation *operation = &operations[i];
+        if(i + 1 < size && compareKeys(map,operation->key,
+                                             operations[i + 1].key) == 0){
+            discardOperation(map,operation);
+            continue;
+        }
+        bool was_found = false;
+        prev_node = seekPrevNode(map,prev_node,operation->key,&was_found);
+
+        if(!(operation->node)){
+            if(was_found){
+                removeNextNode(map,prev_node);
+            }
+            freeKey(map,operation->key);
+        }else{
+            prev_node = mergeNode(map,prev_node,was_found,operation->node);
+        }
+    }
+}
+
+static Node seekPrevNode(Map map,Node prev_node,MapKeyElement element,
+                         bool *was_found)
+{
+    int result = -1,traversed = 0;
+    while(prev_node->next &&
+          (result = compareKeys(map,element,prev_node->next->key)) > 0){
+        prev_node = prev_node->next;
+        traversed++;
+    }
+    countSearch(map,traversed);
+    *was_found = prev_node->next && result == 0;
+
+    return prev_node;
+}
+
+static Node mergeNode(Map map,Node prev_node,bool was_found,Node node)
+{
+    if(!was_found){
+        linkNewNode(map,prev_node,node);
+        return node;
+    }
+    setNodeData(map,prev_node->next,node->data);
+    if(nodeExpiry(prev_node->next)){
+        // the key is put anew, so it no longer expires - as with mapPut
+        setNodeExpiry(map,prev_node->next,0);
+    }
+    freeKey(map,node->key);
+    releaseNode(node);
+
+    return prev_node->next;
+}
+
+static void storeUint32(unsigned char *bytes,uint32_t value)
+{
+    for(int i = 0; i < 4; i++){
+        bytes[i] = (unsigned char)(value >> (8 * i));
+    }
+}
+
+static uint32_t loadUint32(const unsigned char *bytes)
+{
+    uint32_t value = 0;
+    for(int i = 0; i < 4; i++){
+        value |= (uint32_t)bytes[i] << (8 * i);
+    }
+    return value;
+}
+
+static void storeUint64(unsigned char *bytes,uint64_t value)
+{
+    for(int i = 0; i < 8; i++){
+        bytes[i] = (unsigned char)(value >> (8 * i));
+    }
+}
+
+static uint64_t loadUint64(const unsigned char *bytes)
+{
+    uint64_t value = 0;
+    for(int i = 0; i < 8; i++){
+        value |= (uint64_t)bytes[i] << (8 * i);
+    }
+    return value;
+}
+
+static MapResult serializeElement(serializeMapElement serialize,void *element,
+                                  unsigned char **buffer,int *capacity,
+                                  int *length)
+{
+    *length = serialize(element,*buffer,*capacity);
+    if(*length > *capacity){
+        unsigned char *new_buffer = realloc(*buffer,*length);
+        if(!new_buffer){
+            return MAP_OUT_OF_MEMORY;
+        }
+        *buffer = new_buffer;
+        *capacity = *length;
+        *length = serialize(element,*buffer,*capacity);
+    }
+    if(*length < 0 || *length > *capacity){
+        return MAP_IO_ERROR;
+    }
+
+    return MAP_SUCCESS;
+}
+
+static MapResult writeElement(FILE *stream,serializeMapElement serialize,
+                              void *element,unsigned char **buffer,
+                              int *capacity)
+{
+    int length = 0;
+    MapResult result = serializeElement(serialize,element,buffer,capacity,
+                                        &length);
+    if(result != MAP_SUCCESS){
+        return result;
+    }
+    unsigned char length_bytes[4];
+    storeUint32(length_bytes,(uint32_t)length);
+    if(fwrite(length_bytes,1,4,stream) != 4 ||
+       fwrite(*buffer,1,length,stream) != (size_t)length){
+        return MAP_IO_ERROR;
+    }
+
+    return MAP_SUCCESS;
+}
+
+static MapResult readElement(FILE *stream,deserializeMapElement deserialize,
+                             unsigned char **buffer,int *capacity,
+                             void **element)
+{
+    unsigned char length_bytes[4];
+    if(fread(length_bytes,1,4,stream) != 4){
+        return MAP_IO_ERROR;
+    }
+    uint32_t length = loadUint32(length_bytes);
+    if(length > INT_MAX){
+        return MAP_IO_ERROR;
+    }
+    if((int)length > *capacity){
+        unsigned char *new_buffer = realloc(*buffer,length);
+        if(!new_buffer){
+            return MAP_OUT_OF_MEMORY;
+        }
+        *buffer = new_buffer;
+        *capacity = (int)length;
+    }
+    if(fread(*buffer,1,length,stream) != length){
+        return MAP_IO_ERROR;
+    }
+    *element = deserialize(*buffer,(int)length);
+
+    return *element ? MAP_SUCCESS : MAP_IO_ERROR;
+}
+
+static MapResult readSortedList(Map map,FILE *stream,int count,
+                                deserializeMapElement deserializeKey,
+                                deserializeMapElement deserializeData,
+                                Node *list)
+{
+    int capacity = MAP_SERIALIZE_INITIAL_CAPACITY;
+    unsigned char *buffer = malloc(capacity);
+    if(!buffer){
+        return MAP_OUT_OF_MEMORY;
+    }
+
+    struct node_t head;
+    head.next = NULL;
+    Node tail = &head;
+    MapResult result = MAP_SUCCESS;
+
+    while(count-- && result == MAP_SUCCESS){
+        Node node = allocateNode(map);
+        if(!node){
+            result = MAP_OUT_OF_MEMORY;
+            break;
+        }
+        result = readElement(stream,deserializeKey,&buffer,&capacity,
+                             &node->key);
+        if(result != MAP_SUCCESS){
+            releaseNode(node);
+            break;
+        }
+        if(tail != &head && compareKeys(map,node->key,tail->key) <= 0){
+            result = MAP_IO_ERROR;
+        }else{
+            result = readElement(stream,deserializeData,&buffer,&capacity,
+                                 &node->data);
+        }
+        if(result != MAP_SUCCESS){
+            freeKey(map,node->key);
+            releaseNode(node);
+            break;
+        }
+        node->next = NULL;
+        tail->next = node;
+        tail = node;
+    }
+
+    free(buffer);
+    if(result != MAP_SUCCESS){
+        freeList(map,head.next);
+        return result;
+    }
+    *list = head.next;
+
+    return MAP_SUCCESS;
+}
+
+static uint64_t alignImageOffset(uint64_t offset)
+{
+    return (offset + MAP_IMAGE_ALIGNMENT - 1) /
+           MAP_IMAGE_ALIGNMENT * MAP_IMAGE_ALIGNMENT;
+}
+
+static MapResult writeImageElement(FILE *stream,int length,
+                                   const unsigned char *buffer)
+{
+    static const unsigned char padding[MAP_IMAGE_ALIGNMENT] = {0};
+    size_t padding_length = alignImageOffset(length) - length;
+    if(fwrite(buffer,1,length,stream) != (size_t)length ||
+       fwrite(padding,1,padding_length,stream) != padding_length){
+        return MAP_IO_ERROR;
+    }
+
+    return MAP_SUCCESS;
+}
+
+static MapResult writeMappedImage(Map map,FILE *stream,
+                                  serializeMapElement serializeKey,
+                                  serializeMapElement serializeData)
+{
+    unsigned char *index = malloc((size_t)map->size * 8 + 1);
+    int key_capacity = MAP_SERIALIZE_INITIAL_CAPACITY;
+    int data_capacity = MAP_SERIALIZE_INITIAL_CAPACITY;
+    unsigned char *key_buffer = malloc(key_capacity);
+    unsigned char *data_buffer = malloc(data_capacity);
+    if(!index || !key_buffer || !data_buffer){
+        free(index);
+        free(key_buffer);
+        free(data_buffer);
+        return MAP_OUT_OF_MEMORY;
+    }
+
+    // the header is written last, once the offset of the index is known
+    unsigned char header[MAP_IMAGE_HEADER_SIZE] = {0};
+    MapResult result = MAP_SUCCESS;
+    if(fwrite(header,1,MAP_IMAGE_HEADER_SIZE,stream) != MAP_IMAGE_HEADER_SIZE){
+        result = MAP_IO_ERROR;
+    }
+    uint64_t offset = MAP_IMAGE_HEADER_SIZE;
+    int position = 0;
+    for(Node node = map->first->next; node && result == MAP_SUCCESS;
+        node = node->next){
+        int key_length = 0,data_length = 0;
+        result = serializeElement(serializeKey,node->key,&key_buffer,
+                                  &key_capacity,&key_length);
+        if(result == MAP_SUCCESS){
+            result = serializeNodeData(map,node,serializeData,&data_buffer,
+                                       &data_capacity,&data_length);
+        }
+        if(result != MAP_SUCCESS){
+            break;
+        }
+        unsigned char record_header[MAP_IMAGE_RECORD_HEADER_SIZE];
+        storeUint32(record_header,(uint32_t)key_length);
+        storeUint32(record_header + 4,(uint32_t)data_length);
+        if(fwrite(record_header,1,MAP_IMAGE_RECORD_HEADER_SIZE,stream) !=
+           MAP_IMAGE_RECORD_HEADER_SIZE){
+            result = MAP_IO_ERROR;
+        }
+        if(result == MAP_SUCCESS){
+            result = writeImageElement(stream,key_length,key_buffer);
+        }
+        if(result == MAP_SUCCESS){
+            result = writeImageElement(stream,data_length,data_buffer);
+        }
+        storeUint64(index + 8 * position++,offset);
+        offset += MAP_IMAGE_RECORD_HEADER_SIZE + alignImageOffset(key_length) +
+                  alignImageOffset(data_length);
+    }
+
+    if(result == MAP_SUCCESS &&
+       fwrite(index,1,(size_t)map->size * 8,stream) != (size_t)map->size * 8){
+        result = MAP_IO_ERROR;
+    }
+    if(result == MAP_SUCCESS){
+        for(int i = 0; i < 4; i++){
+            header[i] = (unsigned char)MAP_IMAGE_MAGIC[i];
+        }
+        storeUint32(header + 4,MAP_IMAGE_VERSION);
+        storeUint64(header + 8,(uint64_t)map->size);
+        storeUint64(header + 16,offset);
+        if(fseek(stream,0,SEEK_SET) != 0 ||
+           fwrite(header,1,MAP_IMAGE_HEADER_SIZE,stream) !=
+           MAP_IMAGE_HEADER_SIZE || fflush(stream) != 0){
+            result = MAP_IO_ERROR;
+        }
+    }
+
+    free(index);
+    free(key_buffer);
+    free(data_buffer);
+    return result;
+}
+
+static MappedMap mapImage(int fd,compareMapKeyElements compareKeyElements)
+{
+    struct stat file_status;
+    if(fstat(fd,&file_status) != 0 ||
+       file_status.st_size < MAP_IMAGE_HEADER_SIZE){
+        return NULL;
+    }
+    size_t image_size = (size_t)file_status.st_size;
+    void *image = mmap(NULL,image_size,PROT_READ,MAP_SHARED,fd,0);
+    if(image == MAP_FAILED){
+        return NULL;
+    }
+
+    const unsigned char *header = image;
+    uint64_t count = loadUint64(header + 8);
+    uint64_t index_offset = loadUint64(header + 16);
+    bool is_image = true;
+    for(int i = 0; i < 4; i++){
+        is_image = is_image && header[i] == (unsigned char)MAP_IMAGE_MAGIC[i];
+    }
+    if(!is_image || loadUint32(header + 4) != MAP_IMAGE_VERSION ||
+       count > INT_MAX || index_offset % MAP_IMAGE_ALIGNMENT != 0 ||
+       index_offset > image_size || count > (image_size - index_offset) / 8){
+        munmap(image,image_size);
+        return NULL;
+    }
+
+    MappedMap map = malloc(sizeof(*map));
+    if(!map){
+        munmap(image,image_size);
+        return NULL;
+    }
+    map->image = image;
+    map->image_size = image_size;
+    map->size = (int)count;
+    map->index_offset = index_offset;
+    map->compare_keys = compareKeyElements;
+    map->iterator = -1;
+    map->mode = MAP_OPEN_DEFAULT;
+    map->readahead_end = 0;
+
+    return map;
+}
+
+static void adviseImage(MappedMap map)
+{
+    unsigned char *image = (unsigned char*)map->image;
+    // advice is given for whole pages, the records ending in the page where
+    // the index starts
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    size_t index_page = map->index_offset - map->index_offset % page_size;
+    switch(map->mode){
+        case MAP_OPEN_DEFAULT:
+            break;
+        case MAP_OPEN_LAZY:
+            // lookups jump around the records, so reading around a missing
+            // page only wastes memory, while the index is what every lookup
+            // searches
+            posix_madvise(image,index_page,POSIX_MADV_RANDOM);
+            posix_madvise(image + index_page,map->image_size - index_page,
+                          POSIX_MADV_WILLNEED);
+            break;
+        case MAP_OPEN_EAGER:
+            posix_madvise(image,map->image_size,POSIX_MADV_WILLNEED);
+            break;
+    }
+}
+
+static void readAhead(MappedMap map,const unsigned char *key)
+{
+    uint64_t offset = (uint64_t)(key - map->image);
+    if(map->mode != MAP_OPEN_LAZY ||
+       offset + MAP_IMAGE_READAHEAD / 2 < map->readahead_end){
+        return;
+    }
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+    uint64_t start = offset > map->readahead_end ? offset : map->readahead_end;
+    start -= start % page_size;
+    uint64_t end = offset + MAP_IMAGE_READAHEAD;
+    if(end > map->index_offset){
+        end = map->index_offset;
+    }
+    if(end > start){
+        posix_madvise((unsigned char*)map->image + start,end - start,
+                      POSIX_MADV_WILLNEED);
+    }
+    map->readahead_end = end;
+}
+
+static const unsigned char *imageRecord(MappedMap map,int position,
+                                        uint32_t *key_length,
+                                        uint32_t *data_length)
+{
+    uint64_t offset = loadUint64(map->image + map->index_offset +
+                                 8 * (uint64_t)position);
+    if(offset % MAP_IMAGE_ALIGNMENT != 0 ||
+       offset > map->index_offset - MAP_IMAGE_RECORD_HEADER_SIZE){
+        return NULL;
+    }
+    *key_length = loadUint32(map->image + offset);
+    *data_length = loadUint32(map->image + offset + 4);
+    uint64_t record_size = MAP_IMAGE_RECORD_HEADER_SIZE +
+                           alignImageOffset(*key_length) +
+                           alignImageOffset(*data_length);
+    if(record_size > map->index_offset - offset){
+        return NULL;
+    }
+
+    return map->image + offset + MAP_IMAGE_RECORD_HEADER_SIZE;
+}
+
+static bool appendBytes(ByteBuffer *buffer,const void *bytes,size_t count)
+{
+    if(buffer->size + count > buffer->capacity){
+        size_t new_capacity = buffer->capacity ? buffer->capacity : 256;
+        while(new_capacity < buffer->size + count){
+            new_capacity *= 2;
+        }
+        unsigned char *new_bytes = realloc(buffer->bytes,new_capacity);
+        if(!new_bytes){
+            return false;
+        }
+        buffer->bytes = new_bytes;
+        buffer->capacity = new_capacity;
+    }
+    if(bytes && count > 0){
+        memcpy(buffer->bytes + buffer->size,bytes,count);
+    }
+    buffer->size += count;
+
+    return true;
+}
+
+static uint32_t checksumBytes(const unsigned char *bytes,size_t count)
+{
+    return updateChecksum(2166136261u,bytes,count);
+}
+
+static uint32_t updateChecksum(uint32_t checksum,const unsigned char *bytes,
+                               size_t count)
+{
+    for(size_t i = 0; i < count; i++){
+        checksum = (checksum ^ bytes[i]) * 16777619u;
+    }
+    return checksum;
+}
+
+static bool checksumFile(const char *path,uint32_t *checksum)
+{
+    FILE *stream = fopen(path,"rb");
+    if(!stream){
+        return false;
+    }
+    unsigned char buffer[4096];
+    size_t count;
+    *checksum = checksumBytes(NULL,0);
+    while((count = fread(buffer,1,sizeof(buffer),stream)) > 0){
+        *checksum = updateChecksum(*checksum,buffer,count);
+    }
+    bool result = !ferror(stream);
+    fclose(stream);
+
+    return result;
+}
+
+static MapResult encodeRecord(RecordEncoder *encoder,ByteBuffer *out,
+                              ChangeType type,uint64_t sequence,
+                              MapKeyElement key,MapDataElement data)
+{
+    int key_length = 0,data_length = 0;
+    MapResult result = MAP_SUCCESS;
+    if(key){
+        result = serializeElement(encoder->serialize_key,key,
+                                  &encoder->key_buffer,&encoder->key_capacity,
+                                  &key_length);
+    }
+    if(result == MAP_SUCCESS && data){
+        result = serializeElement(encoder->serialize_data,data,
+                                  &encoder->data_buffer,
+                                  &encoder->data_capacity,&data_length);
+    }
+    if(result != MAP_SUCCESS){
+        return result;
+    }
+
+    size_t start = out->size;
+    unsigned char fields[MAP_RECORD_HEADER_SIZE + 13];
+    fields[MAP_RECORD_HEADER_SIZE] = (unsigned char)type;
+    storeUint64(fields + MAP_RECORD_HEADER_SIZE + 1,sequence);
+    storeUint32(fields + MAP_RECORD_HEADER_SIZE + 9,(uint32_t)key_length);
+    unsigned char data_length_bytes[4];
+    storeUint32(data_length_bytes,(uint32_t)data_length);
+    bool appended = appendBytes(out,fields,sizeof(fields)) &&
+                    appendBytes(out,encoder->key_buffer,key_length) &&
+                    appendBytes(out,data_length_bytes,4) &&
+                    appendBytes(out,encoder->data_buffer,data_length);
+    if(!appended){
+        out->size = start;
+        return MAP_OUT_OF_MEMORY;
+    }
+    unsigned char *record = out->bytes + start;
+    size_t body_length = out->size - start - MAP_RECORD_HEADER_SIZE;
+    storeUint32(record,(uint32_t)body_length);
+    storeUint32(record + 4,checksumBytes(record + MAP_RECORD_HEADER_SIZE,
+                                         body_length));
+
+    return MAP_SUCCESS;
+}
+
+static bool decodeRecord(const unsigned char *body,size_t length,
+                         ChangeRecord *record)
+{
+    if(length < 17){
+        return false;
+    }
+    record->type = (ChangeType)body[0];
+    record->sequence = loadUint64(body + 1);
+    record->key_length = loadUint32(body + 9);
+    if(record->key_length > length - 17){
+        return false;
+    }
+    record->key = body + 13;
+    record->data_length = loadUint32(body + 13 + record->key_length);
+    record->data = body + 17 + record->key_length;
+    if(record->data_length != length - 17 - record->key_length){
+        return false;
+    }
+
+    switch(record->type){
+        case CHANGE_PUT:
+            return true;
+        case CHANGE_REMOVE:
+            return record->data_length == 0;
+        case CHANGE_CLEAR:
+            return record->key_length == 0 && record->data_length == 0;
+    }
+    return false;
+}
+
+static MapResult readRecord(FILE *stream,ByteBuffer *body)
+{
+    unsigned char header[MAP_RECORD_HEADER_SIZE];
+    if(fread(header,1,MAP_RECORD_HEADER_SIZE,stream) !=
+       MAP_RECORD_HEADER_SIZE){
+        return MAP_IO_ERROR;
+    }
+    uint32_t length = loadUint32(header);
+    if(length > INT_MAX){
+        return MAP_IO_ERROR;
+    }
+    body->size = 0;
+    if(length > body->capacity){
+        unsigned char *new_bytes = realloc(body->bytes,length);
+        if(!new_bytes){
+            return MAP_OUT_OF_MEMORY;
+        }
+        body->bytes = new_bytes;
+        body->capacity = length;
+    }
+    if(fread(body->bytes,1,length,stream) != length ||
+       checksumBytes(body->bytes,length) != loadUint32(header + 4)){
+        return MAP_IO_ERROR;
+    }
+    body->size = length;
+
+    return MAP_SUCCESS;
+}
+
+static MapResult applyRecord(Map map,ChangeRecord *record,
+                             deserializeMapElement deserializeKey,
+                             deserializeMapElement deserializeData)
+{
+    if(record->type == CHANGE_CLEAR){
+        return clearMap(map);
+    }
+    MapKeyElement key = deserializeKey(record->key,(int)record->key_length);
+    if(!key){
+        return MAP_IO_ERROR;
+    }
+    bool was_found = false;
+    Node prev_node = seekPrevNode(map,map->first,key,&was_found);
+
+    if(record->type == CHANGE_REMOVE){
+        if(was_found){
+            removeNextNode(map,prev_node);
+        }
+        freeKey(map,key);
+        return MAP_SUCCESS;
+    }
+    Node node = allocateNode(map);
+    if(!node){
+        freeKey(map,key);
+        return MAP_OUT_OF_MEMORY;
+    }
+    node->key = key;
+    node->data = deserializeData(record->data,(int)record->data_length);
+    if(!(node->data)){
+        freeKey(map,key);
+        releaseNode(node);
+        return MAP_IO_ERROR;
+    }
+    mergeNode(map,prev_node,was_found,node);
+
+    return MAP_SUCCESS;
+}
+
+static void recordChange(Map map,ChangeType type,Node node)
+{
+    Journal journal = map->journal;
+    if(journal && !(journal->failed)){
+        MapDataElement data = NULL;
+        if(type == CHANGE_PUT){
+            data = borrowNodeData(map,node);
+        }
+        MapResult result = MAP_IO_ERROR;
+        if(type != CHANGE_PUT || data){
+            result = encodeRecord(&journal->encoder,&journal->pending,type,
+                                  journal->sequence + 1,
+                                  node ? node->key : NULL,data);
+        }
+        if(data){
+            returnNodeData(map,node,data);
+        }
+        if(result != MAP_SUCCESS){
+            journal->failed = true;
+        }else{
+            if(journal->pending_count == 0){
+                journal->pending_since = currentTime();
+            }
+            journal->sequence += 1;
+            journal->pending_count += 1;
+        }
+    }
+
+    Replication replication = map->replication;
+    if(replication){
+        replication->sequence += 1;
+        MapDataElement data = type == CHANGE_PUT ?
+                              borrowNodeData(map,node) : NULL;
+        MapResult result = MAP_IO_ERROR;
+        if(type != CHANGE_PUT || data){
+            result = encodeRecord(&replication->encoder,&replication->pending,
+                                  type,replication->sequence,
+                                  node ? node->key : NULL,data);
+        }
+        if(data){
+            returnNodeData(map,node,data);
+        }
+        if(result != MAP_SUCCESS){
+            // the stream has a gap, so the follower must start over from a
+            // full resynchronization
+            if(replication->fd >= 0){
+                close(replication->fd);
+                replication->failed = true;
+            }
+            replication->fd = -1;
+            replication->pending.size = 0;
+            replication->backlog.size = 0;
+            replication->backlog_start = 0;
+        }
+    }
+
+    ChangeTracker tracker = map->tracker;
+    if(tracker && !(tracker->failed)){
+        if(type == CHANGE_CLEAR){
+            clearMap(tracker->dirty);
+            tracker->cleared = true;
+        }else if(putElement(tracker->dirty,node->key,&dirty_mark,0) !=
+                 MAP_SUCCESS){
+            tracker->failed = true;
+        }
+    }
+}
+
+static MapResult finishChanges(Map map)
+{
+    if(map->cache){
+        enforceCapacity(map);
+    }
+    if(map->spill){
+        enforceBudget(map);
+    }
+    MapResult result = MAP_SUCCESS;
+    if(map->replication){
+        result = shipChanges(map->replication);
+    }
+    Journal journal = map->journal;
+    if(!journal){
+        return result;
+    }
+
+    if(journal->pending_count >= MAP_WAL_GROUP_SIZE ||
+       (journal->pending_count &&
+        (journal->sync_policy == MAP_SYNC_ALWAYS ||
+         currentTime() - journal->pending_since >= MAP_WAL_GROUP_DELAY))){
+        flushJournal(journal,journal->sync_policy != MAP_SYNC_NONE);
+    }
+    if(journal->records_since_snapshot + journal->pending_count >=
+       MAP_WAL_SNAPSHOT_INTERVAL){
+        writeSnapshot(map);
+    }
+
+    return journal->failed ? MAP_IO_ERROR : result;
+}
+
+static MapResult flushJournal(Journal journal,bool sync)
+{
+    if(!writeBytes(journal->log_fd,journal->pending.bytes,
+                   journal->pending.size)){
+        journal->failed = true;
+        return MAP_IO_ERROR;
+    }
+    journal->records_since_snapshot += journal->pending_count;
+    journal->pending.size = 0;
+    journal->pending_count = 0;
+
+    if(sync && fsync(journal->log_fd) != 0){
+        journal->failed = true;
+        return MAP_IO_ERROR;
+    }
+
+    return MAP_SUCCESS;
+}
+
+static bool writeBytes(int fd,const unsigned char *bytes,size_t count)
+{
+    size_t written = 0;
+    while(written < count){
+        ssize_t result = write(fd,bytes + written,count - written);
+        if(result < 0){
+            if(errno == EINTR){
+                continue;
+            }
+            return false;
+        }
+        written += (size_t)result;
+    }
+    return true;
+}
+
+static MapResult saveToFile(Map map,const char *path,
+                            const RecordEncoder *encoder)
+{
+    char *temporary_path = malloc(strlen(path) +
+                                  sizeof(MAP_WAL_TEMPORARY_SUFFIX));
+    if(!temporary_path){
+        return MAP_OUT_OF_MEMORY;
+    }
+    strcpy(temporary_path,path);
+    strcat(temporary_path,MAP_WAL_TEMPORARY_SUFFIX);
+    int fd = mkstemp(temporary_path);
+    FILE *stream = fd >= 0 ? fdopen(fd,"wb") : NULL;
+    if(!stream){
+        if(fd >= 0){
+            close(fd);
+            remove(temporary_path);
+        }
+        free(temporary_path);
+        return MAP_IO_ERROR;
+    }
+    MapResult result = saveMap(map,stream,encoder->serialize_key,
+                               encoder->serialize_data);
+    if(result == MAP_SUCCESS &&
+       (fflush(stream) != 0 || fsync(fileno(stream)) != 0)){
+        result = MAP_IO_ERROR;
+    }
+    if(fclose(stream) != 0 && result == MAP_SUCCESS){
+        result = MAP_IO_ERROR;
+    }
+    if(result == MAP_SUCCESS && rename(temporary_path,path) != 0){
+        result = MAP_IO_ERROR;
+    }
+    if(result != MAP_SUCCESS){
+        remove(temporary_path);
+    }else if(!syncDirectory(path)){
+        result = MAP_IO_ERROR;
+    }
+    free(temporary_path);
+
+    return result;
+}
+
+static bool syncDirectory(const char *path)
+{
+    const char *slash = strrchr(path,'/');
+    char *directory = NULL;
+    if(slash){
+        size_t length = slash == path ? 1 : (size_t)(slash - path);
+        directory = malloc(length + 1);
+        if(!directory){
+            return false;
+        }
+        memcpy(directory,path,length);
+        directory[length] = '\0';
+    }
+    int fd = open(directory ? directory : ".",O_RDONLY);
+    free(directory);
+    if(fd < 0){
+        return false;
+    }
+    bool synced = fsync(fd) == 0;
+    close(fd);
+
+    return synced;
+}
+
+static MapResult replayRecords(Map map,FILE *stream,
+                               deserializeMapElement deserializeKey,
+                               deserializeMapElement deserializeData,
+                               uint64_t *sequence,int *count,
+                               long *valid_length)
+{
+    ByteBuffer body = {NULL,0,0};
+    MapResult result = MAP_SUCCESS;
+    ChangeRecord record;
+    *valid_length = ftell(stream);
+    while(readRecord(stream,&body) == MAP_SUCCESS &&
+          decodeRecord(body.bytes,body.size,&record)){
+        result = applyRecord(map,&record,deserializeKey,deserializeData);
+        if(result != MAP_SUCCESS){
+            break;
+        }
+        *valid_length = ftell(stream);
+        *sequence = record.sequence;
+        *count += 1;
+    }
+    free(body.bytes);
+
+    return result;
+}
+
+static MapResult writeSnapshot(Map map)
+{
+    Journal journal = map->journal;
+    if(!(journal->failed)){
+        // the log must cover everything up to the snapshot, in case writing
+        // it fails
+        flushJournal(journal,journal->sync_policy != MAP_SYNC_NONE);
+    }
+
+    MapResult result = saveToFile(map,journal->snapshot_path,&journal->encoder);
+    if(result != MAP_SUCCESS){
+        return result;
+    }
+
+    // the snapshot holds every change, so the log starts over. Should the
+    // process stop before the log is emptied, replaying it on top of the
+    // snapshot does no harm, since replaying a change that is already in a
+    // map leaves the map as it is
+    journal->pending.size = 0;
+    journal->pending_count = 0;
+    if(ftruncate(journal->log_fd,0) != 0 ||
+       lseek(journal->log_fd,0,SEEK_SET) != 0){
+        journal->failed = true;
+        return MAP_IO_ERROR;
+    }
+    journal->records_since_snapshot = 0;
+    journal->failed = false;
+
+    return MAP_SUCCESS;
+}
+
+static MapResult replayLog(Map map,Journal journal,
+                           deserializeMapElement deserializeKey,
+                           deserializeMapElement deserializeData)
+{
+    FILE *stream = fopen(journal->log_path,"rb");
+    if(!stream){
+        return MAP_SUCCESS;
+    }
+
+    long valid_length = 0;
+    MapResult result = replayRecords(map,stream,deserializeKey,deserializeData,
+                                     &journal->sequence,
+                                     &journal->records_since_snapshot,
+                                     &valid_length);
+    fclose(stream);
+
+    if(result == MAP_SUCCESS && truncate(journal->log_path,valid_length) != 0){
+        result = MAP_IO_ERROR;
+    }
+
+    return result;
+}
+
+static Journal createJournal(const char *path,serializeMapElement serializeKey,
+                             serializeMapElement serializeData,
+                             MapSyncPolicy policy)
+{
+    Journal journal = malloc(sizeof(*journal));
+    if(!journal){
+        return NULL;
+    }
+    size_t path_length = strlen(path);
+    journal->snapshot_path = malloc(path_length + 1);
+    journal->log_path = malloc(path_length + sizeof(MAP_WAL_LOG_SUFFIX));
+    journal->log_fd = -1;
+    journal->sync_policy = policy;
+    journal->encoder.serialize_key = serializeKey;
+    journal->encoder.serialize_data = serializeData;
+    journal->encoder.key_buffer = NULL;
+    journal->encoder.key_capacity = 0;
+    journal->encoder.data_buffer = NULL;
+    journal->encoder.data_capacity = 0;
+    journal->pending.bytes = NULL;
+    journal->pending.size = 0;
+    journal->pending.capacity = 0;
+    journal->pending_count = 0;
+    journal->pending_since = 0;
+    journal->records_since_snapshot = 0;
+    journal->sequence = 0;
+    journal->failed = false;
+    if(!(journal->snapshot_path) || !(journal->log_path)){
+        destroyJournal(journal);
+        return NULL;
+    }
+    strcpy(journal->snapshot_path,path);
+    strcpy(journal->log_path,path);
+    strcat(journal->log_path,MAP_WAL_LOG_SUFFIX);
+
+    return journal;
+}
+
+static void destroyJournal(Journal journal)
+{
+    if(journal->log_fd >= 0){
+        close(journal->log_fd);
+    }
+    free(journal->snapshot_path);
+    free(journal->log_path);
+    free(journal->encoder.key_buffer);
+    free(journal->encoder.data_buffer);
+    free(journal->pending.bytes);
+    free(journal);
+}
+
+static MapResult writeSaveHeader(FILE *stream,uint32_t version,int count)
+{
+    unsigned char header[MAP_SAVE_HEADER_SIZE];
+    for(int i = 0; i < MAP_SAVE_MAGIC_LENGTH; i++){
+        header[i] = (unsigned char)MAP_SAVE_MAGIC[i];
+    }
+    storeUint32(header + MAP_SAVE_MAGIC_LENGTH,version);
+    storeUint64(header + MAP_SAVE_MAGIC_LENGTH + 4,(uint64_t)count);
+    if(fwrite(header,1,MAP_SAVE_HEADER_SIZE,stream) != MAP_SAVE_HEADER_SIZE){
+        return MAP_IO_ERROR;
+    }
+
+    return MAP_SUCCESS;
+}
+
+static bool appendVarint(ByteBuffer *buffer,uint64_t value)
+{
+    unsigned char bytes[10];
+    int length = 0;
+    do{
+        bytes[length] = (unsigned char)(value & 0x7f);
+        value >>= 7;
+        if(value){
+            bytes[length] |= 0x80;
+        }
+        length++;
+    }while(value);
+
+    return appendBytes(buffer,bytes,length);
+}
+
+static bool readVarint(const unsigned char **position,const unsigned char *end,
+                       uint64_t *value)
+{
+    *value = 0;
+    for(int shift = 0; shift < 64 && *position < end; shift += 7){
+        unsigned char byte = *(*position)++;
+        *value |= (uint64_t)(byte & 0x7f) << shift;
+        if(!(byte & 0x80)){
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool readBytes(const unsigned char **position,const unsigned char *end,
+                      const unsigned char **bytes,uint64_t *length)
+{
+    if(!readVarint(position,end,length) ||
+       *length > (uint64_t)(end - *position)){
+        return false;
+    }
+    *bytes = *position;
+    *position += *length;
+
+    return true;
+}
+
+static bool compressBytes(const unsigned char *bytes,size_t length,
+                          ByteBuffer *out)
+{
+    // positions of earlier 4-byte sequences by their hash, plus one so that
+    // 0 marks an empty entry
+    size_t table[MAP_LZ_HASH_SIZE] = {0};
+    size_t anchor = 0,i = 0;
+
+    while(i + MAP_LZ_MIN_MATCH <= length){
+        uint32_t sequence = loadUint32(bytes + i);
+        uint32_t hash = (sequence * 2654435761u) >> 20 & (MAP_LZ_HASH_SIZE - 1);
+        size_t candidate = table[hash];
+        table[hash] = i + 1;
+        if(!candidate || i - (candidate - 1) > MAP_LZ_MAX_OFFSET ||
+           loadUint32(bytes + candidate - 1) != sequence){
+            i++;
+            continue;
+        }
+        candidate -= 1;
+        size_t match = MAP_LZ_MIN_MATCH;
+        while(i + match < length && bytes[candidate + match] == bytes[i + match]){
+            match++;
+        }
+        if(!appendVarint(out,i - anchor) ||
+           !appendBytes(out,bytes + anchor,i - anchor) ||
+           !appendVarint(out,match - MAP_LZ_MIN_MATCH) ||
+           !appendVarint(out,i - candidate)){
+            return false;
+        }
+        i += match;
+        anchor = i;
+    }
+
+    return appendVarint(out,length - anchor) &&
+           appendBytes(out,bytes + anchor,length - anchor);
+}
+
+static bool decompressBytes(const unsigned char *bytes,size_t length,
+                            unsigned char *out,size_t out_length)
+{
+    const unsigned char *end = bytes + length;
+    size_t written = 0;
+
+    while(true){
+        uint64_t literals = 0;
+        if(!readVarint(&bytes,end,&literals) ||
+           literals > (uint64_t)(end - bytes) ||
+           literals > out_length - written){
+            return false;
+        }
+        memcpy(out + written,bytes,literals);
+        bytes += literals;
+        written += literals;
+        if(written == out_length){
+            return bytes == end;
+        }
+
+        uint64_t match = 0,offset = 0;
+        if(!readVarint(&bytes,end,&match) || !readVarint(&bytes,end,&offset) ||
+           offset == 0 || offset > written ||
+           match + MAP_LZ_MIN_MATCH > out_length - written){
+            return false;
+        }
+        match += MAP_LZ_MIN_MATCH;
+        // byte by byte, since a match may overlap the bytes it produces
+        for(uint64_t j = 0; j < match; j++, written++){
+            out[written] = out[written - offset];
+        }
+    }
+}
+
+static int encodeKeys(MapKeyEncoding encoding,const ByteBuffer *keys,
+                      int count,ByteBuffer *out,int *width)
+{
+    const unsigned char *position = keys->bytes;
+    const unsigned char *end = keys->bytes + keys->size;
+    const unsigned char *key = NULL,*prev_key = NULL;
+    uint64_t length = 0,prev_length = 0;
+    size_t start = out->size;
+    *width = 0;
+
+    if(encoding == MAP_KEY_ENCODING_INTEGER){
+        int64_t prev_value = 0;
+        for(int i = 0; i < count; i++){
+            readBytes(&position,end,&key,&length);
+            if(length == 0 || length > 8 || (i > 0 && (int)length != *width)){
+                out->size = start;
+                return encodeKeys(MAP_KEY_ENCODING_PLAIN,keys,count,out,width);
+            }
+            *width = (int)length;
+            // sign-extend the little-endian integer
+            uint64_t bits = 0;
+            for(uint64_t j = 0; j < length; j++){
+                bits |= (uint64_t)key[j] << (8 * j);
+            }
+            if(length < 8 && (bits >> (8 * length - 1)) & 1){
+                bits |= ~(uint64_t)0 << (8 * length);
+            }
+            int64_t value = (int64_t)bits;
+            // zigzag-encode the difference, so small negative ones stay short
+            uint64_t delta = (uint64_t)value - (uint64_t)prev_value;
+            uint64_t zigzag = (delta << 1) ^ ((delta >> 63) ? ~(uint64_t)0 : 0);
+            if(!appendVarint(out,zigzag)){
+                return -1;
+            }
+            prev_value = value;
+        }
+        return MAP_KEY_ENCODING_INTEGER;
+    }
+
+    for(int i = 0; i < count; i++){
+        readBytes(&position,end,&key,&length);
+        uint64_t shared = 0;
+        if(encoding == MAP_KEY_ENCODING_PREFIX){
+            while(shared < length && shared < prev_length &&
+                  key[shared] == prev_key[shared]){
+                shared++;
+            }
+            if(!appendVarint(out,shared)){
+                return -1;
+            }
+        }
+        if(!appendVarint(out,length - shared) ||
+           !appendBytes(out,key + shared,length - shared)){
+            return -1;
+        }
+        prev_key = key;
+        prev_length = length;
+    }
+
+    return encoding == MAP_KEY_ENCODING_PREFIX ? MAP_KEY_ENCODING_PREFIX :
+                                                 MAP_KEY_ENCODING_PLAIN;
+}
+
+static MapResult decodeKeys(int encoding,int width,const unsigned char *bytes,
+                            size_t length,int count,ByteBuffer *out)
+{
+    const unsigned char *end = bytes + length;
+    // the previous key, for prefix encoding, as an offset into out
+    size_t prev_key = 0;
+    uint64_t prev_length = 0;
+    uint64_t value = 0;
+
+    for(int i = 0; i < count; i++){
+        if(encoding == MAP_KEY_ENCODING_INTEGER){
+            uint64_t zigzag = 0;
+            if(width < 1 || width > 8 || !readVarint(&bytes,end,&zigzag)){
+                return MAP_IO_ERROR;
+            }
+            value += (zigzag >> 1) ^ ((zigzag & 1) ? ~(uint64_t)0 : 0);
+            unsigned char key[8];
+            for(int j = 0; j < width; j++){
+                key[j] = (unsigned char)(value >> (8 * j));
+            }
+            if(!appendVarint(out,width) || !appendBytes(out,key,width)){
+                return MAP_OUT_OF_MEMORY;
+            }
+            continue;
+        }
+
+        uint64_t shared = 0,suffix_length = 0;
+        const unsigned char *suffix = NULL;
+        if(encoding == MAP_KEY_ENCODING_PREFIX &&
+           (!readVarint(&bytes,end,&shared) || shared > prev_length)){
+            return MAP_IO_ERROR;
+        }
+        if((encoding != MAP_KEY_ENCODING_PREFIX &&
+            encoding != MAP_KEY_ENCODING_PLAIN) ||
+           !readBytes(&bytes,end,&suffix,&suffix_length)){
+            return MAP_IO_ERROR;
+        }
+        if(!appendVarint(out,shared + suffix_length)){
+            return MAP_OUT_OF_MEMORY;
+        }
+        size_t key_start = out->size;
+        // the shared prefix is copied from out itself, which may move when
+        // it grows
+        if(!appendBytes(out,NULL,shared)){
+            return MAP_OUT_OF_MEMORY;
+        }
+        memmove(out->bytes + key_start,out->bytes + prev_key,shared);
+        if(!appendBytes(out,suffix,suffix_length)){
+            return MAP_OUT_OF_MEMORY;
+        }
+        prev_key = key_start;
+        prev_length = shared + suffix_length;
+    }
+
+    return bytes == end ? MAP_SUCCESS : MAP_IO_ERROR;
+}
+
+static MapResult writeBlock(FILE *stream,MapKeyEncoding encoding,
+                            const ByteBuffer *keys,const ByteBuffer *data,
+                            int count,ByteBuffer scratch[2])
+{
+    scratch[0].size = 0;
+    scratch[1].size = 0;
+    int width = 0;
+    int used_encoding = encodeKeys(encoding,keys,count,&scratch[0],&width);
+    if(used_encoding < 0 ||
+       !compressBytes(data->bytes,data->size,&scratch[1])){
+        return MAP_OUT_OF_MEMORY;
+    }
+    // data which does not compress is stored as is
+    bool compressed = scratch[1].size < data->size;
+    const ByteBuffer *stored = compressed ? &scratch[1] : data;
+
+    unsigned char header[MAP_BLOCK_HEADER_SIZE];
+    storeUint32(header,(uint32_t)count);
+    header[4] = (unsigned char)used_encoding;
+    header[5] = (unsigned char)width;
+    header[6] = compressed;
+    header[7] = 0;
+    storeUint32(header + 8,(uint32_t)scratch[0].size);
+    storeUint32(header + 12,(uint32_t)data->size);
+    storeUint32(header + 16,(uint32_t)stored->size);
+    if(fwrite(header,1,MAP_BLOCK_HEADER_SIZE,stream) != MAP_BLOCK_HEADER_SIZE ||
+       fwrite(scratch[0].bytes,1,scratch[0].size,stream) != scratch[0].size ||
+       fwrite(stored->bytes,1,stored->size,stream) != stored->size){
+        return MAP_IO_ERROR;
+    }
+
+    return MAP_SUCCESS;
+}
+
+static MapResult readCompressedList(Map map,FILE *stream,int count,
+                                    deserializeMapElement deserializeKey,
+                                    deserializeMapElement deserializeData,
+                                    Node *list)
+{
+    // the encoded keys and stored data of a block, and their decoded forms
+    ByteBuffer encoded = {NULL,0,0},keys = {NULL,0,0},data = {NULL,0,0};
+    struct node_t head;
+    head.next = NULL;
+    Node tail = &head;
+    MapResult result = MAP_SUCCESS;
+
+    while(count > 0 && result == MAP_SUCCESS){
+        unsigned char header[MAP_BLOCK_HEADER_SIZE];
+        if(fread(header,1,MAP_BLOCK_HEADER_SIZE,stream) !=
+           MAP_BLOCK_HEADER_SIZE){
+            result = MAP_IO_ERROR;
+            break;
+        }
+        uint32_t block_count = loadUint32(header);
+        uint32_t keys_length = loadUint32(header + 8);
+        uint32_t raw_length = loadUint32(header + 12);
+        uint32_t stored_length = loadUint32(header + 16);
+        bool compressed = header[6];
+        if(block_count == 0 || block_count > (uint32_t)count ||
+           (!compressed && stored_length != raw_length)){
+            result = MAP_IO_ERROR;
+            break;
+        }
+        encoded.size = 0;
+        keys.size = 0;
+        data.size = 0;
+        if(!appendBytes(&encoded,NULL,(size_t)keys_length + stored_length) ||
+           !appendBytes(&data,NULL,raw_length)){
+            result = MAP_OUT_OF_MEMORY;
+            break;
+        }
+        if(fread(encoded.bytes,1,encoded.size,stream) != encoded.size){
+            result = MAP_IO_ERROR;
+            break;
+        }
+        result = decodeKeys(header[4],header[5],encoded.bytes,keys_length,
+                            (int)block_count,&keys);
+        if(result != MAP_SUCCESS){
+            break;
+        }
+        if(compressed){
+            if(!decompressBytes(encoded.bytes + keys_length,stored_length,
+                                data.bytes,raw_length)){
+                result = MAP_IO_ERROR;
+                break;
+            }
+        }else if(raw_length > 0){
+            memcpy(data.bytes,encoded.bytes + keys_length,raw_length);
+        }
+
+        const unsigned char *key_position = keys.bytes;
+        const unsigned char *data_position = data.bytes;
+        for(uint32_t i = 0; i < block_count && result == MAP_SUCCESS; i++){
+            const unsigned char *key_bytes = NULL,*data_bytes = NULL;
+            uint64_t key_length = 0,data_length = 0;
+            if(!readBytes(&key_position,keys.bytes + keys.size,&key_bytes,
+                          &key_length) ||
+               !readBytes(&data_position,data.bytes + data.size,&data_bytes,
+                          &data_length) ||
+               key_length > INT_MAX || data_length > INT_MAX){
+                result = MAP_IO_ERROR;
+                break;
+            }
+            Node node = allocateNode(map);
+            if(!node){
+                result = MAP_OUT_OF_MEMORY;
+                break;
+            }
+            node->key = deserializeKey(key_bytes,(int)key_length);
+            node->data = node->key ? deserializeData(data_bytes,
+                                                     (int)data_length) : NULL;
+            if(!(node->key) || !(node->data) || (tail != &head &&
+               compareKeys(map,node->key,tail->key) <= 0)){
+                if(node->key){
+                    freeKey(map,node->key);
+                }
+                if(node->data){
+                    freeData(map,node->data);
+                }
+                releaseNode(node);
+                result = MAP_IO_ERROR;
+                break;
+            }
+            node->next = NULL;
+            tail->next = node;
+            tail = node;
+        }
+        count -= (int)block_count;
+    }
+
+    free(encoded.bytes);
+    free(keys.bytes);
+    free(data.bytes);
+    if(result != MAP_SUCCESS){
+        freeList(map,head.next);
+        return result;
+    }
+    *list = head.next;
+
+    return MAP_SUCCESS;
+}
+
+static MapDataElement copyDirtyMark(MapDataElement mark)
+{
+    return mark;
+}
+
+static void freeDirtyMark(MapDataElement mark)
+{
+    (void)mark;
+}
+
+static ChangeTracker createTracker(Map map,const char *path,
+                                   serializeMapElement serializeKey,
+                                   serializeMapElement serializeData)
+{
+    ChangeTracker tracker = malloc(sizeof(*tracker));
+    if(!tracker){
+        return NULL;
+    }
+    size_t path_length = strlen(path);
+    tracker->snapshot_path = malloc(path_length + 1);
+    tracker->delta_path = malloc(path_length + sizeof(MAP_DELTA_SUFFIX));
+    tracker->encoder.serialize_key = serializeKey;
+    tracker->encoder.serialize_data = serializeData;
+    tracker->encoder.key_buffer = NULL;
+    tracker->encoder.key_capacity = 0;
+    tracker->encoder.data_buffer = NULL;
+    tracker->encoder.data_capacity = 0;
+    tracker->dirty = mapCreate(copyDirtyMark,map->copy_key,freeDirtyMark,
+                               map->free_key,map->compare_keys);
+    tracker->cleared = false;
+    tracker->delta_records = 0;
+    tracker->sequence = 0;
+    tracker->failed = true;
+    if(!(tracker->snapshot_path) || !(tracker->delta_path) ||
+       !(tracker->dirty)){
+        destroyTracker(tracker);
+        return NULL;
+    }
+    strcpy(tracker->snapshot_path,path);
+    strcpy(tracker->delta_path,path);
+    strcat(tracker->delta_path,MAP_DELTA_SUFFIX);
+
+    return tracker;
+}
+
+static void destroyTracker(ChangeTracker tracker)
+{
+    mapDestroy(tracker->dirty);
+    free(tracker->snapshot_path);
+    free(tracker->delta_path);
+    free(tracker->encoder.key_buffer);
+    free(tracker->encoder.data_buffer);
+    free(tracker);
+}
+
+static MapResult writeDelta(Map map)
+{
+    ChangeTracker tracker = map->tracker;
+    ByteBuffer records = {NULL,0,0};
+    int count = 0;
+    MapResult result = MAP_SUCCESS;
+    if(tracker->cleared){
+        result = encodeRecord(&tracker->encoder,&records,CHANGE_CLEAR,
+                              tracker->sequence + 1,NULL,NULL);
+        count++;
+    }
+    // the dirty keys are in the order of the map, so a single pass over the
+    // map finds all of them
+    Node prev_node = map->first;
+    for(Node dirty = tracker->dirty->first->next;
+        dirty && result == MAP_SUCCESS; dirty = dirty->next){
+        bool was_found = false;
+        prev_node = seekPrevNode(map,prev_node,dirty->key,&was_found);
+        MapDataElement data = NULL;
+        if(was_found){
+            data = borrowNodeData(map,prev_node->next);
+            if(!data){
+                result = MAP_IO_ERROR;
+                break;
+            }
+        }
+        result = encodeRecord(&tracker->encoder,&records,
+                              was_found ? CHANGE_PUT : CHANGE_REMOVE,
+                              tracker->sequence + count + 1,dirty->key,data);
+        if(data){
+            returnNodeData(map,prev_node->next,data);
+        }
+        count++;
+    }
+    if(result != MAP_SUCCESS || count == 0){
+        free(records.bytes);
+        return result;
+    }
+
+    int fd = open(tracker->delta_path,O_WRONLY | O_CREAT | O_APPEND,0644);
+    if(fd < 0){
+        result = MAP_IO_ERROR;
+    }else{
+        if(!writeBytes(fd,records.bytes,records.size) || fsync(fd) != 0){
+            result = MAP_IO_ERROR;
+        }
+        if(close(fd) != 0){
+            result = MAP_IO_ERROR;
+        }
+    }
+    free(records.bytes);
+    if(result != MAP_SUCCESS){
+        // part of the delta may have been written, so only a full snapshot
+        // can follow it
+        tracker->failed = true;
+        return result;
+    }
+
+    clearMap(tracker->dirty);
+    tracker->cleared = false;
+    tracker->delta_records += count;
+    tracker->sequence += count;
+
+    return MAP_SUCCESS;
+}
+
+static MapResult writeFullCheckpoint(Map map)
+{
+    ChangeTracker tracker = map->tracker;
+    MapResult result = saveToFile(map,tracker->snapshot_path,&tracker->encoder);
+    if(result != MAP_SUCCESS){
+        return result;
+    }
+    // the snapshot holds every change, so tracking starts over from it
+    clearMap(tracker->dirty);
+    tracker->cleared = false;
+    tracker->delta_records = 0;
+    tracker->failed = true;
+
+    unsigned char header[MAP_DELTA_HEADER_SIZE];
+    for(int i = 0; i < MAP_SAVE_MAGIC_LENGTH; i++){
+        header[i] = (unsigned char)MAP_DELTA_MAGIC[i];
+    }
+    uint32_t checksum = 0;
+    if(!checksumFile(tracker->snapshot_path,&checksum)){
+        return MAP_IO_ERROR;
+    }
+    storeUint32(header + MAP_SAVE_MAGIC_LENGTH,checksum);
+    int fd = open(tracker->delta_path,O_WRONLY | O_CREAT | O_TRUNC,0644);
+    if(fd < 0){
+        return MAP_IO_ERROR;
+    }
+    if(!writeBytes(fd,header,sizeof(header)) || fsync(fd) != 0){
+        result = MAP_IO_ERROR;
+    }
+    if(close(fd) != 0){
+        result = MAP_IO_ERROR;
+    }
+    tracker->failed = result != MAP_SUCCESS;
+
+    return result;
+}
+
+static void releaseData(Map map,MapDataElement data,unsigned int flags)
+{
+    if(flags & NODE_SPILLED){
+        SpillSlot slot = data;
+        map->spill->used_size -= slot->length;
+        free(slot);
+    }else{
+        freeData(map,data);
+    }
+}
+
+static void measureNodeData(Map map,Node node)
+{
+    Cache cache = map->cache;
+    if(cache && cache->byte_budget){
+        int size = cache->measure_key(node->key) +
+                   cache->measure_data(node->data);
+        cache->bytes += size - node->state->cache_size;
+        node->state->cache_size = size;
+    }
+    Spill spill = map->spill;
+    if(!spill){
+        return;
+    }
+    int length = 0;
+    if(spill->measure_data){
+        length = spill->measure_data(node->data);
+    }else if(serializeElement(spill->serialize_data,node->data,&spill->buffer,
+                              &spill->capacity,&length) != MAP_SUCCESS){
+        length = 0;
+    }
+    spill->resident_size += length - node->state->data_size;
+    node->state->data_size = length;
+    node->state->flags |= NODE_REFERENCED;
+}
+
+static void countNode(Map map,Node node)
+{
+    if(map->spill && !(node->state->flags & NODE_SPILLED)){
+        map->spill->resident_size += node->state->data_size;
+    }
+    if(map->cache){
+        map->cache->bytes += node->state->cache_size;
+    }
+}
+
+static void uncountNode(Map map,Node node)
+{
+    if(map->spill && !(node->state->flags & NODE_SPILLED)){
+        map->spill->resident_size -= node->state->data_size;
+    }
+    if(map->cache){
+        map->cache->bytes -= node->state->cache_size;
+    }
+}
+
+static void passNode(Map map,Node node)
+{
+    if(map->spill && map->spill->hand == node){
+        map->spill->hand = node->next;
+    }
+    if(map->spill){
+        for(int i = 0; i < MAP_SPILL_PINNED_COUNT; i++){
+            if(map->spill->pinned[i] == node){
+                map->spill->pinned[i] = NULL;
+            }
+        }
+    }
+    uncountNode(map,node);
+}
+
+static MapDataElement loadSpilledData(Map map,Node node)
+{
+    Spill spill = map->spill;
+    SpillSlot slot = node->data;
+    if(slot->length > spill->capacity){
+        unsigned char *new_buffer = realloc(spill->buffer,slot->length);
+        if(!new_buffer){
+            return NULL;
+        }
+        spill->buffer = new_buffer;
+        spill->capacity = slot->length;
+    }
+    if(pread(spill->fd,spill->buffer,slot->length,slot->offset) !=
+       slot->length){
+        return NULL;
+    }
+
+    return spill->deserialize_data(spill->buffer,slot->length);
+}
+
+static MapResult faultInData(Map map,Node node)
+{
+    if(!(map->spill)){
+        return MAP_SUCCESS;
+    }
+    if(!(node->state->flags & NODE_SPILLED)){
+        node->state->flags |= NODE_REFERENCED;
+        return MAP_SUCCESS;
+    }
+    MapDataElement data = loadSpilledData(map,node);
+    if(!data){
+        return MAP_IO_ERROR;
+    }
+    releaseData(map,node->data,node->state->flags);
+    node->data = data;
+    node->state->flags = NODE_REFERENCED;
+    map->spill->resident_size += node->state->data_size;
+
+    return MAP_SUCCESS;
+}
+
+static MapDataElement borrowNodeData(Map map,Node node)
+{
+    if(!(nodeFlags(node) & NODE_SPILLED)){
+        return node->data;
+    }
+    return loadSpilledData(map,node);
+}
+
+static void returnNodeData(Map map,Node node,MapDataElement data)
+{
+    if(data != node->data){
+        freeData(map,data);
+    }
+}
+
+static MapResult serializeNodeData(Map map,Node node,
+                                   serializeMapElement serialize,
+                                   unsigned char **buffer,int *capacity,
+                                   int *length)
+{
+    MapDataElement data = borrowNodeData(map,node);
+    if(!data){
+        return MAP_IO_ERROR;
+    }
+    MapResult result = serializeElement(serialize,data,buffer,capacity,
+                                        length);
+    returnNodeData(map,node,data);
+
+    return result;
+}
+
+static MapResult spillNodeData(Map map,Node node)
+{
+    Spill spill = map->spill;
+    int length = 0;
+    MapResult result = serializeElement(spill->serialize_data,node->data,
+                                        &spill->buffer,&spill->capacity,
+                                        &length);
+    if(result != MAP_SUCCESS){
+        return result;
+    }
+    SpillSlot slot = malloc(sizeof(*slot));
+    if(!slot){
+        return MAP_OUT_OF_MEMORY;
+    }
+    slot->offset = spill->file_size;
+    slot->length = length;
+    if(pwrite(spill->fd,spill->buffer,length,slot->offset) != length){
+        free(slot);
+        return MAP_IO_ERROR;
+    }
+    spill->file_size += length;
+    spill->used_size += length;
+    spill->resident_size -= node->state->data_size;
+    freeData(map,node->data);
+    node->data = slot;
+    node->state->flags = NODE_SPILLED;
+
+    return MAP_SUCCESS;
+}
+
+static void pinNode(Spill spill,Node node)
+{
+    if(isPinned(spill,node)){
+        return;
+    }
+    spill->pinned[spill->next_pinned] = node;
+    spill->next_pinned = (spill->next_pinned + 1) % MAP_SPILL_PINNED_COUNT;
+}
+
+static bool isPinned(Spill spill,Node node)
+{
+    for(int i = 0; i < MAP_SPILL_PINNED_COUNT; i++){
+        if(spill->pinned[i] == node){
+            return true;
+        }
+    }
+    return false;
+}
+
+static void enforceBudget(Map map)
+{
+    Spill spill = map->spill;
+    // every node is looked at most twice: once to clear its referenced flag,
+    // once to spill it
+    long long steps = 2 * (long long)map->size + 1;
+    while(spill->resident_size > spill->budget && steps-- > 0){
+        if(!(spill->hand)){
+            spill->hand = map->first->next;
+            if(!(spill->hand)){
+                break;
+            }
+        }
+        Node node = spill->hand;
+        spill->hand = node->next;
+        if((node->state->flags & NODE_SPILLED) || isPinned(spill,node)){
+            continue;
+        }
+        if(node->state->flags & NODE_REFERENCED){
+            node->state->flags &= ~NODE_REFERENCED;
+            continue;
+        }
+        if(spillNodeData(map,node) != MAP_SUCCESS){
+            // the data stays in memory, to be spilled another time
+            break;
+        }
+    }
+
+    // nodes kept by the undo log may hold slots, so the file is compacted
+    // only when there is none
+    off_t unused_size = spill->file_size - spill->used_size;
+    if(map->savepoints_count == 0 && unused_size > spill->used_size &&
+       unused_size >= MAP_SPILL_COMPACT_MIN){
+        compactSpillFile(map);
+    }
+}
+
+static int openSpillFile(const char *path)
+{
+    char *name = malloc(strlen(path) + sizeof(MAP_SPILL_TEMPLATE_SUFFIX));
+    if(!name){
+        return -1;
+    }
+    strcpy(name,path);
+    strcat(name,MAP_SPILL_TEMPLATE_SUFFIX);
+    // the file is only reached through its descriptor, so it is unlinked
+    // right away and its space is freed when it is closed
+    int fd = mkstemp(name);
+    if(fd >= 0){
+        unlink(name);
+    }
+    free(name);
+
+    return fd;
+}
+
+static MapResult compactSpillFile(Map map)
+{
+    Spill spill = map->spill;
+    int fd = openSpillFile(spill->path);
+    if(fd < 0){
+        return MAP_IO_ERROR;
+    }
+
+    // the slots are moved to the new file, and their offsets updated once
+    // all of them were moved
+    off_t offset = 0;
+    MapResult result = MAP_SUCCESS;
+    for(Node node = map->first->next; node && result == MAP_SUCCESS;
+        node = node->next){
+        if(!(node->state->flags & NODE_SPILLED)){
+            continue;
+        }
+        SpillSlot slot = node->data;
+        if(slot->length > spill->capacity){
+            unsigned char *new_buffer = realloc(spill->buffer,slot->length);
+            if(!new_buffer){
+                result = MAP_OUT_OF_MEMORY;
+                break;
+            }
+            spill->buffer = new_buffer;
+            spill->capacity = slot->length;
+        }
+        if(pread(spill->fd,spill->buffer,slot->length,slot->offset) !=
+           slot->length ||
+           pwrite(fd,spill->buffer,slot->length,offset) != slot->length){
+            result = MAP_IO_ERROR;
+        }
+        offset += slot->length;
+    }
+    if(result != MAP_SUCCESS){
+        close(fd);
+        return result;
+    }
+
+    offset = 0;
+    for(Node node = map->first->next; node; node = node->next){
+        if(node->state->flags & NODE_SPILLED){
+            SpillSlot slot = node->data;
+            slot->offset = offset;
+            offset += slot->length;
+        }
+    }
+    close(spill->fd);
+    spill->fd = fd;
+    spill->file_size = offset;
+    spill->used_size = offset;
+
+    return MAP_SUCCESS;
+}
+
+static void destroySpill(Spill spill)
+{
+    if(spill->fd >= 0){
+        close(spill->fd);
+    }
+    free(spill->path);
+    free(spill->buffer);
+    free(spill);
+}
+
+static MapResult shipChanges(Replication replication)
+{
+    if(replication->pending.size > 0){
+        appendToBacklog(replication);
+    }
+    if(replication->failed){
+        replication->failed = false;
+        return MAP_IO_ERROR;
+    }
+    return MAP_SUCCESS;
+}
+
+static void appendToBacklog(Replication replication)
+{
+    if(replication->fd >= 0){
+        shipRecords(replication,replication->pending.bytes,
+                    replication->pending.size);
+    }
+
+    ByteBuffer *backlog = &replication->backlog;
+    if(!appendBytes(backlog,replication->pending.bytes,
+                    replication->pending.size)){
+        // without the latest records the backlog is useless
+        backlog->size = 0;
+        replication->backlog_start = 0;
+    }
+    replication->pending.size = 0;
+    while(backlog->size - replication->backlog_start >
+          MAP_REPLICATION_BACKLOG_SIZE){
+        replication->backlog_start += MAP_RECORD_HEADER_SIZE +
+            loadUint32(backlog->bytes + replication->backlog_start);
+    }
+    // the trimmed records are dropped once they are half the buffer
+    if(replication->backlog_start > backlog->size / 2){
+        memmove(backlog->bytes,backlog->bytes + replication->backlog_start,
+                backlog->size - replication->backlog_start);
+        backlog->size -= replication->backlog_start;
+        replication->backlog_start = 0;
+    }
+}
+
+static MapResult shipRecords(Replication replication,
+                             const unsigned char *bytes,size_t count)
+{
+    if(!writeBytes(replication->fd,bytes,count)){
+        close(replication->fd);
+        replication->fd = -1;
+        replication->failed = true;
+        return MAP_IO_ERROR;
+    }
+    return MAP_SUCCESS;
+}
+
+static bool findBacklogRecord(Replication replication,uint64_t sequence,
+                              size_t *offset)
+{
+    const ByteBuffer *backlog = &replication->backlog;
+    *offset = replication->backlog_start;
+    while(*offset < backlog->size){
+        // the sequence number follows the change type in the body
+        uint64_t record_sequence = loadUint64(backlog->bytes + *offset +
+                                              MAP_RECORD_HEADER_SIZE + 1);
+        if(record_sequence == sequence + 1){
+            return true;
+        }
+        if(record_sequence > sequence + 1){
+            break;
+        }
+        *offset += MAP_RECORD_HEADER_SIZE +
+                   loadUint32(backlog->bytes + *offset);
+    }
+    return false;
+}
+
+static MapResult resynchronize(Map map)
+{
+    Replication replication = map->replication;
+    ByteBuffer records = {NULL,0,0};
+    MapResult result = encodeRecord(&replication->encoder,&records,
+                                    CHANGE_CLEAR,replication->sequence,NULL,
+                                    NULL);
+    for(Node node = map->first->next; node && result == MAP_SUCCESS;
+        node = node->next){
+        MapDataElement data = borrowNodeData(map,node);
+        if(!data){
+            result = MAP_IO_ERROR;
+            break;
+        }
+        result = encodeRecord(&replication->encoder,&records,CHANGE_PUT,
+                              replication->sequence,node->key,data);
+        returnNodeData(map,node,data);
+        if(result == MAP_SUCCESS &&
+           (records.size >= MAP_REPLICATION_CHUNK_SIZE || !(node->next))){
+            result = shipRecords(replication,records.bytes,records.size);
+            records.size = 0;
+        }
+    }
+    if(result == MAP_SUCCESS && records.size > 0){
+        result = shipRecords(replication,records.bytes,records.size);
+    }
+    free(records.bytes);
+
+    return result;
+}
+
+static void destroyReplication(Replication replication)
+{
+    if(replication->fd >= 0){
+        close(replication->fd);
+    }
+    free(replication->encoder.key_buffer);
+    free(replication->encoder.data_buffer);
+    free(replication->pending.bytes);
+    free(replication->backlog.bytes);
+    free(replication);
+}
+
+static void pushRecentNode(Cache cache,Node node,int list)
+{
+    node->state->cache_list = list;
+    node->state->newer = NULL;
+    node->state->older = cache->newest[list];
+    if(cache->newest[list]){
+        cache->newest[list]->state->newer = node;
+    }else{
+        cache->oldest[list] = node;
+    }
+    cache->newest[list] = node;
+    cache->sizes[list] += 1;
+}
+
+static void linkRecentNode(Map map,Node node)
+{
+    if(map->cache){
+        pushRecentNode(map->cache,node,CACHE_WINDOW);
+    }
+}
+
+static void unlinkRecentNode(Map map,Node node)
+{
+    Cache cache = map->cache;
+    if(!cache){
+        return;
+    }
+    int list = node->state->cache_list;
+    if(node->state->newer){
+        node->state->newer->state->older = node->state->older;
+    }else{
+        cache->newest[list] = node->state->older;
+    }
+    if(node->state->older){
+        node->state->older->state->newer = node->state->newer;
+    }else{
+        cache->oldest[list] = node->state->newer;
+    }
+    cache->sizes[list] -= 1;
+}
+
+static void touchNode(Map map,Node node)
+{
+    Cache cache = map->cache;
+    if(!cache){
+        return;
+    }
+    if(cache->policy == MAP_EVICTION_TINYLFU){
+        countAccess(cache,node->key);
+    }
+    int list = node->state->cache_list;
+    if(cache->newest[list] == node && list != CACHE_PROBATION){
+        return;
+    }
+    unlinkRecentNode(map,node);
+    if(list != CACHE_PROBATION){
+        pushRecentNode(cache,node,list);
+        return;
+    }
+    pushRecentNode(cache,node,CACHE_PROTECTED);
+    // the protected part takes up to 80% of the main area
+    int main_capacity = 0;
+    windowCapacity(map,&main_capacity);
+    if(cache->sizes[CACHE_PROTECTED] > main_capacity * 4 / 5){
+        Node demoted = cache->oldest[CACHE_PROTECTED];
+        unlinkRecentNode(map,demoted);
+        pushRecentNode(cache,demoted,CACHE_PROBATION);
+    }
+}
+
+static void countAccess(Cache cache,MapKeyElement key)
+{
+    uint64_t hash = cache->hash_key(key);
+    for(int row = 0; row < MAP_SKETCH_DEPTH; row++){
+        size_t index = sketchIndex(cache,&hash,row);
+        if(cache->sketch[index] < MAP_SKETCH_MAX_COUNT){
+            cache->sketch[index] += 1;
+        }
+    }
+    cache->additions += 1;
+    if(cache->additions >= (long long)MAP_SKETCH_SAMPLE_FACTOR *
+                           cache->width){
+        // halving keeps the counts of keys that stay popular, while the
+        // counts of keys that were popular once fade away
+        for(size_t i = 0; i < (size_t)MAP_SKETCH_DEPTH * cache->width; i++){
+            cache->sketch[i] /= 2;
+        }
+        cache->additions /= 2;
+    }
+}
+
+static int estimateFrequency(Cache cache,MapKeyElement key)
+{
+    uint64_t hash = cache->hash_key(key);
+    int frequency = MAP_SKETCH_MAX_COUNT;
+    for(int row = 0; row < MAP_SKETCH_DEPTH; row++){
+        size_t index = sketchIndex(cache,&hash,row);
+        if(cache->sketch[index] < frequency){
+            frequency = cache->sketch[index];
+        }
+    }
+
+    return frequency;
+}
+
+static size_t sketchIndex(Cache cache,uint64_t *hash,int row)
+{
+    *hash = (*hash ^ (*hash >> 31)) * 0x9E3779B97F4A7C15ull;
+    return (size_t)row * cache->width +
+           (size_t)((*hash >> 32) & (uint64_t)(cache->width - 1));
+}
+
+static MapResult resizeSketch(Cache cache)
+{
+    int width = MAP_SKETCH_MIN_WIDTH;
+    while(width < cache->capacity && width < MAP_SKETCH_MAX_WIDTH){
+        width *= 2;
+    }
+    if(cache->sketch && width == cache->width){
+        return MAP_SUCCESS;
+    }
+    unsigned char *sketch = calloc((size_t)MAP_SKETCH_DEPTH * width,1);
+    if(!sketch){
+        return MAP_OUT_OF_MEMORY;
+    }
+    free(cache->sketch);
+    cache->sketch = sketch;
+    cache->width = width;
+    cache->additions = 0;
+
+    return MAP_SUCCESS;
+}
+
+static int windowCapacity(Map map,int *main_capacity)
+{
+    Cache cache = map->cache;
+    int capacity = cache->byte_budget && map->size < cache->capacity ?
+                   map->size : cache->capacity;
+    int window_capacity = capacity / 100 > 1 ? capacity / 100 : 1;
+    *main_capacity = capacity - window_capacity;
+
+    return window_capacity;
+}
+
+static void moveAllRecentNodes(Cache cache,int list)
+{
+    // the main area was used before the window, and the probation part is
+    // the older part of the main area
+    static const int order[CACHE_LISTS_COUNT] = {CACHE_PROBATION,
+                                                 CACHE_PROTECTED,
+                                                 CACHE_WINDOW};
+    Node lists[CACHE_LISTS_COUNT];
+    for(int i = 0; i < CACHE_LISTS_COUNT; i++){
+        lists[i] = cache->oldest[i];
+        cache->newest[i] = NULL;
+        cache->oldest[i] = NULL;
+        cache->sizes[i] = 0;
+    }
+    for(int i = 0; i < CACHE_LISTS_COUNT; i++){
+        Node node = lists[order[i]];
+        while(node){
+            Node newer = node->state->newer;
+            pushRecentNode(cache,node,list);
+            node = newer;
+        }
+    }
+}
+
+static Node selectVictim(Map map)
+{
+    Cache cache = map->cache;
+    if(cache->policy == MAP_EVICTION_LRU){
+        return cache->oldest[CACHE_WINDOW];
+    }
+    int main_capacity = 0;
+    int window_capacity = windowCapacity(map,&main_capacity);
+
+    while(cache->sizes[CACHE_WINDOW] > window_capacity){
+        Node candidate = cache->oldest[CACHE_WINDOW];
+        unlinkRecentNode(map,candidate);
+        pushRecentNode(cache,candidate,CACHE_PROBATION);
+        if(cache->sizes[CACHE_PROBATION] + cache->sizes[CACHE_PROTECTED] <=
+           main_capacity && (!(cache->byte_budget) ||
+                             cache->bytes <= cache->byte_budget)){
+            continue;
+        }
+        Node victim = cache->oldest[CACHE_PROBATION];
+        if(victim == candidate){
+            victim = cache->oldest[CACHE_PROTECTED];
+        }
+        if(!victim || estimateFrequency(cache,candidate->key) >
+                      estimateFrequency(cache,victim->key)){
+            return victim ? victim : candidate;
+        }
+        cache->stats.rejections += 1;
+        return candidate;
+    }
+    for(int list = CACHE_PROBATION; list < CACHE_LISTS_COUNT; list++){
+        if(cache->oldest[list]){
+            return cache->oldest[list];
+        }
+    }
+
+    return cache->oldest[CACHE_WINDOW];
+}
+
+static bool isOverCapacity(Map map)
+{
+    Cache cache = map->cache;
+    return map->size > cache->capacity ||
+           (cache->byte_budget && cache->bytes > cache->byte_budget &&
+            map->size > 0);
+}
+
+static void enforceCapacity(Map map)
+{
+    Cache cache = map->cache;
+    while(isOverCapacity(map) && reserveUndoEntries(map,1) == MAP_SUCCESS){
+        Node node = selectVictim(map);
+        Node prev_node = node->state->prev;
+        if(cache->write_back && node->state->dirty){
+            if(writeBackNode(map,prev_node) != MAP_SUCCESS){
+                // the node stays, to be evicted another time
+                break;
+            }
+        }else{
+            if(cache->evict){
+                MapDataElement data = borrowNodeData(map,node);
+                cache->evict(node->key,data,cache->context);
+                if(data){
+                    returnNodeData(map,node,data);
+                }
+            }
+            removeNextNode(map,prev_node);
+        }
+        cache->stats.evictions += 1;
+    }
+}
+
+static MapResult writeBackNode(Map map,Node prev_node)
+{
+    Cache cache = map->cache;
+    Node node = prev_node->next;
+    MapKeyElement key = node->key;
+    MapDataElement data = borrowNodeData(map,node);
+    if(!data){
+        return MAP_IO_ERROR;
+    }
+    if(map->savepoints_count > 0){
+        // spilled data is read back as a new element, which is the copy
+        MapDataElement data_copy = data == node->data ?
+                                   copyData(map,data) : data;
+        key = copyKey(map,node->key);
+        if(!data_copy || !key){
+            if(data_copy){
+                freeData(map,data_copy);
+            }
+            if(key){
+                freeKey(map,key);
+            }
+            return MAP_OUT_OF_MEMORY;
+        }
+        data = data_copy;
+    }
+    if(cache->evict){
+        cache->evict(key,data,cache->context);
+    }
+    if(map->savepoints_count > 0){
+        removeNextNode(map,prev_node);
+    }else{
+        // the key and data go to the hook instead of being deallocated
+        unlinkNextNode(map,prev_node);
+        if(node->state->flags & NODE_SPILLED){
+            releaseData(map,node->data,node->state->flags);
+        }
+        releaseNode(node);
+    }
+
+    cache->batch_keys[cache->batch_count] = key;
+    cache->batch_data[cache->batch_count] = data;
+    cache->batch_count += 1;
+    if(cache->batch_count == cache->batch_size){
+        flushWriteBack(cache);
+    }
+
+    return MAP_SUCCESS;
+}
+
+static void flushWriteBack(Cache cache)
+{
+    if(cache->batch_count > 0){
+        int count = cache->batch_count;
+        cache->batch_count = 0;
+        cache->write_back(cache->batch_keys,cache->batch_data,count,
+                          cache->write_back_context);
+    }
+}
+
+static void destroyCache(Cache cache)
+{
+    if(cache){
+        flushWriteBack(cache);
+        free(cache->batch_keys);
+        free(cache->batch_data);
+        free(cache->sketch);
+        free(cache);
+    }
+}
+
+static long long currentTime(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC,&now);
+    return (long long)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static long long currentNanoseconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC,&now);
+    return (long long)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static long long beginOperation(Map map,MapOperation operation,
+                                MapKeyElement key)
+{
+    if(map){
+        COUNT_STAT(map,calls[operation]);
+    }
+#ifdef MAP_TRACING
+    if(trace_hooks.begin){
+        trace_hooks.begin(map,operation,key,trace_hooks.context);
+    }
+    if(trace_hooks.end){
+        return currentNanoseconds();
+    }
+#else
+    (void)operation;
+    (void)key;
+#endif
+    return map && map->latency ? currentNanoseconds() : 0;
+}
+
+static void endOperation(Map map,MapOperation operation,MapKeyElement key,
+                         MapResult result,long long start)
+{
+    // an operation which started the tracking or the tracing is not recorded
+    if(start == 0){
+        return;
+    }
+    long long latency = currentNanoseconds() - start;
+#ifdef MAP_TRACING
+    if(trace_hooks.end){
+        trace_hooks.end(map,operation,key,result,latency,trace_hooks.context);
+    }
+#else
+    (void)key;
+    (void)result;
+#endif
+    if(map && map->latency){
+        MapLatencyHistogram *histogram = &map->latency[operation];
+        histogram->counts[latencyBucket(latency)] += 1;
+        histogram->count += 1;
+        histogram->total += latency;
+        if(latency > histogram->max){
+            histogram->max = latency;
+        }
+    }
+}
+
+static MapResult lookupResult(bool valid,bool found)
+{
+    if(!valid){
+        return MAP_NULL_ARGUMENT;
+    }
+    return found ? MAP_SUCCESS : MAP_ITEM_DOES_NOT_EXIST;
+}
+
+static int latencyBucket(long long latency)
+{
+    if(latency < (2 << MAP_LATENCY_SUB_BITS)){
+        return latency > 0 ? (int)latency : 0;
+    }
+    if(latency > MAP_LATENCY_MAX){
+        latency = MAP_LATENCY_MAX;
+    }
+    // the buckets of the latencies whose highest set bit is "exponent" start
+    // at (exponent - MAP_LATENCY_SUB_BITS + 1) << MAP_LATENCY_SUB_BITS
+    int exponent = MAP_LATENCY_SUB_BITS + 1;
+    while(latency >> (exponent + 1)){
+        exponent++;
+    }
+    int shift = exponent - MAP_LATENCY_SUB_BITS;
+    int sub_bucket = (int)(latency >> shift) &
+                     ((1 << MAP_LATENCY_SUB_BITS) - 1);
+    return ((shift + 1) << MAP_LATENCY_SUB_BITS) + sub_bucket;
+}
+
+static long long latencyBucketEnd(int bucket)
+{
+    if(bucket < (2 << MAP_LATENCY_SUB_BITS)){
+        return bucket;
+    }
+    int shift = (bucket >> MAP_LATENCY_SUB_BITS) - 1;
+    int sub_bucket = bucket & ((1 << MAP_LATENCY_SUB_BITS) - 1);
+    long long start = (long long)((1 << MAP_LATENCY_SUB_BITS) + sub_bucket) <<
+                      shift;
+    return start + (1LL << shift) - 1;
+}
+
+static MapResult createExpiry(Map map)
+{
+    if(map->expiry){
+        return MAP_SUCCESS;
+    }
+    if(createNodeStates(map) != MAP_SUCCESS){
+        return MAP_OUT_OF_MEMORY;
+    }
+    Expiry expiry = calloc(1,sizeof(*expiry));
+    if(!expiry){
+        return MAP_OUT_OF_MEMORY;
+    }
+    expiry->time = currentTime();
+    map->expiry = expiry;
+
+    return MAP_SUCCESS;
+}
+
+static void linkTimer(Expiry expiry,Node node)
+{
+    long long expires_at = node->state->expires_at > expiry->time ?
+                           node->state->expires_at : expiry->time;
+    int level = 0;
+    int shift = 0;
+    if(expires_at - expiry->time >= MAP_WHEEL_SLOTS){
+        // the first level whose slots reach the expiry time within a turn
+        do{
+            level += 1;
+            shift += MAP_WHEEL_BITS;
+        }while(level < MAP_WHEEL_LEVELS - 1 &&
+               (expires_at >> shift) - (expiry->time >> shift) >=
+               MAP_WHEEL_SLOTS);
+        if((expires_at >> shift) - (expiry->time >> shift) >=
+           MAP_WHEEL_SLOTS){
+            // too far for the wheel: cascaded from the farthest slot, and put
+            // back at the top level until it is near enough
+            expires_at = ((expiry->time >> shift) + MAP_WHEEL_SLOTS - 1) <<
+                         shift;
+        }
+    }
+    int slot = (int)(expires_at >> shift) & (MAP_WHEEL_SLOTS - 1);
+    Node *head = &expiry->slots[level][slot];
+    node->state->timer_prev = NULL;
+    node->state->timer_next = *head;
+    if(*head){
+        (*head)->state->timer_prev = node;
+    }
+    *head = node;
+    node->state->timer_slot = level * MAP_WHEEL_SLOTS + slot;
+    expiry->counts[level] += 1;
+}
+
+static void unlinkTimer(Map map,Node node)
+{
+    Expiry expiry = map->expiry;
+    if(!expiry || node->state->timer_slot < 0){
+        return;
+    }
+    int level = node->state->timer_slot / MAP_WHEEL_SLOTS;
+    if(node->state->timer_prev){
+        node->state->timer_prev->state->timer_next = node->state->timer_next;
+    }else{
+        expiry->slots[level][node->state->timer_slot % MAP_WHEEL_SLOTS] =
+                node->state->timer_next;
+    }
+    if(node->state->timer_next){
+        node->state->timer_next->state->timer_prev = node->state->timer_prev;
+    }
+    node->state->timer_slot = -1;
+    expiry->counts[level] -= 1;
+}
+
+static void relinkTimer(Map map,Node node)
+{
+    if(!(map->expiry)){
+        return;
+    }
+    node->state->timer_slot = -1;
+    if(node->state->expires_at){
+        linkTimer(map->expiry,node);
+    }
+}
+
+static void setNodeExpiry(Map map,Node node,long long expires_at)
+{
+    unlinkTimer(map,node);
+    node->state->expires_at = expires_at;
+    if(expires_at){
+        linkTimer(map->expiry,node);
+    }
+}
+
+static bool hasExpired(Node node)
+{
+    long long expires_at = nodeExpiry(node);
+    return expires_at && expires_at <= currentTime();
+}
+
+static void removeExpiredNode(Map map,Node prev_node)
+{
+    if(prev_node->next == map->iterator ||
+       reserveUndoEntries(map,1) != MAP_SUCCESS){
+        return;
+    }
+    removeNextNode(map,prev_node);
+    finishChanges(map);
+}
+
+static void cascadeSlot(Expiry expiry,int level,int slot)
+{
+    Node node = expiry->slots[level][slot];
+    expiry->slots[level][slot] = NULL;
+    while(node){
+        Node next = node->state->timer_next;
+        expiry->counts[level] -= 1;
+        linkTimer(expiry,node);
+        node = next;
+    }
+}
+
+static int advanceWheel(Map map,long long now,int limit)
+{
+    Expiry expiry = map->expiry;
+    int removed = 0;
+
+    while(expiry->time <= now){
+        Node *head = &expiry->slots[0][expiry->time & (MAP_WHEEL_SLOTS - 1)];
+        while(*head && removed < limit &&
+              reserveUndoEntries(map,1) == MAP_SUCCESS){
+            removeNextNode(map,(*head)->state->prev);
+            removed += 1;
+        }
+        if(*head){
+            break;
+        }
+        int levels_count = 0;
+        for(int level = 0; level < MAP_WHEEL_LEVELS; level++){
+            levels_count += expiry->counts[level] > 0;
+        }
+        if(levels_count == 0){
+            expiry->time = now + 1;
+            break;
+        }
+        // with level 0 empty, the next slot to look at is where it is
+        // refilled from level 1 (or the one after now)
+        long long refill_time = (expiry->time | (MAP_WHEEL_SLOTS - 1)) + 1;
+        if(expiry->counts[0]){
+            expiry->time += 1;
+        }else{
+            expiry->time = refill_time < now + 1 ? refill_time : now + 1;
+        }
+        int shift = 0;
+        for(int level = 1; level < MAP_WHEEL_LEVELS; level++){
+            shift += MAP_WHEEL_BITS;
+            if(expiry->time & ((1LL << shift) - 1)){
+                break;
+            }
+            cascadeSlot(expiry,level,
+                        (int)(expiry->time >> shift) & (MAP_WHEEL_SLOTS - 1));
+        }
+    }
+
+    return removed;
+}
+
+static MapResult putElement(Map map,MapKeyElement keyElement,
+                            MapDataElement dataElement,long long expires_at)
+{
+    if(!map || !keyElement || !dataElement){
+        return MAP_NULL_ARGUMENT;
+    }
+    if(reserveUndoEntries(map,1) != MAP_SUCCESS){
+        return MAP_OUT_OF_MEMORY;
+    }
+
+    Node prev_node = NULL;
+
+    if(findPrevNode(map,&prev_node,keyElement)){
+        if(replaceNodeData(map,prev_node->next,dataElement) != MAP_SUCCESS){
+            return MAP_OUT_OF_MEMORY;
+        }
+    }else{
+        Node new_node = createNewNode(map,keyElement,dataElement);
+        if(!new_node){
+            return MAP_OUT_OF_MEMORY;
+        }
+        linkNewNode(map,prev_node,new_node);
+    }
+    if(nodeExpiry(prev_node->next) != expires_at){
+        setNodeExpiry(map,prev_node->next,expires_at);
+    }
+
+    map->iterator = NULL;
+
+    return finishChanges(map);
+}
+
+static bool containsElement(Map map,MapKeyElement element)
+{
+    if(!map || !element){
+        return false;
+    }
+
+    Node prev_node = NULL;
+
+    if(!findPrevNode(map,&prev_node,element)){
+        return false;
+    }
+    if(hasExpired(prev_node->next)){
+        removeExpiredNode(map,prev_node);
+        return false;
+    }
+    return true;
+}
+
+static MapDataElement getElement(Map map,MapKeyElement keyElement)
+{
+    if(!map || !keyElement){
+        return NULL;
+    }
+
+    Node prev_node = NULL;
+    bool was_found = findPrevNode(map,&prev_node,keyElement);
+    if(was_found && hasExpired(prev_node->next)){
+        removeExpiredNode(map,prev_node);
+        was_found = false;
+    }
+    if(!was_found){
+        if(map->cache){
+            map->cache->stats.misses += 1;
+            if(map->cache->policy == MAP_EVICTION_TINYLFU){
+                countAccess(map->cache,keyElement);
+            }
+        }
+        return NULL;
+    }
+    Node node = prev_node->next;
+    if(map->cache){
+        map->cache->stats.hits += 1;
+    }
+    if(map->spill){
+        if(faultInData(map,node) != MAP_SUCCESS){
+            return NULL;
+        }
+        pinNode(map->spill,node);
+        enforceBudget(map);
+    }
+    touchNode(map,node);
+
+    return node->data;
+}
+
+static MapResult removeElement(Map map,MapKeyElement keyElement)
+{
+    if(!map || !keyElement){
+        return MAP_NULL_ARGUMENT;
+    }
+    if(reserveUndoEntries(map,1) != MAP_SUCCESS){
+        return MAP_OUT_OF_MEMORY;
+    }
+
+    Node prev_node = NULL;
+    if(!findPrevNode(map,&prev_node,keyElement)){
+        return MAP_ITEM_DOES_NOT_EXIST;
+    }
+    bool expired = hasExpired(prev_node->next);
+    removeNextNode(map,prev_node);
+
+    map->iterator = NULL;
+
+    MapResult result = finishChanges(map);
+    return expired ? MAP_ITEM_DOES_NOT_EXIST : result;
+}
+
+static MapKeyElement getFirstKey(Map map)
+{
+    if(!map){
+        return NULL;
+    }
+    if(!(map->first->next)){
+        return NULL;
+    }
+    map->iterator = map->first->next;
+    return map->iterator->key;
+}
+
+static MapKeyElement getNextKey(Map map)
+{
+    if(!map){
+        return NULL;
+    }
+    if(!(map->iterator)){
+        return NULL;
+    }
+
+    if(!(map->iterator->next)){
+        return NULL;
+    }else{
+        map->iterator = map->iterator->next;
+    }
+
+    return map->iterator->key;
+}
+
+static Map copyMap(Map map)
+{
+    if(!map){
+        return NULL;
+    }
+
+    Map map_copy = mapCreate(map->copy_data,map->copy_key,map->free_data,
+                             map->free_key,map->compare_keys);
+    if(!map_copy){
+        return NULL;
+    }
+
+    map_copy->size = map->size;
+
+    if(map->size != 0){
+        int error_code = copyList(map,map_copy);
+        if(error_code != MAP_SUCCESS){
+            mapDestroy(map_copy);
+            return NULL;
+        }
+    }
+    if(map->expiry){
+        if(createExpiry(map_copy) != MAP_SUCCESS){
+            mapDestroy(map_copy);
+            return NULL;
+        }
+        map_copy->expiry->time = map->expiry->time;
+        Node node_copy = map_copy->first->next;
+        for(Node node = map->first->next; node; node = node->next){
+            if(node->state->expires_at){
+                setNodeExpiry(map_copy,node_copy,node->state->expires_at);
+            }
+            node_copy = node_copy->next;
+        }
+    }
+
+    map->iterator = NULL;
+    map_copy->iterator = NULL;
+
+    return map_copy;
+}
+
+static MapResult clearMap(Map map)
+{
+    if(!map){
+        return MAP_NULL_ARGUMENT;
+    }
+
+    if(reserveUndoEntries(map,1) != MAP_SUCCESS){
+        return MAP_OUT_OF_MEMORY;
+    }
+
+    if(map->savepoints_count > 0){
+        logUndoEntry(map,UNDO_CLEAR,NULL,map->first->next,NULL,0,map->size);
+    }else{
+        freeList(map,map->first->next);
+    }
+    map->first->next = NULL;
+    map->size = 0;
+    if(map->spill){
+        map->spill->resident_size = 0;
+        map->spill->hand = NULL;
+        memset(map->spill->pinned,0,sizeof(map->spill->pinned));
+    }
+    if(map->cache){
+        for(int i = 0; i < CACHE_LISTS_COUNT; i++){
+            map->cache->newest[i] = NULL;
+            map->cache->oldest[i] = NULL;
+            map->cache->sizes[i] = 0;
+        }
+        map->cache->bytes = 0;
+    }
+    if(map->expiry){
+        memset(map->expiry->slots,0,sizeof(map->expiry->slots));
+        memset(map->expiry->counts,0,sizeof(map->expiry->counts));
+    }
+    recordChange(map,CHANGE_CLEAR,NULL);
+
+    return finishChanges(map);
+}
+
+static MapResult computeElement(Map map,MapKeyElement keyElement,
+                                computeMapDataElement compute,void* context)
+{
+    if(!map || !keyElement || !compute){
+        return MAP_NULL_ARGUMENT;
+    }
+    if(reserveUndoEntries(map,2) != MAP_SUCCESS){
+        return MAP_OUT_OF_MEMORY;
+    }
+
+    Node prev_node = NULL;
+    bool was_found = findPrevNode(map,&prev_node,keyElement);
+    if(was_found && hasExpired(prev_node->next)){
+        removeNextNode(map,prev_node);
+        was_found = false;
+    }
+    if(was_found){
+        MapResult result = faultInData(map,prev_node->next);
+        if(result != MAP_SUCCESS){
+            return result;
+        }
+    }
+    MapDataElement old_data = was_found ? prev_node->next->data : NULL;
+    MapDataElement new_data = compute(keyElement,old_data,context);
+
+    map->iterator = NULL;
+
+    MapResult result = storeComputedData(map,prev_node,was_found,keyElement,
+                                         new_data);
+    return result == MAP_SUCCESS ? finishChanges(map) : result;
+}
+
+static MapResult mergeElement(Map map,MapKeyElement keyElement,
+                              MapDataElement dataElement,
+                              mergeMapDataElements combine)
+{
+    if(!map || !keyElement || !dataElement || !combine){
+        return MAP_NULL_ARGUMENT;
+    }
+    if(reserveUndoEntries(map,2) != MAP_SUCCESS){
+        return MAP_OUT_OF_MEMORY;
+    }
+
+    Node prev_node = NULL;
+    bool was_found = findPrevNode(map,&prev_node,keyElement);
+    if(was_found && hasExpired(prev_node->next)){
+        removeNextNode(map,prev_node);
+        was_found = false;
+    }
+    MapDataElement new_data = dataElement;
+    if(was_found){
+        MapResult result = faultInData(map,prev_node->next);
+        if(result != MAP_SUCCESS){
+            return result;
+        }
+        new_data = combine(prev_node->next->data,dataElement);
+    }
+
+    map->iterator = NULL;
+
+    if(was_found && new_data && new_data != prev_node->next->data &&
+       new_data != dataElement){
+        // a newly allocated combination, taken by the map without copying
+        setNodeData(map,prev_node->next,new_data);
+        return finishChanges(map);
+    }
+    MapResult result = storeComputedData(map,prev_node,was_found,keyElement,
+                                         new_data);
+    return result == MAP_SUCCESS ? finishChanges(map) : result;
+}
+
+static MapResult putElements(Map map,MapKeyElement* keyElements,
+                             MapDataElement* dataElements,int count)
+{
+    if(!map || (count > 0 && (!keyElements || !dataElements))){
+        return MAP_NULL_ARGUMENT;
+    }
+    for(int i = 0; i < count; i++){
+        if(!keyElements[i] || !dataElements[i]){
+            return MAP_NULL_ARGUMENT;
+        }
+    }
+    if(count <= 0){
+        return MAP_SUCCESS;
+    }
+
+    StagedOperation *operations = malloc(2 * (size_t)count *
+                                         sizeof(*operations));
+    if(!operations || reserveUndoEntries(map,count) != MAP_SUCCESS){
+        free(operations);
+        return MAP_OUT_OF_MEMORY;
+    }
+    for(int i = 0; i < count; i++){
+        Node new_node = createNewNode(map,keyElements[i],dataElements[i]);
+        if(!new_node){
+            while(i--){
+                discardOperation(map,&operations[i]);
+            }
+            free(operations);
+            return MAP_OUT_OF_MEMORY;
+        }
+        operations[i].key = new_node->key;
+        operations[i].node = new_node;
+    }
+    sortOperations(map,operations,operations + count,count);
+    applyOperations(map,operations,count);
+    free(operations);
+    map->iterator = NULL;
+
+    return finishChanges(map);
+}
+
+static MapResult commitTxn(MapTxn txn)
+{
+    if(!txn){
+        return MAP_NULL_ARGUMENT;
+    }
+    if(reserveUndoEntries(txn->map,txn->size) != MAP_SUCCESS){
+        return MAP_OUT_OF_MEMORY;
+    }
+
+    sortOperations(txn->map,txn->operations,txn->operations + txn->capacity,
+                   txn->size);
+    Map map = txn->map;
+    applyOperations(map,txn->operations,txn->size);
+    map->iterator = NULL;
+
+    free(txn->operations);
+    free(txn);
+
+    return finishChanges(map);
+}
+
+static void initializeMap(Map map,copyMapDataElements copyDataElement,
+                          copyMapKeyElements copyKeyElement,
+                          freeMapDataElements freeDataElement,
+                          freeMapKeyElements freeKeyElement,
+                          compareMapKeyElements compareKeyElements,
+                          Node dummy_first)
+{
+    map->copy_data = copyDataElement;
+    map->copy_key = copyKeyElement;
+    map->free_data = freeDataElement;
+    map->free_key = freeKeyElement;
+    map->compare_keys = compareKeyElements;
+    map->size = 0;
+    map->first = dummy_first;
+    map->first->key = NULL;
+    map->first->data = NULL;
+    map->first->next = NULL;
+    map->first->state = NULL;
+    map->iterator = map->first;
+    pthread_mutex_lock(&node_pool_lock);
+    maps_count += 1;
+    pthread_mutex_unlock(&node_pool_lock);
+    map->undo_log = NULL;
+    map->undo_size = 0;
+    map->undo_capacity = 0;
+    map->savepoints = NULL;
+    map->savepoints_count = 0;
+    map->savepoints_capacity = 0;
+    map->journal = NULL;
+    map->tracker = NULL;
+    map->spill = NULL;
+    map->replication = NULL;
+    map->cache = NULL;
+    map->expiry = NULL;
+    map->node_states = false;
+    memset(&map->stats,0,sizeof(map->stats));
+    map->latency = NULL;
+}
+
+Map mapCreate(copyMapDataElements copyDataElement,
+              copyMapKeyElements copyKeyElement,
+              freeMapDataElements freeDataElement,
+              freeMapKeyElements freeKeyElement,
+              compareMapKeyElements compareKeyElements)
+{
+    if(!copyDataElement || !copyKeyElement || !freeDataElement ||
+       !freeKeyElement || !compareKeyElements){
+        return NULL;
+    }
+
+    Map map = malloc(sizeof(*map));
+    if(!map){
+        return NULL;
+    }
+    Node dummy_first = malloc(sizeof(*dummy_first));
+    if(!dummy_first){
+        free(map);
+        return NULL;
+    }
+
+    initializeMap(map,copyDataElement,copyKeyElement,freeDataElement,
+                  freeKeyElement,compareKeyElements,dummy_first);
+
+    return map;
+}
+
+void mapDestroy(Map map)
+{
+    if(!map){
+        return;
+    }
+    if(map->journal){
+        flushJournal(map->journal,true);
+        destroyJournal(map->journal);
+        map->journal = NULL;
+    }
+    if(map->tracker){
+        destroyTracker(map->tracker);
+        map->tracker = NULL;
+    }
+    if(map->replication){
+        destroyReplication(map->replication);
+        map->replication = NULL;
+    }
+    map->savepoints_count = 0;
+    truncateUndoLog(map,0,false);
+    clearMap(map);
+    if(map->spill){
+        destroySpill(map->spill);
+        map->spill = NULL;
+    }
+    destroyCache(map->cache);
+    map->cache = NULL;
+    free(map->expiry);
+    map->expiry = NULL;
+    free(map->latency);
+    map->latency = NULL;
+    leaveNodePool();
+    free(map->undo_log);
+    free(map->savepoints);
+    free(map->first);
+    free(map);
+}
+
+Map mapCopy(Map map)
+{
+    long long start = beginOperation(map,MAP_OPERATION_COPY,NULL);
+    Map map_copy = copyMap(map);
+    endOperation(map,MAP_OPERATION_COPY,NULL,
+                 map_copy ? MAP_SUCCESS :
+                 map ? MAP_OUT_OF_MEMORY : MAP_NULL_ARGUMENT,start);
+
+    return map_copy;
+}
+
+int mapGetSize(Map map)
+{
+    if(!map){
+        return -1;
+    }
+    return map->size;
+}
+
+bool mapContains(Map map,MapKeyElement element)
+{
+    long long start = beginOperation(map,MAP_OPERATION_CONTAINS,element);
+    bool contains = containsElement(map,element);
+    endOperation(map,MAP_OPERATION_CONTAINS,element,
+                 lookupResult(map && element,contains),start);
+
+    return contains;
+}
+
+MapResult mapPut(Map map,MapKeyElement keyElement,MapDataElement dataElement)
+{
+    long long start = beginOperation(map,MAP_OPERATION_PUT,keyElement);
+    MapResult result = putElement(map,keyElement,dataElement,0);
+    endOperation(map,MAP_OPERATION_PUT,keyElement,result,start);
+
+    return result;
+}
+
+MapDataElement mapGet(Map map, MapKeyElement keyElement)
+{
+    long long start = beginOperation(map,MAP_OPERATION_GET,keyElement);
+    MapDataElement data = getElement(map,keyElement);
+    endOperation(map,MAP_OPERATION_GET,keyElement,
+                 lookupResult(map && keyElement,data),start);
+
+    return data;
+}
+
+MapResult mapRemove(Map map, MapKeyElement keyElement)
+{
+    long long start = beginOperation(map,MAP_OPERATION_REMOVE,keyElement);
+    MapResult result = removeElement(map,keyElement);
+    endOperation(map,MAP_OPERATION_REMOVE,keyElement,result,start);
+
+    return result;
+}
+
+MapKeyElement mapGetFirst(Map map)
+{
+    long long start = beginOperation(map,MAP_OPERATION_GET_FIRST,NULL);
+    MapKeyElement key = getFirstKey(map);
+    endOperation(map,MAP_OPERATION_GET_FIRST,NULL,
+                 lookupResult(map,key),start);
+
+    return key;
+}
+
+MapKeyElement mapGetNext(Map map)
+{
+    long long start = beginOperation(map,MAP_OPERATION_GET_NEXT,NULL);
+    MapKeyElement key = getNextKey(map);
+    endOperation(map,MAP_OPERATION_GET_NEXT,NULL,
+                 lookupResult(map,key),start);
+
+    return key;
+}
+
+MapResult mapClear(Map map)
+{
+    long long start = beginOperation(map,MAP_OPERATION_CLEAR,NULL);
+    MapResult result = clearMap(map);
+    endOperation(map,MAP_OPERATION_CLEAR,NULL,result,start);
+
+    return result;
+}
+
+MapResult mapCompute(Map map,MapKeyElement keyElement,
+                     computeMapDataElement compute,void* context)
+{
+    long long start = beginOperation(map,MAP_OPERATION_COMPUTE,keyElement);
+    MapResult result = computeElement(map,keyElement,compute,context);
+    endOperation(map,MAP_OPERATION_COMPUTE,keyElement,result,start);
+
+    return result;
+}
+
+MapResult mapMergeValue(Map map,MapKeyElement keyElement,
+                        MapDataElement dataElement,
+                        mergeMapDataElements combine)
+{
+    long long start = beginOperation(map,MAP_OPERATION_MERGE,keyElement);
+    MapResult result = mergeElement(map,keyElement,dataElement,combine);
+    endOperation(map,MAP_OPERATION_MERGE,keyElement,result,start);
+
+    return result;
+}
+
+MapTxn mapTxnBegin(Map map)
+{
+    if(!map){
+        return NULL;
+    }
+
+    MapTxn txn = malloc(sizeof(*txn));
+    if(!txn){
+        return NULL;
+    }
+    txn->operations = malloc(2 * MAP_TXN_INITIAL_CAPACITY *
+                             sizeof(*(txn->operations)));
+    if(!(txn->operations)){
+        free(txn);
+        return NULL;
+    }
+    txn->map = map;
+    txn->size = 0;
+    txn->capacity = MAP_TXN_INITIAL_CAPACITY;
+
+    return txn;
+}
+
+MapResult mapTxnPut(MapTxn txn,MapKeyElement keyElement,
+                    MapDataElement dataElement)
+{
+    if(!txn || !keyElement || !dataElement){
+        return MAP_NULL_ARGUMENT;
+    }
+
+    Node new_node = createNewNode(txn->map,keyElement,dataElement);
+    if(!new_node){
+        return MAP_OUT_OF_MEMORY;
+    }
+    if(stageOperation(txn,new_node->key,new_node) != MAP_SUCCESS){
+        freeNode(txn->map,new_node);
+        return MAP_OUT_OF_MEMORY;
+    }
+    if(reserveUndoEntries(txn->map,txn->size) != MAP_SUCCESS){
+        txn->size -= 1;
+        freeNode(txn->map,new_node);
+        return MAP_OUT_OF_MEMORY;
+    }
+
+    return MAP_SUCCESS;
+}
+
+MapResult mapTxnRemove(MapTxn txn,MapKeyElement keyElement)
+{
+    if(!txn || !keyElement){
+        return MAP_NULL_ARGUMENT;
+    }
+
+    MapKeyElement key_copy = copyKey(txn->map,keyElement);
+    if(!key_copy){
+        return MAP_OUT_OF_MEMORY;
+    }
+    if(stageOperation(txn,key_copy,NULL) != MAP_SUCCESS){
+        freeKey(txn->map,key_copy);
+        return MAP_OUT_OF_MEMORY;
+    }
+    if(reserveUndoEntries(txn->map,txn->size) != MAP_SUCCESS){
+        txn->size -= 1;
+        freeKey(txn->map,key_copy);
+        return MAP_OUT_OF_MEMORY;
+    }
+
+    return MAP_SUCCESS;
+}
+
+MapResult mapTxnCommit(MapTxn txn)
+{
+    Map map = txn ? txn->map : NULL;
+    long long start = beginOperation(map,MAP_OPERATION_TXN_COMMIT,NULL);
+    MapResult result = commitTxn(txn);
+    endOperation(map,MAP_OPERATION_TXN_COMMIT,NULL,result,start);
+
+    return result;
+}
+
+void mapTxnAbort(MapTxn txn)
+{
+    if(!txn){
+        return;
+    }
+
+    for(int i = 0; i < txn->size; i++){
+        discardOperation(txn->map,&txn->operations[i]);
+    }
+    free(txn->operations);
+    free(txn);
+}
+
+MapResult mapSavepoint(Map map,MapSavepoint *savepoint)
+{
+    if(!map || !savepoint){
+        return MAP_NULL_ARGUMENT;
+    }
+
+    if(map->savepoints_count == map->savepoints_capacity){
+        int new_capacity = map->savepoints_capacity ?
+                           2 * map->savepoints_capacity : 4;
+        int *new_savepoints = realloc(map->savepoints,
+                                      new_capacity * sizeof(*new_savepoints));
+        if(!new_savepoints){
+            return MAP_OUT_OF_MEMORY;
+        }
+        map->savepoints = new_savepoints;
+        map->savepoints_capacity = new_capacity;
+    }
+    map->savepoints[map->savepoints_count] = map->undo_size;
+    *savepoint = map->savepoints_count;
+    map->savepoints_count += 1;
+
+    return MAP_SUCCESS;
+}
+
+MapResult mapRollback(Map map,MapSavepoint savepoint)
+{
+    if(!map){
+        return MAP_NULL_ARGUMENT;
+    }
+    if(savepoint < 0 || savepoint >= map->savepoints_count){
+        return MAP_ITEM_DOES_NOT_EXIST;
+    }
+
+    truncateUndoLog(map,map->savepoints[savepoint],true);
+    map->savepoints_count = savepoint + 1;
+    map->iterator = NULL;
+
+    return finishChanges(map);
+}
+
+MapResult mapReleaseSavepoint(Map map,MapSavepoint savepoint)
+{
+    if(!map){
+        return MAP_NULL_ARGUMENT;
+    }
+    if(savepoint < 0 || savepoint >= map->savepoints_count){
+        return MAP_ITEM_DOES_NOT_EXIST;
+    }
+
+    map->savepoints_count = savepoint;
+    if(map->savepoints_count == 0){
+        truncateUndoLog(map,0,false);
+    }
+
+    return MAP_SUCCESS;
+}
+
+static MapResult saveMap(Map map,FILE* stream,serializeMapElement serializeKey,
+                         serializeMapElement serializeData)
+{
+    if(!map || !stream || !serializeKey || !serializeData){
+        return MAP_NULL_ARGUMENT;
+    }
+
+    if(writeSaveHeader(stream,MAP_SAVE_VERSION,map->size) != MAP_SUCCESS){
+        return MAP_IO_ERROR;
+    }
+
+    int capacity = MAP_SERIALIZE_INITIAL_CAPACITY;
+    unsigned char *buffer = malloc(capacity);
+    if(!buffer){
+        return MAP_OUT_OF_MEMORY;
+    }
+    MapResult result = MAP_SUCCESS;
+    for(Node node = map->first->next; node && result == MAP_SUCCESS;
+        node = node->next){
+        result = writeElement(stream,serializeKey,node->key,&buffer,&capacity);
+        MapDataElement data = NULL;
+        if(result == MAP_SUCCESS){
+            data = borrowNodeData(map,node);
+            result = data ? MAP_SUCCESS : MAP_IO_ERROR;
+        }
+        if(result == MAP_SUCCESS){
+            result = writeElement(stream,serializeData,data,&buffer,&capacity);
+            returnNodeData(map,node,data);
+        }
+    }
+    free(buffer);
+
+    return result;
+}
+
+MapResult mapSave(Map map,FILE* stream,serializeMapElement serializeKey,
+                  serializeMapElement serializeData)
+{
+    long long start = beginOperation(map,MAP_OPERATION_SAVE,NULL);
+    MapResult result = saveMap(map,stream,serializeKey,serializeData);
+    endOperation(map,MAP_OPERATION_SAVE,NULL,result,start);
+
+    return result;
+}
+
+static MapResult loadMap(Map map,FILE* stream,
+                         deserializeMapElement deserializeKey,
+                         deserializeMapElement deserializeData)
+{
+    if(!map || !stream || !deserializeKey || !deserializeData){
+        return MAP_NULL_ARGUMENT;
+    }
+
+    unsigned char header[MAP_SAVE_HEADER_SIZE];
+    if(fread(header,1,sizeof(header),stream) != sizeof(header)){
+        return MAP_IO_ERROR;
+    }
+    for(int i = 0; i < MAP_SAVE_MAGIC_LENGTH; i++){
+        if(header[i] != (unsigned char)MAP_SAVE_MAGIC[i]){
+            return MAP_IO_ERROR;
+        }
+    }
+    uint32_t version = loadUint32(header + MAP_SAVE_MAGIC_LENGTH);
+    uint64_t count = loadUint64(header + MAP_SAVE_MAGIC_LENGTH + 4);
+    if((version != MAP_SAVE_VERSION &&
+        version != MAP_SAVE_COMPRESSED_VERSION) ||
+       count > (uint64_t)(INT_MAX - map->size)){
+        return MAP_IO_ERROR;
+    }
+
+    Node list = NULL;
+    MapResult result;
+    if(version == MAP_SAVE_COMPRESSED_VERSION){
+        result = readCompressedList(map,stream,(int)count,deserializeKey,
+                                    deserializeData,&list);
+    }else{
+        result = readSortedList(map,stream,(int)count,deserializeKey,
+                                deserializeData,&list);
+    }
+    if(result != MAP_SUCCESS){
+        return result;
+    }
+    if(reserveUndoEntries(map,(int)count) != MAP_SUCCESS){
+        freeList(map,list);
+        return MAP_OUT_OF_MEMORY;
+    }
+
+    Node prev_node = map->first;
+    while(list){
+        Node node = list;
+        list = list->next;
+        bool was_found = false;
+        prev_node = seekPrevNode(map,prev_node,node->key,&was_found);
+        prev_node = mergeNode(map,prev_node,was_found,node);
+    }
+    map->iterator = NULL;
+
+    return finishChanges(map);
+}
+
+MapResult mapLoad(Map map,FILE* stream,deserializeMapElement deserializeKey,
+                  deserializeMapElement deserializeData)
+{
+    long long start = beginOperation(map,MAP_OPERATION_LOAD,NULL);
+    MapResult result = loadMap(map,stream,deserializeKey,deserializeData);
+    endOperation(map,MAP_OPERATION_LOAD,NULL,result,start);
+
+    return result;
+}
+
+MapResult mapSaveMapped(Map map,const char* path,
+                        serializeMapElement serializeKey,
+                        serializeMapElement serializeData)
+{
+    if(!map || !path || !serializeKey || !serializeData){
+        return MAP_NULL_ARGUMENT;
+    }
 
-    *prev_node = cur_node;
-    return was_found;
+    FILE *stream = fopen(path,"wb");
+    if(!stream){
+        return MAP_IO_ERROR;
+    }
+    MapResult result = writeMappedImage(map,stream,serializeKey,serializeData);
+    if(fclose(stream) != 0 && result == MAP_SUCCESS){
+        result = MAP_IO_ERROR;
+    }
+
+    return result;
 }
 
-static Node createNewNode(Map map,MapKeyElement keyElement,
-                          MapDataElement dataElement)
+MappedMap mapOpenMapped(const char* path,
+                        compareMapKeyElements compareKeyElements)
+{
+    return mapOpenMappedWithMode(path,compareKeyElements,MAP_OPEN_DEFAULT);
+}
+
+MappedMap mapOpenMappedWithMode(const char* path,
+                                compareMapKeyElements compareKeyElements,
+                                MapOpenMode mode)
+{
+    if(!path || !compareKeyElements){
+        return NULL;
+    }
+
+    int fd = open(path,O_RDONLY);
+    if(fd < 0){
+        return NULL;
+    }
+    MappedMap map = mapImage(fd,compareKeyElements);
+    close(fd);
+    if(map){
+        map->mode = mode;
+        adviseImage(map);
+    }
+
+    return map;
+}
+
+void mappedMapClose(MappedMap map)
+{
+    if(!map){
+        return;
+    }
+    munmap((void*)map->image,map->image_size);
+    free(map);
+}
+
+int mappedMapGetSize(MappedMap map)
+{
+    if(!map){
+        return -1;
+    }
+    return map->size;
+}
+
+MapDataElement mappedMapGet(MappedMap map,MapKeyElement keyElement)
+{
+    if(!map || !keyElement){
+        return NULL;
+    }
+
+    int low = 0,high = map->size - 1;
+    while(low <= high){
+        int middle = low + (high - low) / 2;
+        uint32_t key_length = 0,data_length = 0;
+        const unsigned char *key = imageRecord(map,middle,&key_length,
+                                               &data_length);
+        if(!key){
+            return NULL;
+        }
+        int result = map->compare_keys(keyElement,(MapKeyElement)key);
+        if(result == 0){
+            return (MapDataElement)(key + alignImageOffset(key_length));
+        }
+        if(result < 0){
+            high = middle - 1;
+        }else{
+            low = middle + 1;
+        }
+    }
+
+    return NULL;
+}
+
+MapKeyElement mappedMapGetFirst(MappedMap map)
+{
+    if(!map || map->size == 0){
+        return NULL;
+    }
+
+    uint32_t key_length = 0,data_length = 0;
+    const unsigned char *key = imageRecord(map,0,&key_length,&data_length);
+    map->iterator = key ? 0 : -1;
+    map->readahead_end = 0;
+    if(key){
+        readAhead(map,key);
+    }
+
+    return (MapKeyElement)key;
+}
+
+MapKeyElement mappedMapGetNext(MappedMap map)
+{
+    if(!map || map->iterator < 0 || map->iterator + 1 >= map->size){
+        return NULL;
+    }
+
+    uint32_t key_length = 0,data_length = 0;
+    const unsigned char *key = imageRecord(map,map->iterator + 1,&key_length,
+                                           &data_length);
+    if(!key){
+        map->iterator = -1;
+        return NULL;
+    }
+    map->iterator += 1;
+    readAhead(map,key);
+
+    return (MapKeyElement)key;
+}
+
+MapResult mapOpenDurable(Map map,const char* path,
+                         serializeMapElement serializeKey,
+                         serializeMapElement serializeData,
+                         deserializeMapElement deserializeKey,
+                         deserializeMapElement deserializeData,
+                         MapSyncPolicy syncPolicy)
+{
+    if(!map || !path || !serializeKey || !serializeData || !deserializeKey ||
+       !deserializeData){
+        return MAP_NULL_ARGUMENT;
+    }
+    if(map->journal){
+        return MAP_ITEM_ALREADY_EXISTS;
+    }
+
+    Journal journal = createJournal(path,serializeKey,serializeData,
+                                    syncPolicy);
+    if(!journal){
+        return MAP_OUT_OF_MEMORY;
+    }
+    MapResult result = MAP_SUCCESS;
+    FILE *snapshot = fopen(journal->snapshot_path,"rb");
+    if(snapshot){
+        result = loadMap(map,snapshot,deserializeKey,deserializeData);
+        fclose(snapshot);
+    }
+    if(result == MAP_SUCCESS){
+        result = replayLog(map,journal,deserializeKey,deserializeData);
+    }
+    if(result == MAP_SUCCESS){
+        journal->log_fd = open(journal->log_path,
+                               O_WRONLY | O_CREAT | O_APPEND,0644);
+        if(journal->log_fd < 0){
+            result = MAP_IO_ERROR;
+        }
+    }
+    if(result != MAP_SUCCESS){
+        destroyJournal(journal);
+        return result;
+    }
+    map->journal = journal;
+    map->iterator = NULL;
+
+    return MAP_SUCCESS;
+}
+
+MapResult mapSync(Map map)
+{
+    if(!map){
+        return MAP_NULL_ARGUMENT;
+    }
+    if(!(map->journal)){
+        return MAP_SUCCESS;
+    }
+    if(map->journal->failed){
+        return MAP_IO_ERROR;
+    }
+
+    return flushJournal(map->journal,true);
+}
+
+static MapResult checkpointMap(Map map)
+{
+    if(!map){
+        return MAP_NULL_ARGUMENT;
+    }
+    if(!(map->journal)){
+        return MAP_SUCCESS;
+    }
+
+    return writeSnapshot(map);
+}
+
+MapResult mapCheckpoint(Map map)
+{
+    long long start = beginOperation(map,MAP_OPERATION_CHECKPOINT,NULL);
+    MapResult result = checkpointMap(map);
+    endOperation(map,MAP_OPERATION_CHECKPOINT,NULL,result,start);
+
+    return result;
+}
+
+MapResult mapPutBatch(Map map,MapKeyElement* keyElements,
+                      MapDataElement* dataElements,int count)
+{
+    long long start = beginOperation(map,MAP_OPERATION_PUT_BATCH,NULL);
+    MapResult result = putElements(map,keyElements,dataElements,count);
+    endOperation(map,MAP_OPERATION_PUT_BATCH,NULL,result,start);
+
+    return result;
+}
+
+static MapResult saveCompressed(Map map,FILE* stream,
+                                serializeMapElement serializeKey,
+                                serializeMapElement serializeData,
+                                MapKeyEncoding keyEncoding)
+{
+    if(!map || !stream || !serializeKey || !serializeData){
+        return MAP_NULL_ARGUMENT;
+    }
+    if(writeSaveHeader(stream,MAP_SAVE_COMPRESSED_VERSION,map->size) !=
+       MAP_SUCCESS){
+        return MAP_IO_ERROR;
+    }
+
+    // the serialized keys and data of the current block, each prefixed by its
+    // length, and the buffers they are encoded into
+    ByteBuffer keys = {NULL,0,0},data = {NULL,0,0};
+    ByteBuffer scratch[2] = {{NULL,0,0},{NULL,0,0}};
+    int capacity = MAP_SERIALIZE_INITIAL_CAPACITY;
+    unsigned char *buffer = malloc(capacity);
+    MapResult result = buffer ? MAP_SUCCESS : MAP_OUT_OF_MEMORY;
+    int block_count = 0;
+
+    for(Node node = map->first->next; node && result == MAP_SUCCESS;
+        node = node->next){
+        int length = 0;
+        result = serializeElement(serializeKey,node->key,&buffer,&capacity,
+                                  &length);
+        if(result == MAP_SUCCESS && (!appendVarint(&keys,length) ||
+           !appendBytes(&keys,buffer,length))){
+            result = MAP_OUT_OF_MEMORY;
+        }
+        if(result == MAP_SUCCESS){
+            result = serializeNodeData(map,node,serializeData,&buffer,
+                                       &capacity,&length);
+        }
+        if(result == MAP_SUCCESS && (!appendVarint(&data,length) ||
+           !appendBytes(&data,buffer,length))){
+            result = MAP_OUT_OF_MEMORY;
+        }
+        block_count++;
+        if(result == MAP_SUCCESS &&
+           (block_count == MAP_BLOCK_SIZE || !(node->next))){
+            result = writeBlock(stream,keyEncoding,&keys,&data,block_count,
+                                scratch);
+            keys.size = 0;
+            data.size = 0;
+            block_count = 0;
+        }
+    }
+
+    free(buffer);
+    free(keys.bytes);
+    free(data.bytes);
+    free(scratch[0].bytes);
+    free(scratch[1].bytes);
+
+    return result;
+}
+
+MapResult mapSaveCompressed(Map map,FILE* stream,
+                            serializeMapElement serializeKey,
+                            serializeMapElement serializeData,
+                            MapKeyEncoding keyEncoding)
+{
+    long long start = beginOperation(map,MAP_OPERATION_SAVE,NULL);
+    MapResult result = saveCompressed(map,stream,serializeKey,serializeData,
+                                      keyEncoding);
+    endOperation(map,MAP_OPERATION_SAVE,NULL,result,start);
+
+    return result;
+}
+
+static MapResult checkpointIncremental(Map map,const char* path,
+                                       serializeMapElement serializeKey,
+                                       serializeMapElement serializeData)
+{
+    if(!map || !path || !serializeKey || !serializeData){
+        return MAP_NULL_ARGUMENT;
+    }
+    map->iterator = NULL;
+    if(map->tracker && strcmp(map->tracker->snapshot_path,path) != 0){
+        destroyTracker(map->tracker);
+        map->tracker = NULL;
+    }
+    if(!(map->tracker)){
+        map->tracker = createTracker(map,path,serializeKey,serializeData);
+        if(!(map->tracker)){
+            return MAP_OUT_OF_MEMORY;
+        }
+    }
+    ChangeTracker tracker = map->tracker;
+    tracker->encoder.serialize_key = serializeKey;
+    tracker->encoder.serialize_data = serializeData;
+
+    // once the deltas hold as many records as the map has elements, restoring
+    // replays as much as a snapshot holds, so they are compacted into one
+    int changes = mapGetSize(tracker->dirty) + (tracker->cleared ? 1 : 0);
+    if(tracker->failed || tracker->delta_records + changes > map->size){
+        return writeFullCheckpoint(map);
+    }
+
+    return writeDelta(map);
+}
+
+MapResult mapCheckpointIncremental(Map map,const char* path,
+                                   serializeMapElement serializeKey,
+                                   serializeMapElement serializeData)
+{
+    long long start = beginOperation(map,MAP_OPERATION_CHECKPOINT,NULL);
+    MapResult result = checkpointIncremental(map,path,serializeKey,
+                                             serializeData);
+    endOperation(map,MAP_OPERATION_CHECKPOINT,NULL,result,start);
+
+    return result;
+}
+
+static MapResult restoreCheckpoint(Map map,const char* path,
+                                   deserializeMapElement deserializeKey,
+                                   deserializeMapElement deserializeData)
+{
+    if(!map || !path || !deserializeKey || !deserializeData){
+        return MAP_NULL_ARGUMENT;
+    }
+    char *delta_path = malloc(strlen(path) + sizeof(MAP_DELTA_SUFFIX));
+    if(!delta_path){
+        return MAP_OUT_OF_MEMORY;
+    }
+    strcpy(delta_path,path);
+    strcat(delta_path,MAP_DELTA_SUFFIX);
+
+    MapResult result = MAP_SUCCESS;
+    uint32_t checksum = 0;
+    FILE *stream = fopen(path,"rb");
+    if(stream){
+        result = loadMap(map,stream,deserializeKey,deserializeData);
+        fclose(stream);
+        if(result == MAP_SUCCESS && !checksumFile(path,&checksum)){
+            result = MAP_IO_ERROR;
+        }
+    }
+    // the deltas only apply to the snapshot whose checksum they are tagged
+    // with - others were left by a crash while a new snapshot was written
+    stream = result == MAP_SUCCESS ? fopen(delta_path,"rb") : NULL;
+    unsigned char header[MAP_DELTA_HEADER_SIZE];
+    if(stream && (fread(header,1,sizeof(header),stream) != sizeof(header) ||
+                  memcmp(header,MAP_DELTA_MAGIC,MAP_SAVE_MAGIC_LENGTH) != 0 ||
+                  loadUint32(header + MAP_SAVE_MAGIC_LENGTH) != checksum)){
+        fclose(stream);
+        stream = NULL;
+    }
+    if(stream){
+        // records after a damaged one were never part of a complete
+        // checkpoint, so the delta file is read up to it
+        uint64_t sequence = 0;
+        int count = 0;
+        long valid_length = 0;
+        result = replayRecords(map,stream,deserializeKey,deserializeData,
+                               &sequence,&count,&valid_length);
+        fclose(stream);
+    }
+    free(delta_path);
+    map->iterator = NULL;
+
+    return result;
+}
+
+MapResult mapRestoreCheckpoint(Map map,const char* path,
+                               deserializeMapElement deserializeKey,
+                               deserializeMapElement deserializeData)
+{
+    long long start = beginOperation(map,MAP_OPERATION_LOAD,NULL);
+    MapResult result = restoreCheckpoint(map,path,deserializeKey,
+                                         deserializeData);
+    endOperation(map,MAP_OPERATION_LOAD,NULL,result,start);
+
+    return result;
+}
+
+MapResult mapSnapshotBackground(Map map,const char* path,
+                                serializeMapElement serializeKey,
+                                serializeMapElement serializeData,
+                                MapSnapshot* snapshot)
+{
+    if(!map || !path || !serializeKey || !serializeData || !snapshot){
+        return MAP_NULL_ARGUMENT;
+    }
+    MapSnapshot new_snapshot = malloc(sizeof(*new_snapshot));
+    if(!new_snapshot){
+        return MAP_OUT_OF_MEMORY;
+    }
+
+    new_snapshot->pid = fork();
+    if(new_snapshot->pid == 0){
+        RecordEncoder encoder = {serializeKey,serializeData,NULL,0,NULL,0};
+        // _exit, so the child leaves alone whatever the parent has open
+        _exit(saveToFile(map,path,&encoder));
+    }
+    if(new_snapshot->pid < 0){
+        free(new_snapshot);
+        return MAP_IO_ERROR;
+    }
+    *snapshot = new_snapshot;
+
+    return MAP_SUCCESS;
+}
+
+MapResult mapSnapshotWait(MapSnapshot snapshot)
+{
+    if(!snapshot){
+        return MAP_NULL_ARGUMENT;
+    }
+    int status = 0;
+    pid_t result = waitpid(snapshot->pid,&status,0);
+    free(snapshot);
+    if(result < 0 || !WIFEXITED(status)){
+        return MAP_IO_ERROR;
+    }
+
+    return (MapResult)WEXITSTATUS(status);
+}
+
+static MapResult setMemoryBudget(Map map,const char* path,long long budget,
+                                 serializeMapElement serializeData,
+                                 deserializeMapElement deserializeData,
+                                 measureMapElement measureData)
+{
+    if(!map || !path || !serializeData || !deserializeData){
+        return MAP_NULL_ARGUMENT;
+    }
+    if(map->spill){
+        map->spill->budget = budget;
+        enforceBudget(map);
+        return MAP_SUCCESS;
+    }
+
+    if(createNodeStates(map) != MAP_SUCCESS){
+        return MAP_OUT_OF_MEMORY;
+    }
+    Spill spill = malloc(sizeof(*spill));
+    if(!spill){
+        return MAP_OUT_OF_MEMORY;
+    }
+    spill->path = malloc(strlen(path) + 1);
+    spill->buffer = malloc(MAP_SERIALIZE_INITIAL_CAPACITY);
+    spill->capacity = MAP_SERIALIZE_INITIAL_CAPACITY;
+    spill->fd = -1;
+    if(!(spill->path) || !(spill->buffer)){
+        destroySpill(spill);
+        return MAP_OUT_OF_MEMORY;
+    }
+    strcpy(spill->path,path);
+    spill->fd = openSpillFile(path);
+    if(spill->fd < 0){
+        destroySpill(spill);
+        return MAP_IO_ERROR;
+    }
+    spill->file_size = 0;
+    spill->used_size = 0;
+    spill->budget = budget;
+    spill->resident_size = 0;
+    spill->serialize_data = serializeData;
+    spill->deserialize_data = deserializeData;
+    spill->measure_data = measureData;
+    spill->hand = NULL;
+    memset(spill->pinned,0,sizeof(spill->pinned));
+    spill->next_pinned = 0;
+    map->spill = spill;
+
+    for(Node node = map->first->next; node; node = node->next){
+        measureNodeData(map,node);
+    }
+    enforceBudget(map);
+    map->iterator = NULL;
+
+    return MAP_SUCCESS;
+}
+
+MapResult mapSetMemoryBudget(Map map,const char* path,long long budget,
+                             serializeMapElement serializeData,
+                             deserializeMapElement deserializeData,
+                             measureMapElement measureData)
+{
+    long long start = beginOperation(map,MAP_OPERATION_CONFIGURE,NULL);
+    MapResult result = setMemoryBudget(map,path,budget,serializeData,
+                                       deserializeData,measureData);
+    endOperation(map,MAP_OPERATION_CONFIGURE,NULL,result,start);
+
+    return result;
+}
+
+MapResult mapSaveShared(Map map,const char* name,
+                        serializeMapElement serializeKey,
+                        serializeMapElement serializeData)
+{
+    if(!map || !name || !serializeKey || !serializeData){
+        return MAP_NULL_ARGUMENT;
+    }
+
+    int fd = shm_open(name,O_RDWR | O_CREAT | O_TRUNC,0644);
+    if(fd < 0){
+        return MAP_IO_ERROR;
+    }
+    FILE *stream = fdopen(fd,"wb");
+    if(!stream){
+        close(fd);
+        shm_unlink(name);
+        return MAP_IO_ERROR;
+    }
+    MapResult result = writeMappedImage(map,stream,serializeKey,serializeData);
+    if(fclose(stream) != 0 && result == MAP_SUCCESS){
+        result = MAP_IO_ERROR;
+    }
+    if(result != MAP_SUCCESS){
+        shm_unlink(name);
+    }
+
+    return result;
+}
+
+MappedMap mapOpenShared(const char* name,
+                        compareMapKeyElements compareKeyElements)
+{
+    if(!name || !compareKeyElements){
+        return NULL;
+    }
+
+    int fd = shm_open(name,O_RDONLY,0);
+    if(fd < 0){
+        return NULL;
+    }
+    MappedMap map = mapImage(fd,compareKeyElements);
+    close(fd);
+
+    return map;
+}
+
+MapResult mapRemoveShared(const char* name)
+{
+    if(!name){
+        return MAP_NULL_ARGUMENT;
+    }
+
+    return shm_unlink(name) == 0 ? MAP_SUCCESS : MAP_ITEM_DOES_NOT_EXIST;
+}
+
+static MapResult replicateMap(Map map,int fd,serializeMapElement serializeKey,
+                              serializeMapElement serializeData,
+                              uint64_t fromSequence)
+{
+    if(!map || !serializeKey || !serializeData){
+        return MAP_NULL_ARGUMENT;
+    }
+    if(!(map->replication)){
+        Replication replication = malloc(sizeof(*replication));
+        if(!replication){
+            return MAP_OUT_OF_MEMORY;
+        }
+        replication->fd = -1;
+        replication->encoder.key_buffer = NULL;
+        replication->encoder.key_capacity = 0;
+        replication->encoder.data_buffer = NULL;
+        replication->encoder.data_capacity = 0;
+        replication->pending.bytes = NULL;
+        replication->pending.size = 0;
+        replication->pending.capacity = 0;
+        replication->backlog.bytes = NULL;
+        replication->backlog.size = 0;
+        replication->backlog.capacity = 0;
+        replication->backlog_start = 0;
+        replication->sequence = 0;
+        replication->failed = false;
+        map->replication = replication;
+    }
+    Replication replication = map->replication;
+    replication->encoder.serialize_key = serializeKey;
+    replication->encoder.serialize_data = serializeData;
+    if(replication->fd >= 0 && replication->fd != fd){
+        close(replication->fd);
+    }
+    replication->fd = fd;
+    replication->failed = false;
+    map->iterator = NULL;
+    if(fd < 0 || fromSequence == replication->sequence){
+        return MAP_SUCCESS;
+    }
+
+    size_t offset = 0;
+    MapResult result = MAP_SUCCESS;
+    if(fromSequence > replication->sequence ||
+       !findBacklogRecord(replication,fromSequence,&offset)){
+        result = resynchronize(map);
+    }else{
+        result = shipRecords(replication,replication->backlog.bytes + offset,
+                             replication->backlog.size - offset);
+    }
+    // the failure is reported here, not by the next change
+    replication->failed = false;
+
+    return result;
+}
+
+MapResult mapReplicate(Map map,int fd,serializeMapElement serializeKey,
+                       serializeMapElement serializeData,uint64_t fromSequence)
+{
+    long long start = beginOperation(map,MAP_OPERATION_REPLICATE,NULL);
+    MapResult result = replicateMap(map,fd,serializeKey,serializeData,
+                                    fromSequence);
+    endOperation(map,MAP_OPERATION_REPLICATE,NULL,result,start);
+
+    return result;
+}
+
+uint64_t mapGetSequence(Map map)
+{
+    if(!map || !(map->replication)){
+        return 0;
+    }
+    return map->replication->sequence;
+}
+
+MapFollower mapFollowerCreate(Map map,deserializeMapElement deserializeKey,
+                              deserializeMapElement deserializeData)
 {
-    Node new_node = malloc(sizeof(*new_node));
-    if(!new_node){
+    if(!map || !deserializeKey || !deserializeData){
         return NULL;
     }
-    new_node->key = map->copy_key(keyElement);
-    new_node->data = map->copy_data(dataElement);
-    if(!(new_node->key) || !(new_node->data)){
-        freeNode(map,new_node);
+
+    MapFollower follower = malloc(sizeof(*follower));
+    if(!follower){
         return NULL;
     }
+    follower->map = map;
+    follower->deserialize_key = deserializeKey;
+    follower->deserialize_data = deserializeData;
+    follower->fd = -1;
+    follower->buffer.bytes = NULL;
+    follower->buffer.size = 0;
+    follower->buffer.capacity = 0;
+    follower->start = 0;
+    follower->sequence = 0;
+    follower->resynchronizing = false;
 
-    return new_node;
+    return follower;
 }
 
-static void insertNewNode(Node prev_node,Node new_node)
+void mapFollowerDestroy(MapFollower follower)
 {
-    new_node->next = prev_node->next;
-    prev_node->next = new_node;
+    if(!follower){
+        return;
+    }
+    free(follower->buffer.bytes);
+    free(follower);
 }
 
-static void initializeMap(Map map,copyMapDataElements copyDataElement,
-                          copyMapKeyElements copyKeyElement,
-                          freeMapDataElements freeDataElement,
-                          freeMapKeyElements freeKeyElement,
-                          compareMapKeyElements compareKeyElements,
-                          Node dummy_first)
+uint64_t mapFollowerGetSequence(MapFollower follower)
 {
-    map->copy_data = copyDataElement;
-    map->copy_key = copyKeyElement;
-    map->free_data = freeDataElement;
-    map->free_key = freeKeyElement;
-    map->compare_keys = compareKeyElements;
-    map->size = 0;
-    map->first = dummy_first;
-    map->first->key = NULL;
-    map->first->data = NULL;
-    map->first->next = NULL;
-    map->iterator = map->first;
+    if(!follower){
+        return 0;
+    }
+    return follower->sequence;
 }
 
-Map mapCreate(copyMapDataElements copyDataElement,
-              copyMapKeyElements copyKeyElement,
-              freeMapDataElements freeDataElement,
-              freeMapKeyElements freeKeyElement,
-              compareMapKeyElements compareKeyElements)
+static MapResult applyReplication(MapFollower follower,int fd)
 {
-    if(!copyDataElement || !copyKeyElement || !freeDataElement ||
-       !freeKeyElement || !compareKeyElements){
-        return NULL;
+    if(!follower){
+        return MAP_NULL_ARGUMENT;
+    }
+    ByteBuffer *buffer = &follower->buffer;
+    if(fd != follower->fd){
+        // a partial record from an earlier connection is never completed
+        buffer->size = 0;
+        follower->start = 0;
+        follower->fd = fd;
+    }
+    if(follower->start > 0){
+        memmove(buffer->bytes,buffer->bytes + follower->start,
+                buffer->size - follower->start);
+        buffer->size -= follower->start;
+        follower->start = 0;
+    }
+    size_t size = buffer->size;
+    if(!appendBytes(buffer,NULL,MAP_REPLICATION_CHUNK_SIZE)){
+        return MAP_OUT_OF_MEMORY;
+    }
+    ssize_t count;
+    do{
+        count = read(fd,buffer->bytes + size,MAP_REPLICATION_CHUNK_SIZE);
+    }while(count < 0 && errno == EINTR);
+    buffer->size = size + (count > 0 ? (size_t)count : 0);
+    if(count <= 0){
+        return MAP_IO_ERROR;
     }
 
-    Map map = malloc(sizeof(*map));
-    if(!map){
-        return NULL;
+    // the complete records read are applied as one batch
+    Map map = follower->map;
+    int records = 0;
+    for(size_t offset = 0; buffer->size - offset >= MAP_RECORD_HEADER_SIZE;
+        records++){
+        uint32_t length = loadUint32(buffer->bytes + offset);
+        if(buffer->size - offset - MAP_RECORD_HEADER_SIZE < length){
+            break;
+        }
+        offset += MAP_RECORD_HEADER_SIZE + length;
     }
-    Node dummy_first = malloc(sizeof(*dummy_first));
-    if(!dummy_first){
-        free(map);
-        return NULL;
+    if(reserveUndoEntries(map,records) != MAP_SUCCESS){
+        return MAP_OUT_OF_MEMORY;
+    }
+    MapResult result = MAP_SUCCESS;
+    for(int i = 0; i < records && result == MAP_SUCCESS; i++){
+        const unsigned char *header = buffer->bytes + follower->start;
+        uint32_t length = loadUint32(header);
+        ChangeRecord record;
+        if(checksumBytes(header + MAP_RECORD_HEADER_SIZE,length) !=
+           loadUint32(header + 4) ||
+           !decodeRecord(header + MAP_RECORD_HEADER_SIZE,length,&record)){
+            result = MAP_IO_ERROR;
+            break;
+        }
+        // a clear starts the map over, so it may follow missed changes
+        bool repeated = follower->resynchronizing &&
+                        record.sequence == follower->sequence;
+        if(record.sequence != follower->sequence + 1 && !repeated &&
+           record.type != CHANGE_CLEAR){
+            result = MAP_IO_ERROR;
+            break;
+        }
+        result = applyRecord(map,&record,follower->deserialize_key,
+                             follower->deserialize_data);
+        if(result == MAP_SUCCESS){
+            follower->resynchronizing = record.type == CHANGE_CLEAR ||
+                                        repeated;
+            follower->sequence = record.sequence;
+            follower->start += MAP_RECORD_HEADER_SIZE + length;
+        }
+    }
+    if(result == MAP_IO_ERROR){
+        // the stream can't be trusted past a damaged or missing record, so
+        // the follower has to reconnect, and the bytes read are dropped
+        buffer->size = 0;
+        follower->start = 0;
     }
+    map->iterator = NULL;
+    MapResult finish_result = finishChanges(map);
 
-    initializeMap(map,copyDataElement,copyKeyElement,freeDataElement,
-                  freeKeyElement,compareKeyElements,dummy_first);
+    return result == MAP_SUCCESS ? finish_result : result;
+}
 
-    return map;
+MapResult mapFollowerApply(MapFollower follower,int fd)
+{
+    Map map = follower ? follower->map : NULL;
+    long long start = beginOperation(map,MAP_OPERATION_REPLICATE,NULL);
+    MapResult result = applyReplication(follower,fd);
+    endOperation(map,MAP_OPERATION_REPLICATE,NULL,result,start);
+
+    return result;
 }
 
-void mapDestroy(Map map)
+static MapResult setCapacity(Map map,int capacity,evictMapElements evict,
+                             void* context)
 {
     if(!map){
-        return;
+        return MAP_NULL_ARGUMENT;
     }
-    mapClear(map);
-    free(map->first);
-    free(map);
+    if(capacity <= 0){
+        destroyCache(map->cache);
+        map->cache = NULL;
+        return MAP_SUCCESS;
+    }
+    if(!(map->cache)){
+        if(createNodeStates(map) != MAP_SUCCESS){
+            return MAP_OUT_OF_MEMORY;
+        }
+        Cache cache = calloc(1,sizeof(*cache));
+        if(!cache){
+            return MAP_OUT_OF_MEMORY;
+        }
+        cache->policy = MAP_EVICTION_LRU;
+        map->cache = cache;
+        // the recency of the existing keys is unknown, so they are evicted in
+        // key order
+        for(Node node = map->first->next; node; node = node->next){
+            node->state->cache_size = 0;
+            linkRecentNode(map,node);
+        }
+    }
+    int old_capacity = map->cache->capacity;
+    map->cache->capacity = capacity;
+    if(map->cache->policy == MAP_EVICTION_TINYLFU &&
+       resizeSketch(map->cache) != MAP_SUCCESS){
+        map->cache->capacity = old_capacity;
+        return MAP_OUT_OF_MEMORY;
+    }
+    map->cache->evict = evict;
+    map->cache->context = context;
+    map->iterator = NULL;
+
+    return finishChanges(map);
 }
 
-Map mapCopy(Map map)
+MapResult mapSetCapacity(Map map,int capacity,evictMapElements evict,
+                         void* context)
+{
+    long long start = beginOperation(map,MAP_OPERATION_CONFIGURE,NULL);
+    MapResult result = setCapacity(map,capacity,evict,context);
+    endOperation(map,MAP_OPERATION_CONFIGURE,NULL,result,start);
+
+    return result;
+}
+
+MapResult mapPutWithTTL(Map map,MapKeyElement keyElement,
+                        MapDataElement dataElement,long long ttl)
+{
+    long long start = beginOperation(map,MAP_OPERATION_PUT,keyElement);
+    MapResult result = map ? createExpiry(map) : MAP_SUCCESS;
+    if(result == MAP_SUCCESS){
+        result = putElement(map,keyElement,dataElement,
+                            currentTime() + (ttl > 0 ? ttl : 0));
+    }
+    endOperation(map,MAP_OPERATION_PUT,keyElement,result,start);
+
+    return result;
+}
+
+int mapExpireTick(Map map,int limit)
 {
     if(!map){
-        return NULL;
+        return -1;
+    }
+    if(!(map->expiry)){
+        return 0;
     }
 
-    Map map_copy = mapCreate(map->copy_data,map->copy_key,map->free_data,
-                             map->free_key,map->compare_keys);
-    if(!map_copy){
-        return NULL;
+    int removed = advanceWheel(map,currentTime(),limit > 0 ? limit : INT_MAX);
+    if(removed > 0){
+        map->iterator = NULL;
+        finishChanges(map);
     }
 
-    map_copy->size = map->size;
+    return removed;
+}
 
-    if(map->size != 0){
-        int error_code = copyList(map,map_copy);
-        if(error_code != MAP_SUCCESS){
-            mapDestroy(map_copy);
-            return NULL;
+static MapResult setEvictionPolicy(Map map,MapEvictionPolicy policy,
+                                   hashMapKeyElements hashKey)
+{
+    if(!map || (policy == MAP_EVICTION_TINYLFU && !hashKey)){
+        return MAP_NULL_ARGUMENT;
+    }
+    Cache cache = map->cache;
+    if(!cache){
+        return MAP_ITEM_DOES_NOT_EXIST;
+    }
+    if(policy == MAP_EVICTION_TINYLFU){
+        cache->hash_key = hashKey;
+        if(resizeSketch(cache) != MAP_SUCCESS){
+            return MAP_OUT_OF_MEMORY;
         }
     }
-
+    if(policy != cache->policy){
+        // a TinyLFU cache starts with all its keys on probation
+        moveAllRecentNodes(cache,policy == MAP_EVICTION_TINYLFU ?
+                                 CACHE_PROBATION : CACHE_WINDOW);
+        cache->policy = policy;
+    }
     map->iterator = NULL;
-    map_copy->iterator = NULL;
 
-    return map_copy;
+    return finishChanges(map);
 }
 
-int mapGetSize(Map map)
+MapResult mapSetEvictionPolicy(Map map,MapEvictionPolicy policy,
+                               hashMapKeyElements hashKey)
 {
-    if(!map){
-        return -1;
-    }
-    return map->size;
+    long long start = beginOperation(map,MAP_OPERATION_CONFIGURE,NULL);
+    MapResult result = setEvictionPolicy(map,policy,hashKey);
+    endOperation(map,MAP_OPERATION_CONFIGURE,NULL,result,start);
+
+    return result;
 }
 
-bool mapContains(Map map,MapKeyElement element)
+MapResult mapGetCacheStats(Map map,MapCacheStats* stats)
 {
-    if(!map || !element){
-        return false;
+    if(!map || !stats){
+        return MAP_NULL_ARGUMENT;
+    }
+    if(!(map->cache)){
+        return MAP_ITEM_DOES_NOT_EXIST;
     }
+    *stats = map->cache->stats;
+    stats->bytes = map->cache->bytes;
 
-    Node prev_node = NULL;
+    return MAP_SUCCESS;
+}
 
-    if(findPrevNode(map,&prev_node,element)){
-        return true;
-    }else{
-        return false;
+void mapResetCacheStats(Map map)
+{
+    if(map && map->cache){
+        memset(&map->cache->stats,0,sizeof(map->cache->stats));
     }
 }
 
-MapResult mapPut(Map map,MapKeyElement keyElement,MapDataElement dataElement)
+static MapResult setByteBudget(Map map,long long budget,
+                               measureMapElement measureKey,
+                               measureMapElement measureData)
 {
-    if(!map || !keyElement || !dataElement){
+    if(!map || (budget > 0 && (!measureKey || !measureData))){
         return MAP_NULL_ARGUMENT;
     }
-
-    Node prev_node = NULL;
-
-    if(findPrevNode(map,&prev_node,keyElement)){
-        map->free_data(prev_node->next->data);
-        prev_node->next->data = map->copy_data(dataElement);
-        if(!(prev_node->next->data)){
-            return MAP_OUT_OF_MEMORY;
-        }
-    }else{
-        Node new_node = createNewNode(map,keyElement,dataElement);
-        if(!new_node){
-            return MAP_OUT_OF_MEMORY;
+    Cache cache = map->cache;
+    if(!cache){
+        return MAP_ITEM_DOES_NOT_EXIST;
+    }
+    if(budget <= 0){
+        // nothing measures the entries anymore, so stop counting them
+        cache->byte_budget = 0;
+        cache->bytes = 0;
+        for(Node node = map->first->next; node; node = node->next){
+            node->state->cache_size = 0;
         }
-        insertNewNode(prev_node,new_node);
-        map->size += 1;
+        return MAP_SUCCESS;
     }
 
+    cache->byte_budget = budget;
+    cache->measure_key = measureKey;
+    cache->measure_data = measureData;
+    cache->bytes = 0;
+    for(Node node = map->first->next; node; node = node->next){
+        MapDataElement data = borrowNodeData(map,node);
+        node->state->cache_size = measureKey(node->key) +
+                           (data ? measureData(data) : 0);
+        if(data){
+            returnNodeData(map,node,data);
+        }
+        cache->bytes += node->state->cache_size;
+    }
     map->iterator = NULL;
 
+    return finishChanges(map);
+}
+
+MapResult mapSetByteBudget(Map map,long long budget,
+                           measureMapElement measureKey,
+                           measureMapElement measureData)
+{
+    long long start = beginOperation(map,MAP_OPERATION_CONFIGURE,NULL);
+    MapResult result = setByteBudget(map,budget,measureKey,measureData);
+    endOperation(map,MAP_OPERATION_CONFIGURE,NULL,result,start);
+
+    return result;
+}
+
+static MapResult setWriteBack(Map map,writeBackMapElements writeBack,
+                              int batchSize,void* context)
+{
+    if(!map){
+        return MAP_NULL_ARGUMENT;
+    }
+    Cache cache = map->cache;
+    if(!cache){
+        return MAP_ITEM_DOES_NOT_EXIST;
+    }
+    flushWriteBack(cache);
+    if(!writeBack){
+        free(cache->batch_keys);
+        free(cache->batch_data);
+        cache->batch_keys = NULL;
+        cache->batch_data = NULL;
+        cache->write_back = NULL;
+        return MAP_SUCCESS;
+    }
+
+    if(batchSize < 1){
+        batchSize = 1;
+    }
+    MapKeyElement *batch_keys = realloc(cache->batch_keys,
+                                        batchSize * sizeof(*batch_keys));
+    if(batch_keys){
+        cache->batch_keys = batch_keys;
+    }
+    MapDataElement *batch_data = realloc(cache->batch_data,
+                                         batchSize * sizeof(*batch_data));
+    if(batch_data){
+        cache->batch_data = batch_data;
+    }
+    if(!batch_keys || !batch_data){
+        return MAP_OUT_OF_MEMORY;
+    }
+    cache->write_back = writeBack;
+    cache->write_back_context = context;
+    cache->batch_size = batchSize;
+
     return MAP_SUCCESS;
 }
 
-MapDataElement mapGet(Map map, MapKeyElement keyElement)
+MapResult mapSetWriteBack(Map map,writeBackMapElements writeBack,int batchSize,
+                          void* context)
+{
+    long long start = beginOperation(map,MAP_OPERATION_CONFIGURE,NULL);
+    MapResult result = setWriteBack(map,writeBack,batchSize,context);
+    endOperation(map,MAP_OPERATION_CONFIGURE,NULL,result,start);
+
+    return result;
+}
+
+MapResult mapMarkDirty(Map map,MapKeyElement keyElement,bool dirty)
 {
     if(!map || !keyElement){
-        return NULL;
+        return MAP_NULL_ARGUMENT;
     }
 
     Node prev_node = NULL;
-    if(!findPrevNode(map,&prev_node,keyElement)){
-        return NULL;
+    if(!findPrevNode(map,&prev_node,keyElement) ||
+       hasExpired(prev_node->next)){
+        return MAP_ITEM_DOES_NOT_EXIST;
+    }
+    if(!(prev_node->next->state)){
+        if(!dirty){
+            return MAP_SUCCESS;
+        }
+        // the mark is kept in the state of the node
+        if(createNodeStates(map) != MAP_SUCCESS){
+            return MAP_OUT_OF_MEMORY;
+        }
     }
+    prev_node->next->state->dirty = dirty;
 
-    return prev_node->next->data;
+    return MAP_SUCCESS;
 }
 
-MapResult mapRemove(Map map, MapKeyElement keyElement)
+bool mapIsDirty(Map map,MapKeyElement keyElement)
 {
     if(!map || !keyElement){
-        return MAP_NULL_ARGUMENT;
+        return false;
     }
 
     Node prev_node = NULL;
-    if(!findPrevNode(map,&prev_node,keyElement)){
+    return findPrevNode(map,&prev_node,keyElement) &&
+           prev_node->next->state && prev_node->next->state->dirty &&
+           !hasExpired(prev_node->next);
+}
+
+MapResult mapFlushWriteBack(Map map)
+{
+    if(!map){
+        return MAP_NULL_ARGUMENT;
+    }
+    if(!(map->cache) || !(map->cache->write_back)){
         return MAP_ITEM_DOES_NOT_EXIST;
     }
-    Node node_to_remove = prev_node->next;
-    prev_node->next = node_to_remove->next;
-    freeNode(map,node_to_remove);
+    flushWriteBack(map->cache);
 
-    map->size -= 1;
-    map->iterator = NULL;
+    return MAP_SUCCESS;
+}
+
+MapResult mapGetStats(Map map,MapStats* stats)
+{
+    if(!map || !stats){
+        return MAP_NULL_ARGUMENT;
+    }
+#ifdef MAP_NO_STATS
+    return MAP_ITEM_DOES_NOT_EXIST;
+#else
+    *stats = map->stats;
 
     return MAP_SUCCESS;
+#endif
 }
 
-MapKeyElement mapGetFirst(Map map)
+void mapResetStats(Map map)
 {
-    if(!map || !(map->first->next)){
-        return NULL;
+    if(map){
+        memset(&map->stats,0,sizeof(map->stats));
     }
-    map->iterator = map->first->next;
-    return map->iterator->key;
 }
 
-MapKeyElement mapGetNext(Map map)
+MapResult mapSetLatencyTracking(Map map,bool track)
 {
-    if(!map || !(map->iterator)){
-        return NULL;
+    if(!map){
+        return MAP_NULL_ARGUMENT;
+    }
+    if(!track){
+        free(map->latency);
+        map->latency = NULL;
+        return MAP_SUCCESS;
+    }
+    if(!(map->latency)){
+        map->latency = calloc(MAP_OPERATIONS_COUNT,sizeof(*map->latency));
+        if(!(map->latency)){
+            return MAP_OUT_OF_MEMORY;
+        }
     }
 
-    if(!(map->iterator->next)){
-        return NULL;
-    }else{
-        map->iterator = map->iterator->next;
+    return MAP_SUCCESS;
+}
+
+MapResult mapGetLatency(Map map,MapOperation operation,
+                        MapLatencyHistogram* histogram)
+{
+    if(!map || !histogram){
+        return MAP_NULL_ARGUMENT;
+    }
+    if(!(map->latency) || operation < 0 || operation >= MAP_OPERATIONS_COUNT){
+        return MAP_ITEM_DOES_NOT_EXIST;
     }
+    *histogram = map->latency[operation];
 
-    return map->iterator->key;
+    return MAP_SUCCESS;
 }
 
-MapResult mapClear(Map map)
+void mapResetLatency(Map map)
 {
-    if(!map){
+    if(map && map->latency){
+        memset(map->latency,0,MAP_OPERATIONS_COUNT * sizeof(*map->latency));
+    }
+}
+
+MapResult mapMergeLatency(MapLatencyHistogram* histogram,
+                          const MapLatencyHistogram* other)
+{
+    if(!histogram || !other){
         return MAP_NULL_ARGUMENT;
     }
+    for(int i = 0; i < MAP_LATENCY_BUCKETS; i++){
+        histogram->counts[i] += other->counts[i];
+    }
+    histogram->count += other->count;
+    histogram->total += other->total;
+    if(other->max > histogram->max){
+        histogram->max = other->max;
+    }
 
-    freeList(map,map->first->next);
-    map->first->next = NULL;
-    map->size = 0;
+    return MAP_SUCCESS;
+}
+
+long long mapLatencyPercentile(const MapLatencyHistogram* histogram,
+                               double percentile)
+{
+    if(!histogram){
+        return -1;
+    }
+    if(histogram->count == 0){
+        return 0;
+    }
+    percentile = percentile < 0 ? 0 : percentile > 100 ? 100 : percentile;
+    // the rank of the latency, counting from 1
+    long long rank = (long long)(percentile / 100 * histogram->count);
+    if(rank < histogram->count &&
+       rank < percentile / 100 * histogram->count){
+        rank++;
+    }
+    if(rank < 1){
+        rank = 1;
+    }
+    long long seen = 0;
+    for(int i = 0; i < MAP_LATENCY_BUCKETS; i++){
+        seen += histogram->counts[i];
+        if(seen >= rank){
+            long long end = latencyBucketEnd(i);
+            return end < histogram->max ? end : histogram->max;
+        }
+    }
+
+    return histogram->max;
+}
+
+MapResult mapSetTraceHooks(const MapTraceHooks* hooks)
+{
+#ifdef MAP_TRACING
+    if(hooks){
+        trace_hooks = *hooks;
+    }else{
+        memset(&trace_hooks,0,sizeof(trace_hooks));
+    }
 
     return MAP_SUCCESS;
+#else
+    (void)hooks;
+    return MAP_ITEM_DOES_NOT_EXIST;
+#endif
 }
@@ -2,6 +2,8 @@
 #define MAP_MTM_H_
 
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
 
 /**
 * Generic Map Container
@@ -32,21 +34,149 @@
 *   				  returns it.
 *	mapClear		- Clears the contents of the map. Frees all the elements of
 *	 				  the map using the free function.
+*   mapCompute		- Computes the data of a key from its current data (if any)
+*   				  and updates, inserts or removes it in a single search.
+*   				  This resets the internal iterator.
+*   mapMergeValue	- Inserts a value for a key, or combines it with the data
+*   				  already paired to that key, in a single search.
+*   				  This resets the internal iterator.
+*   mapPutBatch	- Gives many keys values in a single pass over the map.
+*   				  This resets the internal iterator.
+*   mapTxnBegin	- Starts a transaction: a batch of puts and removes which is
+*   				  applied to the map all at once.
+*   mapTxnPut		- Stages a put in a transaction
+*   mapTxnRemove	- Stages a remove in a transaction
+*   mapTxnCommit	- Applies all the staged operations of a transaction in a
+*   				  single pass over the map and ends the transaction.
+*   				  This resets the internal iterator.
+*   mapTxnAbort	- Discards all the staged operations of a transaction and
+*   				  ends it.
+*   mapSavepoint	- Marks the current state of the map so it can be rolled
+*   				  back to later.
+*   mapRollback	- Reverts all the changes made to the map since a savepoint.
+*   				  This resets the internal iterator.
+*   mapReleaseSavepoint - Forgets a savepoint and the ones set after it.
+*   mapSave		- Writes the elements of the map to a stream, in order.
+*   mapSaveCompressed	- Writes the elements of the map to a stream, in
+*   				  compressed blocks.
+*   mapLoad		- Reads elements written by mapSave or mapSaveCompressed into
+*   				  a map.
+*   				  This resets the internal iterator.
+*   mapSaveMapped	- Writes the map to a file as an indexed image which can be
+*   				  memory-mapped by mapOpenMapped.
+*   mapOpenMapped	- Memory-maps an image file as a read-only map.
+*   mapOpenMappedWithMode - Memory-maps an image file as a read-only map,
+*   				  choosing when its pages are read.
+*   mapSaveShared	- Writes the map as an image into a POSIX shared memory
+*   				  object, for other processes to attach to.
+*   mapOpenShared	- Attaches to an image in shared memory as a read-only map.
+*   mapRemoveShared - Removes a shared memory object written by mapSaveShared.
+*   mappedMapClose	- Unmaps a read-only map.
+*   mappedMapGetSize - Returns the size of a read-only map.
+*   mappedMapGet	- Returns the data paired to a key in a read-only map,
+*   				  pointing directly into the mapped image.
+*   mappedMapGetFirst - Sets the iterator of a read-only map to its first key
+*   				  and returns it.
+*   mappedMapGetNext - Advances the iterator of a read-only map and returns the
+*   				  next key.
+*   mapOpenDurable	- Makes a map durable: loads its last saved state and logs
+*   				  its changes from then on.
+*   mapSync		- Forces the logged changes of a durable map to disk.
+*   mapCheckpoint	- Writes a snapshot of a durable map and empties its log.
+*   mapCheckpointIncremental - Saves the entries of a map changed since its
+*   				  last checkpoint.
+*   mapRestoreCheckpoint - Reads the state saved by mapCheckpointIncremental
+*   				  into a map.
+*   mapSnapshotBackground - Starts saving the current state of a map to a file
+*   				  while the map goes on being used.
+*   mapSnapshotWait	- Waits for a background snapshot to be written.
+*   mapSetMemoryBudget - Limits the memory taken by the data elements of a map,
+*   				  spilling the least recently used ones to disk.
+*   mapReplicate	- Streams the changes of a map to a follower.
+*   mapGetSequence	- Returns the sequence number of the latest change streamed.
+*   mapFollowerCreate - Creates the applier of a follower map.
+*   mapFollowerDestroy - Deallocates the applier of a follower map.
+*   mapFollowerApply - Applies the changes read from a primary to a follower
+*   				  map.
+*   mapFollowerGetSequence - Returns the sequence number of the latest change
+*   				  applied to a follower map.
+*   mapSetCapacity	- Makes a map a cache of a maximal number of keys, evicting
+*   				  the least recently used ones.
+*   mapSetEvictionPolicy - Chooses the policy of a map in cache mode.
+*   mapSetByteBudget - Limits the bytes the keys and data of a map in cache
+*   				  mode take.
+*   mapSetWriteBack - Gives a map in cache mode a hook receiving batches of its
+*   				  evicted dirty entries.
+*   mapMarkDirty	- Marks a key as changed since it was written back, or not.
+*   mapIsDirty		- Returns whether a key is marked as dirty.
+*   mapFlushWriteBack - Gives the evicted dirty entries waiting for a full
+*   				  batch to the write-back hook.
+*   mapGetCacheStats - Returns the hit and eviction counts of a map in cache
+*   				  mode.
+*   mapResetCacheStats - Zeroes the hit and eviction counts of a map in cache
+*   				  mode.
+*   mapPutWithTTL	- Gives a key a value which expires after a given time.
+*   				  This resets the internal iterator.
+*   mapExpireTick	- Removes the keys which expired.
+*   mapGetStats	- Returns the operation counts of a map.
+*   mapResetStats	- Zeroes the operation counts of a map.
+*   mapSetLatencyTracking - Starts or stops recording the latencies of the
+*   				  operations of a map.
+*   mapGetLatency	- Returns the latency histogram of an operation of a map.
+*   mapResetLatency - Empties the latency histograms of a map.
+*   mapMergeLatency - Adds the latencies of a histogram to another.
+*   mapLatencyPercentile - Returns a percentile of the latencies in a
+*   				  histogram.
+*   mapSetTraceHooks - Registers functions called around every operation of
+*   				  every map.
 * 	MAP_FOREACH	- A macro for iterating over the map's elements.
 */
 
 /** Type for defining the map */
 typedef struct Map_t *Map;
 
+/** Type for defining a read-only map memory-mapped from an image file */
+typedef struct MappedMap_t *MappedMap;
+
+/** Type for defining a snapshot of a map being written in the background */
+typedef struct MapSnapshot_t *MapSnapshot;
+
+/** Type for defining the applier of a follower map, mirroring a primary map */
+typedef struct MapFollower_t *MapFollower;
+
+/** Type for defining a transaction of operations on a map */
+typedef struct MapTxn_t *MapTxn;
+
+/** Type for identifying a savepoint of a map */
+typedef int MapSavepoint;
+
 /** Type used for returning error codes from map functions */
 typedef enum MapResult_t {
 	MAP_SUCCESS,
 	MAP_OUT_OF_MEMORY,
 	MAP_NULL_ARGUMENT,
 	MAP_ITEM_ALREADY_EXISTS,
-	MAP_ITEM_DOES_NOT_EXIST
+	MAP_ITEM_DOES_NOT_EXIST,
+	MAP_IO_ERROR
 } MapResult;
 
+/** Type used for choosing when a durable map forces its changes to disk */
+typedef enum MapSyncPolicy_t {
+	/** changes are written to the log in groups (see MAP_SYNC_GROUP) and left
+	 * to the operating system to force to disk */
+	MAP_SYNC_NONE,
+	/** changes are written to the log in groups, each forced to disk. A group
+	 * is written once it holds 64 changes, by the first change made 10
+	 * milliseconds or more after the group started, by mapSync or by
+	 * mapDestroy. Until then, the changes in it are lost by a crash although
+	 * the functions making them returned: call mapSync after the changes
+	 * which must not be lost, or periodically to bound the loss */
+	MAP_SYNC_GROUP,
+	/** every change is written to the log and forced to disk before the
+	 * function making it returns */
+	MAP_SYNC_ALWAYS
+} MapSyncPolicy;
+
 /** Data element data type for map container */
 typedef void* MapDataElement;
 
@@ -75,6 +205,210 @@ typedef void(*freeMapKeyElements)(MapKeyElement);
 */
 typedef int(*compareMapKeyElements)(MapKeyElement, MapKeyElement);
 
+/**
+* Type of function for serializing a key or data element of the map.
+* Receives the element and a buffer of buffer_size bytes.
+* This function should return:
+* 		The number of bytes representing the element, having written them into
+* 		the buffer if they fit in it (if not, it is called again with a buffer
+* 		large enough);
+* 		A negative integer if the element cannot be serialized.
+*/
+typedef int(*serializeMapElement)(void*, void*, int);
+
+/**
+* Type of function for deserializing a key or data element of the map.
+* Receives a buffer and the number of bytes in it, as written by the matching
+* serializeMapElement function.
+* This function should return:
+* 		A newly allocated element, which the map takes as is (without copying
+* 		it) and later deallocates using its free function;
+* 		NULL if the element cannot be deserialized or an allocation failed.
+*/
+typedef void*(*deserializeMapElement)(const void*, int);
+
+/**
+* Type of function used by mapCompute to compute the new data of a key.
+* Receives the key, the data element currently paired with it (NULL if the key
+* is not in the map) and the context pointer given to mapCompute.
+* This function should return:
+* 		The data element to pair with the key. It is copied into the map
+* 		using the copy function, unless it is the current data element itself
+* 		(updated in place) which is then kept as is;
+* 		NULL if the key should not be in the map (it is removed if it exists).
+*/
+typedef MapDataElement(*computeMapDataElement)(MapKeyElement, MapDataElement,
+                                               void*);
+
+/**
+* Type of function used by mapMergeValue to combine the data element already
+* paired with a key (first argument) with a new value (second argument).
+* This function should return:
+* 		The current data element itself, updated in place, which is kept
+* 		as is;
+* 		The new value, which is copied into the map using the copy function;
+* 		A newly allocated data element, which the map takes as is (without
+* 		copying it) and later deallocates using its free function;
+* 		NULL if the key should be removed from the map.
+*/
+typedef MapDataElement(*mergeMapDataElements)(MapDataElement, MapDataElement);
+
+/**
+* Type of function called by a map in cache mode (see mapSetCapacity) with the
+* key and data elements of an entry it evicts, and the context pointer given to
+* mapSetCapacity, right before the entry is removed from the map. The elements
+* are then deallocated by the map or, for an entry marked as dirty, passed to
+* the write-back hook (see mapSetWriteBack), so they should be copied if kept.
+*/
+typedef void(*evictMapElements)(MapKeyElement, MapDataElement, void*);
+
+/**
+* Type of function used by a TinyLFU cache (see mapSetEvictionPolicy) to hash
+* key elements. Equal keys (by the comparison function) must have equal
+* hashes.
+*/
+typedef unsigned int(*hashMapKeyElements)(MapKeyElement);
+
+/**
+* Type of function used by a map with a byte budget (see mapSetByteBudget) or
+* in spill mode (see mapSetMemoryBudget) to measure a key or data element.
+* Returns the number of bytes the element takes, including whatever it points
+* to.
+*/
+typedef int(*measureMapElement)(void*);
+
+/**
+* Type of function a map in cache mode gives batches of its evicted dirty
+* entries to (see mapSetWriteBack). Receives arrays of the key and data
+* elements of count entries, and the context pointer given to mapSetWriteBack.
+* The function owns the elements, and should deallocate them once written.
+* The arrays themselves belong to the map, and are reused after the function
+* returns. It must not change the map.
+*/
+typedef void(*writeBackMapElements)(MapKeyElement*, MapDataElement*, int,
+                                    void*);
+
+/** The policy choosing which keys a map in cache mode evicts */
+typedef enum MapEvictionPolicy_t {
+	/** evicts the least recently used key */
+	MAP_EVICTION_LRU,
+	/** W-TinyLFU: new keys enter a small LRU window (1% of the capacity);
+	 *  a key leaving it is admitted into the main area only if it was
+	 *  accessed more often lately than the key the main area would evict,
+	 *  which keeps one-off scans from flushing the cache */
+	MAP_EVICTION_TINYLFU
+} MapEvictionPolicy;
+
+/** Statistics of a map in cache mode, to compare eviction policies by */
+typedef struct MapCacheStats_t {
+	/** number of mapGet calls which found their key, and which did not */
+	long long hits;
+	long long misses;
+	/** number of keys evicted */
+	long long evictions;
+	/** number of those which were new keys the TinyLFU policy did not admit */
+	long long rejections;
+	/** current number of bytes of the keys and data (with a byte budget) */
+	long long bytes;
+} MapCacheStats;
+
+/** The operations of a map counted by mapGetStats, timed by
+ *  mapSetLatencyTracking and traced by mapSetTraceHooks */
+typedef enum MapOperation_t {
+	/** mapPut and mapPutWithTTL */
+	MAP_OPERATION_PUT,
+	MAP_OPERATION_GET,
+	MAP_OPERATION_CONTAINS,
+	MAP_OPERATION_REMOVE,
+	MAP_OPERATION_GET_FIRST,
+	MAP_OPERATION_GET_NEXT,
+	MAP_OPERATION_COPY,
+	MAP_OPERATION_CLEAR,
+	MAP_OPERATION_COMPUTE,
+	MAP_OPERATION_MERGE,
+	MAP_OPERATION_PUT_BATCH,
+	MAP_OPERATION_TXN_COMMIT,
+	/** mapSave and mapSaveCompressed */
+	MAP_OPERATION_SAVE,
+	/** mapLoad and mapRestoreCheckpoint */
+	MAP_OPERATION_LOAD,
+	/** mapCheckpoint and mapCheckpointIncremental */
+	MAP_OPERATION_CHECKPOINT,
+	/** mapSetCapacity, mapSetEvictionPolicy, mapSetByteBudget,
+	 *  mapSetWriteBack and mapSetMemoryBudget */
+	MAP_OPERATION_CONFIGURE,
+	/** mapReplicate, and mapFollowerApply (counted by the follower's map) */
+	MAP_OPERATION_REPLICATE,
+	/** the number of operations, not an operation */
+	MAP_OPERATIONS_COUNT
+} MapOperation;
+
+/** Operation counts of a map, to find out where its time goes */
+typedef struct MapStats_t {
+	/** number of calls of each operation, indexed by MapOperation */
+	long long calls[MAP_OPERATIONS_COUNT];
+	/** number of calls of the key comparison function */
+	long long compares;
+	/** number of searches for the position of a key, the number of nodes
+	 *  they stepped over in total (the mean is nodes_traversed / searches)
+	 *  and the most nodes a single search stepped over */
+	long long searches;
+	long long nodes_traversed;
+	long long max_traversed;
+	/** number of nodes allocated, rather than reused from freed nodes */
+	long long allocations;
+	/** number of calls of the copy and free functions of keys and data */
+	long long key_copies;
+	long long data_copies;
+	long long key_frees;
+	long long data_frees;
+} MapStats;
+
+/** Number of buckets of a latency histogram. Latencies below 16 nanoseconds
+ *  have a bucket each, and every higher power of 2 is split into 8 buckets,
+ *  up to 2^40 nanoseconds (about 18 minutes), so a bucket spans at most 1/8
+ *  of the latencies in it */
+#define MAP_LATENCY_BUCKETS 304
+
+/** Histogram of the latencies of an operation of a map, in nanoseconds */
+typedef struct MapLatencyHistogram_t {
+	/** number of latencies in each bucket */
+	long long counts[MAP_LATENCY_BUCKETS];
+	/** number of latencies recorded, their sum and the highest of them */
+	long long count;
+	long long total;
+	long long max;
+} MapLatencyHistogram;
+
+/**
+* Type of function called right before an operation of a map (see
+* mapSetTraceHooks). Receives the map, the operation, the key it was given
+* (NULL if none) and the context pointer of the hooks. It must not change the
+* map.
+*/
+typedef void(*beginMapOperation)(Map, MapOperation, MapKeyElement, void*);
+
+/**
+* Type of function called right after an operation of a map (see
+* mapSetTraceHooks). Receives the map, the operation, the key it was given
+* (NULL if none), its result, the number of nanoseconds it took and the
+* context pointer of the hooks. Operations not returning a MapResult report
+* MAP_SUCCESS if they found what they looked for, MAP_ITEM_DOES_NOT_EXIST if
+* not and MAP_NULL_ARGUMENT if given a NULL. It must not change the map.
+*/
+typedef void(*endMapOperation)(Map, MapOperation, MapKeyElement, MapResult,
+                               long long, void*);
+
+/** Functions called around every operation of every map */
+typedef struct MapTraceHooks_t {
+	/** called before each operation, may be NULL */
+	beginMapOperation begin;
+	/** called after each operation, may be NULL */
+	endMapOperation end;
+	/** passed as is to the functions */
+	void* context;
+} MapTraceHooks;
+
 /**
 * mapCreate: Allocates a new empty map.
 *
@@ -160,12 +494,19 @@ MapResult mapPut(Map map, MapKeyElement keyElement, MapDataElement dataElement);
 /**
 *	mapGet: Returns the data associated with a specific key in the map.
 *			Iterator status unchanged
+*			In spill mode (see mapSetMemoryBudget) a spilled data element is
+*			read back from disk. The elements returned by the last 16 calls
+*			to mapGet are not spilled again, so they stay valid until their
+*			keys are changed or removed.
+*			In cache mode (see mapSetCapacity) the key becomes the most
+*			recently used one.
 *
 * @param map - The map for which to get the data element from.
 * @param keyElement - The key element which need to be found and whos data
 we want to get.
 * @return
-*  NULL if a NULL pointer was sent or if the map does not contain the requested key.
+*  NULL if a NULL pointer was sent or if the map does not contain the requested key,
+*  or reading a spilled data element failed.
 * 	The data element associated with the key otherwise.
 */
 MapDataElement mapGet(Map map, MapKeyElement keyElement);
@@ -185,6 +526,8 @@ MapDataElement mapGet(Map map, MapKeyElement keyElement);
 *  will also be freed using the free function given at initialization.
 * @return
 * 	MAP_NULL_ARGUMENT if a NULL was sent to the function
+*  MAP_OUT_OF_MEMORY if there is an active savepoint and logging the removal
+*  	failed
 *  MAP_ITEM_DOES_NOT_EXIST if an equal key item does not already exists in the map
 * 	MAP_SUCCESS the paired elements had been removed successfully
 */
@@ -224,10 +567,916 @@ MapKeyElement mapGetNext(Map map);
 * 	Target map to remove all element from.
 * @return
 * 	MAP_NULL_ARGUMENT - if a NULL pointer was sent.
+* 	MAP_OUT_OF_MEMORY - if there is an active savepoint and logging the
+* 		clear failed.
 * 	MAP_SUCCESS - Otherwise.
 */
 MapResult mapClear(Map map);
 
+/**
+* mapCompute: Computes the data element of a key from the data element
+* currently paired with it, and stores the result - all with a single search
+* of the map. Useful for read-modify-write updates such as counters, which
+* would otherwise need a mapGet followed by a mapPut.
+* Iterator's value is undefined after this operation.
+*
+* @param map - The map to update
+* @param keyElement - The key element whose data is computed. A copy of it
+* 		is inserted if the key is not in the map and compute returns data.
+* @param compute - The function computing the new data element
+* 		(see computeMapDataElement).
+* @param context - Passed as is to compute. May be NULL.
+* @return
+* 	MAP_NULL_ARGUMENT if a NULL was sent as map, keyElement or compute
+* 	MAP_OUT_OF_MEMORY if an allocation failed. The map is unchanged.
+* 	MAP_SUCCESS the key was updated, inserted, removed or left absent
+*/
+MapResult mapCompute(Map map, MapKeyElement keyElement,
+                     computeMapDataElement compute, void* context);
+
+/**
+* mapMergeValue: Pairs a key with a value if the key is not in the map,
+* otherwise pairs it with the combination of its current data element and
+* the value - all with a single search of the map.
+* Iterator's value is undefined after this operation.
+*
+* @param map - The map to update
+* @param keyElement - The key element to merge the value into
+* @param dataElement - The value. A copy of it is inserted if the key is not
+* 		in the map.
+* @param combine - The function combining the current data element with the
+* 		value (see mergeMapDataElements).
+* @return
+* 	MAP_NULL_ARGUMENT if a NULL was sent as one of the arguments
+* 	MAP_OUT_OF_MEMORY if an allocation failed. The map is unchanged.
+* 	MAP_SUCCESS the value had been merged successfully
+*/
+MapResult mapMergeValue(Map map, MapKeyElement keyElement,
+                        MapDataElement dataElement,
+                        mergeMapDataElements combine);
+
+/**
+* mapPutBatch: Gives each key of an array the value at the same position of
+* another array, like calling mapPut for each pair, but sorting the pairs and
+* merging them into the map in a single pass over it. If a key appears more
+* than once, the last pair wins. If an allocation fails the map is unchanged.
+* Iterator's value is undefined after this operation.
+*
+* @param map - The map to put the elements in
+* @param keyElements - The key elements. Copies of them are inserted.
+* @param dataElements - The data elements. Copies of them are inserted.
+* @param count - The number of pairs
+* @return
+* 	MAP_NULL_ARGUMENT if a NULL was sent as map or one of the elements
+* 	MAP_OUT_OF_MEMORY if an allocation failed
+* 	MAP_SUCCESS the pairs had been inserted successfully
+*/
+MapResult mapPutBatch(Map map, MapKeyElement* keyElements,
+                      MapDataElement* dataElements, int count);
+
+/**
+* mapTxnBegin: Starts a transaction on a map. Puts and removes staged in the
+* transaction do not change the map until mapTxnCommit applies all of them
+* together, so the map is never seen with only some of them applied.
+* A transaction must be committed or aborted before its map is destroyed.
+*
+* @param map - The map the transaction will be applied to
+* @return
+* 	NULL if a NULL was sent or a memory allocation failed.
+* 	A new transaction otherwise.
+*/
+MapTxn mapTxnBegin(Map map);
+
+/**
+* mapTxnPut: Stages giving a key a value in a transaction. Copies of the key
+* and data elements are made now, as is room for logging the operation if the
+* map has an active savepoint, so committing the transaction cannot fail
+* unless the map was changed or a savepoint was set on it after staging.
+* If the key is staged more than once, the last staged operation wins.
+*
+* @param txn - The transaction to stage the put in
+* @param keyElement - The key element to put
+* @param dataElement - The data element to pair with the key
+* @return
+* 	MAP_NULL_ARGUMENT if a NULL was sent as one of the arguments
+* 	MAP_OUT_OF_MEMORY if an allocation failed
+* 	MAP_SUCCESS the put had been staged successfully
+*/
+MapResult mapTxnPut(MapTxn txn, MapKeyElement keyElement,
+                    MapDataElement dataElement);
+
+/**
+* mapTxnRemove: Stages removing a key in a transaction. Removing a key which
+* is not in the map when the transaction is committed does nothing.
+* Like mapTxnPut, it makes room for logging the operation if the map has an
+* active savepoint.
+*
+* @param txn - The transaction to stage the remove in
+* @param keyElement - The key element to remove
+* @return
+* 	MAP_NULL_ARGUMENT if a NULL was sent as one of the arguments
+* 	MAP_OUT_OF_MEMORY if an allocation failed
+* 	MAP_SUCCESS the remove had been staged successfully
+*/
+MapResult mapTxnRemove(MapTxn txn, MapKeyElement keyElement);
+
+/**
+* mapTxnCommit: Sorts the staged operations of a transaction by key, applies
+* them to the map in a single pass over it and deallocates the transaction.
+* Iterator's value is undefined after this operation.
+*
+* @param txn - The transaction to commit
+* @return
+* 	MAP_NULL_ARGUMENT if a NULL was sent
+* 	MAP_OUT_OF_MEMORY if the map was changed or a savepoint was set on it
+* 		after staging, and making room for logging the operations failed.
+* 		The transaction is not ended.
+* 	MAP_SUCCESS the operations had been applied successfully
+*/
+MapResult mapTxnCommit(MapTxn txn);
+
+/**
+* mapTxnAbort: Discards the staged operations of a transaction and deallocates
+* it. The map is not changed.
+*
+* @param txn - The transaction to abort. If txn is NULL nothing will be done
+*/
+void mapTxnAbort(MapTxn txn);
+
+/**
+* mapSavepoint: Marks the current state of the map so changes made after it
+* can be reverted by mapRollback. While a savepoint is active the map keeps an
+* undo log of its changes: overwritten data elements and removed nodes are
+* kept until the savepoint is released, and rolling back costs only the
+* number of changes made since the savepoint, regardless of the map's size.
+* Savepoints nest: a later savepoint can be rolled back or released on its own.
+* Data elements changed in place by mapCompute or mapMergeValue functions are
+* not logged, so these changes are not reverted.
+*
+* @param map - The map to set the savepoint on
+* @param savepoint - Where to store the identifier of the new savepoint
+* @return
+* 	MAP_NULL_ARGUMENT if a NULL was sent as one of the arguments
+* 	MAP_OUT_OF_MEMORY if an allocation failed
+* 	MAP_SUCCESS the savepoint had been set successfully
+*/
+MapResult mapSavepoint(Map map, MapSavepoint *savepoint);
+
+/**
+* mapRollback: Reverts every change made to the map since a savepoint. The
+* savepoint stays active, and the savepoints set after it are released.
+* Data elements returned by mapGet since the savepoint are invalid afterwards.
+* Iterator's value is undefined after this operation.
+*
+* @param map - The map to roll back
+* @param savepoint - The savepoint to roll back to
+* @return
+* 	MAP_NULL_ARGUMENT if a NULL was sent as map
+* 	MAP_ITEM_DOES_NOT_EXIST if the savepoint is not active
+* 	MAP_SUCCESS the map had been rolled back successfully
+*/
+MapResult mapRollback(Map map, MapSavepoint savepoint);
+
+/**
+* mapReleaseSavepoint: Releases a savepoint and every savepoint set after it,
+* keeping the changes made since. Once no savepoint is active, the elements
+* kept by the undo log are deallocated using the free functions.
+*
+* @param map - The map to release the savepoint of
+* @param savepoint - The savepoint to release
+* @return
+* 	MAP_NULL_ARGUMENT if a NULL was sent as map
+* 	MAP_ITEM_DOES_NOT_EXIST if the savepoint is not active
+* 	MAP_SUCCESS the savepoint had been released successfully
+*/
+MapResult mapReleaseSavepoint(Map map, MapSavepoint savepoint);
+
+/**
+* mapSave: Writes all the elements of the map to a stream, in the map's order.
+* The stream is a compact binary format: the number of elements followed by
+* each key and data element prefixed by its length. Combined with a file
+* descriptor, use fdopen to get a stream.
+* Iterator status unchanged
+*
+* @param map - The map to save
+* @param stream - The stream to write to. It is not closed or flushed.
+* @param serializeKey - Function for serializing the key elements
+* @param serializeData - Function for serializing the data elements
+* @return
+* 	MAP_NULL_ARGUMENT if a NULL was sent as one of the arguments
+* 	MAP_OUT_OF_MEMORY if an allocation failed
+* 	MAP_IO_ERROR if serializing an element or writing to the stream failed
+* 	MAP_SUCCESS the map had been written successfully
+*/
+MapResult mapSave(Map map, FILE* stream, serializeMapElement serializeKey,
+                  serializeMapElement serializeData);
+
+/** How mapSaveCompressed encodes the keys of a block */
+typedef enum MapKeyEncoding_t {
+	/** each key as its serialized bytes */
+	MAP_KEY_ENCODING_PLAIN,
+	/** keys serialized as little-endian integers of 1 to 8 bytes, as the
+	 *  differences between consecutive keys - compact for dense keys */
+	MAP_KEY_ENCODING_INTEGER,
+	/** each key as the length of the prefix it shares with the previous key
+	 *  and the rest of its bytes - compact for strings sharing prefixes */
+	MAP_KEY_ENCODING_PREFIX
+} MapKeyEncoding;
+
+/**
+* mapSaveCompressed: Writes all the elements of the map to a stream, like
+* mapSave, in blocks of up to 256 elements. The keys of a block are encoded as
+* requested, and its data are compressed unless that does not make them
+* smaller. A block whose serialized keys are not integers of one width is
+* written with MAP_KEY_ENCODING_PLAIN. Read back with mapLoad.
+* Iterator status unchanged
+*
+* @param map - The map to save
+* @param stream - The stream to write to. It is not closed or flushed.
+* @param serializeKey - Function for serializing the key elements
+* @param serializeData - Function for serializing the data elements
+* @param keyEncoding - How to encode the keys
+* @return
+* 	MAP_NULL_ARGUMENT if a NULL was sent as one of the arguments
+* 	MAP_OUT_OF_MEMORY if an allocation failed
+* 	MAP_IO_ERROR if serializing an element or writing to the stream failed
+* 	MAP_SUCCESS the map had been written successfully
+*/
+MapResult mapSaveCompressed(Map map, FILE* stream,
+                            serializeMapElement serializeKey,
+                            serializeMapElement serializeData,
+                            MapKeyEncoding keyEncoding);
+
+/**
+* mapLoad: Reads elements written by mapSave or mapSaveCompressed from a
+* stream into a map.
+* Since the stream is already sorted, the elements are linked in order as they
+* are read instead of being searched for one by one, so loading n elements
+* into an empty map takes O(n). Loaded elements replace the data of keys
+* already in the map. If reading fails, the map is not changed.
+* Iterator's value is undefined after this operation.
+*
+* @param map - The map to load the elements into
+* @param stream - The stream to read from, positioned where mapSave started
+* 		writing. On success it is positioned right after the saved map.
+* @param deserializeKey - Function for deserializing the key elements
+* @param deserializeData - Function for deserializing the data elements
+* @return
+* 	MAP_NULL_ARGUMENT if a NULL was sent as one of the arguments
+* 	MAP_OUT_OF_MEMORY if an allocation failed
+* 	MAP_IO_ERROR if reading from the stream failed, the stream is not in the
+* 		format written by mapSave or mapSaveCompressed, or deserializing an
+* 		element failed
+* 	MAP_SUCCESS the elements had been loaded successfully
+*/
+MapResult mapLoad(Map map, FILE* stream, deserializeMapElement deserializeKey,
+                  deserializeMapElement deserializeData);
+
+/**
+* mapSaveMapped: Writes all the elements of the map to a file as an image
+* which mapOpenMapped can memory-map: the serialized elements, in order and
+* each aligned to 8 bytes, followed by an index of their offsets.
+* The bytes written by the serialize functions are what mappedMapGet returns
+* and what the compare function of the read-only map receives, so they should
+* be usable as elements as is (e.g. the bytes of an int, or a string with its
+* terminating '\0').
+* Iterator status unchanged
+*
+* @param map - The map to save
+* @param path - The path of the image file. An existing file is overwritten.
+* @param serializeKey - Function for serializing the key elements
+* @param serializeData - Function for serializing the data elements
+* @return
+* 	MAP_NULL_ARGUMENT if a NULL was sent as one of the arguments
+* 	MAP_OUT_OF_MEMORY if an allocation failed
+* 	MAP_IO_ERROR if serializing an element or writing the file failed
+* 	MAP_SUCCESS the image had been written successfully
+*/
+MapResult mapSaveMapped(Map map, const char* path,
+                        serializeMapElement serializeKey,
+                        serializeMapElement serializeData);
+
+/**
+* mapOpenMapped: Memory-maps an image written by mapSaveMapped as a read-only
+* map. Only the header is read, so opening takes the same time whatever the
+* size of the image; keys and data are read from the page cache as lookups
+* touch them, and processes mapping the same image share its memory.
+*
+* @param path - The path of the image file
+* @param compareKeyElements - Function pointer to be used for comparing key
+* 		elements, receiving the key searched for and keys in the image
+* @return
+* 	NULL - if one of the parameters is NULL, the file cannot be mapped or is
+* 		not an image, or allocations failed.
+* 	A new MappedMap in case of success.
+*/
+MappedMap mapOpenMapped(const char* path,
+                        compareMapKeyElements compareKeyElements);
+
+/** When the pages of an image opened by mapOpenMappedWithMode are read */
+typedef enum MapOpenMode_t {
+	/** as the kernel reads mapped files by default (as by mapOpenMapped) */
+	MAP_OPEN_DEFAULT,
+	/** only the index is read ahead, and every other page when first
+	 *  accessed; scans with mappedMapGetFirst/mappedMapGetNext read the
+	 *  records ahead of them. Suited to huge images whose hot elements should
+	 *  warm up as they are used. */
+	MAP_OPEN_LAZY,
+	/** the whole image is read in the background right after opening */
+	MAP_OPEN_EAGER
+} MapOpenMode;
+
+/**
+* mapOpenMappedWithMode: Memory-maps an image written by mapSaveMapped as a
+* read-only map, like mapOpenMapped, choosing when its pages are read. Opening
+* only reads the header in every mode; the mode is advice to the kernel.
+*
+* @param path - The path of the image file
+* @param compareKeyElements - Function pointer to be used for comparing key
+* 		elements, receiving the key searched for and keys in the image
+* @param mode - When the pages of the image are read
+* @return
+* 	NULL - if one of the parameters is NULL, the file cannot be mapped or is
+* 		not an image, or allocations failed.
+* 	A new MappedMap in case of success.
+*/
+MappedMap mapOpenMappedWithMode(const char* path,
+                                compareMapKeyElements compareKeyElements,
+                                MapOpenMode mode);
+
+/**
+* mapSaveShared: Writes all the elements of the map, like mapSaveMapped, into
+* a POSIX shared memory object instead of a file. The image links its elements
+* by offsets only, so every process attaching to it with mapOpenShared maps
+* the same memory wherever it lands in its address space, and performs lookups
+* on it directly, without copying. The object exists until it is removed with
+* mapRemoveShared (or the system restarts). Processes should attach only after
+* this function returned; writing the image again while others are attached
+* to it is not supported. Link with -lrt on systems older than glibc 2.17.
+* Iterator status unchanged
+*
+* @param map - The map to save
+* @param name - The name of the shared memory object, starting with '/' and
+* 		containing no other '/'
+* @param serializeKey - Function for serializing the key elements
+* @param serializeData - Function for serializing the data elements
+* @return
+* 	MAP_NULL_ARGUMENT if a NULL was sent as one of the arguments
+* 	MAP_OUT_OF_MEMORY if an allocation failed
+* 	MAP_IO_ERROR if the object cannot be created or serializing an element
+* 		failed. The object is then removed.
+* 	MAP_SUCCESS the map had been written successfully
+*/
+MapResult mapSaveShared(Map map, const char* name,
+                        serializeMapElement serializeKey,
+                        serializeMapElement serializeData);
+
+/**
+* mapOpenShared: Attaches to an image written by mapSaveShared as a read-only
+* map, mapping the shared memory object read-only. Close it with
+* mappedMapClose.
+*
+* @param name - The name given to mapSaveShared
+* @param compareKeyElements - Function pointer to be used for comparing key
+* 		elements, receiving the key searched for and keys in the image
+* @return
+* 	NULL - if one of the parameters is NULL, the object does not exist or is
+* 		not an image, or allocations failed.
+* 	A new MappedMap in case of success.
+*/
+MappedMap mapOpenShared(const char* name,
+                        compareMapKeyElements compareKeyElements);
+
+/**
+* mapRemoveShared: Removes a shared memory object written by mapSaveShared.
+* Processes attached to it keep their mapping until they close it.
+*
+* @param name - The name given to mapSaveShared
+* @return
+* 	MAP_NULL_ARGUMENT if a NULL was sent
+* 	MAP_ITEM_DOES_NOT_EXIST if there is no object by that name
+* 	MAP_SUCCESS the object had been removed successfully
+*/
+MapResult mapRemoveShared(const char* name);
+
+/**
+* mappedMapClose: Unmaps a read-only map. Elements returned by it are invalid
+* afterwards.
+*
+* @param map - Target map to be closed. If map is NULL nothing will be done
+*/
+void mappedMapClose(MappedMap map);
+
+/**
+* mappedMapGetSize: Returns the number of elements in a read-only map
+* @param map - The map which size is requested
+* @return
+* 	-1 if a NULL pointer was sent.
+* 	Otherwise the number of elements in the map.
+*/
+int mappedMapGetSize(MappedMap map);
+
+/**
+* mappedMapGet: Returns the data associated with a specific key in a read-only
+* map, using a binary search of its index. The data is not copied: it points
+* into the mapped image and must not be changed or deallocated.
+* Iterator status unchanged
+*
+* @param map - The map for which to get the data element from.
+* @param keyElement - The key element which need to be found.
+* @return
+* 	NULL if a NULL pointer was sent or if the map does not contain the
+* 	requested key.
+* 	The data element associated with the key otherwise.
+*/
+MapDataElement mappedMapGet(MappedMap map, MapKeyElement keyElement);
+
+/**
+* mappedMapGetFirst: Sets the iterator of a read-only map to its first key
+* element, in the order of the map the image was saved from, and returns it.
+* The key points into the mapped image.
+*
+* @param map - The map for which to set the iterator
+* @return
+* 	NULL if a NULL pointer was sent or the map is empty.
+* 	The first key element of the map otherwise
+*/
+MapKeyElement mappedMapGetFirst(MappedMap map);
+
+/**
+* mappedMapGetNext: Advances the iterator of a read-only map to the next key
+* element and returns it.
+*
+* @param map - The map for which to advance the iterator
+* @return
+* 	NULL if reached the end of the map, or the iterator is at an invalid state
+* 	or a NULL sent as argument
+* 	The next key element on the map in case of success
+*/
+MapKeyElement mappedMapGetNext(MappedMap map);
+
+/**
+* mapOpenDurable: Makes a map durable. The map is loaded with the last state
+* saved at path - its snapshot (the file at path, written by mapSave) and the
+* changes logged after it (the write-ahead log at path with ".wal" appended).
+* From then on every change made to the map is appended to the log: changes
+* are written in groups, and forced to disk according to the sync policy.
+* Every so many changes a new snapshot is written and the log starts over.
+* Functions changing the map return MAP_IO_ERROR if the change was made but
+* could not be logged, until a snapshot is written successfully
+* (see mapCheckpoint).
+* mapDestroy writes and forces the remaining logged changes to disk.
+* Iterator's value is undefined after this operation.
+*
+* @param map - The map to make durable, usually empty
+* @param path - The path of the snapshot. The log and a temporary file used
+* 		when writing snapshots are kept next to it.
+* @param serializeKey - Function for serializing the key elements
+* @param serializeData - Function for serializing the data elements
+* @param deserializeKey - Function for deserializing the key elements
+* @param deserializeData - Function for deserializing the data elements
+* @param syncPolicy - When changes are forced to disk
+* @return
+* 	MAP_NULL_ARGUMENT if a NULL was sent as one of the arguments
+* 	MAP_ITEM_ALREADY_EXISTS if the map is already durable
+* 	MAP_OUT_OF_MEMORY if an allocation failed
+* 	MAP_IO_ERROR if the saved state cannot be read or the log cannot be opened
+* 	MAP_SUCCESS the map had been made durable successfully
+*/
+MapResult mapOpenDurable(Map map, const char* path,
+                         serializeMapElement serializeKey,
+                         serializeMapElement serializeData,
+                         deserializeMapElement deserializeKey,
+                         deserializeMapElement deserializeData,
+                         MapSyncPolicy syncPolicy);
+
+/**
+* mapSync: Writes the changes of a durable map which are waiting for their
+* group to fill, and forces the log to disk. Does nothing for a map which is
+* not durable.
+*
+* @param map - The map to sync
+* @return
+* 	MAP_NULL_ARGUMENT if a NULL was sent
+* 	MAP_IO_ERROR if a change could not be logged or writing the log failed
+* 	MAP_SUCCESS otherwise
+*/
+MapResult mapSync(Map map);
+
+/**
+* mapCheckpoint: Writes a snapshot of a durable map, replacing the previous
+* one, and empties its log. Does nothing for a map which is not durable.
+* Iterator's value is undefined after this operation.
+*
+* @param map - The map to checkpoint
+* @return
+* 	MAP_NULL_ARGUMENT if a NULL was sent
+* 	MAP_OUT_OF_MEMORY if an allocation failed
+* 	MAP_IO_ERROR if writing the snapshot or emptying the log failed
+* 	MAP_SUCCESS otherwise
+*/
+MapResult mapCheckpoint(Map map);
+
+/**
+* mapCheckpointIncremental: Saves the state of a map at path, writing only what
+* changed since the previous checkpoint. The first checkpoint of a map (or the
+* first to a different path) writes a full snapshot at path with mapSave; the
+* map then keeps track of the keys put or removed, and the next checkpoints
+* append the current state of just those entries to a delta file (path with
+* ".delta" appended), which is tagged with the checksum of the snapshot.
+* Once the delta file holds as many records as the map has elements, the
+* checkpoint compacts it into a new full snapshot instead.
+* Should tracking a change fail for lack of memory, the next checkpoint is a
+* full snapshot. Use different paths than for mapOpenDurable.
+* Iterator's value is undefined after this operation.
+*
+* @param map - The map to checkpoint
+* @param path - The path of the snapshot. The delta file and a temporary file
+* 		used when writing snapshots are kept next to it.
+* @param serializeKey - Function for serializing the key elements
+* @param serializeData - Function for serializing the data elements
+* @return
+* 	MAP_NULL_ARGUMENT if a NULL was sent as one of the arguments
+* 	MAP_OUT_OF_MEMORY if an allocation failed
+* 	MAP_IO_ERROR if serializing an element or writing failed. The next
+* 		checkpoint is then a full snapshot.
+* 	MAP_SUCCESS the map had been checkpointed successfully
+*/
+MapResult mapCheckpointIncremental(Map map, const char* path,
+                                   serializeMapElement serializeKey,
+                                   serializeMapElement serializeData);
+
+/**
+* mapRestoreCheckpoint: Reads the state saved by mapCheckpointIncremental at
+* path into a map: loads the snapshot with mapLoad and applies the deltas
+* written after it. If there is no snapshot the map is not changed. A delta
+* file tagged with the checksum of another snapshot (left by a crash while a
+* new snapshot was written) is ignored.
+* A delta whose writing was interrupted by a crash may be partially applied,
+* leaving each of its entries either as of that checkpoint or of the one
+* before it.
+* Iterator's value is undefined after this operation.
+*
+* @param map - The map to restore the elements into, usually empty
+* @param path - The path given to mapCheckpointIncremental
+* @param deserializeKey - Function for deserializing the key elements
+* @param deserializeData - Function for deserializing the data elements
+* @return
+* 	MAP_NULL_ARGUMENT if a NULL was sent as one of the arguments
+* 	MAP_OUT_OF_MEMORY if an allocation failed
+* 	MAP_IO_ERROR if the snapshot cannot be read or deserializing an element
+* 		failed
+* 	MAP_SUCCESS the state had been restored successfully
+*/
+MapResult mapRestoreCheckpoint(Map map, const char* path,
+                               deserializeMapElement deserializeKey,
+                               deserializeMapElement deserializeData);
+
+/**
+* mapSnapshotBackground: Starts saving the map, as it is now, to a file with
+* mapSave, and returns without waiting for it to be written. The snapshot is
+* written by a forked child process, which shares the memory of the map
+* copy-on-write: changes made to the map afterwards copy only the pages they
+* touch, and are not in the snapshot. The file at path is replaced only once
+* the snapshot is complete (it is written to a temporary file with a unique
+* name starting with path first), so snapshots of the same path may be
+* written at once.
+* Every snapshot started must be waited for with mapSnapshotWait.
+* The process should not have other threads when calling this function,
+* since the child is a copy of the calling thread only.
+*
+* @param map - The map to save
+* @param path - The path of the snapshot
+* @param serializeKey - Function for serializing the key elements. Called in
+* 		the child process.
+* @param serializeData - Function for serializing the data elements. Called
+* 		in the child process.
+* @param snapshot - Where to store the snapshot being written
+* @return
+* 	MAP_NULL_ARGUMENT if a NULL was sent as one of the arguments
+* 	MAP_OUT_OF_MEMORY if an allocation failed
+* 	MAP_IO_ERROR if the child process cannot be started
+* 	MAP_SUCCESS the snapshot had been started successfully
+*/
+MapResult mapSnapshotBackground(Map map, const char* path,
+                                serializeMapElement serializeKey,
+                                serializeMapElement serializeData,
+                                MapSnapshot* snapshot);
+
+/**
+* mapSnapshotWait: Waits until a snapshot started by mapSnapshotBackground is
+* written, and deallocates it.
+*
+* @param snapshot - The snapshot to wait for
+* @return
+* 	MAP_NULL_ARGUMENT if a NULL was sent
+* 	MAP_OUT_OF_MEMORY if an allocation failed while writing the snapshot
+* 	MAP_IO_ERROR if serializing an element or writing the snapshot failed
+* 	MAP_SUCCESS the snapshot had been written successfully
+*/
+MapResult mapSnapshotWait(MapSnapshot snapshot);
+
+/**
+* mapSetMemoryBudget: Puts a map in spill mode, in which its data elements take
+* at most about budget bytes of memory, or changes the budget of a map already
+* in spill mode. The size of a data element is measured by measureData, or is
+* the length of its serialized form if measureData is NULL - which costs
+* serializing every data element put or changed in place, so give a
+* measuring function for large data elements. When the data elements in
+* memory exceed the budget, the ones not used recently (by mapGet or a
+* change) are serialized to a spill file and replaced by small stubs, and
+* are read back when they are used again. Keys always stay in memory, so
+* searching the map never reads the disk. The spill file gets a unique name
+* (so no existing file is overwritten) and is removed from the file system
+* as soon as it is created; its space is freed when the map is destroyed.
+* Functions reading all the data elements (such as mapSave and mapCopy) read
+* spilled elements without bringing them back into memory.
+* Iterator's value is undefined after this operation.
+*
+* @param map - The map to limit
+* @param path - The path the name of the spill file starts with, on a local
+* 		file system. A dot and six random characters are appended to it.
+* @param budget - The number of bytes the data elements may take
+* @param serializeData - Function for serializing the data elements
+* @param deserializeData - Function for deserializing the data elements
+* @param measureData - Function for measuring the data elements. May be NULL.
+* 		The functions of a map already in spill mode are kept.
+* @return
+* 	MAP_NULL_ARGUMENT if a NULL was sent as one of the other arguments
+* 	MAP_OUT_OF_MEMORY if an allocation failed
+* 	MAP_IO_ERROR if the spill file cannot be created
+* 	MAP_SUCCESS the budget had been set successfully
+*/
+MapResult mapSetMemoryBudget(Map map, const char* path, long long budget,
+                             serializeMapElement serializeData,
+                             deserializeMapElement deserializeData,
+                             measureMapElement measureData);
+
+/**
+* mapReplicate: Makes a map a primary, streaming its changes to a follower
+* through a file descriptor such as a pipe or a Unix socket. Every change made
+* by mapPut, mapRemove, mapClear and the other changing functions gets the
+* next sequence number (starting at 1) and is written, as a checksummed change
+* record, when the function making it returns; mapFollowerApply applies the
+* records. The latest changes (about a megabyte of records) are kept, so a
+* follower which reconnects after missing changes is sent only those; one
+* which missed more, or is new, is sent a clear and all the elements.
+* Writing is blocking (writes interrupted by a signal are retried): a follower
+* which does not keep up slows the primary. If writing fails the follower is
+* disconnected (its file descriptor closed) until this function is called
+* again, and the function whose changes could not be written returns
+* MAP_IO_ERROR, although the changes were made. Ignore SIGPIPE to be told of a
+* closed follower by failing writes rather than by the signal.
+* Iterator's value is undefined after this operation.
+*
+* @param map - The primary map
+* @param fd - The file descriptor to write the changes to, which the map now
+* 		owns and closes when it is replaced or the map destroyed. -1 to
+* 		disconnect the follower, while still keeping the latest changes.
+* @param serializeKey - Function for serializing the key elements
+* @param serializeData - Function for serializing the data elements
+* @param fromSequence - The sequence number of the latest change the follower
+* 		applied (see mapFollowerGetSequence), 0 for a new follower
+* @return
+* 	MAP_NULL_ARGUMENT if a NULL was sent as one of the arguments
+* 	MAP_OUT_OF_MEMORY if an allocation failed
+* 	MAP_IO_ERROR if writing the changes the follower missed failed
+* 	MAP_SUCCESS the follower had been connected successfully
+*/
+MapResult mapReplicate(Map map, int fd, serializeMapElement serializeKey,
+                       serializeMapElement serializeData,
+                       uint64_t fromSequence);
+
+/**
+* mapGetSequence: Returns the sequence number of the latest change of a
+* primary map.
+*
+* @param map - The primary map
+* @return
+* 	0 if a NULL was sent, the map is not a primary or has not changed since
+* 	it became one
+* 	The sequence number of the latest change otherwise
+*/
+uint64_t mapGetSequence(Map map);
+
+/**
+* mapFollowerCreate: Creates the applier of a follower map, which applies the
+* changes of a primary map (see mapReplicate) to it. The follower map should
+* not be changed otherwise, and start empty.
+*
+* @param map - The follower map
+* @param deserializeKey - Function for deserializing the key elements
+* @param deserializeData - Function for deserializing the data elements
+* @return
+* 	NULL - if one of the parameters is NULL or allocations failed.
+* 	A new MapFollower in case of success.
+*/
+MapFollower mapFollowerCreate(Map map, deserializeMapElement deserializeKey,
+                              deserializeMapElement deserializeData);
+
+/**
+* mapFollowerDestroy: Deallocates the applier of a follower map. The map is
+* not changed.
+*
+* @param follower - The applier to deallocate. If NULL nothing will be done
+*/
+void mapFollowerDestroy(MapFollower follower);
+
+/**
+* mapFollowerApply: Reads once from the primary's file descriptor (blocking
+* if it is blocking and nothing is available), and applies every complete
+* change record read to the follower map as one batch. A record cut by the
+* end of the read is applied by a later call. Calling with another file
+* descriptor (after reconnecting) drops a record cut by the old one.
+* Iterator's value of the follower map is undefined after this operation.
+*
+* @param follower - The applier of the follower map
+* @param fd - The file descriptor to read from
+* @return
+* 	MAP_NULL_ARGUMENT if a NULL was sent
+* 	MAP_OUT_OF_MEMORY if an allocation failed
+* 	MAP_IO_ERROR if reading failed, the primary closed the file descriptor,
+* 		a record is damaged, a record does not follow the latest change
+* 		applied (changes were missed) or deserializing an element failed.
+* 		The changes before the failure were applied and the rest of the
+* 		bytes read were dropped; reconnect to the primary with the sequence
+* 		number of the latest change applied.
+* 	MAP_SUCCESS the changes read had been applied successfully
+*/
+MapResult mapFollowerApply(MapFollower follower, int fd);
+
+/**
+* mapFollowerGetSequence: Returns the sequence number of the latest change
+* applied to a follower map, to give to mapReplicate when reconnecting.
+*
+* @param follower - The applier of the follower map
+* @return
+* 	0 if a NULL was sent or no change was applied
+* 	The sequence number of the latest change applied otherwise
+*/
+uint64_t mapFollowerGetSequence(MapFollower follower);
+
+/**
+* mapSetCapacity: Puts a map in cache mode, in which it holds at most capacity
+* keys, or changes the capacity of a map already in cache mode. The keys are
+* kept in order of recency: mapGet, mapPut and the other functions changing
+* the data of a key make it the most recently used one. Whenever a change
+* leaves the map with more keys than its capacity, the least recently used
+* keys are evicted (removed from the map, as by mapRemove) until it fits. The
+* keys already in the map when it is put in cache mode are evicted in key
+* order. An eviction rolled back by mapRollback brings the entry back.
+* A copy of the map (see mapCopy) is not in cache mode.
+* Iterator's value is undefined after this operation.
+*
+* @param map - The map to limit
+* @param capacity - The maximal number of keys. 0 to end the cache mode.
+* @param evict - Function called with every evicted entry. May be NULL.
+* @param context - Passed as is to evict. May be NULL.
+* @return
+* 	MAP_NULL_ARGUMENT if a NULL was sent as map
+* 	MAP_OUT_OF_MEMORY if an allocation failed
+* 	MAP_IO_ERROR if the map is durable and logging the evictions failed
+* 	MAP_SUCCESS the capacity had been set successfully
+*/
+MapResult mapSetCapacity(Map map, int capacity, evictMapElements evict,
+                         void* context);
+
+/**
+* mapSetEvictionPolicy: Chooses the policy by which a map in cache mode (see
+* mapSetCapacity) evicts keys. A map is put in cache mode with the LRU policy.
+* Under the TinyLFU policy an access is a mapGet (whether or not it finds the
+* key), a put or another change of the data of a key, and the keys already in
+* the map start in the main area.
+* Iterator's value is undefined after this operation.
+*
+* @param map - The map in cache mode
+* @param policy - The eviction policy
+* @param hashKey - Function for hashing the key elements. Only needed for the
+* 		TinyLFU policy, may be NULL otherwise.
+* @return
+* 	MAP_NULL_ARGUMENT if a NULL was sent as map, or as hashKey for the TinyLFU
+* 	policy
+* 	MAP_ITEM_DOES_NOT_EXIST if the map is not in cache mode
+* 	MAP_OUT_OF_MEMORY if an allocation failed
+* 	MAP_SUCCESS the policy had been set successfully
+*/
+MapResult mapSetEvictionPolicy(Map map, MapEvictionPolicy policy,
+                               hashMapKeyElements hashKey);
+
+/**
+* mapSetByteBudget: Gives a map in cache mode (see mapSetCapacity) a budget of
+* bytes for its keys and data, as measured by the given functions, or changes
+* or removes it. The total is kept up to date by every change of the map.
+* Whenever a change leaves the map over its budget, keys are evicted by its
+* policy until it fits (an entry larger than the whole budget is evicted
+* too), as well as when it has more keys than its capacity.
+* Iterator's value is undefined after this operation.
+*
+* @param map - The map in cache mode
+* @param budget - The number of bytes the keys and data may take. 0 or less
+* 		to remove the byte budget, which also resets the byte total to 0.
+* @param measureKey - Function for measuring the key elements
+* @param measureData - Function for measuring the data elements
+* @return
+* 	MAP_NULL_ARGUMENT if a NULL was sent as map, or as one of the functions
+* 	with a budget
+* 	MAP_ITEM_DOES_NOT_EXIST if the map is not in cache mode
+* 	MAP_IO_ERROR if the map is durable and logging the evictions failed
+* 	MAP_SUCCESS the budget had been set successfully
+*/
+MapResult mapSetByteBudget(Map map, long long budget,
+                           measureMapElement measureKey,
+                           measureMapElement measureData);
+
+/**
+* mapSetWriteBack: Gives a map in cache mode (see mapSetCapacity) a write-back
+* hook, or removes it. An evicted entry marked as dirty (see mapMarkDirty) is
+* not deallocated but added to a batch, which is given to the hook, with the
+* ownership of its elements, once batchSize entries are in it - so they can be
+* written together. The last entries of a batch wait for mapFlushWriteBack,
+* for the hook to be changed or removed, or for the cache mode to end (see
+* mapSetCapacity and mapDestroy). While a savepoint is active, the hook gets
+* copies of the evicted entries, since the evictions may be rolled back.
+* Only evicted entries go to the hook: dirty entries removed by mapRemove,
+* mapClear or expiry are deallocated as usual.
+*
+* @param map - The map in cache mode
+* @param writeBack - The hook. NULL to remove it (after giving it the entries
+* 		waiting in its batch).
+* @param batchSize - The number of entries the hook gets at once, at least 1
+* @param context - Passed as is to writeBack. May be NULL.
+* @return
+* 	MAP_NULL_ARGUMENT if a NULL was sent as map
+* 	MAP_ITEM_DOES_NOT_EXIST if the map is not in cache mode
+* 	MAP_OUT_OF_MEMORY if an allocation failed
+* 	MAP_SUCCESS the hook had been set successfully
+*/
+MapResult mapSetWriteBack(Map map, writeBackMapElements writeBack,
+                          int batchSize, void* context);
+
+/**
+* mapMarkDirty: Marks a key as dirty, meaning its data changed since it was
+* last written to wherever the write-back hook writes (see mapSetWriteBack),
+* or as clean. New keys are clean, and changing the data of a key keeps its
+* mark.
+*
+* @param map - The map the key is in
+* @param keyElement - The key to mark
+* @param dirty - true to mark the key as dirty, false to mark it as clean
+* @return
+* 	MAP_NULL_ARGUMENT if a NULL was sent as one of the arguments
+* 	MAP_ITEM_DOES_NOT_EXIST if the key is not in the map
+* 	MAP_OUT_OF_MEMORY if an allocation failed
+* 	MAP_SUCCESS the key had been marked successfully
+*/
+MapResult mapMarkDirty(Map map, MapKeyElement keyElement, bool dirty);
+
+/**
+* mapIsDirty: Checks whether a key is marked as dirty (see mapMarkDirty).
+*
+* @param map - The map the key is in
+* @param keyElement - The key to check
+* @return
+* 	false - if one or more of the inputs is null, the key is not in the map or
+* 	is clean.
+* 	true - if the key is marked as dirty.
+*/
+bool mapIsDirty(Map map, MapKeyElement keyElement);
+
+/**
+* mapFlushWriteBack: Gives the evicted dirty entries waiting for their batch
+* to fill to the write-back hook (see mapSetWriteBack) right away.
+*
+* @param map - The map in cache mode
+* @return
+* 	MAP_NULL_ARGUMENT if a NULL was sent as map
+* 	MAP_ITEM_DOES_NOT_EXIST if the map has no write-back hook
+* 	MAP_SUCCESS the entries had been given to the hook successfully
+*/
+MapResult mapFlushWriteBack(Map map);
+
+/**
+* mapGetCacheStats: Returns the statistics of a map in cache mode, counted
+* since it was put in cache mode or mapResetCacheStats was last called.
+* The hit rate is hits / (hits + misses).
+*
+* @param map - The map in cache mode
+* @param stats - Where to store the statistics
+* @return
+* 	MAP_NULL_ARGUMENT if a NULL was sent as one of the arguments
+* 	MAP_ITEM_DOES_NOT_EXIST if the map is not in cache mode
+* 	MAP_SUCCESS the statistics had been stored successfully
+*/
+MapResult mapGetCacheStats(Map map, MapCacheStats* stats);
+
+/**
+* mapResetCacheStats: Zeroes the statistics of a map in cache mode.
+*
+* @param map - The map in cache mode. If NULL or not in cache mode nothing
+* 		will be done
+*/
+void mapResetCacheStats(Map map);
+
 /*!
 * Macro for iterating over a map.
 * Declares a new iterator for the loop.
@@ -237,4 +1486,153 @@ MapResult mapClear(Map map);
 		iterator ;\
 		iterator = mapGetNext(map))
 
+/**
+* mapPutWithTTL: Gives a specified key a specific value, which expires ttl
+* milliseconds from now (by the monotonic clock). An expired key is no longer
+* found by mapGet, mapContains and the other functions searching for a key,
+* and is removed (as by mapRemove) by the first of them to come across it, or
+* by mapExpireTick. Until then it is still counted by mapGetSize and visited
+* by the iterator. Putting the key again with mapPutWithTTL gives it a new
+* TTL; putting it with mapPut, mapPutBatch or a transaction makes it never
+* expire. Other changes of its data (such as by mapCompute) keep its TTL.
+* mapRollback restores the TTL a key had at the savepoint along with its
+* data. The TTLs are not saved by mapSave or logged by a durable map, but
+* the removals of expired keys are.
+* Iterator's value is undefined after this operation.
+*
+* @param map - The map for which to reassign the data element
+* @param keyElement - The key element which need to be reassigned
+* @param dataElement - The new data element to associate with the given key,
+* 		copied as by mapPut
+* @param ttl - The number of milliseconds the key expires after
+* @return
+* 	MAP_NULL_ARGUMENT if a NULL was sent as one of the arguments
+* 	MAP_OUT_OF_MEMORY if an allocation failed
+* 	MAP_SUCCESS the paired elements had been inserted successfully
+*/
+MapResult mapPutWithTTL(Map map, MapKeyElement keyElement,
+                        MapDataElement dataElement, long long ttl);
+
+/**
+* mapExpireTick: Removes (as by mapRemove) the keys of a map which expired,
+* at most limit of them, so it can be called periodically to spread the
+* removals into bounded slices. Expired keys are kept in a hierarchical timer
+* wheel, so finding them takes amortized constant time per key whatever the
+* number of keys waiting to expire.
+* Iterator's value is undefined after this operation.
+*
+* @param map - The map to remove the expired keys of
+* @param limit - The maximal number of keys to remove. 0 or less to remove
+* 		every expired key.
+* @return
+* 	-1 if a NULL pointer was sent.
+* 	Otherwise the number of keys removed.
+*/
+int mapExpireTick(Map map, int limit);
+
+/**
+* mapGetStats: Returns the operation counts of a map, counted since it was
+* created or mapResetStats was last called. The work of mapCopy is counted by
+* the map copied, and a copy starts with zero counts. Counting costs a few
+* increments per operation; building the map library with MAP_NO_STATS
+* defined leaves it out altogether.
+*
+* @param map - The map to return the counts of
+* @param stats - Where to store the counts
+* @return
+* 	MAP_NULL_ARGUMENT if a NULL was sent as one of the arguments
+* 	MAP_ITEM_DOES_NOT_EXIST if the library was built with MAP_NO_STATS
+* 	MAP_SUCCESS the counts had been stored successfully
+*/
+MapResult mapGetStats(Map map, MapStats* stats);
+
+/**
+* mapResetStats: Zeroes the operation counts of a map.
+*
+* @param map - The map to reset the counts of. If NULL nothing will be done
+*/
+void mapResetStats(Map map);
+
+/**
+* mapSetLatencyTracking: Starts or stops recording the latency of every call of
+* the operations of a map counted by mapGetStats (the whole call, including
+* evictions, spilling and logging it caused), read from the monotonic clock.
+* Tracking costs two clock readings per call. Stopping it discards the
+* histograms. A copy of the map starts untracked.
+*
+* @param map - The map to track
+* @param track - true to start tracking, false to stop
+* @return
+* 	MAP_NULL_ARGUMENT if a NULL was sent as map
+* 	MAP_OUT_OF_MEMORY if an allocation failed
+* 	MAP_SUCCESS the tracking had been started or stopped successfully
+*/
+MapResult mapSetLatencyTracking(Map map, bool track);
+
+/**
+* mapGetLatency: Returns the histogram of the latencies of an operation of a
+* tracked map, recorded since tracking started or mapResetLatency was last
+* called.
+*
+* @param map - The tracked map
+* @param operation - The operation
+* @param histogram - Where to store the histogram
+* @return
+* 	MAP_NULL_ARGUMENT if a NULL was sent as one of the pointers
+* 	MAP_ITEM_DOES_NOT_EXIST if the map is not tracked or operation is not a
+* 	MapOperation
+* 	MAP_SUCCESS the histogram had been stored successfully
+*/
+MapResult mapGetLatency(Map map, MapOperation operation,
+                        MapLatencyHistogram* histogram);
+
+/**
+* mapResetLatency: Empties the latency histograms of a tracked map.
+*
+* @param map - The tracked map. If NULL or not tracked nothing will be done
+*/
+void mapResetLatency(Map map);
+
+/**
+* mapMergeLatency: Adds the latencies of a histogram to another, such as to
+* sum the histograms of an operation over several maps.
+*
+* @param histogram - The histogram to add the latencies to
+* @param other - The histogram whose latencies are added
+* @return
+* 	MAP_NULL_ARGUMENT if a NULL was sent as one of the arguments
+* 	MAP_SUCCESS the latencies had been added successfully
+*/
+MapResult mapMergeLatency(MapLatencyHistogram* histogram,
+                          const MapLatencyHistogram* other);
+
+/**
+* mapLatencyPercentile: Returns a percentile of the latencies in a histogram:
+* the latency which the given percent of them do not exceed. It is the
+* highest latency of its bucket, so it is at most 1/8 too high.
+*
+* @param histogram - The histogram
+* @param percentile - The percent, from 0 to 100 (such as 99.9)
+* @return
+* 	-1 if a NULL pointer was sent.
+* 	0 if the histogram is empty.
+* 	Otherwise the percentile in nanoseconds.
+*/
+long long mapLatencyPercentile(const MapLatencyHistogram* histogram,
+                               double percentile);
+
+/**
+* mapSetTraceHooks: Registers functions to be called before and after every
+* call of the operations of every map counted by mapGetStats, such as to feed
+* them to a tracing system. Tracing is only built into the map library when
+* it is compiled with MAP_TRACING defined; otherwise there is no trace code
+* at all in the operations.
+*
+* @param hooks - The functions, copied. NULL to stop tracing.
+* @return
+* 	MAP_ITEM_DOES_NOT_EXIST if the library was built without MAP_TRACING
+* 	MAP_SUCCESS the functions had been registered successfully
+*/
+MapResult mapSetTraceHooks(const MapTraceHooks* hooks);
+
 #endif /* MAP_MTM_H_ */